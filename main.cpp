@@ -8,8 +8,41 @@
 
 #include "raylib.h"
 #include "raymath.h"
+#include "rlgl.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#if defined(_WIN32)
+    // Keep windows.h from clashing with raylib (Rectangle, CloseWindow, DrawText...)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOGDI
+    #define NOUSER
+    #define NOMINMAX
+    #include <windows.h>
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #include <sys/stat.h>
+    #pragma comment(lib, "ws2_32.lib")
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+    #include <netdb.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <immintrin.h>
+#endif
 
 //------------------------------------------------------------------------------------
 // Global Variables Declaration
@@ -17,8 +50,21 @@
 static const int screenWidth = 800;
 static const int screenHeight = 450;
 
+// Sound effects, synthesized at startup (see Audio Mixer)
+typedef enum {
+    SOUND_RIFLE_SHOT = 0,
+    SOUND_REVOLVER_SHOT,
+    SOUND_RELOAD,
+    SOUND_ENEMY_HIT,
+    SOUND_ENEMY_DEATH,
+    SOUND_ENEMY_STEPS,      // Loop, while an enemy gives chase
+    SOUND_LIGHT_HUM,        // Loop, while a light is on
+    SOUND_LIGHT_SPARK,      // A light flickering out
+    SOUND_COUNT
+} SoundId;
+
 typedef struct Weapon {
-    Texture2D texture;
+    Rectangle sprite;       // Source rectangle in the sprite atlas
     int maxAmmo;
     int currentAmmo;
     float scale;
@@ -31,6 +77,11 @@ typedef struct Weapon {
     int flashOffsetX;
     int flashOffsetY;
     float flashScale;
+    float damage;
+    bool hitscan;           // Shots are instant rays instead of bullets
+    int pellets;            // Rays per hitscan shot (up to MAX_PELLETS)
+    float spread;           // Pellet cone radius at one unit of range
+    int shotSound;          // SoundId
 } Weapon;
 
 //------------------------------------------------------------------------------------
@@ -67,28 +118,77 @@ typedef struct LightSource {
     bool isOn;
 } LightSource;
 
+// Visibility cell: a room's volume including its walls
+typedef struct LevelRoom {
+    BoundingBox bounds;
+} LevelRoom;
+
+// Opening between two rooms (doorway or corridor mouth)
+typedef struct LevelPortal {
+    BoundingBox bounds;
+    int rooms[2];
+} LevelPortal;
+
 // Level Arrays
+// InitializeLevel() fills the built-in buffers below; a level file is mapped
+// into memory instead and the arrays point straight into the mapping.
 #define MAX_WALLS 80
 #define MAX_PILLARS 20
 #define MAX_PROPS 60
 #define MAX_STAIRS 12
 #define MAX_LIGHTS 16
+#define MAX_ROOMS 8
+#define MAX_PORTALS 8
 
-Wall walls[MAX_WALLS];
+Wall builtinWalls[MAX_WALLS];
+Pillar builtinPillars[MAX_PILLARS];
+Prop builtinProps[MAX_PROPS];
+Stair builtinStairs[MAX_STAIRS];
+LightSource builtinLights[MAX_LIGHTS];
+LevelRoom builtinRooms[MAX_ROOMS];
+LevelPortal builtinPortals[MAX_PORTALS];
+
+Wall *walls = builtinWalls;
 int wallCount = 0;
 
-Pillar pillars[MAX_PILLARS];
+Pillar *pillars = builtinPillars;
 int pillarCount = 0;
 
-Prop props[MAX_PROPS];
+Prop *props = builtinProps;
 int propCount = 0;
 
-Stair stairs[MAX_STAIRS];
+Stair *stairs = builtinStairs;
 int stairCount = 0;
 
-LightSource lights[MAX_LIGHTS];
+LightSource *lights = builtinLights;
 int lightCount = 0;
 
+LevelRoom *rooms = builtinRooms;
+int roomCount = 0;
+
+LevelPortal *portals = builtinPortals;
+int portalCount = 0;
+
+BoundingBox levelBounds = { 0 };
+
+// Spawn points of the loaded level (level files use the bunker spawns)
+#define MAX_ENEMIES 5
+
+const Vector3 bunkerEnemySpawns[MAX_ENEMIES] = {
+    {0.0f, 1.0f, -10.0f},   // Central room
+    {24.0f, 1.0f, 0.0f},    // Right room
+    {24.0f, 1.0f, 7.0f},    // Right room
+    {-24.0f, 1.0f, -8.0f},  // Left hall
+    {8.0f, 1.0f, 5.0f}      // Central room
+};
+
+Vector3 levelPlayerStart = { -24.0f, 2.0f, 0.0f };     // Left hall, facing +X
+const Vector3 *levelEnemySpawns = bunkerEnemySpawns;
+int levelEnemyCount = MAX_ENEMIES;
+
+// Single heap block backing a generated level's arrays
+void *generatedLevelMemory = NULL;
+
 // Color Palette - WWII Industrial Bunker
 #define CONCRETE_DARK (Color){55, 55, 60, 255}
 #define CONCRETE_MED (Color){70, 70, 75, 255}
@@ -108,656 +208,9510 @@ int lightCount = 0;
 float globalFlicker = 1.0f;
 float flickerTimer = 0.0f;
 
+// Monotonic wall clock in seconds (works without a window, unlike GetTime)
+double GetWallTime(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// FNV-1a, for state and level fingerprints
+static unsigned int HashBytes(unsigned int hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i])*16777619u;
+    return hash;
+}
+
 //------------------------------------------------------------------------------------
-// Level Initialization
+// Job System
 //------------------------------------------------------------------------------------
-void InitializeLevel()
+// Small work-stealing thread pool. Every thread (the main thread is worker 0) owns a
+// deque: it pushes and pops its own jobs at the back while idle workers steal the
+// oldest jobs from the front of the others. A job covers an index range and counts
+// down a JobCounter when done; jobs scheduled after a counter are parked on it until
+// it drains, so phases chain without a round trip through the main thread. Threads
+// waiting on a counter run queued jobs instead of blocking.
+#define MAX_JOB_THREADS 64
+#define JOB_QUEUE_CAPACITY 1024
+#define MAX_JOB_DEPENDENTS 64
+
+typedef void (*JobFunction)(void *data, int begin, int end);
+
+typedef struct JobCounter JobCounter;
+
+typedef struct Job {
+    JobFunction function;
+    void *data;
+    int begin, end;             // Index range handed to the function
+    JobCounter *counter;        // Counted down when the job finishes, may be NULL
+} Job;
+
+// Jobs outstanding in a group, plus the jobs waiting for the group to finish
+struct JobCounter {
+    std::atomic<int> pending{ 0 };
+    std::mutex lock;
+    Job waiting[MAX_JOB_DEPENDENTS];
+    int waitingCount = 0;
+};
+
+typedef struct JobQueue {
+    std::mutex lock;
+    Job jobs[JOB_QUEUE_CAPACITY];
+    unsigned int head, tail;    // Thieves take from head, the owner works at tail
+} JobQueue;
+
+typedef struct JobSystem {
+    int threadCount;            // Including the main thread; 0 or 1 runs every job inline
+    std::thread *workers;
+    JobQueue *queues;
+    std::atomic<int> queued;    // Jobs sitting in any queue
+    std::atomic<bool> running;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+} JobSystem;
+
+static JobSystem jobSystem;
+static thread_local int jobWorkerIndex = 0;
+
+static bool PushJob(JobQueue *queue, const Job *job)
 {
-    wallCount = 0;
-    pillarCount = 0;
-    propCount = 0;
-    stairCount = 0;
-    lightCount = 0;
-    
-    // ============================================
-    // LEFT HALL - Long narrow room (12 wide x 24 deep)
-    // Centered at X = -24
-    // ============================================
-    
-    // Left Hall - West Wall (outer)
-    walls[wallCount++] = (Wall){{-30.0f, 3.0f, 0.0f}, {0.5f, 6.0f, 26.0f}, CONCRETE_DARK};
-    // Left Hall - North Wall
-    walls[wallCount++] = (Wall){{-24.0f, 3.0f, -13.0f}, {13.0f, 6.0f, 0.5f}, CONCRETE_MED};
-    // Left Hall - South Wall
-    walls[wallCount++] = (Wall){{-24.0f, 3.0f, 13.0f}, {13.0f, 6.0f, 0.5f}, CONCRETE_MED};
-    // Left Hall - East Wall (with doorway gap in middle)
-    walls[wallCount++] = (Wall){{-18.0f, 3.0f, -8.0f}, {0.5f, 6.0f, 10.0f}, CONCRETE_DARK};
-    walls[wallCount++] = (Wall){{-18.0f, 3.0f, 8.0f}, {0.5f, 6.0f, 10.0f}, CONCRETE_DARK};
-    // Doorway lintel (above door)
-    walls[wallCount++] = (Wall){{-18.0f, 5.0f, 0.0f}, {0.5f, 2.0f, 6.0f}, CONCRETE_DARK};
-    
-    // Left Hall - Ceiling
-    walls[wallCount++] = (Wall){{-24.0f, 6.0f, 0.0f}, {12.0f, 0.3f, 26.0f}, CEILING_COLOR};
-    
-    // Left Hall Pillars (2 pillars)
-    pillars[pillarCount++] = (Pillar){{-27.0f, 0.0f, -6.0f}, 1.2f, 6.0f};
-    pillars[pillarCount++] = (Pillar){{-27.0f, 0.0f, 6.0f}, 1.2f, 6.0f};
-    
-    // ============================================
-    // CENTRAL ROOM - Large main area (24 wide x 28 deep)
-    // Centered at X = 0
-    // ============================================
-    
-    // Central Room - North Wall
-    walls[wallCount++] = (Wall){{0.0f, 4.0f, -15.0f}, {26.0f, 8.0f, 0.5f}, CONCRETE_MED};
-    // Central Room - South Wall
-    walls[wallCount++] = (Wall){{0.0f, 4.0f, 15.0f}, {26.0f, 8.0f, 0.5f}, CONCRETE_MED};
-    // Central Room - West Wall segments (with doorway to left hall)
-    walls[wallCount++] = (Wall){{-12.5f, 4.0f, -10.0f}, {0.5f, 8.0f, 10.0f}, WORN_PAINT};
-    walls[wallCount++] = (Wall){{-12.5f, 4.0f, 10.0f}, {0.5f, 8.0f, 10.0f}, WORN_PAINT};
-    walls[wallCount++] = (Wall){{-12.5f, 6.0f, 0.0f}, {0.5f, 4.0f, 6.0f}, WORN_PAINT};
-    // Central Room - East Wall segments (with doorway to right room)
-    walls[wallCount++] = (Wall){{12.5f, 4.0f, -10.0f}, {0.5f, 8.0f, 10.0f}, WORN_PAINT};
-    walls[wallCount++] = (Wall){{12.5f, 4.0f, 10.0f}, {0.5f, 8.0f, 10.0f}, WORN_PAINT};
-    walls[wallCount++] = (Wall){{12.5f, 6.0f, 0.0f}, {0.5f, 4.0f, 6.0f}, WORN_PAINT};
-    
-    // Central Room - Higher Ceiling
-    walls[wallCount++] = (Wall){{0.0f, 8.0f, 0.0f}, {25.0f, 0.3f, 30.0f}, CEILING_COLOR};
-    
-    // Central Room - Ceiling Beams (horizontal metal beams)
-    props[propCount++] = (Prop){{0.0f, 7.5f, -7.0f}, {24.0f, 0.4f, 0.6f}, DARK_METAL, 5};
-    props[propCount++] = (Prop){{0.0f, 7.5f, 0.0f}, {24.0f, 0.4f, 0.6f}, DARK_METAL, 5};
-    props[propCount++] = (Prop){{0.0f, 7.5f, 7.0f}, {24.0f, 0.4f, 0.6f}, DARK_METAL, 5};
-    
-    // Central Room Pillars (6 pillars - 2 rows of 3)
-    pillars[pillarCount++] = (Pillar){{-8.0f, 0.0f, -10.0f}, 1.5f, 8.0f};
-    pillars[pillarCount++] = (Pillar){{-8.0f, 0.0f, 10.0f}, 1.5f, 8.0f};
-    pillars[pillarCount++] = (Pillar){{8.0f, 0.0f, -10.0f}, 1.5f, 8.0f};
-    pillars[pillarCount++] = (Pillar){{8.0f, 0.0f, 10.0f}, 1.5f, 8.0f};
-    // Near stairwell
-    pillars[pillarCount++] = (Pillar){{-4.0f, 0.0f, -3.0f}, 1.0f, 8.0f};
-    pillars[pillarCount++] = (Pillar){{4.0f, 0.0f, -3.0f}, 1.0f, 8.0f};
-    
-    // ============================================
-    // CENTRAL STAIRWELL - Going up in center
-    // ============================================
-    
-    // Stair steps (going from Z=0 to Z=6, rising)
-    for (int i = 0; i < 10; i++) {
-        float stepY = 0.25f + i * 0.4f;
-        float stepZ = 1.0f + i * 0.5f;
-        stairs[stairCount++] = (Stair){{0.0f, stepY, stepZ}, {4.0f, 0.25f, 0.5f}};
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->tail - queue->head == JOB_QUEUE_CAPACITY) return false;
+    queue->jobs[queue->tail++ % JOB_QUEUE_CAPACITY] = *job;
+    return true;
+}
+
+static bool PopJob(JobQueue *queue, Job *job)
+{
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->tail == queue->head) return false;
+    *job = queue->jobs[--queue->tail % JOB_QUEUE_CAPACITY];
+    return true;
+}
+
+static bool StealJob(JobQueue *queue, Job *job)
+{
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->tail == queue->head) return false;
+    *job = queue->jobs[queue->head++ % JOB_QUEUE_CAPACITY];
+    return true;
+}
+
+static void RunJob(const Job *job);
+
+// Queue a job on the calling thread's deque and wake a sleeping worker
+static void SubmitJob(const Job *job)
+{
+    if (!PushJob(&jobSystem.queues[jobWorkerIndex], job)) {
+        RunJob(job);        // Deque full: run it here
+        return;
     }
-    
-    // Stair railing posts (left side)
-    props[propCount++] = (Prop){{-2.2f, 1.5f, 1.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
-    props[propCount++] = (Prop){{-2.2f, 2.3f, 3.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
-    props[propCount++] = (Prop){{-2.2f, 3.1f, 5.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
-    // Stair railing posts (right side)
-    props[propCount++] = (Prop){{2.2f, 1.5f, 1.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
-    props[propCount++] = (Prop){{2.2f, 2.3f, 3.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
-    props[propCount++] = (Prop){{2.2f, 3.1f, 5.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
-    // Horizontal railing bars
-    props[propCount++] = (Prop){{-2.2f, 2.5f, 3.5f}, {0.08f, 0.08f, 5.0f}, RUST_METAL, 4};
-    props[propCount++] = (Prop){{2.2f, 2.5f, 3.5f}, {0.08f, 0.08f, 5.0f}, RUST_METAL, 4};
-    
-    // Upper platform at top of stairs
-    walls[wallCount++] = (Wall){{0.0f, 4.2f, 7.5f}, {5.0f, 0.25f, 3.0f}, CONCRETE_LIGHT};
-    
-    // ============================================
-    // RIGHT ROOM - Large room (16 wide x 20 deep)
-    // Centered at X = 24
-    // ============================================
-    
-    // Right Room - East Wall (outer)
-    walls[wallCount++] = (Wall){{32.0f, 3.0f, 0.0f}, {0.5f, 6.0f, 22.0f}, CONCRETE_DARK};
-    // Right Room - North Wall
-    walls[wallCount++] = (Wall){{24.0f, 3.0f, -11.0f}, {17.0f, 6.0f, 0.5f}, CONCRETE_MED};
-    // Right Room - South Wall
-    walls[wallCount++] = (Wall){{24.0f, 3.0f, 11.0f}, {17.0f, 6.0f, 0.5f}, CONCRETE_MED};
-    // Right Room - West Wall segments (with doorway)
-    walls[wallCount++] = (Wall){{16.0f, 3.0f, -7.0f}, {0.5f, 6.0f, 8.0f}, WORN_PAINT};
-    walls[wallCount++] = (Wall){{16.0f, 3.0f, 7.0f}, {0.5f, 6.0f, 8.0f}, WORN_PAINT};
-    walls[wallCount++] = (Wall){{16.0f, 5.0f, 0.0f}, {0.5f, 2.0f, 6.0f}, WORN_PAINT};
-    
-    // Right Room - Ceiling
-    walls[wallCount++] = (Wall){{24.0f, 6.0f, 0.0f}, {16.0f, 0.3f, 22.0f}, CEILING_COLOR};
-    
-    // Right Room Pillars (4 pillars)
-    pillars[pillarCount++] = (Pillar){{20.0f, 0.0f, -6.0f}, 1.2f, 6.0f};
-    pillars[pillarCount++] = (Pillar){{20.0f, 0.0f, 6.0f}, 1.2f, 6.0f};
-    pillars[pillarCount++] = (Pillar){{28.0f, 0.0f, -6.0f}, 1.2f, 6.0f};
-    pillars[pillarCount++] = (Pillar){{28.0f, 0.0f, 6.0f}, 1.2f, 6.0f};
-    
-    // ============================================
-    // CORRIDOR between Central and Right rooms
-    // ============================================
-    walls[wallCount++] = (Wall){{14.25f, 3.0f, -2.5f}, {4.0f, 6.0f, 0.3f}, CONCRETE_DARK};
-    walls[wallCount++] = (Wall){{14.25f, 3.0f, 2.5f}, {4.0f, 6.0f, 0.3f}, CONCRETE_DARK};
-    walls[wallCount++] = (Wall){{14.25f, 5.5f, 0.0f}, {4.0f, 0.3f, 5.0f}, CEILING_COLOR};
-    
-    // ============================================
-    // PROPS - Crates, Tables, Shelves, Debris
-    // ============================================
-    
-    // LEFT HALL PROPS
-    // Wooden crates stacked
-    props[propCount++] = (Prop){{-28.0f, 0.75f, -10.0f}, {1.5f, 1.5f, 1.5f}, WOOD_CRATE, 0};
-    props[propCount++] = (Prop){{-26.5f, 0.75f, -10.0f}, {1.5f, 1.5f, 1.5f}, WOOD_DARK, 0};
-    props[propCount++] = (Prop){{-27.25f, 2.0f, -10.0f}, {1.3f, 1.0f, 1.3f}, WOOD_CRATE, 0};
-    // Table with debris
-    props[propCount++] = (Prop){{-22.0f, 1.0f, 8.0f}, {3.0f, 0.15f, 1.5f}, WOOD_DARK, 1};
-    props[propCount++] = (Prop){{-22.0f, 0.5f, 7.5f}, {0.2f, 1.0f, 0.2f}, WOOD_DARK, 1};
-    props[propCount++] = (Prop){{-22.0f, 0.5f, 8.5f}, {0.2f, 1.0f, 0.2f}, WOOD_DARK, 1};
-    // Debris pile
-    props[propCount++] = (Prop){{-25.0f, 0.3f, 3.0f}, {2.0f, 0.6f, 1.5f}, DEBRIS_COLOR, 3};
-    // Pipes on wall
-    props[propCount++] = (Prop){{-29.8f, 4.0f, 0.0f}, {0.2f, 0.2f, 20.0f}, PIPE_COLOR, 4};
-    props[propCount++] = (Prop){{-29.8f, 2.5f, -5.0f}, {0.15f, 0.15f, 8.0f}, PIPE_COLOR, 4};
-    
-    // CENTRAL ROOM PROPS
-    // Large crate pile for cover
-    props[propCount++] = (Prop){{-6.0f, 1.0f, -12.0f}, {2.0f, 2.0f, 2.0f}, WOOD_CRATE, 0};
-    props[propCount++] = (Prop){{-4.0f, 1.0f, -12.0f}, {2.0f, 2.0f, 2.0f}, WOOD_DARK, 0};
-    props[propCount++] = (Prop){{-5.0f, 2.5f, -12.0f}, {1.5f, 1.0f, 1.5f}, WOOD_CRATE, 0};
-    // Metal shelves
-    props[propCount++] = (Prop){{10.0f, 1.5f, -13.5f}, {4.0f, 3.0f, 0.8f}, DARK_METAL, 2};
-    // Overturned table
-    props[propCount++] = (Prop){{6.0f, 0.6f, 12.0f}, {2.5f, 0.15f, 1.2f}, WOOD_DARK, 1};
-    // Debris and papers
-    props[propCount++] = (Prop){{-10.0f, 0.15f, 5.0f}, {1.5f, 0.3f, 1.0f}, DEBRIS_COLOR, 3};
-    props[propCount++] = (Prop){{3.0f, 0.1f, -8.0f}, {0.8f, 0.02f, 0.6f}, (Color){200, 195, 180, 255}, 3};
-    // Broken chair
-    props[propCount++] = (Prop){{-9.0f, 0.4f, 8.0f}, {0.5f, 0.8f, 0.5f}, WOOD_DARK, 3};
-    // Cables hanging from ceiling
-    props[propCount++] = (Prop){{5.0f, 6.0f, 5.0f}, {0.05f, 2.5f, 0.05f}, (Color){30, 30, 35, 255}, 4};
-    props[propCount++] = (Prop){{-3.0f, 5.5f, -5.0f}, {0.05f, 3.0f, 0.05f}, (Color){30, 30, 35, 255}, 4};
-    
-    // RIGHT ROOM PROPS
-    // Crate cover positions
-    props[propCount++] = (Prop){{22.0f, 1.0f, -8.0f}, {2.0f, 2.0f, 2.0f}, WOOD_CRATE, 0};
-    props[propCount++] = (Prop){{30.0f, 0.75f, 8.0f}, {1.5f, 1.5f, 1.5f}, WOOD_DARK, 0};
-    props[propCount++] = (Prop){{30.0f, 0.75f, 6.5f}, {1.5f, 1.5f, 1.5f}, WOOD_CRATE, 0};
-    // Old desk/table
-    props[propCount++] = (Prop){{26.0f, 1.0f, -9.0f}, {2.5f, 0.15f, 1.2f}, WOOD_DARK, 1};
-    props[propCount++] = (Prop){{26.0f, 0.5f, -8.5f}, {0.15f, 1.0f, 0.15f}, WOOD_DARK, 1};
-    props[propCount++] = (Prop){{26.0f, 0.5f, -9.5f}, {0.15f, 1.0f, 0.15f}, WOOD_DARK, 1};
-    // Shelf unit
-    props[propCount++] = (Prop){{31.0f, 2.0f, 0.0f}, {0.8f, 4.0f, 3.0f}, DARK_METAL, 2};
-    // Debris
-    props[propCount++] = (Prop){{24.0f, 0.25f, 4.0f}, {1.8f, 0.5f, 1.2f}, DEBRIS_COLOR, 3};
-    // Wall pipes
-    props[propCount++] = (Prop){{31.8f, 3.5f, 0.0f}, {0.15f, 0.15f, 18.0f}, PIPE_COLOR, 4};
-    props[propCount++] = (Prop){{31.8f, 2.0f, 0.0f}, {0.1f, 0.1f, 18.0f}, RUST_METAL, 4};
-    
-    // ============================================
-    // LIGHTS - Dim industrial lighting
-    // ============================================
-    lights[lightCount++] = (LightSource){{-24.0f, 5.5f, 0.0f}, 0.0f, 3.5f, true};
-    lights[lightCount++] = (LightSource){{-24.0f, 5.5f, -8.0f}, 0.0f, 4.2f, true};
-    lights[lightCount++] = (LightSource){{0.0f, 7.5f, -7.0f}, 0.0f, 2.8f, true};
-    lights[lightCount++] = (LightSource){{0.0f, 7.5f, 7.0f}, 0.0f, 5.0f, true};
-    lights[lightCount++] = (LightSource){{24.0f, 5.5f, 0.0f}, 0.0f, 3.0f, true};
-    lights[lightCount++] = (LightSource){{24.0f, 5.5f, -6.0f}, 0.0f, 6.0f, true};
+
+    jobSystem.queued++;
+    { std::lock_guard<std::mutex> guard(jobSystem.sleepLock); }
+    jobSystem.wake.notify_one();
 }
 
-//------------------------------------------------------------------------------------
-// Collision Detection
-//------------------------------------------------------------------------------------
-bool CheckBoxCollision(Vector3 playerPos, float radius, Vector3 boxPos, Vector3 boxSize)
+// The counter is only touched under its lock, so a waiter that has taken the lock
+// after pending reached zero knows no thread still uses it
+static void FinishJob(JobCounter *counter)
 {
-    // Check if player sphere intersects with AABB
-    float closestX = Clamp(playerPos.x, boxPos.x - boxSize.x/2, boxPos.x + boxSize.x/2);
-    float closestY = Clamp(playerPos.y, boxPos.y - boxSize.y/2, boxPos.y + boxSize.y/2);
-    float closestZ = Clamp(playerPos.z, boxPos.z - boxSize.z/2, boxPos.z + boxSize.z/2);
-    
-    float distX = playerPos.x - closestX;
-    float distY = playerPos.y - closestY;
-    float distZ = playerPos.z - closestZ;
-    
-    float distSquared = distX*distX + distY*distY + distZ*distZ;
-    return distSquared < radius*radius;
+    std::lock_guard<std::mutex> guard(counter->lock);
+    if (--counter->pending > 0) return;
+
+    for (int i = 0; i < counter->waitingCount; i++) SubmitJob(&counter->waiting[i]);
+    counter->waitingCount = 0;
+}
+
+static void RunJob(const Job *job)
+{
+    job->function(job->data, job->begin, job->end);
+    if (job->counter != NULL) FinishJob(job->counter);
+}
+
+// Run one job from our own deque, or stolen from another; false if all are empty
+static bool TryRunJob(int self)
+{
+    Job job;
+    bool found = PopJob(&jobSystem.queues[self], &job);
+    for (int i = 1; !found && i < jobSystem.threadCount; i++) found = StealJob(&jobSystem.queues[(self + i) % jobSystem.threadCount], &job);
+    if (!found) return false;
+
+    jobSystem.queued--;
+    RunJob(&job);
+    return true;
+}
+
+static void JobWorkerMain(int index)
+{
+    jobWorkerIndex = index;
+    while (jobSystem.running) {
+        if (TryRunJob(index)) continue;
+
+        std::unique_lock<std::mutex> lock(jobSystem.sleepLock);
+        jobSystem.wake.wait(lock, [] { return jobSystem.queued > 0 || !jobSystem.running; });
+    }
+}
+
+// Start the pool with threadCount threads including the caller, 0 = one per hardware thread
+void InitJobSystem(int threadCount)
+{
+    if (threadCount <= 0) threadCount = (int)std::thread::hardware_concurrency();
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount > MAX_JOB_THREADS) threadCount = MAX_JOB_THREADS;
+
+    jobSystem.threadCount = threadCount;
+    jobSystem.queues = new JobQueue[threadCount]();
+    jobSystem.workers = new std::thread[threadCount];
+    jobSystem.queued = 0;
+    jobSystem.running = true;
+    jobWorkerIndex = 0;
+    for (int i = 1; i < threadCount; i++) jobSystem.workers[i] = std::thread(JobWorkerMain, i);
 }
 
-Vector3 ResolveCollision(Vector3 playerPos, Vector3 oldPos, float radius)
-{
-    Vector3 resolved = playerPos;
-    
-    // Check walls
-    for (int i = 0; i < wallCount; i++) {
-        if (CheckBoxCollision(resolved, radius, walls[i].position, walls[i].size)) {
-            // Push player back
-            resolved = oldPos;
-            break;
+void ShutdownJobSystem(void)
+{
+    if (jobSystem.workers == NULL) return;
+
+    {
+        std::lock_guard<std::mutex> guard(jobSystem.sleepLock);
+        jobSystem.running = false;
+    }
+    jobSystem.wake.notify_all();
+    for (int i = 1; i < jobSystem.threadCount; i++) jobSystem.workers[i].join();
+
+    delete[] jobSystem.workers;
+    delete[] jobSystem.queues;
+    jobSystem.workers = NULL;
+    jobSystem.queues = NULL;
+    jobSystem.threadCount = 0;
+}
+
+// Schedule function(data, begin, end), counted in counter, to start once after has drained
+// (either may be NULL). Without worker threads the job runs right here.
+void ScheduleJob(JobFunction function, void *data, int begin, int end, JobCounter *counter, JobCounter *after)
+{
+    Job job = { function, data, begin, end, counter };
+    if (jobSystem.threadCount <= 1) {
+        function(data, begin, end);
+        return;
+    }
+
+    if (counter != NULL) counter->pending++;
+    if (after != NULL) {
+        std::unique_lock<std::mutex> guard(after->lock);
+        if (after->pending > 0) {
+            if (after->waitingCount < MAX_JOB_DEPENDENTS) {
+                after->waiting[after->waitingCount++] = job;
+                return;
+            }
+
+            // Too many dependents parked: wait the group out here instead
+            guard.unlock();
+            while (after->pending > 0) if (!TryRunJob(jobWorkerIndex)) std::this_thread::yield();
+        }
+    }
+
+    SubmitJob(&job);
+}
+
+// Help run jobs until every job counted in counter has finished
+void WaitForJobs(JobCounter *counter)
+{
+    while (counter->pending > 0) {
+        if (!TryRunJob(jobWorkerIndex)) std::this_thread::yield();
+    }
+
+    std::lock_guard<std::mutex> guard(counter->lock);
+}
+
+// Split [0, count) into chunks of at least grain indices, a few per thread for balance
+void ScheduleParallelFor(JobFunction function, void *data, int count, int grain, JobCounter *counter, JobCounter *after)
+{
+    if (count <= 0) return;
+
+    int chunkCount = (jobSystem.threadCount > 1)? jobSystem.threadCount*4 : 1;
+    if (chunkCount > MAX_JOB_DEPENDENTS) chunkCount = MAX_JOB_DEPENDENTS;
+    int chunk = (count + chunkCount - 1)/chunkCount;
+    if (chunk < grain) chunk = grain;
+
+    for (int begin = 0; begin < count; begin += chunk) {
+        ScheduleJob(function, data, begin, (count - begin < chunk)? count : begin + chunk, counter, after);
+    }
+}
+
+void ParallelFor(JobFunction function, void *data, int count, int grain)
+{
+    JobCounter counter;
+    ScheduleParallelFor(function, data, count, grain, &counter, NULL);
+    WaitForJobs(&counter);
+}
+
+//------------------------------------------------------------------------------------
+// Frame Profiler
+//------------------------------------------------------------------------------------
+// Scoped timers around the main phases of a frame. Every closed scope appends one
+// event to a lock-free ring (any thread may write; a slot is claimed with one atomic
+// add), and closing the Frame zone rolls the per-zone totals of that frame into a
+// short history for the percentile overlay (F3). A zone's frame time is its wall
+// span: the union of its events, so jobs of one zone running side by side on several
+// threads count once; the thread time summed over them is kept as the busy time. The
+// ring can be dumped as Chrome
+// trace JSON (chrome://tracing, Perfetto) or CSV. Scopes cost a branch while not
+// recording; build with -DPROFILER_DISABLED to compile them out entirely.
+#define PROFILE_RING_SIZE (1 << 16)     // Events kept, power of two
+#define PROFILE_HISTORY 240             // Frames of per-zone totals for the percentiles
+
+typedef enum {
+    PROFILE_FRAME = 0,
+    PROFILE_INPUT,              // Input sampling and weapon switching
+    PROFILE_CAMERA,             // Camera movement and ResolveCollision
+    PROFILE_GROUND,             // Ground height lookup, gravity
+    PROFILE_NAVIGATION,         // Flow field rebuild slice
+    PROFILE_PERCEPTION,         // Enemy line of sight queries
+    PROFILE_ENEMIES,            // Enemy AI and movement jobs
+    PROFILE_BULLET_SWEEPS,      // Bullet sweep jobs
+    PROFILE_BULLETS,            // Bullet hits and releases
+    PROFILE_VISIBILITY,
+    PROFILE_DRAW_LEVEL,         // DrawLevelGeometry
+    PROFILE_DRAW_DYNAMIC,       // Lights, enemies and projectiles
+    PROFILE_HUD,
+    PROFILE_AUDIO,              // Voice updates and mixing ahead into the ring
+    PROFILE_PRESENT,            // EndDrawing: buffer swap and frame pacing
+    PROFILE_ZONE_COUNT
+} ProfileZone;
+
+static const char *profileZoneNames[PROFILE_ZONE_COUNT] = {
+    "Frame", "Input + weapon switch", "Camera + collision", "Ground", "Flow field",
+    "Perception", "Enemy jobs", "Bullet sweep jobs", "Bullet update", "Visibility", "DrawLevelGeometry",
+    "Draw lights + entities", "HUD", "Audio mix", "EndDrawing",
+};
+
+typedef struct ProfileEvent {
+    std::atomic<unsigned int> sequence;     // Low bits of index + 1 once written, 0 while being written
+    unsigned char zone;
+    unsigned char thread;                   // Job system worker index
+    unsigned long long start, end;          // Nanoseconds on the profiler clock
+} ProfileEvent;
+
+typedef struct Profiler {
+    std::atomic<bool> recording;
+    bool overlay;
+    std::atomic<unsigned long long> writeIndex;
+    unsigned long long frameIndex;          // First event of the frame in progress
+    float history[PROFILE_ZONE_COUNT][PROFILE_HISTORY];    // Wall milliseconds per frame
+    float busy[PROFILE_ZONE_COUNT][PROFILE_HISTORY];       // Thread milliseconds per frame, summed over threads
+    int historyNext, historyCount;
+} Profiler;
+
+static ProfileEvent profileRing[PROFILE_RING_SIZE];
+static Profiler profiler;
+
+static unsigned long long ProfileNow(void)
+{
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void SetProfilerRecording(bool recording)
+{
+    profiler.recording = recording;
+}
+
+// Read back event index, false if it was overwritten or is still being written
+static bool ReadProfileEvent(unsigned long long index, ProfileEvent *event)
+{
+    const ProfileEvent *slot = &profileRing[index & (PROFILE_RING_SIZE - 1)];
+    unsigned int sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence != (unsigned int)(index + 1)) return false;
+
+    event->zone = slot->zone;
+    event->thread = slot->thread;
+    event->start = slot->start;
+    event->end = slot->end;
+    return slot->sequence.load(std::memory_order_acquire) == sequence;
+}
+
+typedef struct ProfileSpan {
+    int zone;
+    unsigned long long start, end;
+} ProfileSpan;
+
+static ProfileSpan profileSpans[PROFILE_RING_SIZE];
+
+static int CompareProfileSpans(const void *a, const void *b)
+{
+    const ProfileSpan *x = (const ProfileSpan *)a, *y = (const ProfileSpan *)b;
+    if (x->zone != y->zone) return x->zone - y->zone;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+// Roll the zones of the frame just closed into the history: the wall span of each
+// zone (overlapping events merged) and its busy time (events summed)
+static void EndProfileFrame(void)
+{
+    unsigned long long end = profiler.writeIndex;
+    if (end - profiler.frameIndex > PROFILE_RING_SIZE) profiler.frameIndex = end - PROFILE_RING_SIZE;
+
+    int count = 0;
+    ProfileEvent event;
+    for (unsigned long long i = profiler.frameIndex; i < end; i++) {
+        if (ReadProfileEvent(i, &event)) profileSpans[count++] = (ProfileSpan){ event.zone, event.start, event.end };
+    }
+    profiler.frameIndex = end;
+    qsort(profileSpans, count, sizeof(ProfileSpan), CompareProfileSpans);
+
+    double wall[PROFILE_ZONE_COUNT] = { 0 };
+    double busy[PROFILE_ZONE_COUNT] = { 0 };
+    for (int i = 0; i < count;) {
+        int zone = profileSpans[i].zone;
+        unsigned long long spanStart = profileSpans[i].start, spanEnd = profileSpans[i].end;
+        for (; i < count && profileSpans[i].zone == zone; i++) {
+            const ProfileSpan *span = &profileSpans[i];
+            busy[zone] += (span->end - span->start)*1e-6;
+            if (span->start > spanEnd) {
+                wall[zone] += (spanEnd - spanStart)*1e-6;
+                spanStart = span->start;
+            }
+            if (span->end > spanEnd) spanEnd = span->end;
+        }
+        wall[zone] += (spanEnd - spanStart)*1e-6;
+    }
+
+    for (int z = 0; z < PROFILE_ZONE_COUNT; z++) {
+        profiler.history[z][profiler.historyNext] = (float)wall[z];
+        profiler.busy[z][profiler.historyNext] = (float)busy[z];
+    }
+    profiler.historyNext = (profiler.historyNext + 1) % PROFILE_HISTORY;
+    if (profiler.historyCount < PROFILE_HISTORY) profiler.historyCount++;
+}
+
+void RecordProfileZone(int zone, unsigned long long start)
+{
+    unsigned long long end = ProfileNow();
+    unsigned long long index = profiler.writeIndex.fetch_add(1);
+    ProfileEvent *slot = &profileRing[index & (PROFILE_RING_SIZE - 1)];
+
+    slot->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->zone = (unsigned char)zone;
+    slot->thread = (unsigned char)jobWorkerIndex;
+    slot->start = start;
+    slot->end = end;
+    slot->sequence.store((unsigned int)(index + 1), std::memory_order_release);
+
+    if (zone == PROFILE_FRAME) EndProfileFrame();
+}
+
+// Times the enclosing block while the profiler is recording
+struct ProfileScope {
+    int zone;
+    unsigned long long start;
+    ProfileScope(int zone) : zone(zone), start(profiler.recording.load(std::memory_order_relaxed)? ProfileNow() : 0) {}
+    ~ProfileScope() { if (start != 0) RecordProfileZone(zone, start); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#if defined(PROFILER_DISABLED)
+    #define PROFILE_SCOPE(zone)
+    #define BeginProfileZone(zone)
+    #define EndProfileZone(zone)
+#else
+    #define PROFILE_SCOPE(zone) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(zone)
+
+// Begin/End pair for straight-line code such as the draw calls of the main loop
+static thread_local unsigned long long profileZoneStart[PROFILE_ZONE_COUNT];
+
+void BeginProfileZone(int zone)
+{
+    profileZoneStart[zone] = profiler.recording.load(std::memory_order_relaxed)? ProfileNow() : 0;
+}
+
+void EndProfileZone(int zone)
+{
+    if (profileZoneStart[zone] != 0) RecordProfileZone(zone, profileZoneStart[zone]);
+}
+#endif
+
+static int CompareFloats(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+// Per-frame milliseconds of a zone at percentiles p[0..count) (0..1) over the history:
+// wall span, or with busy the thread time summed over every thread that ran the zone
+void GetProfilePercentiles(int zone, bool busy, const float *p, float *values, int count)
+{
+    float sorted[PROFILE_HISTORY];
+    int n = profiler.historyCount;
+    memcpy(sorted, busy? profiler.busy[zone] : profiler.history[zone], n*sizeof(float));
+    qsort(sorted, n, sizeof(float), CompareFloats);
+    for (int i = 0; i < count; i++) values[i] = (n > 0)? sorted[(int)(p[i]*(n - 1) + 0.5f)] : 0.0f;
+}
+
+// Rolling p50/p95/p99 of every zone over the history, drawn at x, y
+void DrawProfileOverlay(int x, int y)
+{
+    const int lineHeight = 12;
+
+    DrawRectangle(x - 6, y - 4, 290, (PROFILE_ZONE_COUNT + 1)*lineHeight + 8, (Color){ 0, 0, 0, 170 });
+#if defined(PROFILER_DISABLED)
+    DrawText("Profiler compiled out (PROFILER_DISABLED)", x, y, 10, (Color){ 200, 200, 190, 255 });
+#else
+    static const float percentiles[3] = { 0.5f, 0.95f, 0.99f };
+    DrawText(TextFormat("ms, last %d frames", profiler.historyCount), x, y, 10, (Color){ 200, 200, 190, 255 });
+    DrawText("p50", x + 170, y, 10, (Color){ 200, 200, 190, 255 });
+    DrawText("p95", x + 210, y, 10, (Color){ 200, 200, 190, 255 });
+    DrawText("p99", x + 250, y, 10, (Color){ 200, 200, 190, 255 });
+
+    for (int z = 0; z < PROFILE_ZONE_COUNT; z++) {
+        float values[3];
+        GetProfilePercentiles(z, false, percentiles, values, 3);
+        int lineY = y + (z + 1)*lineHeight;
+        DrawText(profileZoneNames[z], x, lineY, 10, (Color){ 170, 170, 160, 255 });
+        for (int i = 0; i < 3; i++) DrawText(TextFormat("%.2f", values[i]), x + 170 + 40*i, lineY, 10, (Color){ 170, 170, 160, 255 });
+    }
+#endif
+}
+
+// Dump the events still in the ring: Chrome trace JSON, or CSV when the name ends in .csv
+bool ExportProfileTrace(const char *fileName)
+{
+    FILE *file = fopen(fileName, "w");
+    if (file == NULL) return false;
+
+    const char *extension = strrchr(fileName, '.');
+    bool csv = (extension != NULL) && (strcmp(extension, ".csv") == 0);
+
+    unsigned long long end = profiler.writeIndex;
+    unsigned long long first = (end > PROFILE_RING_SIZE)? end - PROFILE_RING_SIZE : 0;
+    // Enclosing zones are recorded after the zones inside them, so find the earliest start
+    unsigned long long origin = ~0ull;
+    ProfileEvent event;
+    for (unsigned long long i = first; i < end; i++) {
+        if (ReadProfileEvent(i, &event) && event.start < origin) origin = event.start;
+    }
+
+    if (csv) fprintf(file, "zone,thread,start_us,duration_us\n");
+    else fprintf(file, "{\"traceEvents\":[\n");
+
+    int written = 0;
+    for (unsigned long long i = first; i < end; i++) {
+        if (!ReadProfileEvent(i, &event)) continue;
+        double start = (event.start - origin)*1e-3, duration = (event.end - event.start)*1e-3;
+        if (csv) fprintf(file, "%s,%d,%.3f,%.3f\n", profileZoneNames[event.zone], event.thread, start, duration);
+        else fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", (written > 0)? ",\n" : "",
+                     profileZoneNames[event.zone], event.thread, start, duration);
+        written++;
+    }
+
+    if (!csv) fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+//------------------------------------------------------------------------------------
+// Uniform Grid
+//------------------------------------------------------------------------------------
+#define GRID_CELL_SIZE 4.0f
+#define MAX_GRID_CELLS (1 << 20)
+
+// Uniform grid over the XZ plane. Boxes are bucketed into every cell they overlap;
+// cell c owns the bucket entries cellStart[c]..cellStart[c + 1].
+typedef struct UniformGrid {
+    float originX;
+    float originZ;
+    float cellSize;
+    int cellsX;
+    int cellsZ;
+    int *cellStart;
+} UniformGrid;
+
+// Cell range covered by an XZ rectangle, clamped to the grid. False if it misses the grid.
+bool GetGridCellRange(const UniformGrid *grid, float minX, float minZ, float maxX, float maxZ, int *x0, int *z0, int *x1, int *z1)
+{
+    if (grid->cellsX == 0) return false;
+
+    *x0 = (int)floorf((minX - grid->originX)/grid->cellSize);
+    *z0 = (int)floorf((minZ - grid->originZ)/grid->cellSize);
+    *x1 = (int)floorf((maxX - grid->originX)/grid->cellSize);
+    *z1 = (int)floorf((maxZ - grid->originZ)/grid->cellSize);
+
+    if (*x1 < 0 || *z1 < 0 || *x0 >= grid->cellsX || *z0 >= grid->cellsZ) return false;
+    if (*x0 < 0) *x0 = 0;
+    if (*z0 < 0) *z0 = 0;
+    if (*x1 >= grid->cellsX) *x1 = grid->cellsX - 1;
+    if (*z1 >= grid->cellsZ) *z1 = grid->cellsZ - 1;
+    return true;
+}
+
+// True when the XZ extents of a box lie inside the grid, so bucketing it clamps nothing
+bool IsBoxInGrid(const UniformGrid *grid, BoundingBox b)
+{
+    return b.min.x >= grid->originX && b.min.z >= grid->originZ &&
+           b.max.x < grid->originX + grid->cellsX*grid->cellSize && b.max.z < grid->originZ + grid->cellsZ*grid->cellSize;
+}
+
+// True when b lies inside the grid and covers exactly the cells a does, so a bucketed
+// box can move from a to b without rebuilding the buckets
+bool IsSameGridCellRange(const UniformGrid *grid, BoundingBox a, BoundingBox b)
+{
+    if (!IsBoxInGrid(grid, b)) return false;
+
+    int a0, a1, a2, a3, b0, b1, b2, b3;
+    if (!GetGridCellRange(grid, a.min.x, a.min.z, a.max.x, a.max.z, &a0, &a1, &a2, &a3)) return false;
+    if (!GetGridCellRange(grid, b.min.x, b.min.z, b.max.x, b.max.z, &b0, &b1, &b2, &b3)) return false;
+    return a0 == b0 && a1 == b1 && a2 == b2 && a3 == b3;
+}
+
+void UnloadUniformGrid(UniformGrid *grid)
+{
+    free(grid->cellStart);
+    *grid = (UniformGrid){ 0 };
+}
+
+// Bucket boxes by the cells their XZ extents overlap. Sets up the grid and returns
+// the box index of every bucket entry, cell by cell (caller frees), or NULL if empty.
+int *BuildGridBuckets(UniformGrid *grid, const BoundingBox *bounds, int count)
+{
+    *grid = (UniformGrid){ 0 };
+    if (count == 0) return NULL;
+
+    float minX = bounds[0].min.x, maxX = bounds[0].max.x;
+    float minZ = bounds[0].min.z, maxZ = bounds[0].max.z;
+    for (int i = 1; i < count; i++) {
+        minX = fminf(minX, bounds[i].min.x);
+        maxX = fmaxf(maxX, bounds[i].max.x);
+        minZ = fminf(minZ, bounds[i].min.z);
+        maxZ = fmaxf(maxZ, bounds[i].max.z);
+    }
+
+    grid->cellSize = GRID_CELL_SIZE;
+    while (((maxX - minX)/grid->cellSize + 1)*((maxZ - minZ)/grid->cellSize + 1) > MAX_GRID_CELLS) grid->cellSize *= 2.0f;
+    grid->originX = minX;
+    grid->originZ = minZ;
+    grid->cellsX = (int)((maxX - minX)/grid->cellSize) + 1;
+    grid->cellsZ = (int)((maxZ - minZ)/grid->cellSize) + 1;
+
+    int cellCount = grid->cellsX*grid->cellsZ;
+    grid->cellStart = (int *)calloc(cellCount + 1, sizeof(int));
+
+    // Count boxes per cell, prefix sum into start offsets, then scatter
+    for (int i = 0; i < count; i++) {
+        int x0, z0, x1, z1;
+        GetGridCellRange(grid, bounds[i].min.x, bounds[i].min.z, bounds[i].max.x, bounds[i].max.z, &x0, &z0, &x1, &z1);
+        for (int z = z0; z <= z1; z++) {
+            for (int x = x0; x <= x1; x++) grid->cellStart[z*grid->cellsX + x + 1]++;
+        }
+    }
+    for (int c = 0; c < cellCount; c++) grid->cellStart[c + 1] += grid->cellStart[c];
+
+    int *items = (int *)malloc((grid->cellStart[cellCount] + 1)*sizeof(int));
+    int *cursor = (int *)malloc(cellCount*sizeof(int));
+    memcpy(cursor, grid->cellStart, cellCount*sizeof(int));
+
+    for (int i = 0; i < count; i++) {
+        int x0, z0, x1, z1;
+        GetGridCellRange(grid, bounds[i].min.x, bounds[i].min.z, bounds[i].max.x, bounds[i].max.z, &x0, &z0, &x1, &z1);
+        for (int z = z0; z <= z1; z++) {
+            for (int x = x0; x <= x1; x++) items[cursor[z*grid->cellsX + x]++] = i;
+        }
+    }
+
+    free(cursor);
+    return items;
+}
+
+// Patching a CSR bucket array (entries of cell c at cellStart[c] .. cellStart[c + 1])
+// in place: the touched cells, ascending, are rewritten, and shift[g] is how far the
+// entries after touched cell g move, through the next touched cell. First move those
+// untouched runs. In their final order no run overlaps another, so runs moving up go
+// last to first and runs moving down first to last, each into space already vacated.
+static void MoveCsrRuns(const int *cellStart, int total, const int *cells, const int *shift, int groups,
+                        void (*move)(void *entries, int from, int to, int count), void *entries)
+{
+    for (int pass = 0; pass < 2; pass++) {
+        for (int n = 0; n < groups; n++) {
+            int g = (pass == 0)? groups - 1 - n : n;
+            if ((pass == 0)? shift[g] <= 0 : shift[g] >= 0) continue;
+            int from = cellStart[cells[g] + 1];
+            int to = (g + 1 < groups)? cellStart[cells[g + 1]] : total;
+            if (to > from) move(entries, from, from + shift[g], to - from);
+        }
+    }
+}
+
+// Then, once the touched cells are written, shift the offsets of the cells after
+// each touched one
+static void ShiftCsrStarts(int *cellStart, int cellCount, const int *cells, const int *shift, int groups)
+{
+    for (int g = 0; g < groups; g++) {
+        int end = (g + 1 < groups)? cells[g + 1] : cellCount;
+        if (shift[g] == 0) continue;
+        for (int c = cells[g] + 1; c <= end; c++) cellStart[c] += shift[g];
+    }
+}
+
+// One item leaving (add 0) or joining (add 1) one cell of a CSR bucket array
+typedef struct GridEdit {
+    int cell;
+    int add;
+    int item;
+} GridEdit;
+
+// Scratch for patching a CSR bucket array of item indices, allocated once by the
+// caller: capacity edits, and twice that many items for the touched cells. Larger
+// patches rebuild instead.
+typedef struct GridPatchScratch {
+    GridEdit *edits;
+    int editCount;
+    int *items;             // New items of the touched cells, back to back
+    int *cells;             // Touched cells, ascending
+    int *ends;              // End of each touched cell's items
+    int *shift;             // Offset change of the entries after each touched cell
+    int groups;             // Touched cells
+    int capacity;
+} GridPatchScratch;
+
+static bool AddGridEdit(GridPatchScratch *scratch, int cell, int item, int add)
+{
+    if (scratch->editCount == scratch->capacity) return false;
+    scratch->edits[scratch->editCount++] = (GridEdit){ cell, add, item };
+    return true;
+}
+
+// Edits of an item for every grid cell its bounds cover; false when they do not fit
+static bool AddGridBoxEdits(GridPatchScratch *scratch, const UniformGrid *grid, BoundingBox bounds, int item, int add)
+{
+    int x0, z0, x1, z1;
+    if (!GetGridCellRange(grid, bounds.min.x, bounds.min.z, bounds.max.x, bounds.max.z, &x0, &z0, &x1, &z1)) return true;
+    if (scratch->editCount + (x1 - x0 + 1)*(z1 - z0 + 1) > scratch->capacity) return false;
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) scratch->edits[scratch->editCount++] = (GridEdit){ z*grid->cellsX + x, add, item };
+    }
+    return true;
+}
+
+static int CompareGridEdits(const void *a, const void *b)
+{
+    int ca = ((const GridEdit *)a)->cell, cb = ((const GridEdit *)b)->cell;
+    return (ca > cb) - (ca < cb);
+}
+
+// Sort the edits and gather the new items of every touched cell from its old entries,
+// ascending like a fresh build. False when an edit removes an item its cell lacks or
+// the items outgrow the scratch.
+static bool PlanGridPatch(const int *cellStart, const int *entries, GridPatchScratch *scratch)
+{
+    GridEdit *edits = scratch->edits;
+    int editCount = scratch->editCount;
+    qsort(edits, editCount, sizeof(GridEdit), CompareGridEdits);
+
+    int used = 0, groups = 0;
+    for (int i = 0; i < editCount; groups++) {
+        int cell = edits[i].cell, first = used;
+        int oldCount = cellStart[cell + 1] - cellStart[cell];
+        if (used + oldCount + editCount > 2*scratch->capacity) return false;
+        memcpy(&scratch->items[used], &entries[cellStart[cell]], oldCount*sizeof(int));
+        used += oldCount;
+        for (; i < editCount && edits[i].cell == cell; i++) {
+            if (edits[i].add) {
+                scratch->items[used++] = edits[i].item;
+                continue;
+            }
+            int k = first;
+            while (k < used && scratch->items[k] != edits[i].item) k++;
+            if (k == used) return false;
+            scratch->items[k] = scratch->items[--used];
+        }
+        for (int k = first + 1; k < used; k++) {
+            int item = scratch->items[k];
+            int j = k - 1;
+            while (j >= first && scratch->items[j] > item) { scratch->items[j + 1] = scratch->items[j]; j--; }
+            scratch->items[j + 1] = item;
+        }
+        scratch->cells[groups] = cell;
+        scratch->ends[groups] = used;
+        scratch->shift[groups] = ((groups > 0)? scratch->shift[groups - 1] : 0) + (used - first) - oldCount;
+    }
+    scratch->groups = groups;
+    return true;
+}
+
+// Change in entry count of a planned patch
+static int GetGridPatchDelta(const GridPatchScratch *scratch)
+{
+    return (scratch->groups > 0)? scratch->shift[scratch->groups - 1] : 0;
+}
+
+static void MoveGridItems(void *entries, int from, int to, int count)
+{
+    int *items = (int *)entries;
+    memmove(&items[to], &items[from], count*sizeof(int));
+}
+
+// Splice a planned patch into a CSR array of item indices with room for capacity
+// entries; false (and nothing changed) when it does not fit
+static bool ApplyGridPatch(int *cellStart, int cellCount, int *entries, int capacity, const GridPatchScratch *scratch)
+{
+    int total = cellStart[cellCount];
+    if (total + GetGridPatchDelta(scratch) > capacity) return false;
+
+    MoveCsrRuns(cellStart, total, scratch->cells, scratch->shift, scratch->groups, MoveGridItems, entries);
+    for (int g = 0; g < scratch->groups; g++) {
+        int begin = (g > 0)? scratch->ends[g - 1] : 0;
+        int start = cellStart[scratch->cells[g]] + ((g > 0)? scratch->shift[g - 1] : 0);
+        memcpy(&entries[start], &scratch->items[begin], (scratch->ends[g] - begin)*sizeof(int));
+    }
+    ShiftCsrStarts(cellStart, cellCount, scratch->cells, scratch->shift, scratch->groups);
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Rooms and Portals
+//------------------------------------------------------------------------------------
+// Rooms are bucketed on a uniform grid so point and box lookups stay cheap on
+// large levels; each room also lists the portals leading out of it.
+#define MAX_BOX_ROOMS 8     // Boxes spanning more rooms go to the outside batch
+
+UniformGrid roomGrid = { 0 };
+int *roomGridItems = NULL;
+int *roomPortalStart = NULL;    // Portals of room r: roomPortals[roomPortalStart[r] .. roomPortalStart[r + 1]]
+int *roomPortals = NULL;
+int *lightRooms = NULL;         // Room holding each light, -1 outside every room
+
+void UnloadRoomIndex(void)
+{
+    UnloadUniformGrid(&roomGrid);
+    free(roomGridItems);
+    free(roomPortalStart);
+    free(roomPortals);
+    free(lightRooms);
+    roomGridItems = roomPortalStart = roomPortals = lightRooms = NULL;
+}
+
+// First room containing the point, -1 if it is outside every room
+int FindLevelRoom(Vector3 point)
+{
+    int x0, z0, x1, z1;
+    if (roomCount == 0 || !GetGridCellRange(&roomGrid, point.x, point.z, point.x, point.z, &x0, &z0, &x1, &z1)) return -1;
+
+    int cell = z0*roomGrid.cellsX + x0;
+    for (int k = roomGrid.cellStart[cell]; k < roomGrid.cellStart[cell + 1]; k++) {
+        const BoundingBox *b = &rooms[roomGridItems[k]].bounds;
+        if (point.x >= b->min.x && point.x <= b->max.x && point.y >= b->min.y && point.y <= b->max.y &&
+            point.z >= b->min.z && point.z <= b->max.z) return roomGridItems[k];
+    }
+
+    return -1;
+}
+
+// Rooms the box overlaps with positive volume. Returns 0 when it overlaps none
+// or more than MAX_BOX_ROOMS. seen[] (roomCount entries) must start at -1.
+static int FindBoxRooms(BoundingBox box, int stamp, int *seen, int *out)
+{
+    const float eps = 0.001f;
+    int x0, z0, x1, z1;
+    if (roomCount == 0 || !GetGridCellRange(&roomGrid, box.min.x, box.min.z, box.max.x, box.max.z, &x0, &z0, &x1, &z1)) return 0;
+
+    int count = 0;
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) {
+            int cell = z*roomGrid.cellsX + x;
+            for (int k = roomGrid.cellStart[cell]; k < roomGrid.cellStart[cell + 1]; k++) {
+                int r = roomGridItems[k];
+                if (seen[r] == stamp) continue;
+                seen[r] = stamp;
+
+                const BoundingBox *b = &rooms[r].bounds;
+                if (box.min.x >= b->max.x - eps || box.max.x <= b->min.x + eps ||
+                    box.min.y >= b->max.y - eps || box.max.y <= b->min.y + eps ||
+                    box.min.z >= b->max.z - eps || box.max.z <= b->min.z + eps) continue;
+
+                if (count == MAX_BOX_ROOMS) return 0;
+                out[count++] = r;
+            }
+        }
+    }
+
+    return count;
+}
+
+// Index the rooms, their portals and the room of every light
+void BuildRoomIndex(void)
+{
+    UnloadRoomIndex();
+
+    BoundingBox *bounds = (BoundingBox *)calloc((roomCount > 0? roomCount : 1), sizeof(BoundingBox));
+    for (int r = 0; r < roomCount; r++) bounds[r] = rooms[r].bounds;
+    roomGridItems = BuildGridBuckets(&roomGrid, bounds, roomCount);
+    free(bounds);
+
+    roomPortalStart = (int *)calloc(roomCount + 1, sizeof(int));
+    roomPortals = (int *)malloc((portalCount > 0? portalCount*2 : 1)*sizeof(int));
+    for (int p = 0; p < portalCount; p++) {
+        for (int side = 0; side < 2; side++) {
+            int r = portals[p].rooms[side];
+            if (r >= 0 && r < roomCount) roomPortalStart[r + 1]++;
+        }
+    }
+    for (int r = 0; r < roomCount; r++) roomPortalStart[r + 1] += roomPortalStart[r];
+
+    int *cursor = (int *)malloc((roomCount > 0? roomCount : 1)*sizeof(int));
+    for (int r = 0; r < roomCount; r++) cursor[r] = roomPortalStart[r];
+    for (int p = 0; p < portalCount; p++) {
+        for (int side = 0; side < 2; side++) {
+            int r = portals[p].rooms[side];
+            if (r >= 0 && r < roomCount) roomPortals[cursor[r]++] = p;
+        }
+    }
+    free(cursor);
+
+    lightRooms = (int *)malloc((lightCount > 0? lightCount : 1)*sizeof(int));
+    for (int i = 0; i < lightCount; i++) lightRooms[i] = FindLevelRoom(lights[i].position);
+}
+
+//------------------------------------------------------------------------------------
+// Static Geometry Batching
+//------------------------------------------------------------------------------------
+typedef struct StaticBox {
+    Vector3 min;
+    Vector3 max;
+    Color color;
+    Color wireColor;    // Alpha 0 = no edge lines
+} StaticBox;
+
+typedef struct StaticBatch {
+    BoundingBox bounds;
+    int ownedBoxes;     // Boxes whose center lies in this batch's room
+    Mesh mesh;          // Faces, colored per vertex
+    Mesh wireMesh;      // Edges as degenerate triangles
+    int meshCapacity;   // Vertices allocated (and uploaded) per mesh, with headroom for refills
+    int wireCapacity;
+} StaticBatch;
+
+// Boxes behind the batches, kept so edits can rebuild only the batches they touch
+typedef struct StaticScene {
+    StaticBox *boxes;           // Level element order, see MakeStaticBox()
+    unsigned char *faceVisible; // 6 per box
+    int *rooms;                 // MAX_BOX_ROOMS per box: the batches holding it
+    unsigned char *roomCount;
+    int *owner;                 // Batch counting the box in ownedBoxes
+    int *stamp;                 // Per box, dedupes grid queries
+    int *roomSeen;              // Per room, for FindBoxRooms()
+    int seenStamp;
+    int count;
+    UniformGrid grid;           // Boxes by XZ cell, for face culling
+    int *gridItems;
+    int gridCapacity;           // Entries gridItems holds, with headroom for hot reload patches
+    int *batchStart;            // Boxes of batch b: batchBoxes[batchStart[b] .. batchStart[b + 1]]
+    int *batchBoxes;
+    int batchCapacity;
+} StaticScene;
+
+// Level geometry merged once at load: one triangle mesh and one edge mesh per
+// room, plus a last batch for everything outside the rooms. Boxes spanning
+// several rooms (shared walls) are copied into each so any room draws whole.
+StaticBatch *staticBatches = NULL;
+int staticBatchCount = 0;
+Material staticMaterial = { 0 };
+bool staticMeshesUploaded = false;
+int staticHiddenFaces = 0;
+StaticScene staticScene = { 0 };
+
+// Box corners are indexed by bits: 1 = max X, 2 = max Y, 4 = max Z
+static const int boxFaceCorners[6][4] = {
+    {0, 4, 6, 2},   // -X
+    {1, 3, 7, 5},   // +X
+    {0, 1, 5, 4},   // -Y
+    {2, 6, 7, 3},   // +Y
+    {0, 2, 3, 1},   // -Z
+    {4, 5, 7, 6}    // +Z
+};
+
+static float GetAxis(Vector3 v, int axis)
+{
+    return (axis == 0)? v.x : (axis == 1)? v.y : v.z;
+}
+
+static Vector3 GetBoxCorner(const StaticBox *box, int corner)
+{
+    return (Vector3){ (corner & 1)? box->max.x : box->min.x,
+                      (corner & 2)? box->max.y : box->min.y,
+                      (corner & 4)? box->max.z : box->min.z };
+}
+
+// A face is hidden when another box fully covers it and continues past it,
+// e.g. the side of a doorway lintel buried in the neighbouring wall segment.
+// Any such box contains the point just outside the face center, so only the
+// grid cell holding that point needs to be searched.
+static bool IsBoxFaceHidden(const StaticBox *boxes, const UniformGrid *grid, const int *items, int self, int face)
+{
+    const float eps = 0.001f;
+    const StaticBox *box = &boxes[self];
+    int axis = face/2;
+    bool positive = (face % 2) == 1;
+    float plane = positive? GetAxis(box->max, axis) : GetAxis(box->min, axis);
+
+    // Bottom faces resting on the floor are never visible
+    if (face == 2 && plane <= eps) return true;
+
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+
+    Vector3 probe = Vector3Scale(Vector3Add(box->min, box->max), 0.5f);
+    if (axis == 0) probe.x = plane + (positive? eps : -eps);
+    if (axis == 2) probe.z = plane + (positive? eps : -eps);
+
+    int x0, z0, x1, z1;
+    if (!GetGridCellRange(grid, probe.x, probe.z, probe.x, probe.z, &x0, &z0, &x1, &z1)) return false;
+    int cell = z0*grid->cellsX + x0;
+
+    for (int k = grid->cellStart[cell]; k < grid->cellStart[cell + 1]; k++) {
+        int i = items[k];
+        if (i == self) continue;
+        const StaticBox *other = &boxes[i];
+
+        if (GetAxis(other->min, u) > GetAxis(box->min, u) + eps || GetAxis(other->max, u) < GetAxis(box->max, u) - eps) continue;
+        if (GetAxis(other->min, v) > GetAxis(box->min, v) + eps || GetAxis(other->max, v) < GetAxis(box->max, v) - eps) continue;
+
+        if (positive) {
+            if (GetAxis(other->min, axis) <= plane + eps && GetAxis(other->max, axis) > plane + eps) return true;
+        } else {
+            if (GetAxis(other->max, axis) >= plane - eps && GetAxis(other->min, axis) < plane - eps) return true;
+        }
+    }
+
+    return false;
+}
+
+static Mesh AllocStaticMesh(int vertexCount)
+{
+    Mesh mesh = { 0 };
+    mesh.vertexCount = vertexCount;
+    mesh.triangleCount = vertexCount/3;
+    mesh.vertices = (float *)MemAlloc(vertexCount*3*sizeof(float));
+    mesh.texcoords = (float *)MemAlloc(vertexCount*2*sizeof(float));
+    mesh.normals = (float *)MemAlloc(vertexCount*3*sizeof(float));
+    mesh.colors = (unsigned char *)MemAlloc(vertexCount*4*sizeof(unsigned char));
+    return mesh;
+}
+
+static void FreeStaticMesh(Mesh *mesh)
+{
+    if (staticMeshesUploaded) UnloadMesh(*mesh);
+    else {
+        MemFree(mesh->vertices);
+        MemFree(mesh->texcoords);
+        MemFree(mesh->normals);
+        MemFree(mesh->colors);
+    }
+    *mesh = (Mesh){ 0 };
+}
+
+// Baked light of the static geometry, set by LoadLevelLighting() or BakeLevelLighting().
+// Every visible face (in GatherStaticBoxes() order) is split into cells of about
+// LIGHTING_CELL_SIZE units, and the grid corners of each face hold one sample.
+#define LIGHTING_CELL_SIZE 1.0f
+#define LIGHTING_MAX_CELLS 16       // Per face side, bounds the vertex count of huge walls
+#define LIGHTING_FLOOR_HEIGHT 0.01f // Lit floors sit just above the unlit ground plane
+
+typedef struct LevelLighting {
+    Color *samples;         // Light per sample: 128 = full brightness, up to 2x overbright
+    int sampleCount;
+} LevelLighting;
+
+LevelLighting levelLighting = { 0 };
+
+void UnloadLevelLighting(void)
+{
+    free(levelLighting.samples);
+    levelLighting = (LevelLighting){ 0 };
+}
+
+// Cells along the two edges of a face (c0->c1 and c0->c3), 1x1 when there is no lighting
+static void GetFaceCells(const StaticBox *box, int face, bool lit, int *cellsU, int *cellsV)
+{
+    *cellsU = *cellsV = 1;
+    if (!lit) return;
+
+    Vector3 c0 = GetBoxCorner(box, boxFaceCorners[face][0]);
+    float lengthU = Vector3Distance(c0, GetBoxCorner(box, boxFaceCorners[face][1]));
+    float lengthV = Vector3Distance(c0, GetBoxCorner(box, boxFaceCorners[face][3]));
+    *cellsU = (int)Clamp(ceilf(lengthU/LIGHTING_CELL_SIZE), 1.0f, (float)LIGHTING_MAX_CELLS);
+    *cellsV = (int)Clamp(ceilf(lengthV/LIGHTING_CELL_SIZE), 1.0f, (float)LIGHTING_MAX_CELLS);
+}
+
+// Point at (u, v) in [0, 1]^2 across a face
+static Vector3 GetFacePoint(const StaticBox *box, int face, float u, float v)
+{
+    Vector3 c0 = GetBoxCorner(box, boxFaceCorners[face][0]);
+    Vector3 edgeU = Vector3Subtract(GetBoxCorner(box, boxFaceCorners[face][1]), c0);
+    Vector3 edgeV = Vector3Subtract(GetBoxCorner(box, boxFaceCorners[face][3]), c0);
+    return Vector3Add(c0, Vector3Add(Vector3Scale(edgeU, u), Vector3Scale(edgeV, v)));
+}
+
+// Albedo times baked light
+static Color LightColor(Color albedo, Color light)
+{
+    return (Color){ (unsigned char)fminf(albedo.r*light.r/128.0f, 255.0f), (unsigned char)fminf(albedo.g*light.g/128.0f, 255.0f),
+                    (unsigned char)fminf(albedo.b*light.b/128.0f, 255.0f), albedo.a };
+}
+
+static void PushStaticVertex(Mesh *mesh, int *cursor, Vector3 position, Vector3 normal, Color color)
+{
+    int i = *cursor;
+    mesh->vertices[i*3 + 0] = position.x;
+    mesh->vertices[i*3 + 1] = position.y;
+    mesh->vertices[i*3 + 2] = position.z;
+    mesh->normals[i*3 + 0] = normal.x;
+    mesh->normals[i*3 + 1] = normal.y;
+    mesh->normals[i*3 + 2] = normal.z;
+    mesh->colors[i*4 + 0] = color.r;
+    mesh->colors[i*4 + 1] = color.g;
+    mesh->colors[i*4 + 2] = color.b;
+    mesh->colors[i*4 + 3] = color.a;
+    (*cursor)++;
+}
+
+void UnloadStaticScene(StaticScene *scene)
+{
+    free(scene->boxes);
+    free(scene->faceVisible);
+    free(scene->rooms);
+    free(scene->roomCount);
+    free(scene->owner);
+    free(scene->stamp);
+    free(scene->roomSeen);
+    free(scene->gridItems);
+    free(scene->batchStart);
+    free(scene->batchBoxes);
+    UnloadUniformGrid(&scene->grid);
+    *scene = (StaticScene){ 0 };
+}
+
+void UnloadStaticBatches(void)
+{
+    for (int i = 0; i < staticBatchCount; i++) {
+        if (staticBatches[i].mesh.vertices != NULL) FreeStaticMesh(&staticBatches[i].mesh);
+        if (staticBatches[i].wireMesh.vertices != NULL) FreeStaticMesh(&staticBatches[i].wireMesh);
+    }
+    UnloadStaticScene(&staticScene);
+    free(staticBatches);
+    staticBatches = NULL;
+    staticBatchCount = 0;
+    staticMeshesUploaded = false;
+}
+
+static const Vector3 boxFaceNormals[6] = { {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1} };
+
+// Faces go in as one quad each, or as their lighting cells when sampleStart[f] >= 0
+static void PushStaticBox(StaticBatch *batch, int *cursor, int *wireCursor, const StaticBox *box, const unsigned char *faceVisible, const int *sampleStart)
+{
+    for (int f = 0; f < 6; f++) {
+        if (!faceVisible[f]) continue;
+
+        bool lit = sampleStart[f] >= 0;
+        int cellsU, cellsV;
+        GetFaceCells(box, f, lit, &cellsU, &cellsV);
+        for (int b = 0; b < cellsV; b++) {
+            for (int a = 0; a < cellsU; a++) {
+                Vector3 c0 = GetFacePoint(box, f, (float)a/cellsU, (float)b/cellsV);
+                Vector3 c1 = GetFacePoint(box, f, (float)(a + 1)/cellsU, (float)b/cellsV);
+                Vector3 c2 = GetFacePoint(box, f, (float)(a + 1)/cellsU, (float)(b + 1)/cellsV);
+                Vector3 c3 = GetFacePoint(box, f, (float)a/cellsU, (float)(b + 1)/cellsV);
+
+                Color k0 = box->color, k1 = box->color, k2 = box->color, k3 = box->color;
+                if (lit) {
+                    const Color *samples = &levelLighting.samples[sampleStart[f]];
+                    k0 = LightColor(box->color, samples[b*(cellsU + 1) + a]);
+                    k1 = LightColor(box->color, samples[b*(cellsU + 1) + a + 1]);
+                    k2 = LightColor(box->color, samples[(b + 1)*(cellsU + 1) + a + 1]);
+                    k3 = LightColor(box->color, samples[(b + 1)*(cellsU + 1) + a]);
+                }
+
+                PushStaticVertex(&batch->mesh, cursor, c0, boxFaceNormals[f], k0);
+                PushStaticVertex(&batch->mesh, cursor, c1, boxFaceNormals[f], k1);
+                PushStaticVertex(&batch->mesh, cursor, c2, boxFaceNormals[f], k2);
+                PushStaticVertex(&batch->mesh, cursor, c0, boxFaceNormals[f], k0);
+                PushStaticVertex(&batch->mesh, cursor, c2, boxFaceNormals[f], k2);
+                PushStaticVertex(&batch->mesh, cursor, c3, boxFaceNormals[f], k3);
+            }
+        }
+    }
+
+    // Edges are stored as degenerate triangles (a, b, b) and drawn in wire mode
+    if (box->wireColor.a > 0) {
+        for (int corner = 0; corner < 8; corner++) {
+            for (int bit = 1; bit <= 4; bit <<= 1) {
+                if (corner & bit) continue;
+                Vector3 a = GetBoxCorner(box, corner);
+                Vector3 b = GetBoxCorner(box, corner | bit);
+                PushStaticVertex(&batch->wireMesh, wireCursor, a, (Vector3){ 0.0f, 1.0f, 0.0f }, box->wireColor);
+                PushStaticVertex(&batch->wireMesh, wireCursor, b, (Vector3){ 0.0f, 1.0f, 0.0f }, box->wireColor);
+                PushStaticVertex(&batch->wireMesh, wireCursor, b, (Vector3){ 0.0f, 1.0f, 0.0f }, box->wireColor);
+            }
+        }
+    }
+
+    batch->bounds.min = Vector3Min(batch->bounds.min, box->min);
+    batch->bounds.max = Vector3Max(batch->bounds.max, box->max);
+}
+
+// Level box i in element order: walls, pillars, stairs, props, then the room floors
+// (lit levels only)
+static StaticBox MakeStaticBox(int i)
+{
+    if (i < wallCount) {
+        Vector3 half = Vector3Scale(walls[i].size, 0.5f);
+        return (StaticBox){ Vector3Subtract(walls[i].position, half), Vector3Add(walls[i].position, half), walls[i].color, (Color){30, 30, 35, 100} };
+    }
+    i -= wallCount;
+    if (i < pillarCount) {
+        Vector3 min = { pillars[i].position.x - pillars[i].width/2, 0.0f, pillars[i].position.z - pillars[i].width/2 };
+        Vector3 max = { pillars[i].position.x + pillars[i].width/2, pillars[i].height, pillars[i].position.z + pillars[i].width/2 };
+        return (StaticBox){ min, max, CONCRETE_LIGHT, (Color){40, 40, 45, 150} };
+    }
+    i -= pillarCount;
+    if (i < stairCount) {
+        Vector3 half = Vector3Scale(stairs[i].size, 0.5f);
+        return (StaticBox){ Vector3Subtract(stairs[i].position, half), Vector3Add(stairs[i].position, half), CONCRETE_MED, (Color){50, 50, 55, 100} };
+    }
+    i -= stairCount;
+    if (i < propCount) {
+        Vector3 half = Vector3Scale(props[i].size, 0.5f);
+        Color wire = (props[i].type != 4)? (Color){25, 25, 30, 80} : BLANK; // No edges for pipes/cables
+        return (StaticBox){ Vector3Subtract(props[i].position, half), Vector3Add(props[i].position, half), props[i].color, wire };
+    }
+    i -= propCount;
+    Vector3 min = { rooms[i].bounds.min.x, 0.0f, rooms[i].bounds.min.z };
+    Vector3 max = { rooms[i].bounds.max.x, LIGHTING_FLOOR_HEIGHT, rooms[i].bounds.max.z };
+    return (StaticBox){ min, max, FLOOR_COLOR, BLANK };
+}
+
+static void BuildStaticBoxGrid(StaticScene *scene)
+{
+    BoundingBox *bounds = (BoundingBox *)calloc((scene->count > 0? scene->count : 1), sizeof(BoundingBox));
+    for (int i = 0; i < scene->count; i++) bounds[i] = (BoundingBox){ scene->boxes[i].min, scene->boxes[i].max };
+    scene->gridItems = BuildGridBuckets(&scene->grid, bounds, scene->count);
+    free(bounds);
+
+    int entries = (scene->grid.cellStart != NULL)? scene->grid.cellStart[scene->grid.cellsX*scene->grid.cellsZ] : 0;
+    scene->gridCapacity = entries + entries/4 + 64;
+    scene->gridItems = (int *)realloc(scene->gridItems, scene->gridCapacity*sizeof(int));
+}
+
+// Walls, pillars, stairs and props as boxes, plus a floor slab per room when withFloors,
+// with their visible faces (6 flags per box) and the grid used to cull them.
+// Needs BuildRoomIndex().
+void GatherStaticBoxes(StaticScene *scene, bool withFloors)
+{
+    UnloadStaticScene(scene);
+    scene->count = wallCount + pillarCount + stairCount + propCount + (withFloors? roomCount : 0);
+    scene->boxes = (StaticBox *)malloc((scene->count > 0? scene->count : 1)*sizeof(StaticBox));
+    for (int i = 0; i < scene->count; i++) scene->boxes[i] = MakeStaticBox(i);
+
+    // Cull hidden faces
+    BuildStaticBoxGrid(scene);
+    scene->faceVisible = (unsigned char *)malloc((scene->count > 0? scene->count : 1)*6);
+    staticHiddenFaces = 0;
+    for (int i = 0; i < scene->count; i++) {
+        for (int f = 0; f < 6; f++) {
+            scene->faceVisible[i*6 + f] = !IsBoxFaceHidden(scene->boxes, &scene->grid, scene->gridItems, i, f);
+            if (!scene->faceVisible[i*6 + f]) staticHiddenFaces++;
+        }
+    }
+}
+
+// Batches box i is copied into (its rooms, or the outside batch) and the batch owning it
+static void AssignStaticBoxRooms(StaticScene *scene, int i)
+{
+    const StaticBox *box = &scene->boxes[i];
+    int *out = &scene->rooms[i*MAX_BOX_ROOMS];
+    int count = FindBoxRooms((BoundingBox){ box->min, box->max }, scene->seenStamp++, scene->roomSeen, out);
+    if (count == 0) out[count++] = roomCount;
+    scene->roomCount[i] = (unsigned char)count;
+
+    int owner = FindLevelRoom(Vector3Scale(Vector3Add(box->min, box->max), 0.5f));
+    scene->owner[i] = (owner >= 0)? owner : roomCount;
+}
+
+// Use vertexCount vertices of a batch mesh; false when they outgrow its capacity
+static bool ReserveStaticMesh(Mesh *mesh, int capacity, int vertexCount)
+{
+    if (vertexCount > capacity) return false;
+    mesh->vertexCount = vertexCount;
+    mesh->triangleCount = vertexCount/3;
+    return true;
+}
+
+// Merge walls, pillars, stairs and props into the per-room batches (CPU side only).
+// With baked lighting the faces are split into their lit cells and rooms get floors.
+// The box list stays in staticScene for RefreshStaticBoxes().
+void BuildStaticBatches(void)
+{
+    UnloadStaticBatches();
+    BuildRoomIndex();
+
+    StaticScene *scene = &staticScene;
+    bool lit = levelLighting.samples != NULL;
+    GatherStaticBoxes(scene, lit);
+    int boxCount = scene->count;
+    const StaticBox *boxes = scene->boxes;
+
+    // Sample ranges of the lit faces, and the quads every face becomes
+    int *sampleStart = (int *)malloc((boxCount > 0? boxCount*6 : 1)*sizeof(int));
+    int *boxQuads = (int *)malloc((boxCount > 0? boxCount : 1)*sizeof(int));
+    int samples = 0;
+    for (int i = 0; i < boxCount; i++) {
+        boxQuads[i] = 0;
+        for (int f = 0; f < 6; f++) {
+            sampleStart[i*6 + f] = -1;
+            if (!scene->faceVisible[i*6 + f]) continue;
+
+            int cellsU, cellsV;
+            GetFaceCells(&boxes[i], f, lit, &cellsU, &cellsV);
+            boxQuads[i] += cellsU*cellsV;
+            if (lit) {
+                sampleStart[i*6 + f] = samples;
+                samples += (cellsU + 1)*(cellsV + 1);
+            }
+        }
+    }
+    if (lit && samples != levelLighting.sampleCount) {
+        TraceLog(LOG_WARNING, "LIGHTING: Baked lighting has %d samples, the level needs %d; drawing unlit", levelLighting.sampleCount, samples);
+        free(sampleStart);
+        free(boxQuads);
+        UnloadLevelLighting();
+        BuildStaticBatches();
+        return;
+    }
+
+    // Find the rooms of every box
+    scene->rooms = (int *)malloc((boxCount > 0? boxCount*MAX_BOX_ROOMS : 1)*sizeof(int));
+    scene->roomCount = (unsigned char *)malloc((boxCount > 0? boxCount : 1));
+    scene->owner = (int *)malloc((boxCount > 0? boxCount : 1)*sizeof(int));
+    scene->stamp = (int *)calloc((boxCount > 0? boxCount : 1), sizeof(int));
+    scene->roomSeen = (int *)malloc((roomCount > 0? roomCount : 1)*sizeof(int));
+    for (int r = 0; r < roomCount; r++) scene->roomSeen[r] = -1;
+
+    staticBatchCount = roomCount + 1;
+    staticBatches = (StaticBatch *)calloc(staticBatchCount, sizeof(StaticBatch));
+    int *batchQuads = (int *)calloc(staticBatchCount, sizeof(int));
+    int *batchEdges = (int *)calloc(staticBatchCount, sizeof(int));
+    int *batchCursor = (int *)calloc(staticBatchCount, sizeof(int));
+    int *wireCursor = (int *)calloc(staticBatchCount, sizeof(int));
+
+    scene->batchStart = (int *)calloc(staticBatchCount + 1, sizeof(int));
+    for (int i = 0; i < boxCount; i++) {
+        AssignStaticBoxRooms(scene, i);
+        for (int k = 0; k < scene->roomCount[i]; k++) {
+            int b = scene->rooms[i*MAX_BOX_ROOMS + k];
+            batchQuads[b] += boxQuads[i];
+            if (boxes[i].wireColor.a > 0) batchEdges[b] += 12;
+            scene->batchStart[b + 1]++;
+        }
+        staticBatches[scene->owner[i]].ownedBoxes++;
+    }
+
+    // Box lists per batch, ascending, with headroom for RefreshStaticBoxes()
+    for (int b = 0; b < staticBatchCount; b++) scene->batchStart[b + 1] += scene->batchStart[b];
+    int listed = scene->batchStart[staticBatchCount];
+    scene->batchCapacity = listed + listed/4 + 64;
+    scene->batchBoxes = (int *)malloc(scene->batchCapacity*sizeof(int));
+    for (int b = 0; b < staticBatchCount; b++) batchCursor[b] = scene->batchStart[b];
+    for (int i = 0; i < boxCount; i++) {
+        for (int k = 0; k < scene->roomCount[i]; k++) scene->batchBoxes[batchCursor[scene->rooms[i*MAX_BOX_ROOMS + k]]++] = i;
+    }
+
+    // Unlit batches are refilled in place on hot reload, so their meshes get room to
+    // grow by a quarter plus a few boxes (6 quads or 12 edges each)
+    for (int b = 0; b < staticBatchCount; b++) {
+        StaticBatch *batch = &staticBatches[b];
+        int vertices = batchQuads[b]*6, wireVertices = batchEdges[b]*3;
+        batch->bounds = (BoundingBox){ { 1e30f, 1e30f, 1e30f }, { -1e30f, -1e30f, -1e30f } };
+        batch->meshCapacity = vertices + (lit? 0 : vertices/4 + 4*36);
+        batch->wireCapacity = wireVertices + (lit? 0 : wireVertices/4 + 4*36);
+        if (batch->meshCapacity > 0) batch->mesh = AllocStaticMesh(batch->meshCapacity);
+        if (batch->wireCapacity > 0) batch->wireMesh = AllocStaticMesh(batch->wireCapacity);
+        ReserveStaticMesh(&batch->mesh, batch->meshCapacity, vertices);
+        ReserveStaticMesh(&batch->wireMesh, batch->wireCapacity, wireVertices);
+        batchCursor[b] = 0;
+    }
+
+    for (int i = 0; i < boxCount; i++) {
+        for (int k = 0; k < scene->roomCount[i]; k++) {
+            int b = scene->rooms[i*MAX_BOX_ROOMS + k];
+            PushStaticBox(&staticBatches[b], &batchCursor[b], &wireCursor[b], &boxes[i], &scene->faceVisible[i*6], &sampleStart[i*6]);
+        }
+    }
+
+    free(sampleStart);
+    free(boxQuads);
+    free(batchQuads);
+    free(batchEdges);
+    free(batchCursor);
+    free(wireCursor);
+}
+
+// Upload a batch mesh with room for its whole capacity, so refills can update it in place
+static void UploadStaticMesh(Mesh *mesh, int capacity)
+{
+    int vertexCount = mesh->vertexCount;
+    mesh->vertexCount = capacity;
+    mesh->triangleCount = capacity/3;
+    UploadMesh(mesh, false);
+    mesh->vertexCount = vertexCount;
+    mesh->triangleCount = vertexCount/3;
+}
+
+// Send the baked meshes to the GPU (requires a window)
+void UploadStaticBatches(void)
+{
+    if (staticMeshesUploaded) return;
+
+    for (int i = 0; i < staticBatchCount; i++) {
+        if (staticBatches[i].mesh.vertices != NULL) UploadStaticMesh(&staticBatches[i].mesh, staticBatches[i].meshCapacity);
+        if (staticBatches[i].wireMesh.vertices != NULL) UploadStaticMesh(&staticBatches[i].wireMesh, staticBatches[i].wireCapacity);
+    }
+    if (staticMaterial.maps == NULL) staticMaterial = LoadMaterialDefault();
+
+    staticMeshesUploaded = true;
+}
+
+// Send a refilled batch mesh to the GPU: in place when its buffers exist, else a fresh upload
+static void SyncStaticMesh(Mesh *mesh, int capacity)
+{
+    if (!staticMeshesUploaded || mesh->vertexCount == 0) return;
+    if (mesh->vaoId == 0) {
+        UploadStaticMesh(mesh, capacity);
+        return;
+    }
+    UpdateMeshBuffer(*mesh, 0, mesh->vertices, mesh->vertexCount*3*sizeof(float), 0);
+    UpdateMeshBuffer(*mesh, 2, mesh->normals, mesh->vertexCount*3*sizeof(float), 0);
+    UpdateMeshBuffer(*mesh, 3, mesh->colors, mesh->vertexCount*4*sizeof(unsigned char), 0);
+}
+
+// Rebuild one batch from the boxes assigned to it (unlit levels); false when it
+// outgrows the mesh headroom
+static bool RefillStaticBatch(int b)
+{
+    const StaticScene *scene = &staticScene;
+    StaticBatch *batch = &staticBatches[b];
+    static const int unlit[6] = { -1, -1, -1, -1, -1, -1 };
+    const int *batchBoxes = &scene->batchBoxes[scene->batchStart[b]];
+    int boxCount = scene->batchStart[b + 1] - scene->batchStart[b];
+
+    int quads = 0, edges = 0;
+    for (int k = 0; k < boxCount; k++) {
+        int i = batchBoxes[k];
+        for (int f = 0; f < 6; f++) quads += scene->faceVisible[i*6 + f];
+        if (scene->boxes[i].wireColor.a > 0) edges += 12;
+    }
+
+    if (!ReserveStaticMesh(&batch->mesh, batch->meshCapacity, quads*6) || !ReserveStaticMesh(&batch->wireMesh, batch->wireCapacity, edges*3)) return false;
+    batch->bounds = (BoundingBox){ { 1e30f, 1e30f, 1e30f }, { -1e30f, -1e30f, -1e30f } };
+
+    int cursor = 0, wireCursor = 0;
+    for (int k = 0; k < boxCount; k++) {
+        int i = batchBoxes[k];
+        PushStaticBox(batch, &cursor, &wireCursor, &scene->boxes[i], &scene->faceVisible[i*6], unlit);
+    }
+
+    SyncStaticMesh(&batch->mesh, batch->meshCapacity);
+    SyncStaticMesh(&batch->wireMesh, batch->wireCapacity);
+    return true;
+}
+
+static void MarkStaticBoxBatches(const StaticScene *scene, int i, unsigned char *dirtyBatches)
+{
+    for (int k = 0; k < scene->roomCount[i]; k++) dirtyBatches[scene->rooms[i*MAX_BOX_ROOMS + k]] = 1;
+}
+
+// Re-read the given level boxes (element order) after an edit and rebuild only the
+// batches holding them or a neighbour whose hidden faces changed. Boxes that change
+// cells or rooms are spliced into the box grid and the batch box lists like the
+// collision grid. oldBounds is scratch for changedCount boxes, dirtyBatches for
+// staticBatchCount flags. False when the batches must be rebuilt instead (baked
+// lighting, the element counts changed, a box left the grid, or the patch outgrows
+// the scratch or headroom).
+bool RefreshStaticBoxes(const int *changed, int changedCount, BoundingBox *oldBounds, unsigned char *dirtyBatches, GridPatchScratch *scratch)
+{
+    StaticScene *scene = &staticScene;
+    if (levelLighting.samples != NULL || scene->rooms == NULL || scene->count != wallCount + pillarCount + stairCount + propCount) return false;
+
+    memset(dirtyBatches, 0, staticBatchCount);
+
+    // Boxes that change cells leave their old grid cells and join their new ones
+    scratch->editCount = 0;
+    for (int c = 0; c < changedCount; c++) {
+        int i = changed[c];
+        oldBounds[c] = (BoundingBox){ scene->boxes[i].min, scene->boxes[i].max };
+        scene->boxes[i] = MakeStaticBox(i);
+        BoundingBox now = { scene->boxes[i].min, scene->boxes[i].max };
+        if (!IsBoxInGrid(&scene->grid, now)) return false;
+        if (!IsSameGridCellRange(&scene->grid, oldBounds[c], now) &&
+            (!AddGridBoxEdits(scratch, &scene->grid, oldBounds[c], i, 0) || !AddGridBoxEdits(scratch, &scene->grid, now, i, 1))) return false;
+
+        MarkStaticBoxBatches(scene, i, dirtyBatches);
+        staticBatches[scene->owner[i]].ownedBoxes--;
+    }
+    int cellCount = scene->grid.cellsX*scene->grid.cellsZ;
+    if (!PlanGridPatch(scene->grid.cellStart, scene->gridItems, scratch) ||
+        !ApplyGridPatch(scene->grid.cellStart, cellCount, scene->gridItems, scene->gridCapacity, scratch)) return false;
+
+    // Then they move between the box lists of the batches they left and joined
+    scratch->editCount = 0;
+    for (int c = 0; c < changedCount; c++) {
+        int i = changed[c];
+        for (int k = 0; k < scene->roomCount[i]; k++) {
+            if (!AddGridEdit(scratch, scene->rooms[i*MAX_BOX_ROOMS + k], i, 0)) return false;
+        }
+        AssignStaticBoxRooms(scene, i);
+        for (int k = 0; k < scene->roomCount[i]; k++) {
+            if (!AddGridEdit(scratch, scene->rooms[i*MAX_BOX_ROOMS + k], i, 1)) return false;
+        }
+        MarkStaticBoxBatches(scene, i, dirtyBatches);
+        staticBatches[scene->owner[i]].ownedBoxes++;
+    }
+    if (!PlanGridPatch(scene->batchStart, scene->batchBoxes, scratch) ||
+        !ApplyGridPatch(scene->batchStart, staticBatchCount, scene->batchBoxes, scene->batchCapacity, scratch)) return false;
+
+    // Faces of the changed boxes and of every box touching their old or new place
+    static int stamp = 0;
+    stamp++;
+    const float eps = 0.01f;
+    for (int c = 0; c < changedCount; c++) {
+        const StaticBox *box = &scene->boxes[changed[c]];
+        BoundingBox region = { Vector3SubtractValue(Vector3Min(oldBounds[c].min, box->min), eps), Vector3AddValue(Vector3Max(oldBounds[c].max, box->max), eps) };
+
+        int x0, z0, x1, z1;
+        if (!GetGridCellRange(&scene->grid, region.min.x, region.min.z, region.max.x, region.max.z, &x0, &z0, &x1, &z1)) continue;
+        for (int z = z0; z <= z1; z++) {
+            for (int x = x0; x <= x1; x++) {
+                int cell = z*scene->grid.cellsX + x;
+                for (int k = scene->grid.cellStart[cell]; k < scene->grid.cellStart[cell + 1]; k++) {
+                    int j = scene->gridItems[k];
+                    if (scene->stamp[j] == stamp) continue;
+                    scene->stamp[j] = stamp;
+                    const StaticBox *other = &scene->boxes[j];
+                    if (other->min.x > region.max.x || other->max.x < region.min.x || other->min.y > region.max.y ||
+                        other->max.y < region.min.y || other->min.z > region.max.z || other->max.z < region.min.z) continue;
+
+                    bool facesChanged = false;
+                    for (int f = 0; f < 6; f++) {
+                        unsigned char visible = !IsBoxFaceHidden(scene->boxes, &scene->grid, scene->gridItems, j, f);
+                        if (visible == scene->faceVisible[j*6 + f]) continue;
+                        staticHiddenFaces += visible? -1 : 1;
+                        scene->faceVisible[j*6 + f] = visible;
+                        facesChanged = true;
+                    }
+                    if (facesChanged) MarkStaticBoxBatches(scene, j, dirtyBatches);
+                }
+            }
+        }
+    }
+
+    for (int b = 0; b < staticBatchCount; b++) {
+        if (dirtyBatches[b] && !RefillStaticBatch(b)) return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Visibility Culling
+//------------------------------------------------------------------------------------
+// Once per frame: flood from the camera's room through every portal inside the
+// view frustum, then frustum-test the batches, lights and enemies of the rooms
+// reached. With the camera outside every room, all rooms are candidates.
+typedef struct Frustum {
+    Vector4 planes[6];      // ax + by + cz + d >= 0 inside
+} Frustum;
+
+typedef struct LevelVisibility {
+    Frustum frustum;
+    unsigned char *roomVisible;     // roomCount + 1 entries, last = outside every room
+    unsigned char *batchVisible;    // Per static batch, after the frustum test
+    unsigned char *lightVisible;
+    int *queue;
+    int roomCapacity;
+    int lightCapacity;
+    int cameraRoom;
+    int visibleRooms;
+    int culledObjects;              // Static boxes, lights and enemies skipped this frame
+    int totalObjects;
+} LevelVisibility;
+
+LevelVisibility levelVisibility = { 0 };
+
+// Gribb-Hartmann plane extraction from the same projection BeginMode3D() uses
+Frustum GetCameraFrustum(Camera camera, float aspect)
+{
+    Matrix view = MatrixLookAt(camera.position, camera.target, camera.up);
+    Matrix projection = MatrixPerspective(camera.fovy*DEG2RAD, aspect, 0.01, 1000.0);
+    Matrix m = MatrixMultiply(view, projection);
+
+    Frustum frustum;
+    frustum.planes[0] = (Vector4){ m.m3 + m.m0, m.m7 + m.m4, m.m11 + m.m8, m.m15 + m.m12 };   // Left
+    frustum.planes[1] = (Vector4){ m.m3 - m.m0, m.m7 - m.m4, m.m11 - m.m8, m.m15 - m.m12 };   // Right
+    frustum.planes[2] = (Vector4){ m.m3 + m.m1, m.m7 + m.m5, m.m11 + m.m9, m.m15 + m.m13 };   // Bottom
+    frustum.planes[3] = (Vector4){ m.m3 - m.m1, m.m7 - m.m5, m.m11 - m.m9, m.m15 - m.m13 };   // Top
+    frustum.planes[4] = (Vector4){ m.m3 + m.m2, m.m7 + m.m6, m.m11 + m.m10, m.m15 + m.m14 };  // Near
+    frustum.planes[5] = (Vector4){ m.m3 - m.m2, m.m7 - m.m6, m.m11 - m.m10, m.m15 - m.m14 };  // Far
+    return frustum;
+}
+
+// Conservative: false only when the box is fully behind one plane
+bool FrustumIntersectsBox(const Frustum *frustum, BoundingBox box)
+{
+    for (int i = 0; i < 6; i++) {
+        Vector4 p = frustum->planes[i];
+        Vector3 corner = { (p.x >= 0.0f)? box.max.x : box.min.x, (p.y >= 0.0f)? box.max.y : box.min.y, (p.z >= 0.0f)? box.max.z : box.min.z };
+        if (p.x*corner.x + p.y*corner.y + p.z*corner.z + p.w < 0.0f) return false;
+    }
+    return true;
+}
+
+void UnloadLevelVisibility(void)
+{
+    free(levelVisibility.roomVisible);
+    free(levelVisibility.batchVisible);
+    free(levelVisibility.lightVisible);
+    free(levelVisibility.queue);
+    levelVisibility = (LevelVisibility){ 0 };
+}
+
+static BoundingBox GetLightBounds(int i)
+{
+    // Fixture plus the glow quad hanging below it
+    Vector3 p = lights[i].position;
+    return (BoundingBox){ { p.x - 1.0f, p.y - 1.6f, p.z - 1.0f }, { p.x + 1.0f, p.y + 0.1f, p.z + 1.0f } };
+}
+
+void UpdateLevelVisibility(Camera camera, float aspect)
+{
+    PROFILE_SCOPE(PROFILE_VISIBILITY);
+    LevelVisibility *vis = &levelVisibility;
+
+    if (vis->roomCapacity < roomCount + 1) {
+        free(vis->roomVisible);
+        free(vis->batchVisible);
+        free(vis->queue);
+        vis->roomCapacity = roomCount + 1;
+        vis->roomVisible = (unsigned char *)malloc(vis->roomCapacity);
+        vis->batchVisible = (unsigned char *)malloc(vis->roomCapacity);
+        vis->queue = (int *)malloc(vis->roomCapacity*sizeof(int));
+    }
+    if (vis->lightCapacity < lightCount) {
+        free(vis->lightVisible);
+        vis->lightCapacity = lightCount;
+        vis->lightVisible = (unsigned char *)malloc(vis->lightCapacity);
+    }
+
+    vis->frustum = GetCameraFrustum(camera, aspect);
+    vis->cameraRoom = FindLevelRoom(camera.position);
+    vis->culledObjects = 0;
+    vis->totalObjects = wallCount + pillarCount + stairCount + propCount + lightCount;
+
+    // Portal flood from the camera room
+    memset(vis->roomVisible, (vis->cameraRoom < 0)? 1 : 0, roomCount + 1);
+    vis->roomVisible[roomCount] = 1;
+    if (vis->cameraRoom >= 0) {
+        int head = 0, tail = 0;
+        vis->roomVisible[vis->cameraRoom] = 1;
+        vis->queue[tail++] = vis->cameraRoom;
+        while (head < tail) {
+            int r = vis->queue[head++];
+            for (int k = roomPortalStart[r]; k < roomPortalStart[r + 1]; k++) {
+                const LevelPortal *portal = &portals[roomPortals[k]];
+                int next = (portal->rooms[0] == r)? portal->rooms[1] : portal->rooms[0];
+                if (next < 0 || next >= roomCount || vis->roomVisible[next]) continue;
+                if (!FrustumIntersectsBox(&vis->frustum, portal->bounds)) continue;
+                vis->roomVisible[next] = 1;
+                vis->queue[tail++] = next;
+            }
+        }
+    }
+
+    vis->visibleRooms = 0;
+    for (int r = 0; r < roomCount; r++) vis->visibleRooms += vis->roomVisible[r];
+
+    for (int b = 0; b < staticBatchCount; b++) {
+        const StaticBatch *batch = &staticBatches[b];
+        vis->batchVisible[b] = vis->roomVisible[b] && (batch->mesh.vertexCount + batch->wireMesh.vertexCount > 0) &&
+                               FrustumIntersectsBox(&vis->frustum, batch->bounds);
+        if (!vis->batchVisible[b]) vis->culledObjects += batch->ownedBoxes;
+    }
+
+    for (int i = 0; i < lightCount; i++) {
+        int room = (lightRooms[i] >= 0)? lightRooms[i] : roomCount;
+        vis->lightVisible[i] = vis->roomVisible[room] && FrustumIntersectsBox(&vis->frustum, GetLightBounds(i));
+        if (!vis->lightVisible[i]) vis->culledObjects++;
+    }
+}
+
+// Visibility test for dynamic objects (enemies), counted in the culled total
+bool IsLevelBoxVisible(BoundingBox box)
+{
+    LevelVisibility *vis = &levelVisibility;
+    vis->totalObjects++;
+
+    int room = FindLevelRoom(Vector3Scale(Vector3Add(box.min, box.max), 0.5f));
+    if (vis->roomVisible[(room >= 0)? room : roomCount] && FrustumIntersectsBox(&vis->frustum, box)) return true;
+
+    vis->culledObjects++;
+    return false;
+}
+
+//------------------------------------------------------------------------------------
+// Collision Index
+//------------------------------------------------------------------------------------
+typedef enum {
+    COLLIDER_WALL   = 1 << 0,
+    COLLIDER_PILLAR = 1 << 1,
+    COLLIDER_STAIR  = 1 << 2,
+    COLLIDER_PROP   = 1 << 3,   // Large crates, block movement
+    COLLIDER_DETAIL = 1 << 4,   // Tables, shelves, debris, beams: stop bullets only
+    COLLIDER_ENEMY  = 1 << 5    // Enemy hitboxes (EnemyStore), never in the level grid
+} ColliderKind;
+
+// What each mover collides with
+#define COLLIDE_PLAYER (COLLIDER_WALL | COLLIDER_PILLAR | COLLIDER_PROP)
+#define COLLIDE_BULLET (COLLIDER_WALL | COLLIDER_PILLAR | COLLIDER_STAIR | COLLIDER_PROP | COLLIDER_DETAIL)
+
+typedef struct LevelCollider {
+    Vector3 position;   // Box center
+    Vector3 size;
+    int kind;           // ColliderKind
+    int index;          // Index into walls, pillars, stairs or props
+} LevelCollider;
+
+// Structure-of-arrays min/max box store for the batch kernels. Boxes are copied
+// cell by cell so every cell is one contiguous run; the arrays are padded so
+// SIMD loads may run past the last entry.
+typedef struct LevelBoxSoA {
+    float *minX, *minY, *minZ;
+    float *maxX, *maxY, *maxZ;
+    int *kind;          // ColliderKind, 0 for padding
+    int *collider;      // Index into levelColliders
+    int count;
+} LevelBoxSoA;
+
+#define BOX_SOA_PADDING 8
+
+LevelCollider *levelColliders = NULL;
+int levelColliderCount = 0;
+int *elementColliders = NULL;           // Collider of each level element (walls, pillars, stairs, props), -1 if none
+UniformGrid collisionGrid = { 0 };     // Bucket entries are the collisionBoxes
+LevelBoxSoA collisionBoxes = { 0 };
+int collisionBoxCapacity = 0;           // Entries allocated, with headroom for hot reload patches
+
+void AllocLevelBoxSoA(LevelBoxSoA *boxes, int count)
+{
+    int n = count + BOX_SOA_PADDING;
+    boxes->minX = (float *)calloc(n, sizeof(float));
+    boxes->minY = (float *)calloc(n, sizeof(float));
+    boxes->minZ = (float *)calloc(n, sizeof(float));
+    boxes->maxX = (float *)calloc(n, sizeof(float));
+    boxes->maxY = (float *)calloc(n, sizeof(float));
+    boxes->maxZ = (float *)calloc(n, sizeof(float));
+    boxes->kind = (int *)calloc(n, sizeof(int));
+    boxes->collider = (int *)calloc(n, sizeof(int));
+    boxes->count = count;
+}
+
+void FreeLevelBoxSoA(LevelBoxSoA *boxes)
+{
+    free(boxes->minX); free(boxes->minY); free(boxes->minZ);
+    free(boxes->maxX); free(boxes->maxY); free(boxes->maxZ);
+    free(boxes->kind);
+    free(boxes->collider);
+    *boxes = (LevelBoxSoA){ 0 };
+}
+
+void SetLevelBox(LevelBoxSoA *boxes, int k, const LevelCollider *c, int collider)
+{
+    boxes->minX[k] = c->position.x - c->size.x/2;
+    boxes->minY[k] = c->position.y - c->size.y/2;
+    boxes->minZ[k] = c->position.z - c->size.z/2;
+    boxes->maxX[k] = c->position.x + c->size.x/2;
+    boxes->maxY[k] = c->position.y + c->size.y/2;
+    boxes->maxZ[k] = c->position.z + c->size.z/2;
+    boxes->kind[k] = c->kind;
+    boxes->collider[k] = collider;
+}
+
+// Collider of level element e (walls, pillars, stairs, props in order); false if it has none
+static bool GetElementCollider(int e, LevelCollider *c)
+{
+    if (e < wallCount) {
+        *c = (LevelCollider){ walls[e].position, walls[e].size, COLLIDER_WALL, e };
+        return true;
+    }
+    e -= wallCount;
+    if (e < pillarCount) {
+        Vector3 pillarBox = {pillars[e].position.x, pillars[e].height/2, pillars[e].position.z};
+        Vector3 pillarSize = {pillars[e].width, pillars[e].height, pillars[e].width};
+        *c = (LevelCollider){ pillarBox, pillarSize, COLLIDER_PILLAR, e };
+        return true;
+    }
+    e -= pillarCount;
+    if (e < stairCount) {
+        *c = (LevelCollider){ stairs[e].position, stairs[e].size, COLLIDER_STAIR, e };
+        return true;
+    }
+    e -= stairCount;
+    if (props[e].type == 0 && props[e].size.x > 1.0f) { // Only large crates
+        *c = (LevelCollider){ props[e].position, props[e].size, COLLIDER_PROP, e };
+        return true;
+    }
+    if (props[e].type != 4) { // Pipes and cables are too thin to matter
+        *c = (LevelCollider){ props[e].position, props[e].size, COLLIDER_DETAIL, e };
+        return true;
+    }
+    return false;
+}
+
+static BoundingBox GetColliderBounds(const LevelCollider *c)
+{
+    Vector3 half = Vector3Scale(c->size, 0.5f);
+    return (BoundingBox){ Vector3Subtract(c->position, half), Vector3Add(c->position, half) };
+}
+
+// Build the static collision index from the level arrays
+void BuildCollisionGrid(void)
+{
+    free(levelColliders);
+    free(elementColliders);
+    UnloadUniformGrid(&collisionGrid);
+    FreeLevelBoxSoA(&collisionBoxes);
+
+    int elementCount = wallCount + pillarCount + stairCount + propCount;
+    levelColliders = (LevelCollider *)malloc((elementCount + 1)*sizeof(LevelCollider));
+    elementColliders = (int *)malloc((elementCount + 1)*sizeof(int));
+    levelColliderCount = 0;
+
+    for (int e = 0; e < elementCount; e++) {
+        elementColliders[e] = GetElementCollider(e, &levelColliders[levelColliderCount])? levelColliderCount++ : -1;
+    }
+
+    // Bucket the colliders and copy them cell by cell into the SoA store
+    BoundingBox *bounds = (BoundingBox *)malloc((levelColliderCount + 1)*sizeof(BoundingBox));
+    for (int i = 0; i < levelColliderCount; i++) bounds[i] = GetColliderBounds(&levelColliders[i]);
+
+    int *items = BuildGridBuckets(&collisionGrid, bounds, levelColliderCount);
+    int entries = (items != NULL)? collisionGrid.cellStart[collisionGrid.cellsX*collisionGrid.cellsZ] : 0;
+    collisionBoxCapacity = entries + entries/4 + 64;
+    AllocLevelBoxSoA(&collisionBoxes, collisionBoxCapacity);
+    collisionBoxes.count = entries;
+    for (int k = 0; k < entries; k++) SetLevelBox(&collisionBoxes, k, &levelColliders[items[k]], items[k]);
+
+    free(items);
+    free(bounds);
+}
+
+static void MoveCollisionEntries(void *entries, int from, int to, int count)
+{
+    LevelBoxSoA *boxes = (LevelBoxSoA *)entries;
+    memmove(&boxes->minX[to], &boxes->minX[from], count*sizeof(float));
+    memmove(&boxes->minY[to], &boxes->minY[from], count*sizeof(float));
+    memmove(&boxes->minZ[to], &boxes->minZ[from], count*sizeof(float));
+    memmove(&boxes->maxX[to], &boxes->maxX[from], count*sizeof(float));
+    memmove(&boxes->maxY[to], &boxes->maxY[from], count*sizeof(float));
+    memmove(&boxes->maxZ[to], &boxes->maxZ[from], count*sizeof(float));
+    memmove(&boxes->kind[to], &boxes->kind[from], count*sizeof(int));
+    memmove(&boxes->collider[to], &boxes->collider[from], count*sizeof(int));
+}
+
+// Re-read the colliders of the given level elements after an edit. A collider that
+// keeps its cells is rewritten where it stands; one that changes cells leaves its old
+// cells and joins its new ones, and only those cells are refilled while the entries
+// between them move as blocks (the same splice as the ground heightfield). oldBounds
+// (scratch, changedCount entries) receives each element's previous collider bounds,
+// empty if it had none. False when the grid must be rebuilt instead: a collider
+// appeared, vanished or left the grid, or the patch outgrows the scratch or headroom.
+bool RefreshLevelColliders(const int *changed, int changedCount, BoundingBox *oldBounds, GridPatchScratch *scratch)
+{
+    if (elementColliders == NULL) return false;
+
+    scratch->editCount = 0;
+    for (int k = 0; k < changedCount; k++) {
+        int c = elementColliders[changed[k]];
+        LevelCollider collider;
+        bool exists = GetElementCollider(changed[k], &collider);
+        if ((c >= 0) != exists) return false;
+        oldBounds[k] = (BoundingBox){ 0 };
+        if (c < 0) continue;
+
+        oldBounds[k] = GetColliderBounds(&levelColliders[c]);
+        BoundingBox now = GetColliderBounds(&collider);
+        if (!IsBoxInGrid(&collisionGrid, now)) return false;
+        if (IsSameGridCellRange(&collisionGrid, oldBounds[k], now)) continue;
+        if (!AddGridBoxEdits(scratch, &collisionGrid, oldBounds[k], c, 0) || !AddGridBoxEdits(scratch, &collisionGrid, now, c, 1)) return false;
+    }
+
+    // New colliders of every touched cell, before the grid changes
+    if (!PlanGridPatch(collisionGrid.cellStart, collisionBoxes.collider, scratch)) return false;
+    int cellCount = collisionGrid.cellsX*collisionGrid.cellsZ;
+    int total = collisionGrid.cellStart[cellCount];
+    int delta = GetGridPatchDelta(scratch);
+    if (total + delta > collisionBoxCapacity) return false;
+
+    for (int k = 0; k < changedCount; k++) {
+        int c = elementColliders[changed[k]];
+        if (c >= 0) GetElementCollider(changed[k], &levelColliders[c]);
+    }
+
+    // Splice the touched cells in; the entries past the end are padding again
+    MoveCsrRuns(collisionGrid.cellStart, total, scratch->cells, scratch->shift, scratch->groups, MoveCollisionEntries, &collisionBoxes);
+    for (int g = 0; g < scratch->groups; g++) {
+        int begin = (g > 0)? scratch->ends[g - 1] : 0;
+        int start = collisionGrid.cellStart[scratch->cells[g]] + ((g > 0)? scratch->shift[g - 1] : 0);
+        for (int k = begin; k < scratch->ends[g]; k++) SetLevelBox(&collisionBoxes, start + k - begin, &levelColliders[scratch->items[k]], scratch->items[k]);
+    }
+    ShiftCsrStarts(collisionGrid.cellStart, cellCount, scratch->cells, scratch->shift, scratch->groups);
+    for (int k = total + delta; k < total; k++) collisionBoxes.kind[k] = 0;
+    collisionBoxes.count = total + delta;
+
+    // Every grid cell a collider covers holds a copy in the SoA store
+    for (int k = 0; k < changedCount; k++) {
+        int c = elementColliders[changed[k]];
+        if (c < 0) continue;
+
+        int x0, z0, x1, z1;
+        BoundingBox bounds = GetColliderBounds(&levelColliders[c]);
+        GetGridCellRange(&collisionGrid, bounds.min.x, bounds.min.z, bounds.max.x, bounds.max.z, &x0, &z0, &x1, &z1);
+        for (int z = z0; z <= z1; z++) {
+            for (int x = x0; x <= x1; x++) {
+                int cell = z*collisionGrid.cellsX + x;
+                for (int i = collisionGrid.cellStart[cell]; i < collisionGrid.cellStart[cell + 1]; i++) {
+                    if (collisionBoxes.collider[i] == c) SetLevelBox(&collisionBoxes, i, &levelColliders[c], c);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Batch Collision Kernels
+//------------------------------------------------------------------------------------
+// Test one sphere or segment against many boxes of a LevelBoxSoA at once and return
+// a hit mask (bit i = box first + i). Up to 32 boxes per call. AVX2 and SSE2 paths
+// process 8 or 4 boxes per step; the scalar versions are the reference fallback.
+#if defined(__AVX2__)
+    #define SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64)
+    #define SIMD_WIDTH 4
+#else
+    #define SIMD_WIDTH 1
+#endif
+
+static unsigned int LowBitsMask(int count)
+{
+    return (count >= 32)? 0xffffffffu : ((1u << count) - 1u);
+}
+
+static int LowestSetBit(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int bit = 0;
+    while (!(mask & 1u)) { mask >>= 1; bit++; }
+    return bit;
+#endif
+}
+
+static int CountSetBits(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return __builtin_popcount(mask);
+#else
+    int count = 0;
+    for (; mask; mask &= mask - 1) count++;
+    return count;
+#endif
+}
+
+static float MinF(float a, float b) { return (a < b)? a : b; }
+static float MaxF(float a, float b) { return (a > b)? a : b; }
+
+// Segment direction reciprocal with zero components nudged so the slab test never sees 0*inf
+Vector3 SafeInverseDelta(Vector3 delta)
+{
+    const float tiny = 1e-8f;
+    Vector3 inv;
+    inv.x = 1.0f/((fabsf(delta.x) < tiny)? tiny : delta.x);
+    inv.y = 1.0f/((fabsf(delta.y) < tiny)? tiny : delta.y);
+    inv.z = 1.0f/((fabsf(delta.z) < tiny)? tiny : delta.z);
+    return inv;
+}
+
+unsigned int SphereBoxMaskScalar(const LevelBoxSoA *boxes, int first, int count, Vector3 center, float radius, int kindMask)
+{
+    unsigned int mask = 0;
+    for (int i = 0; i < count; i++) {
+        int k = first + i;
+        if (!(boxes->kind[k] & kindMask)) continue;
+        float dx = center.x - Clamp(center.x, boxes->minX[k], boxes->maxX[k]);
+        float dy = center.y - Clamp(center.y, boxes->minY[k], boxes->maxY[k]);
+        float dz = center.z - Clamp(center.z, boxes->minZ[k], boxes->maxZ[k]);
+        if (dx*dx + dy*dy + dz*dz < radius*radius) mask |= 1u << i;
+    }
+    return mask;
+}
+
+// Slab test of start + t*delta (boxes inflated by radius), writes entry times to tEntry[i]
+unsigned int SegmentBoxMaskScalar(const LevelBoxSoA *boxes, int first, int count, Vector3 start, Vector3 invDelta, float radius, int kindMask, float *tEntry)
+{
+    unsigned int mask = 0;
+    for (int i = 0; i < count; i++) {
+        int k = first + i;
+        if (!(boxes->kind[k] & kindMask)) continue;
+        float t1x = (boxes->minX[k] - radius - start.x)*invDelta.x, t2x = (boxes->maxX[k] + radius - start.x)*invDelta.x;
+        float t1y = (boxes->minY[k] - radius - start.y)*invDelta.y, t2y = (boxes->maxY[k] + radius - start.y)*invDelta.y;
+        float t1z = (boxes->minZ[k] - radius - start.z)*invDelta.z, t2z = (boxes->maxZ[k] + radius - start.z)*invDelta.z;
+        float tNear = MaxF(MaxF(MinF(t1x, t2x), MinF(t1y, t2y)), MaxF(MinF(t1z, t2z), 0.0f));
+        float tFar = MinF(MinF(MaxF(t1x, t2x), MaxF(t1y, t2y)), MinF(MaxF(t1z, t2z), 1.0f));
+        tEntry[i] = tNear;
+        if (tNear <= tFar) mask |= 1u << i;
+    }
+    return mask;
+}
+
+#if SIMD_WIDTH == 8
+unsigned int SphereBoxMask(const LevelBoxSoA *boxes, int first, int count, Vector3 center, float radius, int kindMask)
+{
+    const __m256 px = _mm256_set1_ps(center.x), py = _mm256_set1_ps(center.y), pz = _mm256_set1_ps(center.z);
+    const __m256 r2 = _mm256_set1_ps(radius*radius);
+    const __m256i km = _mm256_set1_epi32(kindMask);
+    unsigned int mask = 0;
+
+    for (int i = 0; i < count; i += 8) {
+        int k = first + i;
+        __m256 dx = _mm256_sub_ps(px, _mm256_max_ps(_mm256_min_ps(px, _mm256_loadu_ps(boxes->maxX + k)), _mm256_loadu_ps(boxes->minX + k)));
+        __m256 dy = _mm256_sub_ps(py, _mm256_max_ps(_mm256_min_ps(py, _mm256_loadu_ps(boxes->maxY + k)), _mm256_loadu_ps(boxes->minY + k)));
+        __m256 dz = _mm256_sub_ps(pz, _mm256_max_ps(_mm256_min_ps(pz, _mm256_loadu_ps(boxes->maxZ + k)), _mm256_loadu_ps(boxes->minZ + k)));
+        __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+        __m256 hit = _mm256_cmp_ps(d2, r2, _CMP_LT_OQ);
+        __m256i kinds = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(boxes->kind + k)), km);
+        __m256 noKind = _mm256_castsi256_ps(_mm256_cmpeq_epi32(kinds, _mm256_setzero_si256()));
+        mask |= (unsigned int)_mm256_movemask_ps(_mm256_andnot_ps(noKind, hit)) << i;
+    }
+    return mask & LowBitsMask(count);
+}
+
+unsigned int SegmentBoxMask(const LevelBoxSoA *boxes, int first, int count, Vector3 start, Vector3 invDelta, float radius, int kindMask, float *tEntry)
+{
+    const __m256 sx = _mm256_set1_ps(start.x), sy = _mm256_set1_ps(start.y), sz = _mm256_set1_ps(start.z);
+    const __m256 ix = _mm256_set1_ps(invDelta.x), iy = _mm256_set1_ps(invDelta.y), iz = _mm256_set1_ps(invDelta.z);
+    const __m256 r = _mm256_set1_ps(radius);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256i km = _mm256_set1_epi32(kindMask);
+    unsigned int mask = 0;
+
+    for (int i = 0; i < count; i += 8) {
+        int k = first + i;
+        __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(boxes->minX + k), r), sx), ix);
+        __m256 t2x = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(boxes->maxX + k), r), sx), ix);
+        __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(boxes->minY + k), r), sy), iy);
+        __m256 t2y = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(boxes->maxY + k), r), sy), iy);
+        __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(boxes->minZ + k), r), sz), iz);
+        __m256 t2z = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(boxes->maxZ + k), r), sz), iz);
+        __m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t1x, t2x), _mm256_min_ps(t1y, t2y)), _mm256_max_ps(_mm256_min_ps(t1z, t2z), zero));
+        __m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t1x, t2x), _mm256_max_ps(t1y, t2y)), _mm256_min_ps(_mm256_max_ps(t1z, t2z), one));
+        _mm256_storeu_ps(tEntry + i, tNear);
+        __m256 hit = _mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ);
+        __m256i kinds = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(boxes->kind + k)), km);
+        __m256 noKind = _mm256_castsi256_ps(_mm256_cmpeq_epi32(kinds, _mm256_setzero_si256()));
+        mask |= (unsigned int)_mm256_movemask_ps(_mm256_andnot_ps(noKind, hit)) << i;
+    }
+    return mask & LowBitsMask(count);
+}
+#elif SIMD_WIDTH == 4
+unsigned int SphereBoxMask(const LevelBoxSoA *boxes, int first, int count, Vector3 center, float radius, int kindMask)
+{
+    const __m128 px = _mm_set1_ps(center.x), py = _mm_set1_ps(center.y), pz = _mm_set1_ps(center.z);
+    const __m128 r2 = _mm_set1_ps(radius*radius);
+    const __m128i km = _mm_set1_epi32(kindMask);
+    unsigned int mask = 0;
+
+    for (int i = 0; i < count; i += 4) {
+        int k = first + i;
+        __m128 dx = _mm_sub_ps(px, _mm_max_ps(_mm_min_ps(px, _mm_loadu_ps(boxes->maxX + k)), _mm_loadu_ps(boxes->minX + k)));
+        __m128 dy = _mm_sub_ps(py, _mm_max_ps(_mm_min_ps(py, _mm_loadu_ps(boxes->maxY + k)), _mm_loadu_ps(boxes->minY + k)));
+        __m128 dz = _mm_sub_ps(pz, _mm_max_ps(_mm_min_ps(pz, _mm_loadu_ps(boxes->maxZ + k)), _mm_loadu_ps(boxes->minZ + k)));
+        __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        __m128 hit = _mm_cmplt_ps(d2, r2);
+        __m128i kinds = _mm_and_si128(_mm_loadu_si128((const __m128i *)(boxes->kind + k)), km);
+        __m128 noKind = _mm_castsi128_ps(_mm_cmpeq_epi32(kinds, _mm_setzero_si128()));
+        mask |= (unsigned int)_mm_movemask_ps(_mm_andnot_ps(noKind, hit)) << i;
+    }
+    return mask & LowBitsMask(count);
+}
+
+unsigned int SegmentBoxMask(const LevelBoxSoA *boxes, int first, int count, Vector3 start, Vector3 invDelta, float radius, int kindMask, float *tEntry)
+{
+    const __m128 sx = _mm_set1_ps(start.x), sy = _mm_set1_ps(start.y), sz = _mm_set1_ps(start.z);
+    const __m128 ix = _mm_set1_ps(invDelta.x), iy = _mm_set1_ps(invDelta.y), iz = _mm_set1_ps(invDelta.z);
+    const __m128 r = _mm_set1_ps(radius);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const __m128i km = _mm_set1_epi32(kindMask);
+    unsigned int mask = 0;
+
+    for (int i = 0; i < count; i += 4) {
+        int k = first + i;
+        __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(boxes->minX + k), r), sx), ix);
+        __m128 t2x = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(boxes->maxX + k), r), sx), ix);
+        __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(boxes->minY + k), r), sy), iy);
+        __m128 t2y = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(boxes->maxY + k), r), sy), iy);
+        __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(boxes->minZ + k), r), sz), iz);
+        __m128 t2z = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(boxes->maxZ + k), r), sz), iz);
+        __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t1x, t2x), _mm_min_ps(t1y, t2y)), _mm_max_ps(_mm_min_ps(t1z, t2z), zero));
+        __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t1x, t2x), _mm_max_ps(t1y, t2y)), _mm_min_ps(_mm_max_ps(t1z, t2z), one));
+        _mm_storeu_ps(tEntry + i, tNear);
+        __m128 hit = _mm_cmple_ps(tNear, tFar);
+        __m128i kinds = _mm_and_si128(_mm_loadu_si128((const __m128i *)(boxes->kind + k)), km);
+        __m128 noKind = _mm_castsi128_ps(_mm_cmpeq_epi32(kinds, _mm_setzero_si128()));
+        mask |= (unsigned int)_mm_movemask_ps(_mm_andnot_ps(noKind, hit)) << i;
+    }
+    return mask & LowBitsMask(count);
+}
+#else
+unsigned int SphereBoxMask(const LevelBoxSoA *boxes, int first, int count, Vector3 center, float radius, int kindMask)
+{
+    return SphereBoxMaskScalar(boxes, first, count, center, radius, kindMask);
+}
+
+unsigned int SegmentBoxMask(const LevelBoxSoA *boxes, int first, int count, Vector3 start, Vector3 invDelta, float radius, int kindMask, float *tEntry)
+{
+    return SegmentBoxMaskScalar(boxes, first, count, start, invDelta, radius, kindMask, tEntry);
+}
+#endif
+
+//------------------------------------------------------------------------------------
+// Navigation
+//------------------------------------------------------------------------------------
+// Walkable grid rasterized at load from the colliders that block movement, and a
+// flow field toward the player on top of it: every cell points at the neighbour
+// closest to the target, so any number of enemies steer with one lookup each.
+// The field is rebuilt when the player changes cell, a slice per tick into a back
+// buffer that is published when complete, so frame cost stays bounded on big levels.
+#define NAV_CELL_SIZE 0.5f
+#define NAV_AGENT_RADIUS 0.8f           // Blocked cells are inflated by this much
+#define NAV_AGENT_HEIGHT 2.0f           // Geometry above this (lintels, ceilings) is ignored
+#define NAV_CELLS_PER_TICK 65536        // Flow field rebuild budget per simulation tick
+#define NAV_UNREACHED 0xFFFFFFFFu
+#define NAV_NO_DIRECTION 255
+#define NAV_SNAP_RADIUS 8               // Cells searched for a free target next to a blocked one
+
+typedef struct NavGrid {
+    float originX, originZ;
+    float cellSize;
+    int cellsX, cellsZ;
+    unsigned char *blocked;
+} NavGrid;
+
+typedef struct FlowField {
+    int target;                 // Target cell, -1 while unbuilt
+    unsigned int *distance;     // Steps to the target, NAV_UNREACHED if cut off
+    unsigned char *direction;   // Neighbour index 0..7 toward the target, NAV_NO_DIRECTION at it
+} FlowField;
+
+typedef enum { FLOW_IDLE = 0, FLOW_SEARCH, FLOW_DIRECTIONS } FlowBuildPhase;
+
+typedef struct FlowFieldBuilder {
+    FlowField fields[2];
+    int front;                  // Published field, -1 before the first build completes
+    int phase;                  // FlowBuildPhase of the back field
+    int target;                 // Cell being built toward
+    int *queue;
+    int head, tail;
+    int cursor;                 // Next cell of the direction pass
+    int builds;                 // Completed rebuilds
+    bool stale;                 // The grid changed since the last build began
+} FlowFieldBuilder;
+
+NavGrid navGrid = { 0 };
+FlowFieldBuilder flowBuilder = { 0 };
+
+// Neighbour offsets: 4 orthogonal, then 4 diagonal
+static const int navNeighbourX[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+static const int navNeighbourZ[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+
+void UnloadNavigation(void)
+{
+    free(navGrid.blocked);
+    for (int i = 0; i < 2; i++) {
+        free(flowBuilder.fields[i].distance);
+        free(flowBuilder.fields[i].direction);
+    }
+    free(flowBuilder.queue);
+    navGrid = (NavGrid){ 0 };
+    flowBuilder = (FlowFieldBuilder){ 0 };
+    flowBuilder.front = -1;
+    flowBuilder.target = -1;
+}
+
+int GetNavCell(Vector3 position)
+{
+    int x = (int)floorf((position.x - navGrid.originX)/navGrid.cellSize);
+    int z = (int)floorf((position.z - navGrid.originZ)/navGrid.cellSize);
+    if (x < 0 || z < 0 || x >= navGrid.cellsX || z >= navGrid.cellsZ) return -1;
+    return z*navGrid.cellsX + x;
+}
+
+// Block the cells of a collider that stops movement within agent height, clipped to cells [x0..x1, z0..z1]
+static void RasterNavCollider(const LevelCollider *c, int clipX0, int clipZ0, int clipX1, int clipZ1)
+{
+    if (!(c->kind & COLLIDE_PLAYER)) return;
+    if (c->position.y - c->size.y/2 >= NAV_AGENT_HEIGHT || c->position.y + c->size.y/2 <= 0.0f) return;
+
+    // Every cell touching the collider grown by the agent radius, so an agent
+    // anywhere inside a free cell is clear of the geometry
+    float minX = c->position.x - c->size.x/2 - NAV_AGENT_RADIUS - navGrid.originX;
+    float maxX = c->position.x + c->size.x/2 + NAV_AGENT_RADIUS - navGrid.originX;
+    float minZ = c->position.z - c->size.z/2 - NAV_AGENT_RADIUS - navGrid.originZ;
+    float maxZ = c->position.z + c->size.z/2 + NAV_AGENT_RADIUS - navGrid.originZ;
+    int x0 = (int)floorf(minX/NAV_CELL_SIZE), x1 = (int)ceilf(maxX/NAV_CELL_SIZE) - 1;
+    int z0 = (int)floorf(minZ/NAV_CELL_SIZE), z1 = (int)ceilf(maxZ/NAV_CELL_SIZE) - 1;
+    if (x0 < clipX0) x0 = clipX0;
+    if (z0 < clipZ0) z0 = clipZ0;
+    if (x1 > clipX1) x1 = clipX1;
+    if (z1 > clipZ1) z1 = clipZ1;
+
+    for (int z = z0; z <= z1; z++) memset(&navGrid.blocked[z*navGrid.cellsX + x0], 1, (x1 >= x0)? x1 - x0 + 1 : 0);
+}
+
+// Rasterize walls, pillars and large crates reaching into agent height (needs BuildCollisionGrid)
+void BuildNavGrid(void)
+{
+    UnloadNavigation();
+
+    navGrid.cellSize = NAV_CELL_SIZE;
+    navGrid.originX = levelBounds.min.x - NAV_CELL_SIZE;
+    navGrid.originZ = levelBounds.min.z - NAV_CELL_SIZE;
+    navGrid.cellsX = (int)ceilf((levelBounds.max.x - levelBounds.min.x)/NAV_CELL_SIZE) + 2;
+    navGrid.cellsZ = (int)ceilf((levelBounds.max.z - levelBounds.min.z)/NAV_CELL_SIZE) + 2;
+
+    int cellCount = navGrid.cellsX*navGrid.cellsZ;
+    navGrid.blocked = (unsigned char *)calloc(cellCount, 1);
+
+    for (int i = 0; i < levelColliderCount; i++) RasterNavCollider(&levelColliders[i], 0, 0, navGrid.cellsX - 1, navGrid.cellsZ - 1);
+
+    for (int i = 0; i < 2; i++) {
+        flowBuilder.fields[i].target = -1;
+        flowBuilder.fields[i].distance = (unsigned int *)malloc(cellCount*sizeof(unsigned int));
+        flowBuilder.fields[i].direction = (unsigned char *)malloc(cellCount);
+    }
+    flowBuilder.queue = (int *)malloc(cellCount*sizeof(int));
+}
+
+// Re-rasterize the nav cells around a changed area of the level (after the collision
+// grid is up to date) and have the flow field rebuilt. False if the area leaves the grid.
+bool RefreshNavRegion(BoundingBox region)
+{
+    if (navGrid.blocked == NULL) return false;
+
+    float grow = NAV_AGENT_RADIUS + NAV_CELL_SIZE;
+    int x0 = (int)floorf((region.min.x - grow - navGrid.originX)/NAV_CELL_SIZE);
+    int z0 = (int)floorf((region.min.z - grow - navGrid.originZ)/NAV_CELL_SIZE);
+    int x1 = (int)floorf((region.max.x + grow - navGrid.originX)/NAV_CELL_SIZE);
+    int z1 = (int)floorf((region.max.z + grow - navGrid.originZ)/NAV_CELL_SIZE);
+    if (x0 < 0 || z0 < 0 || x1 >= navGrid.cellsX || z1 >= navGrid.cellsZ) return false;
+
+    for (int z = z0; z <= z1; z++) memset(&navGrid.blocked[z*navGrid.cellsX + x0], 0, x1 - x0 + 1);
+
+    // Colliders reaching into the cleared cells, found through the collision grid
+    float minX = navGrid.originX + x0*NAV_CELL_SIZE - NAV_AGENT_RADIUS, maxX = navGrid.originX + (x1 + 1)*NAV_CELL_SIZE + NAV_AGENT_RADIUS;
+    float minZ = navGrid.originZ + z0*NAV_CELL_SIZE - NAV_AGENT_RADIUS, maxZ = navGrid.originZ + (z1 + 1)*NAV_CELL_SIZE + NAV_AGENT_RADIUS;
+    int gx0, gz0, gx1, gz1;
+    if (GetGridCellRange(&collisionGrid, minX, minZ, maxX, maxZ, &gx0, &gz0, &gx1, &gz1)) {
+        for (int z = gz0; z <= gz1; z++) {
+            for (int x = gx0; x <= gx1; x++) {
+                int cell = z*collisionGrid.cellsX + x;
+                for (int k = collisionGrid.cellStart[cell]; k < collisionGrid.cellStart[cell + 1]; k++) {
+                    RasterNavCollider(&levelColliders[collisionBoxes.collider[k]], x0, z0, x1, z1);
+                }
+            }
+        }
+    }
+
+    flowBuilder.stale = true;
+    return true;
+}
+
+// Nearest free cell in growing square rings, or the cell itself if none is close
+static int SnapToFreeNavCell(int cell)
+{
+    if (!navGrid.blocked[cell]) return cell;
+
+    int cx = cell % navGrid.cellsX, cz = cell / navGrid.cellsX;
+    for (int r = 1; r <= NAV_SNAP_RADIUS; r++) {
+        for (int z = cz - r; z <= cz + r; z++) {
+            for (int x = cx - r; x <= cx + r; x++) {
+                if (x != cx - r && x != cx + r && z != cz - r && z != cz + r) continue;
+                if (x < 0 || z < 0 || x >= navGrid.cellsX || z >= navGrid.cellsZ) continue;
+                if (!navGrid.blocked[z*navGrid.cellsX + x]) return z*navGrid.cellsX + x;
+            }
+        }
+    }
+
+    return cell;
+}
+
+static void BeginFlowField(int target)
+{
+    FlowField *field = &flowBuilder.fields[flowBuilder.front == 0];
+    int cellCount = navGrid.cellsX*navGrid.cellsZ;
+
+    for (int i = 0; i < cellCount; i++) field->distance[i] = NAV_UNREACHED;
+    // The player can stand closer to a wall than the agent inflation, so seed the
+    // search from the nearest free cell
+    int seed = SnapToFreeNavCell(target);
+    field->target = target;
+    field->distance[seed] = 0;
+
+    flowBuilder.target = target;
+    flowBuilder.stale = false;
+    flowBuilder.queue[0] = seed;
+    flowBuilder.head = 0;
+    flowBuilder.tail = 1;
+    flowBuilder.cursor = 0;
+    flowBuilder.phase = FLOW_SEARCH;
+}
+
+// Advance the back field by about budget cells; returns true when a new field is published
+bool StepFlowField(int budget)
+{
+    if (flowBuilder.phase == FLOW_IDLE) return false;
+
+    FlowField *field = &flowBuilder.fields[flowBuilder.front == 0];
+    int cellsX = navGrid.cellsX;
+    int cellCount = cellsX*navGrid.cellsZ;
+
+    // Breadth-first distances over free cells, 4-connected
+    while (flowBuilder.phase == FLOW_SEARCH && budget > 0) {
+        if (flowBuilder.head == flowBuilder.tail) {
+            flowBuilder.phase = FLOW_DIRECTIONS;
+            break;
+        }
+
+        int cell = flowBuilder.queue[flowBuilder.head++];
+        int x = cell % cellsX, z = cell / cellsX;
+        unsigned int next = field->distance[cell] + 1;
+        for (int n = 0; n < 4; n++) {
+            int nx = x + navNeighbourX[n], nz = z + navNeighbourZ[n];
+            if (nx < 0 || nz < 0 || nx >= cellsX || nz >= navGrid.cellsZ) continue;
+            int neighbour = nz*cellsX + nx;
+            if (navGrid.blocked[neighbour] || field->distance[neighbour] != NAV_UNREACHED) continue;
+            field->distance[neighbour] = next;
+            flowBuilder.queue[flowBuilder.tail++] = neighbour;
+        }
+        budget--;
+    }
+
+    // Each cell points at its closest neighbour; diagonals only when both sides are open.
+    // Blocked cells get directions too, so an agent pushed against a wall steers back out.
+    while (flowBuilder.phase == FLOW_DIRECTIONS && budget > 0) {
+        int end = (flowBuilder.cursor + budget < cellCount)? flowBuilder.cursor + budget : cellCount;
+        budget -= end - flowBuilder.cursor;
+
+        for (int cell = flowBuilder.cursor; cell < end; cell++) {
+            int x = cell % cellsX, z = cell / cellsX;
+            unsigned int best = field->distance[cell];
+            unsigned char direction = NAV_NO_DIRECTION;
+            for (int n = 0; n < 8; n++) {
+                int nx = x + navNeighbourX[n], nz = z + navNeighbourZ[n];
+                if (nx < 0 || nz < 0 || nx >= cellsX || nz >= navGrid.cellsZ) continue;
+                if (n >= 4 && (navGrid.blocked[z*cellsX + nx] || navGrid.blocked[nz*cellsX + x])) continue;
+                unsigned int d = field->distance[nz*cellsX + nx];
+                if (d < best) {
+                    best = d;
+                    direction = (unsigned char)n;
+                }
+            }
+            field->direction[cell] = direction;
+        }
+
+        flowBuilder.cursor = end;
+        if (end == cellCount) {
+            flowBuilder.front = (flowBuilder.front == 0);
+            flowBuilder.phase = FLOW_IDLE;
+            flowBuilder.builds++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Keep the flow field pointed at the player: start a rebuild once the player has
+// left the cell of the last build, and spend this tick's budget on it
+void UpdateFlowField(Vector3 playerPosition, int budget)
+{
+    if (navGrid.blocked == NULL) return;
+
+    int target = GetNavCell(playerPosition);
+    if (target >= 0 && flowBuilder.phase == FLOW_IDLE && (target != flowBuilder.target || flowBuilder.stale)) BeginFlowField(target);
+
+    StepFlowField(budget);
+}
+
+// O(1) steering lookup: unit XZ direction toward the player, false if there is no field
+// or the position is cut off from the player
+bool GetFlowDirection(Vector3 position, Vector3 *direction)
+{
+    if (navGrid.blocked == NULL || flowBuilder.front < 0) return false;
+
+    int cell = GetNavCell(position);
+    if (cell < 0) return false;
+
+    unsigned char n = flowBuilder.fields[flowBuilder.front].direction[cell];
+    if (n == NAV_NO_DIRECTION) return false;
+
+    const float diagonal = 0.70710678f;
+    float scale = (n >= 4)? diagonal : 1.0f;
+    *direction = (Vector3){ navNeighbourX[n]*scale, 0.0f, navNeighbourZ[n]*scale };
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Ground Heightfield
+//------------------------------------------------------------------------------------
+// Top surfaces of the level boxes baked into a 2D grid over the level at load time.
+// Each cell lists the tops of every box overlapping it in ascending order, so the
+// floor under any point is one cell lookup and a short scan, for players and enemies
+// alike. A box claims every cell it overlaps, which keeps a body standing on a ledge
+// until its center is about a cell (one body radius) past the edge.
+#define GROUND_CELL_SIZE 0.5f
+#define MAX_STEP_HEIGHT 0.55f       // Highest step walked up or down without jumping or falling
+
+typedef struct GroundGrid {
+    float originX;
+    float originZ;
+    int cellsX;
+    int cellsZ;
+    int *cellStart;     // Tops of cell c: tops[cellStart[c] .. cellStart[c + 1]], ascending
+    float *tops;
+    int capacity;       // Tops allocated, with headroom for hot reload patches
+} GroundGrid;
+
+GroundGrid groundGrid = { 0 };
+
+void UnloadGroundGrid(void)
+{
+    free(groundGrid.cellStart);
+    free(groundGrid.tops);
+    groundGrid = (GroundGrid){ 0 };
+}
+
+// Box of a level element (element order) that can be stood on; pipes and cables can't
+static bool GetWalkableBox(int e, BoundingBox *box)
+{
+    int prop = e - wallCount - pillarCount - stairCount;
+    if (prop >= 0 && props[prop].type == 4) return false;
+    StaticBox b = MakeStaticBox(e);
+    *box = (BoundingBox){ b.min, b.max };
+    return true;
+}
+
+// Ground cells a box overlaps; false if none
+static bool GetGroundCellRange(BoundingBox box, int *x0, int *z0, int *x1, int *z1)
+{
+    const float eps = 0.001f;   // Boxes just touching a cell border stay out of the next cell
+    *x0 = (int)floorf((box.min.x + eps - groundGrid.originX)/GROUND_CELL_SIZE);
+    *z0 = (int)floorf((box.min.z + eps - groundGrid.originZ)/GROUND_CELL_SIZE);
+    *x1 = (int)floorf((box.max.x - eps - groundGrid.originX)/GROUND_CELL_SIZE);
+    *z1 = (int)floorf((box.max.z - eps - groundGrid.originZ)/GROUND_CELL_SIZE);
+    if (*x0 < 0) *x0 = 0;
+    if (*z0 < 0) *z0 = 0;
+    if (*x1 >= groundGrid.cellsX) *x1 = groundGrid.cellsX - 1;
+    if (*z1 >= groundGrid.cellsZ) *z1 = groundGrid.cellsZ - 1;
+    return *x0 <= *x1 && *z0 <= *z1;
+}
+
+// Cells hold a handful of tops: insertion sort
+static void SortGroundCell(int c)
+{
+    float *tops = &groundGrid.tops[groundGrid.cellStart[c]];
+    int count = groundGrid.cellStart[c + 1] - groundGrid.cellStart[c];
+    for (int i = 1; i < count; i++) {
+        float top = tops[i];
+        int j = i - 1;
+        while (j >= 0 && tops[j] > top) { tops[j + 1] = tops[j]; j--; }
+        tops[j + 1] = top;
+    }
+}
+
+// Bake the walkable tops of the current level (needs levelBounds)
+void BuildGroundGrid(void)
+{
+    UnloadGroundGrid();
+
+    groundGrid.originX = levelBounds.min.x - GROUND_CELL_SIZE;
+    groundGrid.originZ = levelBounds.min.z - GROUND_CELL_SIZE;
+    groundGrid.cellsX = (int)ceilf((levelBounds.max.x - levelBounds.min.x)/GROUND_CELL_SIZE) + 2;
+    groundGrid.cellsZ = (int)ceilf((levelBounds.max.z - levelBounds.min.z)/GROUND_CELL_SIZE) + 2;
+    int cellCount = groundGrid.cellsX*groundGrid.cellsZ;
+    groundGrid.cellStart = (int *)calloc(cellCount + 1, sizeof(int));
+
+    // Count, prefix sum, then fill
+    int elementCount = wallCount + pillarCount + stairCount + propCount;
+    for (int e = 0; e < elementCount; e++) {
+        BoundingBox box;
+        int x0, z0, x1, z1;
+        if (!GetWalkableBox(e, &box) || !GetGroundCellRange(box, &x0, &z0, &x1, &z1)) continue;
+        for (int z = z0; z <= z1; z++) {
+            for (int x = x0; x <= x1; x++) groundGrid.cellStart[z*groundGrid.cellsX + x + 1]++;
+        }
+    }
+    for (int c = 0; c < cellCount; c++) groundGrid.cellStart[c + 1] += groundGrid.cellStart[c];
+
+    int total = groundGrid.cellStart[cellCount];
+    groundGrid.capacity = total + total/4 + 64;
+    groundGrid.tops = (float *)malloc(groundGrid.capacity*sizeof(float));
+    int *cursor = (int *)malloc(cellCount*sizeof(int));
+    memcpy(cursor, groundGrid.cellStart, cellCount*sizeof(int));
+    for (int e = 0; e < elementCount; e++) {
+        BoundingBox box;
+        int x0, z0, x1, z1;
+        if (!GetWalkableBox(e, &box) || !GetGroundCellRange(box, &x0, &z0, &x1, &z1)) continue;
+        for (int z = z0; z <= z1; z++) {
+            for (int x = x0; x <= x1; x++) groundGrid.tops[cursor[z*groundGrid.cellsX + x]++] = box.max.y;
+        }
+    }
+    free(cursor);
+
+    for (int c = 0; c < cellCount; c++) SortGroundCell(c);
+}
+
+// One top leaving (old box) or joining (new box) one ground cell
+typedef struct GroundEdit {
+    int cell;
+    int add;
+    float top;
+} GroundEdit;
+
+// Scratch for RefreshGroundBoxes(), allocated once by the caller: capacity edits,
+// and twice that many tops for the touched cells. Larger patches rebuild instead.
+typedef struct GroundPatchScratch {
+    GroundEdit *edits;
+    float *tops;            // New tops of the touched cells, back to back
+    int *cells;             // Touched cells, ascending
+    int *ends;              // End of each touched cell's tops
+    int *shift;             // Offset change of the tops after each touched cell
+    int capacity;
+} GroundPatchScratch;
+
+static void MoveGroundTops(void *entries, int from, int to, int count)
+{
+    float *tops = (float *)entries;
+    memmove(&tops[to], &tops[from], count*sizeof(float));
+}
+
+static int CompareGroundEdits(const void *a, const void *b)
+{
+    int ca = ((const GroundEdit *)a)->cell, cb = ((const GroundEdit *)b)->cell;
+    return (ca > cb) - (ca < cb);
+}
+
+// Append the edits of a box's top to its ground cells (empty box: not walkable).
+// False when they do not fit.
+static bool AddGroundEdits(GroundPatchScratch *scratch, int *count, BoundingBox box, int add)
+{
+    int x0, z0, x1, z1;
+    if (box.min.x > box.max.x || !GetGroundCellRange(box, &x0, &z0, &x1, &z1)) return true;
+    if (*count + (x1 - x0 + 1)*(z1 - z0 + 1) > scratch->capacity) return false;
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) scratch->edits[(*count)++] = (GroundEdit){ z*groundGrid.cellsX + x, add, box.max.y };
+    }
+    return true;
+}
+
+// Patch the tops of edited level elements: each old top (empty box: was not walkable)
+// leaves its old cells and the element's current top joins its new cells. Only the
+// touched cells are refilled; the tops between them move as blocks and their offsets
+// shift. False if the grid is missing, out of step with the old boxes, or the patch
+// outgrows the scratch or the tops' headroom; it must then be rebuilt.
+bool RefreshGroundBoxes(const int *elements, const BoundingBox *oldBoxes, int count, GroundPatchScratch *scratch)
+{
+    if (groundGrid.cellStart == NULL) return false;
+
+    int editCount = 0;
+    for (int k = 0; k < count; k++) {
+        BoundingBox now;
+        if (!GetWalkableBox(elements[k], &now)) now = (BoundingBox){ { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f } };
+        if (!AddGroundEdits(scratch, &editCount, oldBoxes[k], 0) || !AddGroundEdits(scratch, &editCount, now, 1)) return false;
+    }
+    if (editCount == 0) return true;
+    GroundEdit *edits = scratch->edits;
+    qsort(edits, editCount, sizeof(GroundEdit), CompareGroundEdits);
+
+    // New tops of every touched cell, before the grid is changed
+    int used = 0, groups = 0;
+    for (int i = 0; i < editCount; groups++) {
+        int c = edits[i].cell, first = used;
+        int oldCount = groundGrid.cellStart[c + 1] - groundGrid.cellStart[c];
+        if (used + oldCount + editCount > 2*scratch->capacity) return false;
+        memcpy(&scratch->tops[used], &groundGrid.tops[groundGrid.cellStart[c]], oldCount*sizeof(float));
+        used += oldCount;
+        for (; i < editCount && edits[i].cell == c; i++) {
+            if (edits[i].add) {
+                scratch->tops[used++] = edits[i].top;
+                continue;
+            }
+            int k = first;
+            while (k < used && scratch->tops[k] != edits[i].top) k++;
+            if (k == used) return false;
+            scratch->tops[k] = scratch->tops[--used];
+        }
+        for (int k = first + 1; k < used; k++) {
+            float top = scratch->tops[k];
+            int j = k - 1;
+            while (j >= first && scratch->tops[j] > top) { scratch->tops[j + 1] = scratch->tops[j]; j--; }
+            scratch->tops[j + 1] = top;
+        }
+        scratch->cells[groups] = c;
+        scratch->ends[groups] = used;
+        scratch->shift[groups] = ((groups > 0)? scratch->shift[groups - 1] : 0) + (used - first) - oldCount;
+    }
+
+    int cellCount = groundGrid.cellsX*groundGrid.cellsZ;
+    int total = groundGrid.cellStart[cellCount];
+    int delta = scratch->shift[groups - 1];
+    if (total + delta > groundGrid.capacity) return false;
+
+    MoveCsrRuns(groundGrid.cellStart, total, scratch->cells, scratch->shift, groups, MoveGroundTops, groundGrid.tops);
+    for (int g = 0; g < groups; g++) {
+        int begin = (g > 0)? scratch->ends[g - 1] : 0;
+        int start = groundGrid.cellStart[scratch->cells[g]] + ((g > 0)? scratch->shift[g - 1] : 0);
+        memcpy(&groundGrid.tops[start], &scratch->tops[begin], (scratch->ends[g] - begin)*sizeof(float));
+    }
+    ShiftCsrStarts(groundGrid.cellStart, cellCount, scratch->cells, scratch->shift, groups);
+    return true;
+}
+
+// Height of the highest walkable surface at (x, z) that is no higher than maxHeight;
+// 0 (the floor) if there is none
+float GetGroundHeight(float x, float z, float maxHeight)
+{
+    int cx = (int)floorf((x - groundGrid.originX)/GROUND_CELL_SIZE);
+    int cz = (int)floorf((z - groundGrid.originZ)/GROUND_CELL_SIZE);
+    if (cx < 0 || cz < 0 || cx >= groundGrid.cellsX || cz >= groundGrid.cellsZ) return 0.0f;
+
+    int cell = cz*groundGrid.cellsX + cx;
+    for (int k = groundGrid.cellStart[cell + 1] - 1; k >= groundGrid.cellStart[cell]; k--) {
+        if (groundGrid.tops[k] <= maxHeight) return (groundGrid.tops[k] > 0.0f)? groundGrid.tops[k] : 0.0f;
+    }
+    return 0.0f;
+}
+
+//------------------------------------------------------------------------------------
+// Level Files
+//------------------------------------------------------------------------------------
+// Binary level layout (little-endian): a LevelFileHeader followed by the raw
+// Wall/Pillar/Prop/Stair/LightSource arrays at 16-byte aligned offsets. The file
+// is mapped copy-on-write and the level arrays point into it, so loading does
+// no parsing; only the derived batches and collision grid are rebuilt.
+#define LEVEL_FILE_MAGIC 0x4C4B4E42u    // "BNKL"
+#define LEVEL_FILE_VERSION 2         // 2: rooms and portals
+
+typedef enum {
+    LEVEL_SECTION_WALLS = 0,
+    LEVEL_SECTION_PILLARS,
+    LEVEL_SECTION_PROPS,
+    LEVEL_SECTION_STAIRS,
+    LEVEL_SECTION_LIGHTS,
+    LEVEL_SECTION_ROOMS,
+    LEVEL_SECTION_PORTALS,
+    LEVEL_SECTION_COUNT
+} LevelSection;
+
+typedef struct LevelFileSection {
+    unsigned int offset;    // From start of file
+    int count;
+    int stride;             // sizeof element, checked on load
+} LevelFileSection;
+
+typedef struct LevelFileHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int headerSize;
+    unsigned int fileSize;
+    LevelFileSection sections[LEVEL_SECTION_COUNT];
+    BoundingBox bounds;     // Precomputed extents of all level geometry
+} LevelFileHeader;
+
+typedef struct MappedFile {
+    void *data;
+    size_t size;
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} MappedFile;
+
+MappedFile levelMapping = { 0 };
+
+// Hot reload state of a watched level file (see StartLevelWatch). The level arrays,
+// the reload buffer and the scratch lists of a reload are carved from one arena
+// allocated when watching starts.
+typedef struct LevelWatch {
+    const char *path;                   // NULL when not watching
+    unsigned char *arena;
+    void *sections[LEVEL_SECTION_COUNT];
+    int capacity[LEVEL_SECTION_COUNT];  // Elements the arena holds per section
+    unsigned char *fileBuffer;          // Reloads read the file here
+    size_t fileCapacity;
+    int *changed;                       // Changed level elements of a reload
+    BoundingBox *oldBounds;             // Their previous box, collider and walkable bounds
+    BoundingBox *oldColliderBounds;
+    BoundingBox *oldGroundBounds;       // Empty (min > max) when not walkable
+    unsigned char *dirtyBatches;
+    GridPatchScratch gridScratch;       // Static box grid, batch box lists, then collision grid
+    GroundPatchScratch groundScratch;
+    long long modTime;                  // Stamp of the file as last read
+    long long fileSize;
+    unsigned int fileHash;
+    long long seenModTime;              // Stamp at the last poll
+    long long seenFileSize;
+    double nextPoll;
+    int reloads;
+} LevelWatch;
+
+LevelWatch levelWatch = { 0 };
+
+static const int levelSectionStrides[LEVEL_SECTION_COUNT] = {
+    (int)sizeof(Wall), (int)sizeof(Pillar), (int)sizeof(Prop), (int)sizeof(Stair), (int)sizeof(LightSource),
+    (int)sizeof(LevelRoom), (int)sizeof(LevelPortal)
+};
+
+// Map a whole file copy-on-write: writes stay private to the process
+bool MapFile(const char *fileName, MappedFile *mapped)
+{
+    *mapped = (MappedFile){ 0 };
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) { CloseHandle(file); return false; }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (mapping == NULL) { CloseHandle(file); return false; }
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (data == NULL) { CloseHandle(mapping); CloseHandle(file); return false; }
+
+    mapped->file = file;
+    mapped->mapping = mapping;
+    mapped->size = (size_t)size.QuadPart;
+#else
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) { close(fd); return false; }
+
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    mapped->size = (size_t)info.st_size;
+#endif
+
+    mapped->data = data;
+    return true;
+}
+
+void UnmapFile(MappedFile *mapped)
+{
+    if (mapped->data == NULL) return;
+
+#if defined(_WIN32)
+    UnmapViewOfFile(mapped->data);
+    CloseHandle(mapped->mapping);
+    CloseHandle(mapped->file);
+#else
+    munmap(mapped->data, mapped->size);
+#endif
+
+    *mapped = (MappedFile){ 0 };
+}
+
+static void ExtendBounds(BoundingBox *bounds, Vector3 min, Vector3 max)
+{
+    bounds->min = Vector3Min(bounds->min, min);
+    bounds->max = Vector3Max(bounds->max, max);
+}
+
+// Extents of every wall, pillar, stair, prop and light
+BoundingBox ComputeLevelBounds(void)
+{
+    BoundingBox bounds = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+
+    for (int i = 0; i < wallCount; i++) {
+        Vector3 half = Vector3Scale(walls[i].size, 0.5f);
+        ExtendBounds(&bounds, Vector3Subtract(walls[i].position, half), Vector3Add(walls[i].position, half));
+    }
+    for (int i = 0; i < pillarCount; i++) {
+        Vector3 half = { pillars[i].width/2, 0.0f, pillars[i].width/2 };
+        ExtendBounds(&bounds, Vector3Subtract(pillars[i].position, half), Vector3Add(pillars[i].position, (Vector3){ half.x, pillars[i].height, half.z }));
+    }
+    for (int i = 0; i < stairCount; i++) {
+        Vector3 half = Vector3Scale(stairs[i].size, 0.5f);
+        ExtendBounds(&bounds, Vector3Subtract(stairs[i].position, half), Vector3Add(stairs[i].position, half));
+    }
+    for (int i = 0; i < propCount; i++) {
+        Vector3 half = Vector3Scale(props[i].size, 0.5f);
+        ExtendBounds(&bounds, Vector3Subtract(props[i].position, half), Vector3Add(props[i].position, half));
+    }
+    for (int i = 0; i < lightCount; i++) ExtendBounds(&bounds, lights[i].position, lights[i].position);
+
+    return bounds;
+}
+
+// Drop any mapped level file or generated level and point the level arrays
+// back at the built-in buffers
+void UnloadLevel(void)
+{
+    UnloadRoomIndex();
+    UnloadLevelLighting();
+    UnloadNavigation();
+    UnloadGroundGrid();
+    UnmapFile(&levelMapping);
+    free(generatedLevelMemory);
+    generatedLevelMemory = NULL;
+    free(levelWatch.arena);
+    free(levelWatch.fileBuffer);
+    levelWatch = (LevelWatch){ 0 };
+
+    walls = builtinWalls;
+    pillars = builtinPillars;
+    props = builtinProps;
+    stairs = builtinStairs;
+    lights = builtinLights;
+    rooms = builtinRooms;
+    portals = builtinPortals;
+    wallCount = pillarCount = propCount = stairCount = lightCount = 0;
+    roomCount = portalCount = 0;
+
+    levelPlayerStart = (Vector3){ -24.0f, 2.0f, 0.0f };
+    levelEnemySpawns = bunkerEnemySpawns;
+    levelEnemyCount = MAX_ENEMIES;
+}
+
+// Fingerprint of the level geometry: network peers and baked lighting must match it
+unsigned int HashLevel(void)
+{
+    unsigned int hash = 2166136261u;
+    hash = HashBytes(hash, &levelPlayerStart, sizeof(Vector3));
+    hash = HashBytes(hash, walls, wallCount*sizeof(Wall));
+    hash = HashBytes(hash, pillars, pillarCount*sizeof(Pillar));
+    hash = HashBytes(hash, props, propCount*sizeof(Prop));
+    hash = HashBytes(hash, stairs, stairCount*sizeof(Stair));
+    for (int i = 0; i < lightCount; i++) hash = HashBytes(hash, &lights[i].position, sizeof(Vector3));   // Flicker state changes at runtime
+    return hash;
+}
+
+// Write the current level in the binary level format
+bool ExportLevelFile(const char *fileName)
+{
+    const void *arrays[LEVEL_SECTION_COUNT] = { walls, pillars, props, stairs, lights, rooms, portals };
+    const int counts[LEVEL_SECTION_COUNT] = { wallCount, pillarCount, propCount, stairCount, lightCount, roomCount, portalCount };
+
+    LevelFileHeader header = { 0 };
+    header.magic = LEVEL_FILE_MAGIC;
+    header.version = LEVEL_FILE_VERSION;
+    header.headerSize = sizeof(LevelFileHeader);
+    header.bounds = ComputeLevelBounds();
+
+    unsigned int offset = (sizeof(LevelFileHeader) + 15u) & ~15u;
+    for (int s = 0; s < LEVEL_SECTION_COUNT; s++) {
+        header.sections[s].offset = offset;
+        header.sections[s].count = counts[s];
+        header.sections[s].stride = levelSectionStrides[s];
+        offset = (offset + counts[s]*levelSectionStrides[s] + 15u) & ~15u;
+    }
+    header.fileSize = offset;
+
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL) return false;
+
+    static const unsigned char zeros[16] = { 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    size_t written = sizeof(header);
+    for (int s = 0; s < LEVEL_SECTION_COUNT && ok; s++) {
+        ok = fwrite(zeros, 1, header.sections[s].offset - written, file) == header.sections[s].offset - written;
+        if (ok && counts[s] > 0) ok = fwrite(arrays[s], levelSectionStrides[s], counts[s], file) == (size_t)counts[s];
+        written = header.sections[s].offset + (size_t)counts[s]*levelSectionStrides[s];
+    }
+    if (ok) ok = fwrite(zeros, 1, header.fileSize - written, file) == header.fileSize - written;
+
+    fclose(file);
+    return ok;
+}
+
+// Header and section table checks; the sections must lie inside the size bytes at data
+static bool IsValidLevelFile(const void *data, size_t size)
+{
+    const LevelFileHeader *header = (const LevelFileHeader *)data;
+    bool valid = size >= sizeof(LevelFileHeader) && header->magic == LEVEL_FILE_MAGIC &&
+                 header->version == LEVEL_FILE_VERSION && header->headerSize == sizeof(LevelFileHeader) &&
+                 header->fileSize <= size;
+    for (int s = 0; s < LEVEL_SECTION_COUNT && valid; s++) {
+        const LevelFileSection *section = &header->sections[s];
+        valid = section->stride == levelSectionStrides[s] && section->count >= 0 && (section->offset % 4) == 0 &&
+                section->offset <= header->fileSize &&
+                (unsigned long long)section->count*section->stride <= header->fileSize - section->offset;
+    }
+    return valid;
+}
+
+// Level array of a file section
+static void *GetLevelSection(int s, int *count)
+{
+    switch (s) {
+        case LEVEL_SECTION_WALLS: *count = wallCount; return walls;
+        case LEVEL_SECTION_PILLARS: *count = pillarCount; return pillars;
+        case LEVEL_SECTION_PROPS: *count = propCount; return props;
+        case LEVEL_SECTION_STAIRS: *count = stairCount; return stairs;
+        case LEVEL_SECTION_LIGHTS: *count = lightCount; return lights;
+        case LEVEL_SECTION_ROOMS: *count = roomCount; return rooms;
+        default: *count = portalCount; return portals;
+    }
+}
+
+// Point the level array of a file section at count elements
+static void SetLevelSection(int s, void *data, int count)
+{
+    switch (s) {
+        case LEVEL_SECTION_WALLS: walls = (Wall *)data; wallCount = count; break;
+        case LEVEL_SECTION_PILLARS: pillars = (Pillar *)data; pillarCount = count; break;
+        case LEVEL_SECTION_PROPS: props = (Prop *)data; propCount = count; break;
+        case LEVEL_SECTION_STAIRS: stairs = (Stair *)data; stairCount = count; break;
+        case LEVEL_SECTION_LIGHTS: lights = (LightSource *)data; lightCount = count; break;
+        case LEVEL_SECTION_ROOMS: rooms = (LevelRoom *)data; roomCount = count; break;
+        default: portals = (LevelPortal *)data; portalCount = count; break;
+    }
+}
+
+// Map a binary level file and point the level arrays into it
+bool LoadLevelFile(const char *fileName)
+{
+    double start = GetWallTime();
+
+    MappedFile mapped;
+    if (!MapFile(fileName, &mapped)) {
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Failed to open level file", fileName);
+        return false;
+    }
+
+    const LevelFileHeader *header = (const LevelFileHeader *)mapped.data;
+    if (!IsValidLevelFile(mapped.data, mapped.size)) {
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Not a valid level file (version %d expected)", fileName, LEVEL_FILE_VERSION);
+        UnmapFile(&mapped);
+        return false;
+    }
+
+    UnloadLevel();
+    levelMapping = mapped;
+
+    unsigned char *base = (unsigned char *)mapped.data;
+    for (int s = 0; s < LEVEL_SECTION_COUNT; s++) SetLevelSection(s, base + header->sections[s].offset, header->sections[s].count);
+    levelBounds = header->bounds;
+
+    double mapTime = GetWallTime() - start;
+
+    BuildStaticBatches();
+    double batchTime = GetWallTime() - start - mapTime;
+    BuildCollisionGrid();
+    BuildNavGrid();
+    BuildGroundGrid();
+    double totalTime = GetWallTime() - start;
+
+    TraceLog(LOG_INFO, "LEVEL: [%s] Loaded %d walls, %d pillars, %d props, %d stairs, %d lights, %d rooms in %.2f ms (map %.2f ms, batches %.2f ms, grid + nav %.2f ms)",
+             fileName, wallCount, pillarCount, propCount, stairCount, lightCount, roomCount, totalTime*1000.0,
+             mapTime*1000.0, batchTime*1000.0, (totalTime - mapTime - batchTime)*1000.0);
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Level Hot Reload
+//------------------------------------------------------------------------------------
+// A watched level file is polled for a new modification stamp. Edits that keep every
+// element count are diffed element by element and patched in place: only the static
+// batches, collision cells and nav cells around the changed boxes are rebuilt. Other
+// edits reload the level arrays (in place while they fit the arena) and rebuild fully.
+#define HOT_RELOAD_POLL_INTERVAL 0.1    // Seconds between file stamp checks
+
+// Modification time of a file, in nanoseconds where the file system keeps them
+static long long GetStatModTime(const struct stat *info)
+{
+#if defined(__linux__)
+    return (long long)info->st_mtim.tv_sec*1000000000LL + info->st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    return (long long)info->st_mtimespec.tv_sec*1000000000LL + info->st_mtimespec.tv_nsec;
+#else
+    return (long long)info->st_mtime*1000000000LL;
+#endif
+}
+
+// Read the watched file into the reload buffer. False if it cannot be read or is not
+// (yet) a complete level file, e.g. while the editor is still writing it.
+static bool ReadLevelWatchFile(size_t *size)
+{
+    FILE *file = fopen(levelWatch.path, "rb");
+    if (file == NULL) return false;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (length > 0 && (size_t)length > levelWatch.fileCapacity) {
+        free(levelWatch.fileBuffer);
+        levelWatch.fileCapacity = (size_t)length + length/4 + 4096;
+        levelWatch.fileBuffer = (unsigned char *)malloc(levelWatch.fileCapacity);
+    }
+    bool ok = length > 0 && fread(levelWatch.fileBuffer, 1, (size_t)length, file) == (size_t)length;
+    fclose(file);
+
+    *size = (size_t)length;
+    return ok && IsValidLevelFile(levelWatch.fileBuffer, *size);
+}
+
+// Watch the loaded level file for edits. The level arrays move into an arena with
+// headroom per section, since the editor may rewrite or truncate the mapped file.
+bool StartLevelWatch(const char *path)
+{
+    struct stat info;
+    if (stat(path, &info) != 0) return false;
+
+    LevelWatch watch = { 0 };
+    watch.path = path;
+    size_t size = 0, elements = 0;
+    for (int s = 0; s < LEVEL_SECTION_COUNT; s++) {
+        int count;
+        GetLevelSection(s, &count);
+        watch.capacity[s] = count + count/4 + 16;
+        size += ((size_t)watch.capacity[s]*levelSectionStrides[s] + 15) & ~(size_t)15;
+        if (s != LEVEL_SECTION_LIGHTS && s != LEVEL_SECTION_ROOMS && s != LEVEL_SECTION_PORTALS) elements += watch.capacity[s];
+    }
+    size_t sectionSize = size;
+    size += elements*(3*sizeof(BoundingBox) + sizeof(int)) + ((watch.capacity[LEVEL_SECTION_ROOMS] + 1 + 15) & ~(size_t)15);
+
+    // Grid patches up to a quarter of the largest grid's entries
+    int gridEntries = collisionBoxes.count;
+    int boxEntries = (staticScene.grid.cellStart != NULL)? staticScene.grid.cellStart[staticScene.grid.cellsX*staticScene.grid.cellsZ] : 0;
+    int listEntries = (staticScene.batchStart != NULL)? staticScene.batchStart[staticBatchCount] : 0;
+    if (boxEntries > gridEntries) gridEntries = boxEntries;
+    if (listEntries > gridEntries) gridEntries = listEntries;
+    watch.gridScratch.capacity = gridEntries/4 + 1024;
+    size += (size_t)watch.gridScratch.capacity*(sizeof(GridEdit) + 2*sizeof(int) + 3*sizeof(int));
+    int groundTops = (groundGrid.cellStart != NULL)? groundGrid.cellStart[groundGrid.cellsX*groundGrid.cellsZ] : 0;
+    watch.groundScratch.capacity = groundTops/4 + 4096;
+    size += (size_t)watch.groundScratch.capacity*(sizeof(GroundEdit) + 2*sizeof(float) + 3*sizeof(int));
+
+    watch.arena = (unsigned char *)calloc(size, 1);
+    unsigned char *cursor = watch.arena;
+    for (int s = 0; s < LEVEL_SECTION_COUNT; s++) {
+        int count;
+        void *data = GetLevelSection(s, &count);
+        watch.sections[s] = cursor;
+        if (count > 0) memcpy(cursor, data, (size_t)count*levelSectionStrides[s]);
+        cursor += ((size_t)watch.capacity[s]*levelSectionStrides[s] + 15) & ~(size_t)15;
+    }
+    watch.oldBounds = (BoundingBox *)(watch.arena + sectionSize);
+    watch.oldColliderBounds = watch.oldBounds + elements;
+    watch.oldGroundBounds = watch.oldColliderBounds + elements;
+    watch.changed = (int *)(watch.oldGroundBounds + elements);
+    watch.dirtyBatches = (unsigned char *)(watch.changed + elements);
+    GridPatchScratch *grid = &watch.gridScratch;
+    grid->edits = (GridEdit *)(watch.dirtyBatches + ((watch.capacity[LEVEL_SECTION_ROOMS] + 1 + 15) & ~(size_t)15));
+    grid->items = (int *)(grid->edits + grid->capacity);
+    grid->cells = grid->items + 2*grid->capacity;
+    grid->ends = grid->cells + grid->capacity;
+    grid->shift = grid->ends + grid->capacity;
+    GroundPatchScratch *ground = &watch.groundScratch;
+    ground->edits = (GroundEdit *)(grid->shift + grid->capacity);
+    ground->tops = (float *)(ground->edits + ground->capacity);
+    ground->cells = (int *)(ground->tops + 2*ground->capacity);
+    ground->ends = ground->cells + ground->capacity;
+    ground->shift = ground->ends + ground->capacity;
+
+    // The arrays leave the mapping or generator memory for good
+    UnmapFile(&levelMapping);
+    free(generatedLevelMemory);
+    generatedLevelMemory = NULL;
+    free(levelWatch.arena);
+    free(levelWatch.fileBuffer);
+    levelWatch = watch;
+    for (int s = 0; s < LEVEL_SECTION_COUNT; s++) {
+        int count;
+        GetLevelSection(s, &count);
+        SetLevelSection(s, levelWatch.sections[s], count);
+    }
+
+    size_t fileSize;
+    levelWatch.fileHash = ReadLevelWatchFile(&fileSize)? HashBytes(2166136261u, levelWatch.fileBuffer, fileSize) : 0;
+    levelWatch.modTime = levelWatch.seenModTime = GetStatModTime(&info);
+    levelWatch.fileSize = levelWatch.seenFileSize = (long long)info.st_size;
+    return true;
+}
+
+// Patch the level from the reload buffer when no element count or room changed.
+// Returns the number of changed boxes (listed in levelWatch.changed), -1 if the
+// edit is structural.
+static int PatchLevelElements(const LevelFileHeader *header, int *lightsChanged)
+{
+    const unsigned char *base = levelWatch.fileBuffer;
+    for (int s = 0; s < LEVEL_SECTION_COUNT; s++) {
+        int count;
+        void *data = GetLevelSection(s, &count);
+        if (header->sections[s].count != count) return -1;
+        if ((s == LEVEL_SECTION_ROOMS || s == LEVEL_SECTION_PORTALS) &&
+            memcmp(data, base + header->sections[s].offset, (size_t)count*levelSectionStrides[s]) != 0) return -1;
+    }
+
+    // Element order: walls, pillars, stairs, props
+    static const int elementSections[4] = { LEVEL_SECTION_WALLS, LEVEL_SECTION_PILLARS, LEVEL_SECTION_STAIRS, LEVEL_SECTION_PROPS };
+    int changedCount = 0, element = 0;
+    for (int k = 0; k < 4; k++) {
+        int s = elementSections[k], count;
+        unsigned char *data = (unsigned char *)GetLevelSection(s, &count);
+        const unsigned char *source = base + header->sections[s].offset;
+        int stride = levelSectionStrides[s];
+        for (int i = 0; i < count; i++) {
+            if (memcmp(data + i*stride, source + i*stride, stride) == 0) continue;
+            BoundingBox *ground = &levelWatch.oldGroundBounds[changedCount];
+            if (!GetWalkableBox(element + i, ground)) *ground = (BoundingBox){ { 1.0f, 1.0f, 1.0f }, { -1.0f, -1.0f, -1.0f } };
+            memcpy(data + i*stride, source + i*stride, stride);
+            levelWatch.changed[changedCount++] = element + i;
+        }
+        element += count;
+    }
+
+    // Lights keep their flicker state
+    const LightSource *sourceLights = (const LightSource *)(base + header->sections[LEVEL_SECTION_LIGHTS].offset);
+    *lightsChanged = 0;
+    for (int i = 0; i < lightCount; i++) {
+        if (memcmp(&lights[i].position, &sourceLights[i].position, sizeof(Vector3)) == 0 && lights[i].flickerSpeed == sourceLights[i].flickerSpeed) continue;
+        lights[i].position = sourceLights[i].position;
+        lights[i].flickerSpeed = sourceLights[i].flickerSpeed;
+        lightRooms[i] = FindLevelRoom(lights[i].position);
+        (*lightsChanged)++;
+    }
+
+    return changedCount;
+}
+
+// Apply the reload buffer to the level. Returns true if anything changed.
+static bool ApplyLevelReload(void)
+{
+    double start = GetWallTime();
+    const LevelFileHeader *header = (const LevelFileHeader *)levelWatch.fileBuffer;
+    int lightsChanged = 0;
+    int boxesChanged = PatchLevelElements(header, &lightsChanged);
+    if (boxesChanged == 0 && lightsChanged == 0) return false;
+
+    if (boxesChanged >= 0) {
+        // Baked samples belong to the old geometry
+        bool batchesRefreshed = false;
+        if (levelLighting.samples != NULL) {
+            UnloadLevelLighting();
+            TraceLog(LOG_WARNING, "HOTRELOAD: [%s] Level changed, baked lighting dropped until the next bake", levelWatch.path);
+        } else {
+            batchesRefreshed = RefreshStaticBoxes(levelWatch.changed, boxesChanged, levelWatch.oldBounds, levelWatch.dirtyBatches, &levelWatch.gridScratch);
+        }
+        if (!batchesRefreshed) BuildStaticBatches();
+        double batchTime = GetWallTime() - start;
+
+        bool sameBounds = memcmp(&levelBounds, &header->bounds, sizeof(BoundingBox)) == 0;
+        levelBounds = header->bounds;
+        bool gridRefreshed = sameBounds && RefreshLevelColliders(levelWatch.changed, boxesChanged, levelWatch.oldColliderBounds, &levelWatch.gridScratch);
+        for (int k = 0; k < boxesChanged && gridRefreshed; k++) {
+            int c = elementColliders[levelWatch.changed[k]];
+            if (c < 0) continue;
+            BoundingBox now = GetColliderBounds(&levelColliders[c]), old = levelWatch.oldColliderBounds[k];
+            if (IsSameGridCellRange(&collisionGrid, old, now)) gridRefreshed = RefreshNavRegion((BoundingBox){ Vector3Min(old.min, now.min), Vector3Max(old.max, now.max) });
+            else gridRefreshed = RefreshNavRegion(old) && RefreshNavRegion(now);
+        }
+        if (!gridRefreshed) {
+            BuildCollisionGrid();
+            BuildNavGrid();
+        }
+        bool groundRefreshed = sameBounds && RefreshGroundBoxes(levelWatch.changed, levelWatch.oldGroundBounds, boxesChanged, &levelWatch.groundScratch);
+        if (!groundRefreshed) BuildGroundGrid();
+        double totalTime = GetWallTime() - start;
+
+        TraceLog(LOG_INFO, "HOTRELOAD: [%s] Patched %d boxes and %d lights in %.2f ms (batches %.2f ms %s, grids %.2f ms: collision and nav %s, ground %s)",
+                 levelWatch.path, boxesChanged, lightsChanged, totalTime*1000.0, batchTime*1000.0, batchesRefreshed? "incremental" : "full",
+                 (totalTime - batchTime)*1000.0, gridRefreshed? "incremental" : "full", groundRefreshed? "incremental" : "full");
+        return true;
+    }
+
+    // Structural edit: reload the arrays in place while they fit, else start over
+    bool fits = true;
+    for (int s = 0; s < LEVEL_SECTION_COUNT; s++) fits = fits && header->sections[s].count <= levelWatch.capacity[s];
+    if (!fits) {
+        const char *path = levelWatch.path;
+        if (!LoadLevelFile(path)) return false;
+        StartLevelWatch(path);
+        return true;
+    }
+
+    for (int s = 0; s < LEVEL_SECTION_COUNT; s++) {
+        memcpy(levelWatch.sections[s], levelWatch.fileBuffer + header->sections[s].offset, (size_t)header->sections[s].count*levelSectionStrides[s]);
+        SetLevelSection(s, levelWatch.sections[s], header->sections[s].count);
+    }
+    levelBounds = header->bounds;
+    UnloadLevelLighting();
+    BuildStaticBatches();
+    BuildCollisionGrid();
+    BuildNavGrid();
+    BuildGroundGrid();
+
+    TraceLog(LOG_INFO, "HOTRELOAD: [%s] Reloaded %d walls, %d pillars, %d props, %d stairs, %d lights, %d rooms in %.2f ms (full rebuild)",
+             levelWatch.path, wallCount, pillarCount, propCount, stairCount, lightCount, roomCount, (GetWallTime() - start)*1000.0);
+    return true;
+}
+
+// Re-read the watched file and apply it if its contents changed. Returns true if the
+// level changed; the caller then uploads any batches that were rebuilt from scratch.
+bool ReloadLevelWatch(void)
+{
+    struct stat info;
+    size_t size;
+    if (levelWatch.path == NULL || stat(levelWatch.path, &info) != 0 || !ReadLevelWatchFile(&size)) return false;  // Retried on the next poll
+
+    levelWatch.modTime = GetStatModTime(&info);
+    levelWatch.fileSize = (long long)info.st_size;
+    unsigned int hash = HashBytes(2166136261u, levelWatch.fileBuffer, size);
+    if (hash == levelWatch.fileHash) return false;
+    levelWatch.fileHash = hash;
+    levelWatch.reloads++;
+
+    return ApplyLevelReload();
+}
+
+// Once per frame: check the file stamp (modification time and size) every
+// HOT_RELOAD_POLL_INTERVAL. The file is only read once a new stamp has held for a
+// whole interval, so an editor still writing it is not read on every poll; a read
+// that fails keeps the old stamp and is retried on the next poll.
+bool PollLevelWatch(double now)
+{
+    if (levelWatch.path == NULL || now < levelWatch.nextPoll) return false;
+    levelWatch.nextPoll = now + HOT_RELOAD_POLL_INTERVAL;
+
+    struct stat info;
+    if (stat(levelWatch.path, &info) != 0) return false;
+    long long modTime = GetStatModTime(&info), size = (long long)info.st_size;
+    if (modTime != levelWatch.seenModTime || size != levelWatch.seenFileSize) {
+        levelWatch.seenModTime = modTime;
+        levelWatch.seenFileSize = size;
+        return false;
+    }
+    if (modTime == levelWatch.modTime && size == levelWatch.fileSize) return false;
+
+    return ReloadLevelWatch();
+}
+
+//------------------------------------------------------------------------------------
+// Level Initialization
+//------------------------------------------------------------------------------------
+void InitializeLevel()
+{
+    // Back to the built-in buffers (drops any mapped level file)
+    UnloadLevel();
+    
+    // ============================================
+    // LEFT HALL - Long narrow room (12 wide x 24 deep)
+    // Centered at X = -24
+    // ============================================
+    
+    // Left Hall - West Wall (outer)
+    walls[wallCount++] = (Wall){{-30.0f, 3.0f, 0.0f}, {0.5f, 6.0f, 26.0f}, CONCRETE_DARK};
+    // Left Hall - North Wall
+    walls[wallCount++] = (Wall){{-24.0f, 3.0f, -13.0f}, {13.0f, 6.0f, 0.5f}, CONCRETE_MED};
+    // Left Hall - South Wall
+    walls[wallCount++] = (Wall){{-24.0f, 3.0f, 13.0f}, {13.0f, 6.0f, 0.5f}, CONCRETE_MED};
+    // Left Hall - East Wall (with doorway gap in middle)
+    walls[wallCount++] = (Wall){{-18.0f, 3.0f, -8.0f}, {0.5f, 6.0f, 10.0f}, CONCRETE_DARK};
+    walls[wallCount++] = (Wall){{-18.0f, 3.0f, 8.0f}, {0.5f, 6.0f, 10.0f}, CONCRETE_DARK};
+    // Doorway lintel (above door)
+    walls[wallCount++] = (Wall){{-18.0f, 5.0f, 0.0f}, {0.5f, 2.0f, 6.0f}, CONCRETE_DARK};
+    
+    // Left Hall - Ceiling
+    walls[wallCount++] = (Wall){{-24.0f, 6.0f, 0.0f}, {12.0f, 0.3f, 26.0f}, CEILING_COLOR};
+    
+    // Left Hall Pillars (2 pillars)
+    pillars[pillarCount++] = (Pillar){{-27.0f, 0.0f, -6.0f}, 1.2f, 6.0f};
+    pillars[pillarCount++] = (Pillar){{-27.0f, 0.0f, 6.0f}, 1.2f, 6.0f};
+    
+    // ============================================
+    // CENTRAL ROOM - Large main area (24 wide x 28 deep)
+    // Centered at X = 0
+    // ============================================
+    
+    // Central Room - North Wall
+    walls[wallCount++] = (Wall){{0.0f, 4.0f, -15.0f}, {26.0f, 8.0f, 0.5f}, CONCRETE_MED};
+    // Central Room - South Wall
+    walls[wallCount++] = (Wall){{0.0f, 4.0f, 15.0f}, {26.0f, 8.0f, 0.5f}, CONCRETE_MED};
+    // Central Room - West Wall segments (with doorway to left hall)
+    walls[wallCount++] = (Wall){{-12.5f, 4.0f, -10.0f}, {0.5f, 8.0f, 10.0f}, WORN_PAINT};
+    walls[wallCount++] = (Wall){{-12.5f, 4.0f, 10.0f}, {0.5f, 8.0f, 10.0f}, WORN_PAINT};
+    walls[wallCount++] = (Wall){{-12.5f, 6.0f, 0.0f}, {0.5f, 4.0f, 6.0f}, WORN_PAINT};
+    // Central Room - East Wall segments (with doorway to right room)
+    walls[wallCount++] = (Wall){{12.5f, 4.0f, -10.0f}, {0.5f, 8.0f, 10.0f}, WORN_PAINT};
+    walls[wallCount++] = (Wall){{12.5f, 4.0f, 10.0f}, {0.5f, 8.0f, 10.0f}, WORN_PAINT};
+    walls[wallCount++] = (Wall){{12.5f, 6.0f, 0.0f}, {0.5f, 4.0f, 6.0f}, WORN_PAINT};
+    
+    // Central Room - Higher Ceiling
+    walls[wallCount++] = (Wall){{0.0f, 8.0f, 0.0f}, {25.0f, 0.3f, 30.0f}, CEILING_COLOR};
+    
+    // Central Room - Ceiling Beams (horizontal metal beams)
+    props[propCount++] = (Prop){{0.0f, 7.5f, -7.0f}, {24.0f, 0.4f, 0.6f}, DARK_METAL, 5};
+    props[propCount++] = (Prop){{0.0f, 7.5f, 0.0f}, {24.0f, 0.4f, 0.6f}, DARK_METAL, 5};
+    props[propCount++] = (Prop){{0.0f, 7.5f, 7.0f}, {24.0f, 0.4f, 0.6f}, DARK_METAL, 5};
+    
+    // Central Room Pillars (6 pillars - 2 rows of 3)
+    pillars[pillarCount++] = (Pillar){{-8.0f, 0.0f, -10.0f}, 1.5f, 8.0f};
+    pillars[pillarCount++] = (Pillar){{-8.0f, 0.0f, 10.0f}, 1.5f, 8.0f};
+    pillars[pillarCount++] = (Pillar){{8.0f, 0.0f, -10.0f}, 1.5f, 8.0f};
+    pillars[pillarCount++] = (Pillar){{8.0f, 0.0f, 10.0f}, 1.5f, 8.0f};
+    // Near stairwell
+    pillars[pillarCount++] = (Pillar){{-4.0f, 0.0f, -3.0f}, 1.0f, 8.0f};
+    pillars[pillarCount++] = (Pillar){{4.0f, 0.0f, -3.0f}, 1.0f, 8.0f};
+    
+    // ============================================
+    // CENTRAL STAIRWELL - Going up in center
+    // ============================================
+    
+    // Stair steps (going from Z=0 to Z=6, rising)
+    for (int i = 0; i < 10; i++) {
+        float stepY = 0.25f + i * 0.4f;
+        float stepZ = 1.0f + i * 0.5f;
+        stairs[stairCount++] = (Stair){{0.0f, stepY, stepZ}, {4.0f, 0.25f, 0.5f}};
+    }
+    
+    // Stair railing posts (left side)
+    props[propCount++] = (Prop){{-2.2f, 1.5f, 1.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
+    props[propCount++] = (Prop){{-2.2f, 2.3f, 3.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
+    props[propCount++] = (Prop){{-2.2f, 3.1f, 5.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
+    // Stair railing posts (right side)
+    props[propCount++] = (Prop){{2.2f, 1.5f, 1.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
+    props[propCount++] = (Prop){{2.2f, 2.3f, 3.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
+    props[propCount++] = (Prop){{2.2f, 3.1f, 5.5f}, {0.1f, 1.5f, 0.1f}, RUST_METAL, 4};
+    // Horizontal railing bars
+    props[propCount++] = (Prop){{-2.2f, 2.5f, 3.5f}, {0.08f, 0.08f, 5.0f}, RUST_METAL, 4};
+    props[propCount++] = (Prop){{2.2f, 2.5f, 3.5f}, {0.08f, 0.08f, 5.0f}, RUST_METAL, 4};
+    
+    // Upper platform at top of stairs
+    walls[wallCount++] = (Wall){{0.0f, 4.2f, 7.5f}, {5.0f, 0.25f, 3.0f}, CONCRETE_LIGHT};
+    
+    // ============================================
+    // RIGHT ROOM - Large room (16 wide x 20 deep)
+    // Centered at X = 24
+    // ============================================
+    
+    // Right Room - East Wall (outer)
+    walls[wallCount++] = (Wall){{32.0f, 3.0f, 0.0f}, {0.5f, 6.0f, 22.0f}, CONCRETE_DARK};
+    // Right Room - North Wall
+    walls[wallCount++] = (Wall){{24.0f, 3.0f, -11.0f}, {17.0f, 6.0f, 0.5f}, CONCRETE_MED};
+    // Right Room - South Wall
+    walls[wallCount++] = (Wall){{24.0f, 3.0f, 11.0f}, {17.0f, 6.0f, 0.5f}, CONCRETE_MED};
+    // Right Room - West Wall segments (with doorway)
+    walls[wallCount++] = (Wall){{16.0f, 3.0f, -7.0f}, {0.5f, 6.0f, 8.0f}, WORN_PAINT};
+    walls[wallCount++] = (Wall){{16.0f, 3.0f, 7.0f}, {0.5f, 6.0f, 8.0f}, WORN_PAINT};
+    walls[wallCount++] = (Wall){{16.0f, 5.0f, 0.0f}, {0.5f, 2.0f, 6.0f}, WORN_PAINT};
+    
+    // Right Room - Ceiling
+    walls[wallCount++] = (Wall){{24.0f, 6.0f, 0.0f}, {16.0f, 0.3f, 22.0f}, CEILING_COLOR};
+    
+    // Right Room Pillars (4 pillars)
+    pillars[pillarCount++] = (Pillar){{20.0f, 0.0f, -6.0f}, 1.2f, 6.0f};
+    pillars[pillarCount++] = (Pillar){{20.0f, 0.0f, 6.0f}, 1.2f, 6.0f};
+    pillars[pillarCount++] = (Pillar){{28.0f, 0.0f, -6.0f}, 1.2f, 6.0f};
+    pillars[pillarCount++] = (Pillar){{28.0f, 0.0f, 6.0f}, 1.2f, 6.0f};
+    
+    // ============================================
+    // CORRIDOR between Central and Right rooms
+    // ============================================
+    walls[wallCount++] = (Wall){{14.25f, 3.0f, -2.5f}, {4.0f, 6.0f, 0.3f}, CONCRETE_DARK};
+    walls[wallCount++] = (Wall){{14.25f, 3.0f, 2.5f}, {4.0f, 6.0f, 0.3f}, CONCRETE_DARK};
+    walls[wallCount++] = (Wall){{14.25f, 5.5f, 0.0f}, {4.0f, 0.3f, 5.0f}, CEILING_COLOR};
+    
+    // ============================================
+    // PROPS - Crates, Tables, Shelves, Debris
+    // ============================================
+    
+    // LEFT HALL PROPS
+    // Wooden crates stacked
+    props[propCount++] = (Prop){{-28.0f, 0.75f, -10.0f}, {1.5f, 1.5f, 1.5f}, WOOD_CRATE, 0};
+    props[propCount++] = (Prop){{-26.5f, 0.75f, -10.0f}, {1.5f, 1.5f, 1.5f}, WOOD_DARK, 0};
+    props[propCount++] = (Prop){{-27.25f, 2.0f, -10.0f}, {1.3f, 1.0f, 1.3f}, WOOD_CRATE, 0};
+    // Table with debris
+    props[propCount++] = (Prop){{-22.0f, 1.0f, 8.0f}, {3.0f, 0.15f, 1.5f}, WOOD_DARK, 1};
+    props[propCount++] = (Prop){{-22.0f, 0.5f, 7.5f}, {0.2f, 1.0f, 0.2f}, WOOD_DARK, 1};
+    props[propCount++] = (Prop){{-22.0f, 0.5f, 8.5f}, {0.2f, 1.0f, 0.2f}, WOOD_DARK, 1};
+    // Debris pile
+    props[propCount++] = (Prop){{-25.0f, 0.3f, 3.0f}, {2.0f, 0.6f, 1.5f}, DEBRIS_COLOR, 3};
+    // Pipes on wall
+    props[propCount++] = (Prop){{-29.8f, 4.0f, 0.0f}, {0.2f, 0.2f, 20.0f}, PIPE_COLOR, 4};
+    props[propCount++] = (Prop){{-29.8f, 2.5f, -5.0f}, {0.15f, 0.15f, 8.0f}, PIPE_COLOR, 4};
+    
+    // CENTRAL ROOM PROPS
+    // Large crate pile for cover
+    props[propCount++] = (Prop){{-6.0f, 1.0f, -12.0f}, {2.0f, 2.0f, 2.0f}, WOOD_CRATE, 0};
+    props[propCount++] = (Prop){{-4.0f, 1.0f, -12.0f}, {2.0f, 2.0f, 2.0f}, WOOD_DARK, 0};
+    props[propCount++] = (Prop){{-5.0f, 2.5f, -12.0f}, {1.5f, 1.0f, 1.5f}, WOOD_CRATE, 0};
+    // Metal shelves
+    props[propCount++] = (Prop){{10.0f, 1.5f, -13.5f}, {4.0f, 3.0f, 0.8f}, DARK_METAL, 2};
+    // Overturned table
+    props[propCount++] = (Prop){{6.0f, 0.6f, 12.0f}, {2.5f, 0.15f, 1.2f}, WOOD_DARK, 1};
+    // Debris and papers
+    props[propCount++] = (Prop){{-10.0f, 0.15f, 5.0f}, {1.5f, 0.3f, 1.0f}, DEBRIS_COLOR, 3};
+    props[propCount++] = (Prop){{3.0f, 0.1f, -8.0f}, {0.8f, 0.02f, 0.6f}, (Color){200, 195, 180, 255}, 3};
+    // Broken chair
+    props[propCount++] = (Prop){{-9.0f, 0.4f, 8.0f}, {0.5f, 0.8f, 0.5f}, WOOD_DARK, 3};
+    // Cables hanging from ceiling
+    props[propCount++] = (Prop){{5.0f, 6.0f, 5.0f}, {0.05f, 2.5f, 0.05f}, (Color){30, 30, 35, 255}, 4};
+    props[propCount++] = (Prop){{-3.0f, 5.5f, -5.0f}, {0.05f, 3.0f, 0.05f}, (Color){30, 30, 35, 255}, 4};
+    
+    // RIGHT ROOM PROPS
+    // Crate cover positions
+    props[propCount++] = (Prop){{22.0f, 1.0f, -8.0f}, {2.0f, 2.0f, 2.0f}, WOOD_CRATE, 0};
+    props[propCount++] = (Prop){{30.0f, 0.75f, 8.0f}, {1.5f, 1.5f, 1.5f}, WOOD_DARK, 0};
+    props[propCount++] = (Prop){{30.0f, 0.75f, 6.5f}, {1.5f, 1.5f, 1.5f}, WOOD_CRATE, 0};
+    // Old desk/table
+    props[propCount++] = (Prop){{26.0f, 1.0f, -9.0f}, {2.5f, 0.15f, 1.2f}, WOOD_DARK, 1};
+    props[propCount++] = (Prop){{26.0f, 0.5f, -8.5f}, {0.15f, 1.0f, 0.15f}, WOOD_DARK, 1};
+    props[propCount++] = (Prop){{26.0f, 0.5f, -9.5f}, {0.15f, 1.0f, 0.15f}, WOOD_DARK, 1};
+    // Shelf unit
+    props[propCount++] = (Prop){{31.0f, 2.0f, 0.0f}, {0.8f, 4.0f, 3.0f}, DARK_METAL, 2};
+    // Debris
+    props[propCount++] = (Prop){{24.0f, 0.25f, 4.0f}, {1.8f, 0.5f, 1.2f}, DEBRIS_COLOR, 3};
+    // Wall pipes
+    props[propCount++] = (Prop){{31.8f, 3.5f, 0.0f}, {0.15f, 0.15f, 18.0f}, PIPE_COLOR, 4};
+    props[propCount++] = (Prop){{31.8f, 2.0f, 0.0f}, {0.1f, 0.1f, 18.0f}, RUST_METAL, 4};
+    
+    // ============================================
+    // LIGHTS - Dim industrial lighting
+    // ============================================
+    lights[lightCount++] = (LightSource){{-24.0f, 5.5f, 0.0f}, 0.0f, 3.5f, true};
+    lights[lightCount++] = (LightSource){{-24.0f, 5.5f, -8.0f}, 0.0f, 4.2f, true};
+    lights[lightCount++] = (LightSource){{0.0f, 7.5f, -7.0f}, 0.0f, 2.8f, true};
+    lights[lightCount++] = (LightSource){{0.0f, 7.5f, 7.0f}, 0.0f, 5.0f, true};
+    lights[lightCount++] = (LightSource){{24.0f, 5.5f, 0.0f}, 0.0f, 3.0f, true};
+    lights[lightCount++] = (LightSource){{24.0f, 5.5f, -6.0f}, 0.0f, 6.0f, true};
+
+    // ============================================
+    // ROOMS & PORTALS - Visibility cells, walls included
+    // ============================================
+    rooms[roomCount++] = (LevelRoom){{{-30.25f, 0.0f, -13.25f}, {-17.75f, 6.15f, 13.25f}}};  // 0: Left hall
+    rooms[roomCount++] = (LevelRoom){{{-18.25f, 0.0f, -13.25f}, {-12.25f, 8.0f, 13.25f}}};   // 1: West passage
+    rooms[roomCount++] = (LevelRoom){{{-13.0f, 0.0f, -15.25f}, {13.0f, 8.15f, 15.25f}}};     // 2: Central room
+    rooms[roomCount++] = (LevelRoom){{{12.25f, 0.0f, -2.65f}, {16.25f, 5.65f, 2.65f}}};      // 3: East corridor
+    rooms[roomCount++] = (LevelRoom){{{15.75f, 0.0f, -11.25f}, {32.25f, 6.15f, 11.25f}}};    // 4: Right room
+
+    portals[portalCount++] = (LevelPortal){{{-18.25f, 0.0f, -3.0f}, {-17.75f, 4.0f, 3.0f}}, {0, 1}};
+    portals[portalCount++] = (LevelPortal){{{-12.75f, 0.0f, -5.0f}, {-12.25f, 4.0f, 5.0f}}, {1, 2}};
+    portals[portalCount++] = (LevelPortal){{{12.25f, 0.0f, -2.5f}, {12.75f, 4.0f, 2.5f}}, {2, 3}};
+    portals[portalCount++] = (LevelPortal){{{15.75f, 0.0f, -2.5f}, {16.25f, 4.0f, 2.5f}}, {3, 4}};
+
+    // Merge the static geometry into batched meshes and index it for collision and navigation
+    levelBounds = ComputeLevelBounds();
+    BuildStaticBatches();
+    BuildCollisionGrid();
+    BuildNavGrid();
+    BuildGroundGrid();
+}
+
+//------------------------------------------------------------------------------------
+// Level Generator
+//------------------------------------------------------------------------------------
+// Seeded bunker-style layouts for stress testing: a square grid of rooms joined by
+// doorways, each with pillars, crates, tables, debris, an occasional stairwell and
+// a ceiling light. Same seed and size always give the same level.
+#define GEN_ROOM_SIZE 16.0f
+#define GEN_WALL_HEIGHT 6.0f
+#define GEN_DOOR_WIDTH 4.0f
+#define GEN_BOXES_PER_ROOM 14       // Average, used to size the room grid
+#define GEN_MAX_ROOM_PROPS 9
+#define GEN_STAIR_STEPS 6
+#define GEN_BOXES_PER_ENEMY 50      // Stress scenes scale enemies and bullets with level size
+#define GEN_BOXES_PER_BULLET 10
+
+// xorshift32, kept apart from rand() so generation never disturbs gameplay randomness
+static unsigned int GenRandom(unsigned int *seed)
+{
+    unsigned int x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+static float GenRandomFloat(unsigned int *seed, float min, float max)
+{
+    return min + (max - min)*(float)(GenRandom(seed) >> 8)/16777216.0f;
+}
+
+// Wall along X (alongX) or Z centered at (x, z), split around a centered doorway
+static void GenerateWallRun(float x, float z, bool alongX, bool doorway, Color color)
+{
+    float length = GEN_ROOM_SIZE + 1.0f;
+    if (!doorway) {
+        Vector3 size = alongX? (Vector3){ length, GEN_WALL_HEIGHT, 1.0f } : (Vector3){ 1.0f, GEN_WALL_HEIGHT, length };
+        walls[wallCount++] = (Wall){ { x, GEN_WALL_HEIGHT/2, z }, size, color };
+        return;
+    }
+
+    float segment = (length - GEN_DOOR_WIDTH)/2;
+    float offset = (GEN_DOOR_WIDTH + segment)/2;
+    for (int side = -1; side <= 1; side += 2) {
+        Vector3 position = alongX? (Vector3){ x + side*offset, GEN_WALL_HEIGHT/2, z } : (Vector3){ x, GEN_WALL_HEIGHT/2, z + side*offset };
+        Vector3 size = alongX? (Vector3){ segment, GEN_WALL_HEIGHT, 1.0f } : (Vector3){ 1.0f, GEN_WALL_HEIGHT, segment };
+        walls[wallCount++] = (Wall){ position, size, color };
+    }
+}
+
+// Fill the level arrays with roughly targetBoxes walls, pillars, props and stairs.
+// The arrays live in one heap block released by UnloadLevel().
+void GenerateLevelLayout(unsigned int seed, int targetBoxes)
+{
+    UnloadLevel();
+
+    int roomsPerSide = (int)ceilf(sqrtf((float)(targetBoxes > GEN_BOXES_PER_ROOM? targetBoxes : GEN_BOXES_PER_ROOM)/GEN_BOXES_PER_ROOM));
+    int cellCount = roomsPerSide*roomsPerSide;
+    int enemyCount = (targetBoxes/GEN_BOXES_PER_ENEMY > 1)? targetBoxes/GEN_BOXES_PER_ENEMY : 1;
+
+    // Worst case per room: west and north walls with doorways, 4 pillars, all props, a full stairwell
+    int maxWalls = cellCount*4 + roomsPerSide*2;
+    int maxPillars = cellCount*4;
+    int maxProps = cellCount*GEN_MAX_ROOM_PROPS;
+    int maxStairs = cellCount*GEN_STAIR_STEPS;
+    int maxPortals = cellCount*2;
+    size_t bytes = maxWalls*sizeof(Wall) + maxPillars*sizeof(Pillar) + maxProps*sizeof(Prop) + maxStairs*sizeof(Stair) +
+                   cellCount*(sizeof(LightSource) + sizeof(LevelRoom)) + maxPortals*sizeof(LevelPortal) + enemyCount*sizeof(Vector3);
+    unsigned char *memory = (unsigned char *)malloc(bytes);
+    generatedLevelMemory = memory;
+
+    walls = (Wall *)memory;
+    pillars = (Pillar *)(walls + maxWalls);
+    props = (Prop *)(pillars + maxPillars);
+    stairs = (Stair *)(props + maxProps);
+    lights = (LightSource *)(stairs + maxStairs);
+    rooms = (LevelRoom *)(lights + cellCount);
+    portals = (LevelPortal *)(rooms + cellCount);
+    Vector3 *spawns = (Vector3 *)(portals + maxPortals);
+
+    if (seed == 0) seed = 1;
+    const Color wallColors[3] = { CONCRETE_DARK, CONCRETE_MED, WORN_PAINT };
+    const Color crateColors[2] = { WOOD_CRATE, WOOD_DARK };
+    float origin = -roomsPerSide*GEN_ROOM_SIZE/2;
+
+    for (int rz = 0; rz < roomsPerSide; rz++) {
+        for (int rx = 0; rx < roomsPerSide; rx++) {
+            float cx = origin + (rx + 0.5f)*GEN_ROOM_SIZE;
+            float cz = origin + (rz + 0.5f)*GEN_ROOM_SIZE;
+            float half = GEN_ROOM_SIZE/2;
+            Color wallColor = wallColors[GenRandom(&seed)%3];
+
+            // Visibility cell, and portals through the west and north doorways
+            int room = roomCount++;
+            rooms[room] = (LevelRoom){ { { cx - half - 0.5f, 0.0f, cz - half - 0.5f }, { cx + half + 0.5f, GEN_WALL_HEIGHT, cz + half + 0.5f } } };
+            if (rx > 0) portals[portalCount++] = (LevelPortal){ { { cx - half - 0.5f, 0.0f, cz - GEN_DOOR_WIDTH/2 }, { cx - half + 0.5f, GEN_WALL_HEIGHT, cz + GEN_DOOR_WIDTH/2 } }, { room - 1, room } };
+            if (rz > 0) portals[portalCount++] = (LevelPortal){ { { cx - GEN_DOOR_WIDTH/2, 0.0f, cz - half - 0.5f }, { cx + GEN_DOOR_WIDTH/2, GEN_WALL_HEIGHT, cz - half + 0.5f } }, { room - roomsPerSide, room } };
+
+            // Each room owns its west and north walls; the outer rim gets the rest
+            GenerateWallRun(cx - half, cz, false, rx > 0, wallColor);
+            GenerateWallRun(cx, cz - half, true, rz > 0, wallColor);
+            if (rx == roomsPerSide - 1) GenerateWallRun(cx + half, cz, false, false, wallColor);
+            if (rz == roomsPerSide - 1) GenerateWallRun(cx, cz + half, true, false, wallColor);
+
+            // Pillars at the quarter points
+            int pillarLayout = GenRandom(&seed)%3;
+            for (int p = 0; p < 4 && pillarLayout > 0; p++) {
+                if (pillarLayout == 1 && (p & 1)) continue;
+                float px = cx + ((p & 1)? 1.0f : -1.0f)*half/2;
+                float pz = cz + ((p & 2)? 1.0f : -1.0f)*half/2;
+                pillars[pillarCount++] = (Pillar){ { px, 0.0f, pz }, 1.2f, GEN_WALL_HEIGHT };
+            }
+
+            // Stairwell along the east wall of every eighth room
+            bool hasStairs = (GenRandom(&seed)%8) == 0;
+            if (hasStairs) {
+                for (int step = 0; step < GEN_STAIR_STEPS; step++) {
+                    float stepY = 0.35f + step*0.5f;
+                    stairs[stairCount++] = (Stair){ { cx + half - 2.5f, stepY, cz - 3.0f + step*1.0f }, { 3.0f, 0.25f, 1.0f } };
+                }
+            }
+
+            // Props scattered around the room, keeping the center free for spawns
+            int propTarget = 3 + (int)(GenRandom(&seed)%(GEN_MAX_ROOM_PROPS - 2));
+            for (int p = 0; p < propTarget; p++) {
+                float px = cx + GenRandomFloat(&seed, -half + 2.0f, half - 2.0f);
+                float pz = cz + GenRandomFloat(&seed, -half + 2.0f, half - 2.0f);
+                if (fabsf(px - cx) < 3.0f && fabsf(pz - cz) < 3.0f) px += (px < cx)? -3.0f : 3.0f;
+                if (hasStairs && px > cx + half - 5.0f) px -= 5.0f;
+
+                switch (GenRandom(&seed)%4) {
+                    case 0: {   // Large crate
+                        float size = GenRandomFloat(&seed, 1.2f, 2.0f);
+                        props[propCount++] = (Prop){ { px, size/2, pz }, { size, size, size }, crateColors[GenRandom(&seed)%2], 0 };
+                    } break;
+                    case 1: {   // Small crate
+                        props[propCount++] = (Prop){ { px, 0.4f, pz }, { 0.8f, 0.8f, 0.8f }, crateColors[GenRandom(&seed)%2], 0 };
+                    } break;
+                    case 2: {   // Table
+                        props[propCount++] = (Prop){ { px, 1.0f, pz }, { 2.5f, 0.15f, 1.2f }, WOOD_DARK, 1 };
+                    } break;
+                    default: {  // Debris pile
+                        props[propCount++] = (Prop){ { px, 0.25f, pz }, { GenRandomFloat(&seed, 1.0f, 2.0f), 0.5f, 1.2f }, DEBRIS_COLOR, 3 };
+                    } break;
+                }
+            }
+
+            lights[lightCount++] = (LightSource){ { cx, GEN_WALL_HEIGHT - 0.5f, cz }, 0.0f, GenRandomFloat(&seed, 2.5f, 6.0f), true };
+        }
+    }
+
+    // Player in the first room, enemies near the centers of the others
+    levelPlayerStart = (Vector3){ origin + GEN_ROOM_SIZE/2, 2.0f, origin + GEN_ROOM_SIZE/2 };
+    for (int e = 0; e < enemyCount; e++) {
+        int room = (cellCount > 1)? 1 + (int)(GenRandom(&seed)%(cellCount - 1)) : 0;
+        float ex = origin + (room%roomsPerSide + 0.5f)*GEN_ROOM_SIZE + GenRandomFloat(&seed, -1.0f, 1.0f);
+        float ez = origin + (room/roomsPerSide + 0.5f)*GEN_ROOM_SIZE + GenRandomFloat(&seed, -1.0f, 1.0f);
+        spawns[e] = (Vector3){ ex, 1.0f, ez };
+    }
+    levelEnemySpawns = spawns;
+    levelEnemyCount = enemyCount;
+    levelBounds = ComputeLevelBounds();
+}
+
+// Generate a level and build its batches, collision grid and navigation grid
+void GenerateLevel(unsigned int seed, int targetBoxes)
+{
+    GenerateLevelLayout(seed, targetBoxes);
+    BuildStaticBatches();
+    BuildCollisionGrid();
+    BuildNavGrid();
+    BuildGroundGrid();
+}
+
+//------------------------------------------------------------------------------------
+// Collision Detection
+//------------------------------------------------------------------------------------
+bool CheckBoxCollision(Vector3 playerPos, float radius, Vector3 boxPos, Vector3 boxSize)
+{
+    // Check if player sphere intersects with AABB
+    float closestX = Clamp(playerPos.x, boxPos.x - boxSize.x/2, boxPos.x + boxSize.x/2);
+    float closestY = Clamp(playerPos.y, boxPos.y - boxSize.y/2, boxPos.y + boxSize.y/2);
+    float closestZ = Clamp(playerPos.z, boxPos.z - boxSize.z/2, boxPos.z + boxSize.z/2);
+    
+    float distX = playerPos.x - closestX;
+    float distY = playerPos.y - closestY;
+    float distZ = playerPos.z - closestZ;
+    
+    float distSquared = distX*distX + distY*distY + distZ*distZ;
+    return distSquared < radius*radius;
+}
+
+// First level collider touching the sphere whose kind is in mask, or -1
+int QueryLevelSphere(Vector3 center, float radius, int mask)
+{
+    int x0, z0, x1, z1;
+    if (!GetGridCellRange(&collisionGrid, center.x - radius, center.z - radius, center.x + radius, center.z + radius, &x0, &z0, &x1, &z1)) return -1;
+
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) {
+            int cell = z*collisionGrid.cellsX + x;
+            int end = collisionGrid.cellStart[cell + 1];
+            for (int k = collisionGrid.cellStart[cell]; k < end; k += 32) {
+                unsigned int hits = SphereBoxMask(&collisionBoxes, k, (end - k < 32)? end - k : 32, center, radius, mask);
+                if (hits) return collisionBoxes.collider[k + LowestSetBit(hits)];
+            }
+        }
+    }
+
+    return -1;
+}
+
+// Entry time t in [0, 1] of the segment start + t*delta into the box, false if it misses
+bool SegmentBoxEntry(Vector3 start, Vector3 delta, Vector3 boxMin, Vector3 boxMax, float *tEntry)
+{
+    float tMin = 0.0f;
+    float tMax = 1.0f;
+    const float s[3] = { start.x, start.y, start.z };
+    const float d[3] = { delta.x, delta.y, delta.z };
+    const float lo[3] = { boxMin.x, boxMin.y, boxMin.z };
+    const float hi[3] = { boxMax.x, boxMax.y, boxMax.z };
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (fabsf(d[axis]) < 1e-8f) {
+            if (s[axis] < lo[axis] || s[axis] > hi[axis]) return false;
+        } else {
+            float inv = 1.0f/d[axis];
+            float t1 = (lo[axis] - s[axis])*inv;
+            float t2 = (hi[axis] - s[axis])*inv;
+            if (t1 > t2) { float tmp = t1; t1 = t2; t2 = tmp; }
+            if (t1 > tMin) tMin = t1;
+            if (t2 < tMax) tMax = t2;
+            if (tMin > tMax) return false;
+        }
+    }
+
+    *tEntry = tMin;
+    return true;
+}
+
+// Earliest level collider hit by a sphere swept from start to end.
+// Returns the collider index (or -1) and writes the time of impact in [0, 1].
+int SweepLevelSegment(Vector3 start, Vector3 end, float radius, int mask, float *tHit)
+{
+    int x0, z0, x1, z1;
+    if (!GetGridCellRange(&collisionGrid, fminf(start.x, end.x) - radius, fminf(start.z, end.z) - radius,
+                          fmaxf(start.x, end.x) + radius, fmaxf(start.z, end.z) + radius, &x0, &z0, &x1, &z1)) return -1;
+
+    Vector3 invDelta = SafeInverseDelta(Vector3Subtract(end, start));
+    int best = -1;
+    float bestT = 1.0f;
+    float tEntry[32];
+
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) {
+            int cell = z*collisionGrid.cellsX + x;
+            int cellEnd = collisionGrid.cellStart[cell + 1];
+            for (int k = collisionGrid.cellStart[cell]; k < cellEnd; k += 32) {
+                unsigned int hits = SegmentBoxMask(&collisionBoxes, k, (cellEnd - k < 32)? cellEnd - k : 32, start, invDelta, radius, mask, tEntry);
+                while (hits) {
+                    int i = LowestSetBit(hits);
+                    hits &= hits - 1;
+                    if (tEntry[i] <= bestT) {
+                        best = collisionBoxes.collider[k + i];
+                        bestT = tEntry[i];
+                    }
+                }
+            }
+        }
+    }
+
+    *tHit = bestT;
+    return best;
+}
+
+Vector3 ResolveCollision(Vector3 playerPos, Vector3 oldPos, float radius)
+{
+    Vector3 resolved = playerPos;
+    
+    // Check walls, pillars and large props (crates only for collision)
+    if (QueryLevelSphere(resolved, radius, COLLIDE_PLAYER) >= 0) {
+        // Push player back
+        resolved = oldPos;
+    }
+    
+    return resolved;
+}
+
+//------------------------------------------------------------------------------------
+// Lighting Baker
+//------------------------------------------------------------------------------------
+// Offline direct light and ambient occlusion for the static geometry, stored per
+// sample of the lit faces (see GetFaceCells) and multiplied into the vertex colors
+// of the static batches, so lit levels cost nothing extra to draw. Faces are baked
+// in parallel on the job system; shadow and occlusion rays go through the collision
+// grid. The result is saved next to the level and only loads while HashLevel() matches.
+#define LIGHTING_FILE_MAGIC 0x544C4B42u     // "BKLT"
+#define LIGHTING_FILE_VERSION 1
+#define LIGHT_RANGE 12.0f                   // Falloff reaches zero here
+#define LIGHT_INTENSITY 1.3f
+#define AMBIENT_LIGHT 0.6f                  // Unoccluded ambient term
+#define AO_RAYS 16                          // Occlusion rays per sample
+#define AO_RANGE 1.5f                       // Occluders further away than this don't darken
+#define BAKE_SURFACE_OFFSET 0.02f           // Rays start this far off the surface
+
+typedef struct LightingFileHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int levelHash;     // HashLevel() of the baked level
+    int sampleCount;
+    float cellSize;
+    int aoRays;
+} LightingFileHeader;
+
+typedef struct BakeFace {
+    StaticBox box;
+    int face;
+    int sampleStart;
+} BakeFace;
+
+typedef struct LightingBake {
+    const BakeFace *faces;
+    Color *samples;
+    UniformGrid lightGrid;      // Lights bucketed by the cells their range covers
+    int *lightItems;
+    std::atomic<long long> rays;
+} LightingBake;
+
+static float Smoothstep01(float x)
+{
+    x = Clamp(x, 0.0f, 1.0f);
+    return x*x*(3.0f - 2.0f*x);
+}
+
+// Lit and occluded light of one sample, with 1.0 = full brightness
+static Vector3 BakeSample(LightingBake *bake, Vector3 point, Vector3 normal, unsigned int seed, long long *rays)
+{
+    const Vector3 lightTint = { 1.0f, 0.89f, 0.67f };
+    Vector3 start = Vector3Add(point, Vector3Scale(normal, BAKE_SURFACE_OFFSET));
+    Vector3 light = { 0 };
+
+    // Direct light from every lamp in range, shadowed by the level
+    int x0, z0, x1, z1;
+    if (GetGridCellRange(&bake->lightGrid, point.x, point.z, point.x, point.z, &x0, &z0, &x1, &z1)) {
+        int cell = z0*bake->lightGrid.cellsX + x0;
+        for (int k = bake->lightGrid.cellStart[cell]; k < bake->lightGrid.cellStart[cell + 1]; k++) {
+            Vector3 toLight = Vector3Subtract(lights[bake->lightItems[k]].position, start);
+            float distance = Vector3Length(toLight);
+            if (distance >= LIGHT_RANGE || distance < 1e-4f) continue;
+            Vector3 dir = Vector3Scale(toLight, 1.0f/distance);
+            float lambert = Vector3DotProduct(normal, dir);
+            if (lambert <= 0.0f) continue;
+
+            // Stop short of the fixture so the lamp housing doesn't shadow itself
+            float t;
+            Vector3 end = Vector3Subtract(lights[bake->lightItems[k]].position, Vector3Scale(dir, 0.25f));
+            (*rays)++;
+            if (SweepLevelSegment(start, end, 0.0f, COLLIDE_BULLET, &t) >= 0) continue;
+
+            float falloff = Smoothstep01(1.0f - distance/LIGHT_RANGE);
+            light = Vector3Add(light, Vector3Scale(lightTint, LIGHT_INTENSITY*falloff*lambert));
+        }
+    }
+
+    // Ambient occlusion: cosine weighted rays over the hemisphere, the ground counts
+    Vector3 tangent = (fabsf(normal.y) > 0.5f)? (Vector3){ 1.0f, 0.0f, 0.0f } : (Vector3){ 0.0f, 1.0f, 0.0f };
+    Vector3 bitangent = Vector3CrossProduct(normal, tangent);
+    int open = 0;
+    for (int r = 0; r < AO_RAYS; r++) {
+        seed = seed*1664525u + 1013904223u;
+        float u1 = (seed >> 8)*(1.0f/16777216.0f);
+        seed = seed*1664525u + 1013904223u;
+        float u2 = (seed >> 8)*(1.0f/16777216.0f);
+
+        float radius = sqrtf(u1), angle = 2.0f*PI*u2;
+        Vector3 dir = Vector3Add(Vector3Scale(normal, sqrtf(1.0f - u1)),
+                                 Vector3Add(Vector3Scale(tangent, radius*cosf(angle)), Vector3Scale(bitangent, radius*sinf(angle))));
+        Vector3 end = Vector3Add(start, Vector3Scale(dir, AO_RANGE));
+
+        float t;
+        (*rays)++;
+        if (end.y >= 0.0f && SweepLevelSegment(start, end, 0.0f, COLLIDE_BULLET, &t) < 0) open++;
+    }
+    float ambient = AMBIENT_LIGHT*(0.25f + 0.75f*open/(float)AO_RAYS);
+
+    return Vector3AddValue(light, ambient);
+}
+
+static void BakeFacesJob(void *data, int begin, int end)
+{
+    LightingBake *bake = (LightingBake *)data;
+    long long rays = 0;
+
+    for (int i = begin; i < end; i++) {
+        const BakeFace *face = &bake->faces[i];
+        int cellsU, cellsV;
+        GetFaceCells(&face->box, face->face, true, &cellsU, &cellsV);
+
+        // Pull the edge samples a little inside so they don't start in the neighbouring box
+        Vector3 c0 = GetBoxCorner(&face->box, boxFaceCorners[face->face][0]);
+        float insetU = fminf(BAKE_SURFACE_OFFSET/fmaxf(Vector3Distance(c0, GetBoxCorner(&face->box, boxFaceCorners[face->face][1])), 1e-4f), 0.5f);
+        float insetV = fminf(BAKE_SURFACE_OFFSET/fmaxf(Vector3Distance(c0, GetBoxCorner(&face->box, boxFaceCorners[face->face][3])), 1e-4f), 0.5f);
+
+        for (int b = 0; b <= cellsV; b++) {
+            for (int a = 0; a <= cellsU; a++) {
+                int sample = face->sampleStart + b*(cellsU + 1) + a;
+                float u = Clamp((float)a/cellsU, insetU, 1.0f - insetU);
+                float v = Clamp((float)b/cellsV, insetV, 1.0f - insetV);
+                Vector3 point = GetFacePoint(&face->box, face->face, u, v);
+                Vector3 light = BakeSample(bake, point, boxFaceNormals[face->face], (unsigned int)sample*2654435761u, &rays);
+
+                bake->samples[sample] = (Color){ (unsigned char)fminf(light.x*128.0f, 255.0f), (unsigned char)fminf(light.y*128.0f, 255.0f),
+                                                 (unsigned char)fminf(light.z*128.0f, 255.0f), 255 };
+            }
+        }
+    }
+
+    bake->rays += rays;
+}
+
+// Bake the current level into levelLighting and rebuild the static batches lit.
+// Needs the collision grid. Writes the number of rays traced.
+void BakeLevelLighting(long long *rayCount)
+{
+    UnloadLevelLighting();
+    BuildRoomIndex();
+
+    StaticScene scene = { 0 };
+    GatherStaticBoxes(&scene, true);
+    int boxCount = scene.count;
+    const StaticBox *boxes = scene.boxes;
+    const unsigned char *faceVisible = scene.faceVisible;
+
+    // Same face and sample order as BuildStaticBatches()
+    BakeFace *faces = (BakeFace *)malloc((boxCount > 0? boxCount*6 : 1)*sizeof(BakeFace));
+    int faceCount = 0, sampleCount = 0;
+    for (int i = 0; i < boxCount; i++) {
+        for (int f = 0; f < 6; f++) {
+            if (!faceVisible[i*6 + f]) continue;
+            int cellsU, cellsV;
+            GetFaceCells(&boxes[i], f, true, &cellsU, &cellsV);
+            faces[faceCount++] = (BakeFace){ boxes[i], f, sampleCount };
+            sampleCount += (cellsU + 1)*(cellsV + 1);
+        }
+    }
+
+    BoundingBox *lightBounds = (BoundingBox *)calloc((lightCount > 0? lightCount : 1), sizeof(BoundingBox));
+    for (int i = 0; i < lightCount; i++) {
+        lightBounds[i] = (BoundingBox){ Vector3SubtractValue(lights[i].position, LIGHT_RANGE), Vector3AddValue(lights[i].position, LIGHT_RANGE) };
+    }
+
+    LightingBake *bake = new LightingBake();
+    bake->faces = faces;
+    bake->samples = (Color *)malloc((sampleCount > 0? sampleCount : 1)*sizeof(Color));
+    bake->lightItems = BuildGridBuckets(&bake->lightGrid, lightBounds, lightCount);
+    bake->rays = 0;
+    ParallelFor(BakeFacesJob, bake, faceCount, 8);
+
+    levelLighting.samples = bake->samples;
+    levelLighting.sampleCount = sampleCount;
+    *rayCount = bake->rays;
+
+    free(bake->lightItems);
+    UnloadUniformGrid(&bake->lightGrid);
+    delete bake;
+    free(lightBounds);
+    free(faces);
+    UnloadStaticScene(&scene);
+
+    BuildStaticBatches();
+}
+
+bool ExportLevelLighting(const char *fileName)
+{
+    if (levelLighting.samples == NULL) return false;
+
+    LightingFileHeader header = { LIGHTING_FILE_MAGIC, LIGHTING_FILE_VERSION, HashLevel(), levelLighting.sampleCount, LIGHTING_CELL_SIZE, AO_RAYS };
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL) return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(levelLighting.samples, sizeof(Color), levelLighting.sampleCount, file) == (size_t)levelLighting.sampleCount;
+    fclose(file);
+    return ok;
+}
+
+// Load baked lighting for the current level and rebuild the static batches lit.
+// Quietly false when there is no file; a file baked for other geometry is refused.
+bool LoadLevelLighting(const char *fileName)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL) return false;
+
+    LightingFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && header.magic == LIGHTING_FILE_MAGIC &&
+              header.version == LIGHTING_FILE_VERSION && header.sampleCount > 0 && header.cellSize == LIGHTING_CELL_SIZE;
+    if (!ok) {
+        TraceLog(LOG_WARNING, "LIGHTING: [%s] Not a valid lighting file (version %d expected)", fileName, LIGHTING_FILE_VERSION);
+        fclose(file);
+        return false;
+    }
+    if (header.levelHash != HashLevel()) {
+        TraceLog(LOG_WARNING, "LIGHTING: [%s] Baked for another level (%08x, this is %08x); rebake with --bake-lighting", fileName, header.levelHash, HashLevel());
+        fclose(file);
+        return false;
+    }
+
+    Color *samples = (Color *)malloc(header.sampleCount*sizeof(Color));
+    ok = fread(samples, sizeof(Color), header.sampleCount, file) == (size_t)header.sampleCount;
+    fclose(file);
+    if (!ok) {
+        TraceLog(LOG_WARNING, "LIGHTING: [%s] Truncated lighting file", fileName);
+        free(samples);
+        return false;
+    }
+
+    UnloadLevelLighting();
+    levelLighting.samples = samples;
+    levelLighting.sampleCount = header.sampleCount;
+    BuildStaticBatches();
+    if (levelLighting.samples == NULL) return false;
+
+    TraceLog(LOG_INFO, "LIGHTING: [%s] Loaded %d samples", fileName, header.sampleCount);
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// Instanced Rendering
+//------------------------------------------------------------------------------------
+// Dynamic boxes and spheres (enemies, players, lamps, bullets) go through one
+// instanced draw per primitive group instead of a DrawCube call each. A group keeps
+// its instances (position, size, color) in a CPU array mirrored in a GPU buffer;
+// every frame the caller pushes the visible instances in order and only the slots
+// whose contents changed since the last frame are uploaded before the draw.
+typedef enum {
+    INSTANCES_BOXES = 0,        // Solid boxes
+    INSTANCES_BOX_EDGES,        // Box outlines, drawn in wire mode
+    INSTANCES_SPHERES,          // Low-poly spheres
+    INSTANCES_GLOWS,            // Translucent boxes, drawn last
+    INSTANCE_GROUP_COUNT
+} InstanceGroupKind;
+
+typedef struct InstanceData {
+    Vector3 position;   // Center
+    Vector3 size;       // Full extents
+    Color color;
+} InstanceData;
+
+typedef struct InstanceGroup {
+    InstanceData *instances;
+    int count;              // Pushed this frame
+    int drawnCount;         // Drawn last frame; slots beyond it are stale on the GPU
+    int capacity;
+    int dirtyBegin;         // Slots [dirtyBegin, dirtyEnd) differ from the GPU copy
+    int dirtyEnd;
+    unsigned int vao;       // GPU side, needs a window
+    unsigned int meshBuffer;
+    unsigned int instanceBuffer;
+    int bufferCapacity;
+    int vertexCount;
+} InstanceGroup;
+
+typedef struct InstanceStats {
+    int instances;      // Drawn last frame
+    int uploaded;       // Of those, sent to the GPU
+    int drawCalls;
+} InstanceStats;
+
+InstanceGroup instanceGroups[INSTANCE_GROUP_COUNT] = { 0 };
+InstanceStats instanceStats = { 0 };
+Shader instanceShader = { 0 };
+int instanceMvpLoc = -1;
+int instanceAttribLocs[3] = { -1, -1, -1 };     // instancePosition, instanceSize, instanceColor
+
+static const char *instanceVertexShader =
+    "#version 330\n"
+    "in vec3 vertexPosition;\n"
+    "in vec3 instancePosition;\n"
+    "in vec3 instanceSize;\n"
+    "in vec4 instanceColor;\n"
+    "uniform mat4 mvp;\n"
+    "out vec4 fragColor;\n"
+    "void main() {\n"
+    "    fragColor = instanceColor;\n"
+    "    gl_Position = mvp*vec4(instancePosition + vertexPosition*instanceSize, 1.0);\n"
+    "}\n";
+
+static const char *instanceFragmentShader =
+    "#version 330\n"
+    "in vec4 fragColor;\n"
+    "out vec4 finalColor;\n"
+    "void main() { finalColor = fragColor; }\n";
+
+// Start the frame's instance list of a group
+void BeginInstances(InstanceGroupKind kind)
+{
+    instanceGroups[kind].count = 0;
+}
+
+// Add an instance; a slot that holds the same values as last frame isn't uploaded again
+void PushInstance(InstanceGroupKind kind, Vector3 position, Vector3 size, Color color)
+{
+    InstanceGroup *group = &instanceGroups[kind];
+    if (group->count == group->capacity) {
+        group->capacity = (group->capacity > 0)? group->capacity*2 : 256;
+        group->instances = (InstanceData *)realloc(group->instances, group->capacity*sizeof(InstanceData));
+    }
+
+    int slot = group->count++;
+    InstanceData instance = { position, size, color };
+    if (slot >= group->drawnCount || memcmp(&group->instances[slot], &instance, sizeof(InstanceData)) != 0) {
+        group->instances[slot] = instance;
+        if (group->dirtyBegin >= group->dirtyEnd) group->dirtyBegin = slot;
+        else if (slot < group->dirtyBegin) group->dirtyBegin = slot;
+        if (slot + 1 > group->dirtyEnd) group->dirtyEnd = slot + 1;
+    }
+}
+
+// Unit cube triangles, centered on the origin
+static int BuildUnitCube(float *vertices)
+{
+    int n = 0;
+    for (int f = 0; f < 6; f++) {
+        const int quad[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int k = 0; k < 6; k++) {
+            int corner = boxFaceCorners[f][quad[k]];
+            vertices[n++] = (corner & 1)? 0.5f : -0.5f;
+            vertices[n++] = (corner & 2)? 0.5f : -0.5f;
+            vertices[n++] = (corner & 4)? 0.5f : -0.5f;
+        }
+    }
+    return n/3;
+}
+
+// Unit cube edges as degenerate triangles (a, b, b), like the static wire meshes
+static int BuildUnitCubeEdges(float *vertices)
+{
+    int n = 0;
+    for (int a = 0; a < 8; a++) {
+        for (int axis = 0; axis < 3; axis++) {
+            int b = a | (1 << axis);
+            if (b == a) continue;
+            const int ends[3] = { a, b, b };
+            for (int k = 0; k < 3; k++) {
+                vertices[n++] = (ends[k] & 1)? 0.5f : -0.5f;
+                vertices[n++] = (ends[k] & 2)? 0.5f : -0.5f;
+                vertices[n++] = (ends[k] & 4)? 0.5f : -0.5f;
+            }
+        }
+    }
+    return n/3;
+}
+
+// Unit diameter sphere of rings x slices quads
+static int BuildUnitSphere(float *vertices, int rings, int slices)
+{
+    int n = 0;
+    for (int r = 0; r < rings; r++) {
+        for (int s = 0; s < slices; s++) {
+            Vector3 p[4];
+            for (int k = 0; k < 4; k++) {
+                float theta = PI*(r + (k >> 1))/rings;
+                float phi = 2.0f*PI*(s + ((k == 1 || k == 2)? 1 : 0))/slices;
+                p[k] = (Vector3){ 0.5f*sinf(theta)*cosf(phi), 0.5f*cosf(theta), 0.5f*sinf(theta)*sinf(phi) };
+            }
+            const int quad[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int k = 0; k < 6; k++) {
+                vertices[n++] = p[quad[k]].x;
+                vertices[n++] = p[quad[k]].y;
+                vertices[n++] = p[quad[k]].z;
+            }
+        }
+    }
+    return n/3;
+}
+
+// (Re)create the instance buffer of a group and point the instance attributes at it
+static void AllocInstanceBuffer(InstanceGroup *group)
+{
+    if (group->instanceBuffer != 0) rlUnloadVertexBuffer(group->instanceBuffer);
+    group->bufferCapacity = group->capacity;
+
+    rlEnableVertexArray(group->vao);
+    group->instanceBuffer = rlLoadVertexBuffer(NULL, group->bufferCapacity*sizeof(InstanceData), true);
+    const int components[3] = { 3, 3, 4 };
+    const int types[3] = { RL_FLOAT, RL_FLOAT, RL_UNSIGNED_BYTE };
+    const size_t offsets[3] = { offsetof(InstanceData, position), offsetof(InstanceData, size), offsetof(InstanceData, color) };
+    for (int a = 0; a < 3; a++) {
+        if (instanceAttribLocs[a] < 0) continue;
+        rlSetVertexAttribute(instanceAttribLocs[a], components[a], types[a], a == 2, sizeof(InstanceData), (const void *)offsets[a]);
+        rlSetVertexAttributeDivisor(instanceAttribLocs[a], 1);
+        rlEnableVertexAttribute(instanceAttribLocs[a]);
+    }
+    rlDisableVertexArray();
+
+    // The new buffer is empty
+    group->dirtyBegin = 0;
+    group->dirtyEnd = group->count;
+}
+
+// Load the instancing shader and the group meshes (requires a window)
+void InitInstancedRenderer(void)
+{
+    instanceShader = LoadShaderFromMemory(instanceVertexShader, instanceFragmentShader);
+    instanceMvpLoc = GetShaderLocation(instanceShader, "mvp");
+    instanceAttribLocs[0] = GetShaderLocationAttrib(instanceShader, "instancePosition");
+    instanceAttribLocs[1] = GetShaderLocationAttrib(instanceShader, "instanceSize");
+    instanceAttribLocs[2] = GetShaderLocationAttrib(instanceShader, "instanceColor");
+    int positionLoc = GetShaderLocationAttrib(instanceShader, "vertexPosition");
+
+    float *vertices = (float *)malloc(8*12*6*3*sizeof(float));
+    for (int g = 0; g < INSTANCE_GROUP_COUNT; g++) {
+        InstanceGroup *group = &instanceGroups[g];
+        if (g == INSTANCES_BOX_EDGES) group->vertexCount = BuildUnitCubeEdges(vertices);
+        else if (g == INSTANCES_SPHERES) group->vertexCount = BuildUnitSphere(vertices, 6, 8);
+        else group->vertexCount = BuildUnitCube(vertices);
+
+        group->vao = rlLoadVertexArray();
+        rlEnableVertexArray(group->vao);
+        group->meshBuffer = rlLoadVertexBuffer(vertices, group->vertexCount*3*sizeof(float), false);
+        rlSetVertexAttribute(positionLoc, 3, RL_FLOAT, false, 0, NULL);
+        rlEnableVertexAttribute(positionLoc);
+        rlDisableVertexArray();
+
+        if (group->capacity == 0) {
+            group->capacity = 256;
+            group->instances = (InstanceData *)malloc(group->capacity*sizeof(InstanceData));
+        }
+        AllocInstanceBuffer(group);
+    }
+    free(vertices);
+}
+
+void UnloadInstancedRenderer(void)
+{
+    for (int g = 0; g < INSTANCE_GROUP_COUNT; g++) {
+        InstanceGroup *group = &instanceGroups[g];
+        if (group->vao != 0) {
+            rlUnloadVertexBuffer(group->instanceBuffer);
+            rlUnloadVertexBuffer(group->meshBuffer);
+            rlUnloadVertexArray(group->vao);
+        }
+        free(group->instances);
+        *group = (InstanceGroup){ 0 };
+    }
+    if (instanceShader.id != 0) UnloadShader(instanceShader);
+    instanceShader = (Shader){ 0 };
+}
+
+// Upload the changed slots of a group and draw all its instances in one call (inside BeginMode3D)
+void DrawInstances(InstanceGroupKind kind)
+{
+    InstanceGroup *group = &instanceGroups[kind];
+    if (group->vao == 0) return;
+
+    if (group->bufferCapacity < group->capacity) AllocInstanceBuffer(group);
+    if (group->dirtyEnd > group->count) group->dirtyEnd = group->count;
+    if (group->dirtyBegin < group->dirtyEnd) {
+        rlUpdateVertexBuffer(group->instanceBuffer, &group->instances[group->dirtyBegin], (group->dirtyEnd - group->dirtyBegin)*sizeof(InstanceData),
+                             group->dirtyBegin*sizeof(InstanceData));
+        instanceStats.uploaded += group->dirtyEnd - group->dirtyBegin;
+    }
+    group->dirtyBegin = group->dirtyEnd = 0;
+    group->drawnCount = group->count;
+    if (group->count == 0) return;
+
+    // Flush raylib's batched immediate-mode geometry first so the draw order holds
+    rlDrawRenderBatchActive();
+    rlEnableShader(instanceShader.id);
+    rlSetUniformMatrix(instanceMvpLoc, MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()));
+    rlEnableVertexArray(group->vao);
+    if (kind == INSTANCES_BOX_EDGES) {
+        rlDisableBackfaceCulling();
+        rlEnableWireMode();
+    }
+    rlDrawVertexArrayInstanced(0, group->vertexCount, group->count);
+    if (kind == INSTANCES_BOX_EDGES) {
+        rlDisableWireMode();
+        rlEnableBackfaceCulling();
+    }
+    rlDisableVertexArray();
+    rlDisableShader();
+
+    instanceStats.instances += group->count;
+    instanceStats.drawCalls++;
+}
+
+//------------------------------------------------------------------------------------
+// Drawing Functions
+//------------------------------------------------------------------------------------
+void DrawLevelGeometry()
+{
+    PROFILE_SCOPE(PROFILE_DRAW_LEVEL);
+
+    // Draw Floor - Dark concrete, covering the level with some margin
+    Vector3 floorCenter = { (levelBounds.min.x + levelBounds.max.x)/2, 0.0f, (levelBounds.min.z + levelBounds.max.z)/2 };
+    Vector2 floorSize = { levelBounds.max.x - levelBounds.min.x + 20.0f, levelBounds.max.z - levelBounds.min.z + 20.0f };
+    DrawPlane(floorCenter, floorSize, FLOOR_COLOR);
+    
+    // Draw walls, pillars, stairs and props of the visible rooms (one mesh per room)
+    for (int i = 0; i < staticBatchCount; i++) {
+        if (levelVisibility.batchVisible[i] && staticBatches[i].mesh.vertexCount > 0) DrawMesh(staticBatches[i].mesh, staticMaterial, MatrixIdentity());
+    }
+    
+    // Add subtle edge lines for definition
+    rlDrawRenderBatchActive();
+    rlDisableBackfaceCulling();
+    rlEnableWireMode();
+    for (int i = 0; i < staticBatchCount; i++) {
+        if (levelVisibility.batchVisible[i] && staticBatches[i].wireMesh.vertexCount > 0) DrawMesh(staticBatches[i].wireMesh, staticMaterial, MatrixIdentity());
+    }
+    rlDisableWireMode();
+    rlEnableBackfaceCulling();
+}
+
+// Queue the visible light fixtures and glow cones as instances (see DrawInstances)
+void DrawAtmosphericLights()
+{
+    // Draw light fixtures (simple boxes representing lamps)
+    for (int i = 0; i < lightCount; i++) {
+        if (!levelVisibility.lightVisible[i]) continue;
+
+        Color lightColor = lights[i].isOn ? (Color){180, 160, 120, 255} : (Color){60, 55, 50, 255};
+        PushInstance(INSTANCES_BOXES, lights[i].position, (Vector3){ 0.6f, 0.2f, 0.6f }, DARK_METAL);
+        
+        if (lights[i].isOn && levelLighting.samples == NULL) {
+            // Light glow cone (simple representation, baked lighting shows the real pool of light)
+            Vector3 glowPos = {lights[i].position.x, lights[i].position.y - 1.5f, lights[i].position.z};
+            PushInstance(INSTANCES_GLOWS, glowPos, (Vector3){ 2.0f, 0.05f, 2.0f }, (Color){100, 90, 70, 40});
+        }
+    }
+}
+
+void UpdateLightFlicker(float deltaTime)
+{
+    flickerTimer += deltaTime;
+    
+    // Random flicker effect
+    if (flickerTimer > 0.1f) {
+        flickerTimer = 0.0f;
+        globalFlicker = 0.85f + ((float)(rand() % 30) / 100.0f);
+        
+        // Randomly toggle individual lights for dramatic effect
+        for (int i = 0; i < lightCount; i++) {
+            lights[i].flickerTimer += deltaTime * lights[i].flickerSpeed;
+            if (lights[i].flickerTimer > 1.0f) {
+                lights[i].flickerTimer = 0.0f;
+                // 5% chance to flicker off briefly
+                if (rand() % 100 < 5) {
+                    lights[i].isOn = !lights[i].isOn;
+                } else {
+                    lights[i].isOn = true;
+                }
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------
+// Retained HUD
+//------------------------------------------------------------------------------------
+// HUD text lives in widgets that cache their rendered image in a render texture.
+// Each widget is bound to the game values it shows; UpdateGameHud() hashes those
+// values every frame and only formats, measures and re-renders a widget when the
+// hash changes. Drawing the HUD is then one textured quad per visible widget.
+typedef enum {
+    HUD_AMMO = 0,       // Ammo count or the reload notice
+    HUD_HINT,           // Controls, rendered once
+    HUD_ENEMIES,        // Enemies left
+    HUD_STATS,          // Visibility and instancing counters
+    HUD_VICTORY,        // Shown when the area is cleared
+    HUD_WIDGET_COUNT
+} HudWidgetId;
+
+typedef struct HudWidget {
+    unsigned int key;           // Hash of the bound values the cached image shows
+    bool rendered;
+    bool visible;
+    RenderTexture2D target;     // Premultiplied text, grown as needed
+    int width;                  // Used part of the target
+    int height;
+    Vector2 position;           // Top left on screen
+} HudWidget;
+
+HudWidget hudWidgets[HUD_WIDGET_COUNT] = { 0 };
+
+// True (and remembers the new values) when a widget's bound values changed
+static bool HudValuesChanged(HudWidget *widget, const int *values, int count)
+{
+    unsigned int key = HashBytes(2166136261u, values, count*sizeof(int));
+    if (widget->rendered && key == widget->key) return false;
+    widget->key = key;
+    return true;
+}
+
+// Lay out and render a widget's text into its cached texture (outside BeginMode3D/BeginTextureMode)
+static void RenderHudWidget(HudWidget *widget, const char *text, int fontSize, Color color)
+{
+    widget->width = MeasureText(text, fontSize);
+    widget->height = fontSize;
+    if (widget->target.id == 0 || widget->target.texture.width < widget->width || widget->target.texture.height < widget->height) {
+        if (widget->target.id != 0) UnloadRenderTexture(widget->target);
+        widget->target = LoadRenderTexture((widget->width + 63) & ~63, widget->height);
+    }
+
+    // Blend color as usual but keep coverage as alpha, so the texture holds premultiplied text
+    BeginTextureMode(widget->target);
+        ClearBackground(BLANK);
+        rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE, RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD, RL_FUNC_ADD);
+        BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+            DrawText(text, 0, 0, fontSize, color);
+        EndBlendMode();
+    EndTextureMode();
+
+    widget->rendered = true;
+}
+
+// Bring the HUD widgets up to date with the game; call before BeginDrawing()
+void UpdateGameHud(const Weapon *weapon, int enemiesLeft)
+{
+    HudWidget *ammo = &hudWidgets[HUD_AMMO];
+    int ammoValues[3] = { weapon->currentAmmo, weapon->maxAmmo, weapon->isReloading };
+    if (HudValuesChanged(ammo, ammoValues, 3)) {
+        if (weapon->isReloading) {
+            RenderHudWidget(ammo, "RELOADING...", 30, (Color){200, 150, 50, 255});
+            ammo->position = (Vector2){ (float)(screenWidth - ammo->width - 20), (float)(screenHeight - 40) };
+        } else {
+            Color ammoColor = (weapon->currentAmmo <= weapon->maxAmmo / 4) ? RED : (Color){180, 180, 160, 255};
+            RenderHudWidget(ammo, TextFormat("AMMO: %d / %d", weapon->currentAmmo, weapon->maxAmmo), 40, ammoColor);
+            ammo->position = (Vector2){ (float)(screenWidth - ammo->width - 20), (float)(screenHeight - 50) };
+        }
+    }
+
+    HudWidget *hint = &hudWidgets[HUD_HINT];
+    if (!hint->rendered) {
+        RenderHudWidget(hint, "WASD: Move | Mouse: Look | LMB: Shoot | R: Reload | 1/2: Switch", 16, (Color){150, 150, 140, 200});
+        hint->position = (Vector2){ 10, 10 };
+    }
+
+    HudWidget *enemies = &hudWidgets[HUD_ENEMIES];
+    if (HudValuesChanged(enemies, &enemiesLeft, 1)) {
+        RenderHudWidget(enemies, TextFormat("Enemies: %d", enemiesLeft), 20, (Color){180, 100, 100, 255});
+        enemies->position = (Vector2){ 10, 30 };
+    }
+
+    // Counters of the last drawn frame
+    HudWidget *stats = &hudWidgets[HUD_STATS];
+    int statValues[7] = { levelVisibility.visibleRooms, roomCount, levelVisibility.culledObjects, levelVisibility.totalObjects,
+                          instanceStats.instances, instanceStats.drawCalls, instanceStats.uploaded };
+    if (HudValuesChanged(stats, statValues, 7)) {
+        RenderHudWidget(stats, TextFormat("Rooms: %d/%d  Culled: %d/%d  Instances: %d in %d draws, %d updated", statValues[0], statValues[1],
+                        statValues[2], statValues[3], statValues[4], statValues[5], statValues[6]), 16, (Color){150, 150, 140, 200});
+        stats->position = (Vector2){ 10, 55 };
+    }
+
+    HudWidget *victory = &hudWidgets[HUD_VICTORY];
+    if (!victory->rendered) {
+        RenderHudWidget(victory, "AREA CLEARED!", 40, (Color){100, 200, 100, 255});
+        victory->position = (Vector2){ (float)(screenWidth/2 - victory->width/2), (float)(screenHeight/2 - 50) };
+    }
+
+    for (int i = 0; i < HUD_WIDGET_COUNT; i++) hudWidgets[i].visible = (i != HUD_VICTORY) || enemiesLeft == 0;
+}
+
+// Draw the cached widgets (screen space)
+void DrawHud(void)
+{
+    BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+    for (int i = 0; i < HUD_WIDGET_COUNT; i++) {
+        const HudWidget *widget = &hudWidgets[i];
+        if (!widget->visible || !widget->rendered) continue;
+
+        // Render textures are stored bottom up; the text sits in the top rows
+        Rectangle source = { 0.0f, (float)(widget->target.texture.height - widget->height), (float)widget->width, -(float)widget->height };
+        DrawTextureRec(widget->target.texture, source, widget->position, WHITE);
+    }
+    EndBlendMode();
+}
+
+void UnloadHud(void)
+{
+    for (int i = 0; i < HUD_WIDGET_COUNT; i++) {
+        if (hudWidgets[i].target.id != 0) UnloadRenderTexture(hudWidgets[i].target);
+        hudWidgets[i] = (HudWidget){ 0 };
+    }
+}
+
+//------------------------------------------------------------------------------------
+// Simulation
+//------------------------------------------------------------------------------------
+#define SIM_TICK_RATE 60
+#define SIM_DT (1.0f/SIM_TICK_RATE)
+#define MAX_SIM_STEPS_PER_FRAME 8   // Catch-up limit after a hitch; older time is dropped
+
+#define MAX_BULLETS 1024     // Default projectile pool capacity (--max-bullets)
+
+// Camera controller (matches raylib CAMERA_FIRST_PERSON, scaled by delta time)
+#define CAMERA_MOVE_SPEED 5.4f
+#define CAMERA_ROTATION_SPEED 1.8f
+#define CAMERA_MOUSE_MOVE_SENSITIVITY 0.003f
+
+// Physics
+#define GRAVITY 13.0f
+#define JUMP_FORCE 6.0f
+
+// Input buttons sampled once per tick
+typedef enum {
+    INPUT_FORWARD    = 1 << 0,
+    INPUT_BACK       = 1 << 1,
+    INPUT_LEFT       = 1 << 2,
+    INPUT_RIGHT      = 1 << 3,
+    INPUT_LOOK_UP    = 1 << 4,
+    INPUT_LOOK_DOWN  = 1 << 5,
+    INPUT_LOOK_LEFT  = 1 << 6,
+    INPUT_LOOK_RIGHT = 1 << 7,
+    INPUT_JUMP       = 1 << 8,
+    INPUT_FIRE       = 1 << 9,
+    INPUT_RELOAD     = 1 << 10,
+    INPUT_WEAPON_1   = 1 << 11,
+    INPUT_WEAPON_2   = 1 << 12
+} InputButton;
+
+typedef struct SimInput {
+    unsigned int down;      // Buttons held this tick
+    unsigned int pressed;   // Buttons that went down this tick
+    Vector2 mouseDelta;
+    float wheel;
+} SimInput;
+
+typedef struct Bullet {
+    Vector3 position;
+    Vector3 previous;       // Position before the last tick, for render interpolation
+    Vector3 direction;
+    float damage;
+} Bullet;
+
+// Projectile pool: live bullets are packed densely in bullets[0..count), so update
+// and draw only touch the active set. Allocate pops a free handle id, release swaps
+// the last live bullet into the hole; both are O(1).
+typedef struct ProjectilePool {
+    Bullet *bullets;    // Dense live bullets
+    int *ids;           // Handle id of each dense slot
+    int *slotOf;        // Handle id -> dense slot, -1 when free
+    int *freeIds;       // Stack of free handle ids
+    int freeCount;
+    int count;
+    int capacity;
+} ProjectilePool;
+
+#define BULLET_SPEED 120.0f         // Units per second
+#define BULLET_RADIUS 0.1f
+
+// Weapon feel, as rates so it plays the same at any step length
+#define RECOIL_RECOVERY 1.2f        // Recoil offset regained per second
+#define SWAY_SMOOTHING 0.1f         // Fraction of the way to the target sway per 1/60 s
+#define BOB_SETTLE 0.1f             // Fraction of the way to the resting bob per 1/60 s
+
+// Enemy AI states
+typedef enum {
+    ENEMY_IDLE = 0,     // Standing guard until the player comes close or shoots it
+    ENEMY_CHASE,        // Closing in on the player
+    ENEMY_ENGAGE        // Holding position within engage range
+} EnemyState;
+
+#define MAX_ENEMY_CAPACITY 4096     // Default enemy store capacity (--max-enemies)
+#define ENEMY_HEALTH 100.0f
+#define ENEMY_SPEED 2.5f
+#define ENEMY_RADIUS 0.8f           // Level collision while moving
+#define ENEMY_ALERT_RANGE 12.0f
+#define ENEMY_ENGAGE_RANGE 4.0f
+#define ENEMY_DISENGAGE_RANGE 6.0f
+
+// Enemy entity store: structure-of-arrays, live enemies packed densely in
+// [0..count) with the same handle scheme as the projectile pool. Hitboxes live
+// in a LevelBoxSoA (kind COLLIDER_ENEMY, collider = handle id) so bullet sweeps
+// reuse the batch segment kernel. Everything is sized once at init.
+typedef struct EnemyStore {
+    Vector3 *position;      // Hitbox center
+    Vector3 *velocity;
+    float *health;
+    unsigned char *state;   // EnemyState
+    LevelBoxSoA hitboxes;
+    int *ids;               // Handle id of each dense slot
+    int *slotOf;            // Handle id -> dense slot, -1 when free
+    int *freeIds;
+    int freeCount;
+    int count;              // Live enemies
+    int capacity;
+} EnemyStore;
+#define ENEMY_HALF_EXTENTS (Vector3){ 0.9f, 1.0f, 0.9f }
+#define ENEMY_JOB_GRAIN 64              // Fewest enemies worth a job of their own
+#define BULLET_JOB_GRAIN 32             // Fewest bullet sweeps worth a job of their own
+
+typedef enum { HIT_NONE = 0, HIT_LEVEL, HIT_ENEMY } HitType;
+
+typedef struct SweepHit {
+    int type;       // HitType
+    int index;      // Level collider or enemy handle id
+    float t;        // Time of impact along the segment, 0..1
+    Vector3 point;
+} SweepHit;
+
+#define MAX_PELLETS 12              // Rays per hitscan shot
+#define HITSCAN_RANGE 100.0f
+
+typedef struct SceneRay {
+    Vector3 origin;
+    Vector3 direction;      // Unit length
+    float maxDistance;
+} SceneRay;
+
+typedef struct SceneHit {
+    int type;               // HitType
+    int index;              // Level collider or enemy handle id, -1 for none
+    int kind;               // ColliderKind of the surface, COLLIDER_ENEMY for enemies
+    float distance;         // maxDistance when nothing was hit
+    Vector3 point;
+    Vector3 normal;         // Zero when nothing was hit
+} SceneHit;
+
+// Enemy perception: line of sight to the players, time-sliced
+#define LOS_BUDGET_PER_TICK 64      // Queries traced per tick, the rest wait their turn
+#define LOS_REFRESH_TICKS 6         // Re-queue a result this old
+#define LOS_MAX_AGE_TICKS 30        // Results older than this are not acted on
+#define LOS_EYE_HEIGHT 0.6f         // Above the hitbox center
+#define LOS_NO_TICK 0xFFFFFFFFu
+
+typedef struct PerceptionStats {
+    unsigned long long requests;        // Queries queued
+    unsigned long long processed;       // Queries traced
+    unsigned long long cacheHits;       // Lookups answered by a fresh enough result
+    unsigned long long latencyTicks;    // Queue-to-trace ticks, summed over processed
+    unsigned int maxLatency;
+    int processedLastTick;
+} PerceptionStats;
+
+// Line of sight results by enemy handle id, and a FIFO of the enemies waiting for a
+// trace. Each enemy is queued at most once, so the FIFO serves them round robin.
+typedef struct PerceptionCache {
+    unsigned char *visible;     // Nearest player in sight when last traced
+    unsigned int *checkedTick;  // Tick of the last trace, LOS_NO_TICK before the first
+    unsigned int *queuedTick;   // Tick the pending query was queued, LOS_NO_TICK when none
+    int *queue;                 // Ring of enemy handle ids
+    int head;
+    int count;
+    int capacity;               // Enemy store capacity
+    SceneRay rays[LOS_BUDGET_PER_TICK];
+    SceneHit hits[LOS_BUDGET_PER_TICK];
+    int rayIds[LOS_BUDGET_PER_TICK];
+    PerceptionStats stats;
+} PerceptionCache;
+
+#define MAX_SOUND_EVENTS 64         // Sounds started per tick, the rest are dropped
+
+// A sound the simulation started this tick, played by the audio mixer
+typedef struct SoundEvent {
+    int sound;              // SoundId
+    int source;             // Player slot that made it, -1 for the world
+    Vector3 position;
+} SoundEvent;
+
+#define MAX_PLAYERS 32              // Player slots: the local game plays slot 0, a server one per client
+#define BULLET_RANGE 100.0f         // Bullets further than this from every player are dropped
+
+// Everything one player controls: view, weapons and movement
+typedef struct PlayerState {
+    bool active;
+    Camera camera;
+
+    Weapon weapons[2];
+    int currentWeapon;
+
+    // Weapon Switch Logic
+    int targetWeapon;
+    bool isSwitching;
+    float switchTimer;
+    float switchDuration;
+
+    // Gun Dynamics
+    float recoilOffset;
+    Vector2 weaponSway;
+    float weaponBob;
+
+    // Physics & Movement
+    float verticalVelocity;
+    bool isGrounded;
+    float playerHeight;
+    float playerRadius;
+} PlayerState;
+
+typedef struct GameState {
+    PlayerState players[MAX_PLAYERS];
+
+    // Enemies
+    EnemyStore enemies;
+
+    // Projectiles
+    ProjectilePool projectiles;
+    SweepHit *bulletHits;       // Per-slot sweep result of the current tick
+
+    // Hitscan pellets fired this tick, traced as one batch
+    SceneRay *shotRays;
+    SceneHit *shotHits;
+    float *shotDamage;
+    int shotCount;
+
+    PerceptionCache perception;
+
+    // Sounds started this tick
+    SoundEvent sounds[MAX_SOUND_EVENTS];
+    int soundCount;
+
+    int *enemyNetIds;           // Network client: server handle id of each dense enemy slot, NULL elsewhere
+
+    unsigned int tick;
+    int shotsFired;
+} GameState;
+
+void InitProjectilePool(ProjectilePool *pool, int capacity)
+{
+    if (capacity < 1) capacity = 1;
+    pool->bullets = (Bullet *)malloc(capacity*sizeof(Bullet));
+    pool->ids = (int *)malloc(capacity*sizeof(int));
+    pool->slotOf = (int *)malloc(capacity*sizeof(int));
+    pool->freeIds = (int *)malloc(capacity*sizeof(int));
+    pool->capacity = capacity;
+    pool->count = 0;
+
+    // Hand out low ids first
+    pool->freeCount = capacity;
+    for (int i = 0; i < capacity; i++) {
+        pool->freeIds[i] = capacity - 1 - i;
+        pool->slotOf[i] = -1;
+    }
+}
+
+void UnloadProjectilePool(ProjectilePool *pool)
+{
+    free(pool->bullets);
+    free(pool->ids);
+    free(pool->slotOf);
+    free(pool->freeIds);
+    *pool = (ProjectilePool){ 0 };
+}
+
+// Returns the new bullet (at the end of the dense array), NULL if the pool is full
+Bullet *AllocProjectile(ProjectilePool *pool)
+{
+    if (pool->freeCount == 0) return NULL;
+
+    int id = pool->freeIds[--pool->freeCount];
+    int slot = pool->count++;
+    pool->ids[slot] = id;
+    pool->slotOf[id] = slot;
+    return &pool->bullets[slot];
+}
+
+// Release the bullet in dense slot. The last live bullet moves into the slot.
+void ReleaseProjectileAt(ProjectilePool *pool, int slot)
+{
+    int id = pool->ids[slot];
+    int last = --pool->count;
+
+    if (slot != last) {
+        pool->bullets[slot] = pool->bullets[last];
+        pool->ids[slot] = pool->ids[last];
+        pool->slotOf[pool->ids[slot]] = slot;
+    }
+
+    pool->slotOf[id] = -1;
+    pool->freeIds[pool->freeCount++] = id;
+}
+
+// Release by handle id (ids stay valid while their bullet is live)
+void ReleaseProjectile(ProjectilePool *pool, int id)
+{
+    if (id >= 0 && id < pool->capacity && pool->slotOf[id] >= 0) ReleaseProjectileAt(pool, pool->slotOf[id]);
+}
+
+void InitEnemyStore(EnemyStore *store, int capacity)
+{
+    if (capacity < 1) capacity = 1;
+    store->position = (Vector3 *)malloc(capacity*sizeof(Vector3));
+    store->velocity = (Vector3 *)malloc(capacity*sizeof(Vector3));
+    store->health = (float *)malloc(capacity*sizeof(float));
+    store->state = (unsigned char *)malloc(capacity);
+    AllocLevelBoxSoA(&store->hitboxes, capacity);
+    store->hitboxes.count = 0;
+    store->ids = (int *)malloc(capacity*sizeof(int));
+    store->slotOf = (int *)malloc(capacity*sizeof(int));
+    store->freeIds = (int *)malloc(capacity*sizeof(int));
+    store->capacity = capacity;
+    store->count = 0;
+
+    store->freeCount = capacity;
+    for (int i = 0; i < capacity; i++) {
+        store->freeIds[i] = capacity - 1 - i;
+        store->slotOf[i] = -1;
+    }
+}
+
+void UnloadEnemyStore(EnemyStore *store)
+{
+    free(store->position);
+    free(store->velocity);
+    free(store->health);
+    free(store->state);
+    FreeLevelBoxSoA(&store->hitboxes);
+    free(store->ids);
+    free(store->slotOf);
+    free(store->freeIds);
+    *store = (EnemyStore){ 0 };
+}
+
+static void SetEnemyHitbox(EnemyStore *store, int slot)
+{
+    const Vector3 half = ENEMY_HALF_EXTENTS;
+    Vector3 p = store->position[slot];
+    LevelBoxSoA *boxes = &store->hitboxes;
+    boxes->minX[slot] = p.x - half.x; boxes->maxX[slot] = p.x + half.x;
+    boxes->minY[slot] = p.y - half.y; boxes->maxY[slot] = p.y + half.y;
+    boxes->minZ[slot] = p.z - half.z; boxes->maxZ[slot] = p.z + half.z;
+}
+
+// Returns the new enemy's handle id, -1 if the store is full
+int SpawnEnemy(EnemyStore *store, Vector3 position)
+{
+    if (store->freeCount == 0) return -1;
+
+    int id = store->freeIds[--store->freeCount];
+    int slot = store->count++;
+    store->ids[slot] = id;
+    store->slotOf[id] = slot;
+
+    store->position[slot] = position;
+    store->velocity[slot] = (Vector3){ 0.0f, 0.0f, 0.0f };
+    store->health[slot] = ENEMY_HEALTH;
+    store->state[slot] = ENEMY_IDLE;
+    SetEnemyHitbox(store, slot);
+    store->hitboxes.kind[slot] = COLLIDER_ENEMY;
+    store->hitboxes.collider[slot] = id;
+    store->hitboxes.count = store->count;
+    return id;
+}
+
+// Despawn the enemy in dense slot. The last live enemy moves into the slot.
+void DespawnEnemyAt(EnemyStore *store, int slot)
+{
+    int id = store->ids[slot];
+    int last = --store->count;
+    LevelBoxSoA *boxes = &store->hitboxes;
+
+    if (slot != last) {
+        store->position[slot] = store->position[last];
+        store->velocity[slot] = store->velocity[last];
+        store->health[slot] = store->health[last];
+        store->state[slot] = store->state[last];
+        boxes->minX[slot] = boxes->minX[last]; boxes->maxX[slot] = boxes->maxX[last];
+        boxes->minY[slot] = boxes->minY[last]; boxes->maxY[slot] = boxes->maxY[last];
+        boxes->minZ[slot] = boxes->minZ[last]; boxes->maxZ[slot] = boxes->maxZ[last];
+        boxes->collider[slot] = boxes->collider[last];
+        store->ids[slot] = store->ids[last];
+        store->slotOf[store->ids[slot]] = slot;
+    }
+
+    boxes->kind[last] = 0;
+    boxes->count = store->count;
+    store->slotOf[id] = -1;
+    store->freeIds[store->freeCount++] = id;
+}
+
+void DespawnEnemy(EnemyStore *store, int id)
+{
+    if (id >= 0 && id < store->capacity && store->slotOf[id] >= 0) DespawnEnemyAt(store, store->slotOf[id]);
+}
+
+// Apply damage by handle id; the enemy is alerted, or despawned at zero health
+void DamageEnemy(EnemyStore *store, int id, float damage)
+{
+    if (id < 0 || id >= store->capacity || store->slotOf[id] < 0) return;
+
+    int slot = store->slotOf[id];
+    store->health[slot] -= damage;
+    if (store->health[slot] <= 0.0f) DespawnEnemyAt(store, slot);
+    else if (store->state[slot] == ENEMY_IDLE) store->state[slot] = ENEMY_CHASE;
+}
+
+void InitPerceptionCache(PerceptionCache *perception, int capacity)
+{
+    if (capacity < 1) capacity = 1;
+    perception->visible = (unsigned char *)calloc(capacity, 1);
+    perception->checkedTick = (unsigned int *)malloc(capacity*sizeof(unsigned int));
+    perception->queuedTick = (unsigned int *)malloc(capacity*sizeof(unsigned int));
+    perception->queue = (int *)malloc(capacity*sizeof(int));
+    perception->head = 0;
+    perception->count = 0;
+    perception->capacity = capacity;
+    perception->stats = (PerceptionStats){ 0 };
+    for (int i = 0; i < capacity; i++) perception->checkedTick[i] = perception->queuedTick[i] = LOS_NO_TICK;
+}
+
+void UnloadPerceptionCache(PerceptionCache *perception)
+{
+    free(perception->visible);
+    free(perception->checkedTick);
+    free(perception->queuedTick);
+    free(perception->queue);
+    perception->visible = NULL;
+    perception->checkedTick = perception->queuedTick = NULL;
+    perception->queue = NULL;
+    perception->count = perception->capacity = 0;
+}
+
+// Drop the line of sight result of a despawned enemy, whose handle id the next spawn
+// reuses. A query still queued is left to drain; it then serves the new enemy.
+void ForgetEnemyPerception(PerceptionCache *perception, int id)
+{
+    perception->visible[id] = 0;
+    perception->checkedTick[id] = LOS_NO_TICK;
+}
+
+// True when the enemy's last line of sight result is at most maxAge ticks old
+static bool IsPerceptionFresh(const PerceptionCache *perception, int id, unsigned int tick, unsigned int maxAge)
+{
+    unsigned int checked = perception->checkedTick[id];
+    return checked != LOS_NO_TICK && tick - checked <= maxAge;
+}
+
+// Advance enemy AI and movement one tick for dense slots [begin, end). Each enemy
+// goes for the nearest of the player positions in targets, and only writes its own
+// slot, so ranges can run on different threads. The flow field leads to targets[0];
+// an enemy after anyone else heads straight for them. An idle enemy is alerted by a
+// player in range only once perception has it in sight (NULL perception: range alone).
+void UpdateEnemies(EnemyStore *store, const Vector3 *targets, int targetCount, const PerceptionCache *perception,
+                   unsigned int tick, float deltaTime, int begin, int end)
+{
+    for (int i = begin; i < end; i++) {
+        Vector3 p = store->position[i];
+        if (targetCount == 0) {
+            store->velocity[i] = (Vector3){ 0.0f, 0.0f, 0.0f };
+            continue;
+        }
+
+        int nearest = 0;
+        float dx = targets[0].x - p.x;
+        float dz = targets[0].z - p.z;
+        float distance = sqrtf(dx*dx + dz*dz);
+        for (int t = 1; t < targetCount; t++) {
+            float tx = targets[t].x - p.x;
+            float tz = targets[t].z - p.z;
+            float d = sqrtf(tx*tx + tz*tz);
+            if (d < distance) { nearest = t; dx = tx; dz = tz; distance = d; }
+        }
+
+        switch (store->state[i]) {
+            case ENEMY_IDLE: {
+                int id = store->ids[i];
+                bool seen = (perception == NULL) ||
+                            (perception->visible[id] && IsPerceptionFresh(perception, id, tick, LOS_MAX_AGE_TICKS));
+                if (distance < ENEMY_ALERT_RANGE && seen) store->state[i] = ENEMY_CHASE;
+            } break;
+            case ENEMY_CHASE: if (distance < ENEMY_ENGAGE_RANGE) store->state[i] = ENEMY_ENGAGE; break;
+            case ENEMY_ENGAGE: if (distance > ENEMY_DISENGAGE_RANGE) store->state[i] = ENEMY_CHASE; break;
+            default: break;
+        }
+
+        if (store->state[i] != ENEMY_CHASE || distance < 0.001f) {
+            store->velocity[i] = (Vector3){ 0.0f, 0.0f, 0.0f };
+            continue;
+        }
+
+        // Follow the flow field around walls; head straight in once close
+        Vector3 heading = { dx/distance, 0.0f, dz/distance };
+        if (distance > ENEMY_ENGAGE_RANGE && nearest == 0) GetFlowDirection(p, &heading);
+        store->velocity[i] = Vector3Scale(heading, ENEMY_SPEED);
+
+        // Move, sliding along walls one axis at a time when blocked
+        Vector3 next = { p.x + store->velocity[i].x*deltaTime, p.y, p.z + store->velocity[i].z*deltaTime };
+        if (QueryLevelSphere(next, ENEMY_RADIUS, COLLIDE_PLAYER) >= 0) {
+            Vector3 slideX = { next.x, p.y, p.z };
+            Vector3 slideZ = { p.x, p.y, next.z };
+            if (QueryLevelSphere(slideX, ENEMY_RADIUS, COLLIDE_PLAYER) < 0) next = slideX;
+            else if (QueryLevelSphere(slideZ, ENEMY_RADIUS, COLLIDE_PLAYER) < 0) next = slideZ;
+            else next = p;
+        }
+
+        // Up and down steps; higher surfaces are walked under or blocked by the level
+        float feet = p.y - ENEMY_HALF_EXTENTS.y;
+        next.y = GetGroundHeight(next.x, next.z, feet + MAX_STEP_HEIGHT) + ENEMY_HALF_EXTENTS.y;
+
+        store->position[i] = next;
+        SetEnemyHitbox(store, i);
+    }
+}
+
+// Spawn a player at the level start with full magazines
+void InitPlayer(PlayerState *player)
+{
+    *player = (PlayerState){ 0 };
+    player->active = true;
+
+    // Define the camera to look into our 3d world
+    player->camera.position = levelPlayerStart;
+    player->camera.target = Vector3Add(levelPlayerStart, (Vector3){ 6.0f, 0.0f, 0.0f });
+    player->camera.up = (Vector3){ 0.0f, 1.0f, 0.0f };
+    player->camera.fovy = 60.0f;
+    player->camera.projection = CAMERA_PERSPECTIVE;
+
+    // Rifle
+    player->weapons[0].maxAmmo = 32;
+    player->weapons[0].currentAmmo = 32;
+    player->weapons[0].scale = 0.4f;
+    player->weapons[0].reloadTime = 2.0f;
+    player->weapons[0].cooldown = 0.1f;
+    player->weapons[0].automatic = true;
+    player->weapons[0].flashOffsetX = 60;
+    player->weapons[0].flashOffsetY = 100;
+    player->weapons[0].flashScale = 0.2f;
+    player->weapons[0].damage = 34.0f;
+    player->weapons[0].pellets = 1;
+    player->weapons[0].shotSound = SOUND_RIFLE_SHOT;
+
+    // Revolver
+    player->weapons[1].maxAmmo = 6;
+    player->weapons[1].currentAmmo = 6;
+    player->weapons[1].scale = 0.4f;
+    player->weapons[1].reloadTime = 1.5f;
+    player->weapons[1].cooldown = 0.5f;
+    player->weapons[1].automatic = false;
+    player->weapons[1].flashOffsetX = 60;
+    player->weapons[1].flashOffsetY = 110;
+    player->weapons[1].flashScale = 0.15f;
+    player->weapons[1].damage = 100.0f;
+    player->weapons[1].hitscan = true;     // One instant round down the sights
+    player->weapons[1].pellets = 1;
+    player->weapons[1].shotSound = SOUND_REVOLVER_SHOT;
+
+    player->currentWeapon = 0;
+    player->targetWeapon = 0;
+    player->switchDuration = 0.6f;
+
+    player->isGrounded = true;
+    player->playerHeight = 2.0f;
+    player->playerRadius = 0.5f;
+}
+
+// World with the local player in slot 0
+void InitGameState(GameState *state, int maxBullets, int maxEnemies)
+{
+    *state = (GameState){ 0 };
+    InitPlayer(&state->players[0]);
+
+    // Enemies at the level spawn points
+    InitEnemyStore(&state->enemies, (maxEnemies > levelEnemyCount)? maxEnemies : levelEnemyCount);
+    for (int e = 0; e < levelEnemyCount; e++) SpawnEnemy(&state->enemies, levelEnemySpawns[e]);
+
+    InitProjectilePool(&state->projectiles, maxBullets);
+    state->bulletHits = (SweepHit *)malloc(state->projectiles.capacity*sizeof(SweepHit));
+
+    state->shotRays = (SceneRay *)malloc(MAX_PLAYERS*MAX_PELLETS*sizeof(SceneRay));
+    state->shotHits = (SceneHit *)malloc(MAX_PLAYERS*MAX_PELLETS*sizeof(SceneHit));
+    state->shotDamage = (float *)malloc(MAX_PLAYERS*MAX_PELLETS*sizeof(float));
+
+    InitPerceptionCache(&state->perception, state->enemies.capacity);
+}
+
+void UnloadGameState(GameState *state)
+{
+    UnloadEnemyStore(&state->enemies);
+    UnloadProjectilePool(&state->projectiles);
+    free(state->bulletHits);
+    free(state->shotRays);
+    free(state->shotHits);
+    free(state->shotDamage);
+    free(state->enemyNetIds);
+    UnloadPerceptionCache(&state->perception);
+}
+
+// Read the raylib input devices into a tick input
+SimInput PollSimInput(void)
+{
+    PROFILE_SCOPE(PROFILE_INPUT);
+    SimInput input = { 0 };
+
+    if (IsKeyDown(KEY_W)) input.down |= INPUT_FORWARD;
+    if (IsKeyDown(KEY_S)) input.down |= INPUT_BACK;
+    if (IsKeyDown(KEY_A)) input.down |= INPUT_LEFT;
+    if (IsKeyDown(KEY_D)) input.down |= INPUT_RIGHT;
+    if (IsKeyDown(KEY_UP)) input.down |= INPUT_LOOK_UP;
+    if (IsKeyDown(KEY_DOWN)) input.down |= INPUT_LOOK_DOWN;
+    if (IsKeyDown(KEY_LEFT)) input.down |= INPUT_LOOK_LEFT;
+    if (IsKeyDown(KEY_RIGHT)) input.down |= INPUT_LOOK_RIGHT;
+    if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) input.down |= INPUT_FIRE;
+
+    if (IsKeyPressed(KEY_SPACE)) input.pressed |= INPUT_JUMP;
+    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) input.pressed |= INPUT_FIRE;
+    if (IsKeyPressed(KEY_R)) input.pressed |= INPUT_RELOAD;
+    if (IsKeyPressed(KEY_ONE)) input.pressed |= INPUT_WEAPON_1;
+    if (IsKeyPressed(KEY_TWO)) input.pressed |= INPUT_WEAPON_2;
+
+    input.mouseDelta = GetMouseDelta();
+    input.wheel = GetMouseWheelMove();
+
+    return input;
+}
+
+// Scripted input for headless runs: walk and turn through the level,
+// hold fire, jump, reload and swap weapons on a fixed schedule
+SimInput GenerateBotInput(unsigned int tick)
+{
+    SimInput input = { 0 };
+
+    input.down |= INPUT_FORWARD | INPUT_FIRE;
+    if ((tick/120) % 2) input.down |= INPUT_LEFT;
+    if (tick % 15 == 0) input.pressed |= INPUT_FIRE;
+    if (tick % 90 == 0) input.pressed |= INPUT_JUMP;
+    if (tick % 400 == 200) input.pressed |= INPUT_RELOAD;
+    if (tick % 600 == 300) input.pressed |= INPUT_WEAPON_2;
+    if (tick % 600 == 0) input.pressed |= INPUT_WEAPON_1;
+
+    input.mouseDelta.x = 4.0f*sinf(tick*0.01f);
+    input.mouseDelta.y = 0.5f*sinf(tick*0.037f);
+
+    return input;
+}
+
+void RotateCameraYaw(Camera *camera, float angle)
+{
+    Vector3 up = Vector3Normalize(camera->up);
+    Vector3 targetPosition = Vector3Subtract(camera->target, camera->position);
+    targetPosition = Vector3RotateByAxisAngle(targetPosition, up, angle);
+    camera->target = Vector3Add(camera->position, targetPosition);
+}
+
+void RotateCameraPitch(Camera *camera, float angle)
+{
+    Vector3 up = Vector3Normalize(camera->up);
+    Vector3 targetPosition = Vector3Subtract(camera->target, camera->position);
+
+    // Lock the view so the camera never flips over the up axis
+    float maxAngleUp = Vector3Angle(up, targetPosition) - 0.001f;
+    if (angle > maxAngleUp) angle = maxAngleUp;
+    float maxAngleDown = -Vector3Angle(Vector3Negate(up), targetPosition) + 0.001f;
+    if (angle < maxAngleDown) angle = maxAngleDown;
+
+    Vector3 right = Vector3Normalize(Vector3CrossProduct(targetPosition, up));
+    targetPosition = Vector3RotateByAxisAngle(targetPosition, right, angle);
+    camera->target = Vector3Add(camera->position, targetPosition);
+}
+
+void UpdatePlayerCamera(Camera *camera, const SimInput *input, float deltaTime)
+{
+    // Camera rotation
+    float rotation = CAMERA_ROTATION_SPEED*deltaTime;
+    if (input->down & INPUT_LOOK_DOWN) RotateCameraPitch(camera, -rotation);
+    if (input->down & INPUT_LOOK_UP) RotateCameraPitch(camera, rotation);
+    if (input->down & INPUT_LOOK_RIGHT) RotateCameraYaw(camera, -rotation);
+    if (input->down & INPUT_LOOK_LEFT) RotateCameraYaw(camera, rotation);
+
+    RotateCameraYaw(camera, -input->mouseDelta.x*CAMERA_MOUSE_MOVE_SENSITIVITY);
+    RotateCameraPitch(camera, -input->mouseDelta.y*CAMERA_MOUSE_MOVE_SENSITIVITY);
+
+    // Camera movement, kept in the world plane
+    Vector3 forward = Vector3Subtract(camera->target, camera->position);
+    forward.y = 0.0f;
+    forward = Vector3Normalize(forward);
+    Vector3 right = Vector3Normalize(Vector3CrossProduct(forward, camera->up));
+
+    Vector3 move = { 0 };
+    if (input->down & INPUT_FORWARD) move = Vector3Add(move, forward);
+    if (input->down & INPUT_BACK) move = Vector3Subtract(move, forward);
+    if (input->down & INPUT_RIGHT) move = Vector3Add(move, right);
+    if (input->down & INPUT_LEFT) move = Vector3Subtract(move, right);
+    move = Vector3Scale(move, CAMERA_MOVE_SPEED*deltaTime);
+
+    camera->position = Vector3Add(camera->position, move);
+    camera->target = Vector3Add(camera->target, move);
+}
+
+// Sweep a projectile from start to end against the level and every live enemy,
+// returning the earliest impact so nothing behind a wall can be hit
+bool SweepProjectile(const GameState *state, Vector3 start, Vector3 end, float radius, SweepHit *hit)
+{
+    *hit = (SweepHit){ HIT_NONE, -1, 1.0f, end };
+
+    float t;
+    int collider = SweepLevelSegment(start, end, radius, COLLIDE_BULLET, &t);
+    if (collider >= 0) {
+        hit->type = HIT_LEVEL;
+        hit->index = collider;
+        hit->t = t;
+    }
+
+    // Enemy hitboxes, 32 at a time through the batch kernel
+    Vector3 delta = Vector3Subtract(end, start);
+    Vector3 invDelta = SafeInverseDelta(delta);
+    const EnemyStore *enemies = &state->enemies;
+    float tEntry[32];
+    for (int k = 0; k < enemies->count; k += 32) {
+        unsigned int hits = SegmentBoxMask(&enemies->hitboxes, k, (enemies->count - k < 32)? enemies->count - k : 32,
+                                           start, invDelta, radius, COLLIDER_ENEMY, tEntry);
+        while (hits) {
+            int i = LowestSetBit(hits);
+            hits &= hits - 1;
+            if (tEntry[i] < hit->t) {
+                hit->type = HIT_ENEMY;
+                hit->index = enemies->ids[k + i];
+                hit->t = tEntry[i];
+            }
+        }
+    }
+
+    hit->point = Vector3Add(start, Vector3Scale(delta, hit->t));
+    return hit->type != HIT_NONE;
+}
+
+//------------------------------------------------------------------------------------
+// Scene Raycasts
+//------------------------------------------------------------------------------------
+// Batched nearest-hit queries for hitscan weapons. Consecutive rays that start close
+// together and head the same way (the pellets of a shot) are traced as a packet: the
+// packet walks the collision grid one column of cells at a time along its main axis,
+// reading each cell once for every ray crossing it, and stops as soon as every ray
+// has a hit before the next column. Enemies are culled per packet with one fat
+// segment around all its rays before the per-ray tests.
+#define RAY_PACKET_SIZE 16
+#define RAY_PACKET_SPREAD 4.0f      // A ray starting further than this from the packet's first starts a new one
+#define RAY_JOB_GRAIN 64
+
+typedef struct RaycastJob {
+    const SceneRay *rays;
+    SceneHit *hits;
+    int mask;
+    const EnemyStore *enemies;
+    int packetSize;
+} RaycastJob;
+
+// Main walk axis of a ray: 0 (x) or 2 (z), the larger horizontal component
+static int GetRayAxis(Vector3 direction)
+{
+    return (fabsf(direction.x) >= fabsf(direction.z))? 0 : 2;
+}
+
+// Face of the box the ray enters through (the slab entered last), or the reversed
+// ray when it starts inside
+static Vector3 GetRayBoxNormal(Vector3 origin, Vector3 direction, Vector3 boxMin, Vector3 boxMax)
+{
+    Vector3 invDirection = SafeInverseDelta(direction);
+    float tx = ((direction.x >= 0.0f)? boxMin.x - origin.x : boxMax.x - origin.x)*invDirection.x;
+    float ty = ((direction.y >= 0.0f)? boxMin.y - origin.y : boxMax.y - origin.y)*invDirection.y;
+    float tz = ((direction.z >= 0.0f)? boxMin.z - origin.z : boxMax.z - origin.z)*invDirection.z;
+    if (tx <= 0.0f && ty <= 0.0f && tz <= 0.0f) return Vector3Negate(direction);
+    if (tx >= ty && tx >= tz) return (Vector3){ (direction.x >= 0.0f)? -1.0f : 1.0f, 0.0f, 0.0f };
+    if (ty >= tz) return (Vector3){ 0.0f, (direction.y >= 0.0f)? -1.0f : 1.0f, 0.0f };
+    return (Vector3){ 0.0f, 0.0f, (direction.z >= 0.0f)? -1.0f : 1.0f };
+}
+
+// Trace up to RAY_PACKET_SIZE rays sharing a walk axis and direction along it
+static void TraceRayPacket(const SceneRay *rays, int count, int mask, const EnemyStore *enemies, SceneHit *hits)
+{
+    Vector3 start[RAY_PACKET_SIZE], delta[RAY_PACKET_SIZE], invDelta[RAY_PACKET_SIZE];
+    float best[RAY_PACKET_SIZE];
+    int bestIndex[RAY_PACKET_SIZE], bestType[RAY_PACKET_SIZE];
+    int rowLo[RAY_PACKET_SIZE], rowHi[RAY_PACKET_SIZE];
+    float tEntry[32];
+
+    for (int i = 0; i < count; i++) {
+        start[i] = rays[i].origin;
+        delta[i] = Vector3Scale(rays[i].direction, rays[i].maxDistance);
+        invDelta[i] = SafeInverseDelta(delta[i]);
+        best[i] = 1.0f;
+        bestIndex[i] = -1;
+        bestType[i] = HIT_NONE;
+    }
+
+    // Level: columns of cells along the walk axis, in ray order
+    const UniformGrid *grid = &collisionGrid;
+    int axis = GetRayAxis(rays[0].direction), other = 2 - axis;
+    int step = (GetAxis(rays[0].direction, axis) >= 0.0f)? 1 : -1;
+    int columns = (axis == 0)? grid->cellsX : grid->cellsZ, rows = (axis == 0)? grid->cellsZ : grid->cellsX;
+    float originA = (axis == 0)? grid->originX : grid->originZ, originB = (axis == 0)? grid->originZ : grid->originX;
+    const float eps = 1e-4f;
+
+    int first = (step > 0)? columns : -1, last = (step > 0)? -1 : columns;
+    for (int i = 0; i < count && grid->cellStart != NULL; i++) {
+        int c0 = (int)floorf((GetAxis(start[i], axis) - originA)/grid->cellSize);
+        int c1 = (int)floorf((GetAxis(start[i], axis) + GetAxis(delta[i], axis) - originA)/grid->cellSize);
+        if (step > 0) { first = (c0 < first)? c0 : first; last = (c1 > last)? c1 : last; }
+        else { first = (c0 > first)? c0 : first; last = (c1 < last)? c1 : last; }
+    }
+    if (step > 0) { first = (first < 0)? 0 : first; last = (last >= columns)? columns - 1 : last; }
+    else { first = (first >= columns)? columns - 1 : first; last = (last < 0)? 0 : last; }
+
+    for (int col = first; (step > 0)? col <= last : col >= last; col += step) {
+        float lo = originA + col*grid->cellSize - eps, hi = lo + grid->cellSize + 2*eps;
+        int rowMin = rows, rowMax = -1, remaining = 0;
+        for (int i = 0; i < count; i++) {
+            float a = GetAxis(start[i], axis), inv = GetAxis(invDelta[i], axis);
+            float t0 = (lo - a)*inv, t1 = (hi - a)*inv;
+            if (t0 > t1) { float swap = t0; t0 = t1; t1 = swap; }
+            if (t0 <= best[i]) remaining++;
+            t0 = fmaxf(t0, 0.0f);
+            t1 = fminf(t1, best[i]);
+            rowLo[i] = 1;
+            rowHi[i] = 0;
+            if (t0 > t1) continue;
+
+            float b0 = GetAxis(start[i], other) + GetAxis(delta[i], other)*t0;
+            float b1 = GetAxis(start[i], other) + GetAxis(delta[i], other)*t1;
+            rowLo[i] = (int)floorf((fminf(b0, b1) - eps - originB)/grid->cellSize);
+            rowHi[i] = (int)floorf((fmaxf(b0, b1) + eps - originB)/grid->cellSize);
+            if (rowLo[i] < 0) rowLo[i] = 0;
+            if (rowHi[i] >= rows) rowHi[i] = rows - 1;
+            if (rowLo[i] < rowMin) rowMin = rowLo[i];
+            if (rowHi[i] > rowMax) rowMax = rowHi[i];
+        }
+        if (remaining == 0) break;
+
+        for (int row = rowMin; row <= rowMax; row++) {
+            int cell = (axis == 0)? row*grid->cellsX + col : col*grid->cellsX + row;
+            int cellEnd = grid->cellStart[cell + 1];
+            for (int k = grid->cellStart[cell]; k < cellEnd; k += 32) {
+                int n = (cellEnd - k < 32)? cellEnd - k : 32;
+                for (int i = 0; i < count; i++) {
+                    if (row < rowLo[i] || row > rowHi[i]) continue;
+                    unsigned int hitMask = SegmentBoxMask(&collisionBoxes, k, n, start[i], invDelta[i], 0.0f, mask, tEntry);
+                    while (hitMask) {
+                        int b = LowestSetBit(hitMask);
+                        hitMask &= hitMask - 1;
+                        if (tEntry[b] <= best[i]) {
+                            best[i] = tEntry[b];
+                            bestIndex[i] = collisionBoxes.collider[k + b];
+                            bestType[i] = HIT_LEVEL;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Enemies: a segment from the mean start to the mean end, fattened to hold every
+    // ray up to its level hit, picks the candidates
+    if ((mask & COLLIDER_ENEMY) && enemies != NULL && enemies->count > 0) {
+        Vector3 c0 = { 0 }, c1 = { 0 };
+        for (int i = 0; i < count; i++) {
+            c0 = Vector3Add(c0, start[i]);
+            c1 = Vector3Add(c1, Vector3Add(start[i], Vector3Scale(delta[i], best[i])));
+        }
+        c0 = Vector3Scale(c0, 1.0f/count);
+        c1 = Vector3Scale(c1, 1.0f/count);
+        Vector3 axisDelta = Vector3Subtract(c1, c0);
+        float axisLengthSqr = Vector3DotProduct(axisDelta, axisDelta);
+        float radius = 0.0f;
+        for (int i = 0; i < count; i++) {
+            Vector3 ends[2] = { start[i], Vector3Add(start[i], Vector3Scale(delta[i], best[i])) };
+            for (int e = 0; e < 2; e++) {
+                float s = (axisLengthSqr > 0.0f)? Clamp(Vector3DotProduct(Vector3Subtract(ends[e], c0), axisDelta)/axisLengthSqr, 0.0f, 1.0f) : 0.0f;
+                radius = fmaxf(radius, Vector3Distance(ends[e], Vector3Add(c0, Vector3Scale(axisDelta, s))));
+            }
+        }
+        Vector3 axisInv = SafeInverseDelta(axisDelta);
+
+        for (int k = 0; k < enemies->count; k += 32) {
+            int n = (enemies->count - k < 32)? enemies->count - k : 32;
+            unsigned int candidates = SegmentBoxMask(&enemies->hitboxes, k, n, c0, axisInv, radius + eps, COLLIDER_ENEMY, tEntry);
+            if (candidates == 0) continue;
+            for (int i = 0; i < count; i++) {
+                unsigned int hitMask = SegmentBoxMask(&enemies->hitboxes, k, n, start[i], invDelta[i], 0.0f, COLLIDER_ENEMY, tEntry) & candidates;
+                while (hitMask) {
+                    int b = LowestSetBit(hitMask);
+                    hitMask &= hitMask - 1;
+                    if (tEntry[b] < best[i]) {
+                        best[i] = tEntry[b];
+                        bestIndex[i] = k + b;
+                        bestType[i] = HIT_ENEMY;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        SceneHit *hit = &hits[i];
+        hit->type = bestType[i];
+        hit->distance = best[i]*rays[i].maxDistance;
+        hit->point = Vector3Add(start[i], Vector3Scale(delta[i], best[i]));
+        hit->normal = (Vector3){ 0.0f, 0.0f, 0.0f };
+        hit->index = -1;
+        hit->kind = 0;
+        if (bestType[i] == HIT_LEVEL) {
+            const LevelCollider *c = &levelColliders[bestIndex[i]];
+            Vector3 half = Vector3Scale(c->size, 0.5f);
+            hit->index = bestIndex[i];
+            hit->kind = c->kind;
+            hit->normal = GetRayBoxNormal(start[i], rays[i].direction, Vector3Subtract(c->position, half), Vector3Add(c->position, half));
+        } else if (bestType[i] == HIT_ENEMY) {
+            const LevelBoxSoA *boxes = &enemies->hitboxes;
+            int slot = bestIndex[i];
+            hit->index = enemies->ids[slot];
+            hit->kind = COLLIDER_ENEMY;
+            hit->normal = GetRayBoxNormal(start[i], rays[i].direction, (Vector3){ boxes->minX[slot], boxes->minY[slot], boxes->minZ[slot] },
+                                          (Vector3){ boxes->maxX[slot], boxes->maxY[slot], boxes->maxZ[slot] });
+        }
+    }
+}
+
+// Split a range of rays into packets of coherent neighbours and trace them
+static void RaycastJobRange(void *data, int begin, int end)
+{
+    const RaycastJob *job = (const RaycastJob *)data;
+    const SceneRay *rays = job->rays;
+    int i = begin;
+    while (i < end) {
+        int axis = GetRayAxis(rays[i].direction);
+        bool positive = GetAxis(rays[i].direction, axis) >= 0.0f;
+        int n = 1;
+        while (i + n < end && n < job->packetSize && GetRayAxis(rays[i + n].direction) == axis &&
+               (GetAxis(rays[i + n].direction, axis) >= 0.0f) == positive &&
+               Vector3DistanceSqr(rays[i + n].origin, rays[i].origin) <= RAY_PACKET_SPREAD*RAY_PACKET_SPREAD) n++;
+        TraceRayPacket(&rays[i], n, job->mask, job->enemies, &job->hits[i]);
+        i += n;
+    }
+}
+
+// Nearest hit of every ray against the level colliders whose kind is in mask, and
+// the enemies if mask has COLLIDER_ENEMY (enemies may be NULL). Rays are traced in
+// parallel jobs; each ray's result is independent of the batch and thread count.
+void RaycastScenePackets(const SceneRay *rays, int count, int mask, const EnemyStore *enemies, SceneHit *hits, int packetSize)
+{
+    RaycastJob job = { rays, hits, mask, enemies, (packetSize < 1)? 1 : (packetSize > RAY_PACKET_SIZE)? RAY_PACKET_SIZE : packetSize };
+    ParallelFor(RaycastJobRange, &job, count, RAY_JOB_GRAIN);
+}
+
+void RaycastScene(const SceneRay *rays, int count, int mask, const EnemyStore *enemies, SceneHit *hits)
+{
+    RaycastScenePackets(rays, count, mask, enemies, hits, RAY_PACKET_SIZE);
+}
+
+// Pellet rays of a hitscan shot into rays (room for MAX_PELLETS): one ray down the
+// view, the rest on a golden-angle spiral filling the spread cone. Returns the count.
+int GenerateShotPellets(const Camera *camera, const Weapon *weapon, SceneRay *rays)
+{
+    Vector3 forward = Vector3Normalize(Vector3Subtract(camera->target, camera->position));
+    Vector3 right = Vector3Normalize(Vector3CrossProduct(forward, camera->up));
+    Vector3 up = Vector3CrossProduct(right, forward);
+    int pellets = (weapon->pellets < 1)? 1 : (weapon->pellets > MAX_PELLETS)? MAX_PELLETS : weapon->pellets;
+    for (int p = 0; p < pellets; p++) {
+        float r = (pellets > 1)? weapon->spread*sqrtf((float)p/(pellets - 1)) : 0.0f;
+        float angle = p*2.39996323f;
+        Vector3 direction = Vector3Add(forward, Vector3Add(Vector3Scale(right, r*cosf(angle)), Vector3Scale(up, r*sinf(angle))));
+        rays[p] = (SceneRay){ camera->position, Vector3Normalize(direction), HITSCAN_RANGE };
+    }
+    return pellets;
+}
+
+// Queue the pellets of a hitscan shot for this tick's batch
+static void QueueHitscanShot(GameState *state, const Camera *camera, const Weapon *weapon)
+{
+    int pellets = GenerateShotPellets(camera, weapon, &state->shotRays[state->shotCount]);
+    for (int p = 0; p < pellets; p++) state->shotDamage[state->shotCount++] = weapon->damage;
+}
+
+//------------------------------------------------------------------------------------
+// Enemy Perception
+//------------------------------------------------------------------------------------
+// Idle enemies need to see a player before they give chase: a player behind a wall,
+// pillar or large crate is not noticed. Rather than a ray per enemy per tick, an
+// enemy near a player queues a query when its cached result is LOS_REFRESH_TICKS old,
+// and at most LOS_BUDGET_PER_TICK queries are traced per tick, oldest first, as one
+// RaycastScene batch. Under load the queue grows and results age instead of the
+// tick getting slower; results past LOS_MAX_AGE_TICKS are not acted on.
+
+// Queue the stale queries of idle enemies within alert range of a player, then trace
+// the queue's head toward each enemy's nearest player. Runs once per tick before
+// the enemy jobs, which only read the cache.
+void UpdatePerception(GameState *state, const Vector3 *targets, int targetCount)
+{
+    PerceptionCache *perception = &state->perception;
+    PerceptionStats *stats = &perception->stats;
+    const EnemyStore *enemies = &state->enemies;
+    unsigned int tick = state->tick;
+    stats->processedLastTick = 0;
+    if (targetCount == 0) return;
+
+    for (int i = 0; i < enemies->count; i++) {
+        if (enemies->state[i] != ENEMY_IDLE) continue;
+
+        Vector3 p = enemies->position[i];
+        bool inRange = false;
+        for (int t = 0; t < targetCount && !inRange; t++) {
+            float dx = targets[t].x - p.x;
+            float dz = targets[t].z - p.z;
+            inRange = dx*dx + dz*dz < ENEMY_ALERT_RANGE*ENEMY_ALERT_RANGE;
+        }
+        if (!inRange) continue;
+
+        int id = enemies->ids[i];
+        if (IsPerceptionFresh(perception, id, tick, LOS_REFRESH_TICKS - 1)) stats->cacheHits++;
+        else if (perception->queuedTick[id] == LOS_NO_TICK) {
+            perception->queue[(perception->head + perception->count++) % perception->capacity] = id;
+            perception->queuedTick[id] = tick;
+            stats->requests++;
+        }
+    }
+
+    // Enemies despawned while queued give up their turn
+    int rayCount = 0;
+    while (perception->count > 0 && rayCount < LOS_BUDGET_PER_TICK) {
+        int id = perception->queue[perception->head];
+        perception->head = (perception->head + 1) % perception->capacity;
+        perception->count--;
+
+        unsigned int latency = tick - perception->queuedTick[id];
+        perception->queuedTick[id] = LOS_NO_TICK;
+        if (enemies->slotOf[id] < 0) continue;
+
+        Vector3 eye = enemies->position[enemies->slotOf[id]];
+        eye.y += LOS_EYE_HEIGHT;
+        Vector3 target = targets[0];
+        for (int t = 1; t < targetCount; t++) {
+            if (Vector3DistanceSqr(eye, targets[t]) < Vector3DistanceSqr(eye, target)) target = targets[t];
+        }
+
+        float distance = Vector3Distance(eye, target);
+        Vector3 direction = (distance > 0.001f)? Vector3Scale(Vector3Subtract(target, eye), 1.0f/distance) : (Vector3){ 0.0f, 1.0f, 0.0f };
+        perception->rays[rayCount] = (SceneRay){ eye, direction, distance };
+        perception->rayIds[rayCount++] = id;
+
+        stats->latencyTicks += latency;
+        if (latency > stats->maxLatency) stats->maxLatency = latency;
+    }
+
+    if (rayCount > 0) RaycastScene(perception->rays, rayCount, COLLIDE_PLAYER, NULL, perception->hits);
+    for (int r = 0; r < rayCount; r++) {
+        int id = perception->rayIds[r];
+        perception->visible[id] = perception->hits[r].type == HIT_NONE;
+        perception->checkedTick[id] = tick;
+    }
+    stats->processed += rayCount;
+    stats->processedLastTick = rayCount;
+}
+
+// Shared arguments of the per-tick simulation jobs
+typedef struct SimulationJob {
+    GameState *state;
+    const Vector3 *targets;     // Positions of the active players
+    int targetCount;
+    float deltaTime;
+} SimulationJob;
+
+static void UpdateEnemiesJob(void *data, int begin, int end)
+{
+    PROFILE_SCOPE(PROFILE_ENEMIES);
+    SimulationJob *job = (SimulationJob *)data;
+    GameState *state = job->state;
+    UpdateEnemies(&state->enemies, job->targets, job->targetCount, &state->perception, state->tick, job->deltaTime, begin, end);
+}
+
+// Sweep bullets [begin, end) over this tick's flight into bulletHits; reads the world only
+static void SweepProjectilesJob(void *data, int begin, int end)
+{
+    PROFILE_SCOPE(PROFILE_BULLET_SWEEPS);
+    GameState *state = ((SimulationJob *)data)->state;
+    float deltaTime = ((SimulationJob *)data)->deltaTime;
+    const Bullet *bullets = state->projectiles.bullets;
+    for (int i = begin; i < end; i++) {
+        Vector3 target = Vector3Add(bullets[i].position, Vector3Scale(bullets[i].direction, BULLET_SPEED*deltaTime));
+        SweepProjectile(state, bullets[i].position, target, BULLET_RADIUS, &state->bulletHits[i]);
+    }
+}
+
+// Blend factor for one step that converges like factorPerTick does every 1/60 s
+static float StepSmoothing(float factorPerTick, float deltaTime)
+{
+    return 1.0f - powf(1.0f - factorPerTick, deltaTime*60.0f);
+}
+
+// Advance one player's weapons, view and movement by one step. Reads only the
+// player and the static level, so a client can run it ahead of the server to
+// predict its own player. Returns true when a shot went off; canFire is false
+// while there is nowhere to put the bullet.
+bool UpdatePlayer(PlayerState *player, const SimInput *input, float deltaTime, bool canFire)
+{
+    Camera *camera = &player->camera;
+
+    // Store old position for collision
+    Vector3 oldPosition = camera->position;
+
+    // Weapon Switching Input
+    BeginProfileZone(PROFILE_INPUT);
+    if (!player->isSwitching) {
+        if ((input->pressed & INPUT_WEAPON_1) && player->currentWeapon != 0) {
+            player->targetWeapon = 0;
+            player->isSwitching = true;
+            player->switchTimer = 0.0f;
+        }
+        if ((input->pressed & INPUT_WEAPON_2) && player->currentWeapon != 1) {
+            player->targetWeapon = 1;
+            player->isSwitching = true;
+            player->switchTimer = 0.0f;
+        }
+
+        if (input->wheel != 0) {
+            int next = player->currentWeapon + (int)input->wheel;
+            if (next > 1) next = 0;
+            if (next < 0) next = 1;
+
+            if (next != player->currentWeapon) {
+                player->targetWeapon = next;
+                player->isSwitching = true;
+                player->switchTimer = 0.0f;
+            }
+        }
+    }
+
+    // Weapon Switch Animation Logic
+    if (player->isSwitching) {
+        player->switchTimer += deltaTime;
+
+        if (player->switchTimer >= player->switchDuration / 2.0f && player->currentWeapon != player->targetWeapon) {
+            player->currentWeapon = player->targetWeapon;
+        }
+
+        if (player->switchTimer >= player->switchDuration) {
+            player->isSwitching = false;
+            player->switchTimer = 0.0f;
+        }
+    }
+    EndProfileZone(PROFILE_INPUT);
+
+    float oldCamY = camera->position.y;
+
+    BeginProfileZone(PROFILE_CAMERA);
+    UpdatePlayerCamera(camera, input, deltaTime);
+
+    // Apply collision detection
+    camera->position = ResolveCollision(camera->position, oldPosition, player->playerRadius);
+    EndProfileZone(PROFILE_CAMERA);
+
+    // Physics: Apply Gravity
+    BeginProfileZone(PROFILE_GROUND);
+    if (!player->isGrounded) {
+        player->verticalVelocity -= GRAVITY * deltaTime;
+    } else {
+        if (input->pressed & INPUT_JUMP) {
+            player->verticalVelocity = JUMP_FORCE;
+            player->isGrounded = false;
+        }
+    }
+
+    camera->position.y += player->verticalVelocity * deltaTime;
+
+    // Ground: the highest surface under the player within a step of their feet. Landing
+    // or walking up a step lifts them onto it; while grounded, a step down is followed
+    // instead of fallen.
+    float playerHeight = player->playerHeight;
+    float feet = camera->position.y - playerHeight;
+    float ground = GetGroundHeight(camera->position.x, camera->position.z, feet + MAX_STEP_HEIGHT);
+
+    if (feet <= ground || (player->isGrounded && feet - ground <= MAX_STEP_HEIGHT)) {
+        camera->position.y = ground + playerHeight;
+        player->verticalVelocity = 0;
+        player->isGrounded = true;
+    } else {
+        player->isGrounded = false;
+    }
+
+    camera->target.y += (camera->position.y - oldCamY);
+    EndProfileZone(PROFILE_GROUND);
+
+    // Reload Logic
+    Weapon *w = &player->weapons[player->currentWeapon];
+
+    if (w->isReloading) {
+        w->reloadTimer -= deltaTime;
+        if (w->reloadTimer <= 0) {
+            w->currentAmmo = w->maxAmmo;
+            w->isReloading = false;
+        }
+    } else {
+        if (w->currentAmmo <= 0 || (input->pressed & INPUT_RELOAD)) {
+            if (w->currentAmmo < w->maxAmmo) {
+                w->isReloading = true;
+                w->reloadTimer = w->reloadTime;
+            }
+        }
+    }
+
+    w->timeSinceLastShot += deltaTime;
+
+    // Shooting logic
+    bool shootInput = false;
+    if (w->automatic) shootInput = (input->down & INPUT_FIRE) != 0;
+    else shootInput = (input->pressed & INPUT_FIRE) != 0;
+
+    bool fired = false;
+    if (shootInput && canFire && !w->isReloading && !player->isSwitching && w->currentAmmo > 0 && w->timeSinceLastShot >= w->cooldown) {
+        w->currentAmmo--;
+        w->timeSinceLastShot = 0.0f;
+        player->recoilOffset = 0.4f;
+        fired = true;
+    }
+
+    // Weapon dynamics
+    if (player->recoilOffset > 0) player->recoilOffset -= RECOIL_RECOVERY*deltaTime;
+    if (player->recoilOffset < 0) player->recoilOffset = 0.0f;
+
+    float swayIntensity = 2.0f;
+    float swaySmooth = StepSmoothing(SWAY_SMOOTHING, deltaTime);
+
+    Vector2 targetSway = { -input->mouseDelta.x * swayIntensity, -input->mouseDelta.y * swayIntensity };
+
+    float constantSwayClamp = 30.0f;
+    if (targetSway.x > constantSwayClamp) targetSway.x = constantSwayClamp;
+    if (targetSway.x < -constantSwayClamp) targetSway.x = -constantSwayClamp;
+    if (targetSway.y > constantSwayClamp) targetSway.y = constantSwayClamp;
+    if (targetSway.y < -constantSwayClamp) targetSway.y = -constantSwayClamp;
+
+    player->weaponSway.x = Lerp(player->weaponSway.x, targetSway.x, swaySmooth);
+    player->weaponSway.y = Lerp(player->weaponSway.y, targetSway.y, swaySmooth);
+
+    bool isMoving = (input->down & (INPUT_FORWARD | INPUT_BACK | INPUT_LEFT | INPUT_RIGHT)) != 0;
+    if (isMoving) {
+        player->weaponBob += deltaTime * 10.0f;
+    } else {
+        player->weaponBob = Lerp(player->weaponBob, (float)((int)(player->weaponBob / PI) * PI), StepSmoothing(BOB_SETTLE, deltaTime));
+    }
+
+    return fired;
+}
+
+// Queue a sound for the mixer; past MAX_SOUND_EVENTS in a tick it is dropped
+static void AddSoundEvent(GameState *state, int sound, int source, Vector3 position)
+{
+    if (state->soundCount < MAX_SOUND_EVENTS) state->sounds[state->soundCount++] = (SoundEvent){ sound, source, position };
+}
+
+// The shot and reload sounds of a player's tick; a reload that started this tick
+// still has its full timer
+static void AddPlayerSounds(GameState *state, int slot, bool fired)
+{
+    const PlayerState *player = &state->players[slot];
+    const Weapon *current = &player->weapons[player->currentWeapon];
+    if (fired) AddSoundEvent(state, current->shotSound, slot, player->camera.position);
+    if (current->isReloading && current->reloadTimer == current->reloadTime) AddSoundEvent(state, SOUND_RELOAD, slot, player->camera.position);
+}
+
+// DamageEnemy, with the hit or death sound where the enemy stood; a dead enemy's
+// line of sight result goes with it
+static void HitEnemy(GameState *state, int id, float damage)
+{
+    EnemyStore *enemies = &state->enemies;
+    if (id < 0 || id >= enemies->capacity || enemies->slotOf[id] < 0) return;
+
+    Vector3 position = enemies->position[enemies->slotOf[id]];
+    DamageEnemy(enemies, id, damage);
+    bool killed = enemies->slotOf[id] < 0;
+    if (killed) ForgetEnemyPerception(&state->perception, id);
+    AddSoundEvent(state, killed? SOUND_ENEMY_DEATH : SOUND_ENEMY_HIT, -1, position);
+}
+
+// Advance the game by one step. inputs[] is indexed by player slot and read for
+// the active players only. Touches no window, GPU or input device state, so it
+// can run headless as well as inside the render loop.
+void UpdateSimulation(GameState *state, const SimInput *inputs, float deltaTime)
+{
+    // Update atmospheric effects
+    UpdateLightFlicker(deltaTime);
+    state->soundCount = 0;
+
+    // Players in slot order, each shot spawning a bullet at the eye
+    ProjectilePool *pool = &state->projectiles;
+    Vector3 targets[MAX_PLAYERS];
+    int targetCount = 0;
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        PlayerState *player = &state->players[p];
+        if (!player->active) continue;
+
+        bool hitscan = player->weapons[player->currentWeapon].hitscan;
+        bool fired = UpdatePlayer(player, &inputs[p], deltaTime, hitscan || pool->count < pool->capacity);
+        if (fired) {
+            const Weapon *weapon = &player->weapons[player->currentWeapon];
+            if (weapon->hitscan) {
+                QueueHitscanShot(state, &player->camera, weapon);
+            } else {
+                Bullet *b = AllocProjectile(pool);
+                b->position = player->camera.position;
+                Vector3 forward = Vector3Subtract(player->camera.target, player->camera.position);
+                b->direction = Vector3Normalize(forward);
+                b->damage = weapon->damage;
+            }
+            state->shotsFired++;
+        }
+        AddPlayerSounds(state, p, fired);
+        targets[targetCount++] = player->camera.position;
+    }
+
+    // Enemy AI and movement, steering along the flow field toward the first player,
+    // then the projectile sweeps against the moved enemies, both split into jobs. The
+    // flow field and the line of sight cache are advanced first since enemies read them.
+    BeginProfileZone(PROFILE_NAVIGATION);
+    if (targetCount > 0) UpdateFlowField(targets[0], NAV_CELLS_PER_TICK);
+    EndProfileZone(PROFILE_NAVIGATION);
+
+    BeginProfileZone(PROFILE_PERCEPTION);
+    UpdatePerception(state, targets, targetCount);
+    EndProfileZone(PROFILE_PERCEPTION);
+
+    SimulationJob job = { state, targets, targetCount, deltaTime };
+    JobCounter enemiesMoved, bulletsSwept;
+    ScheduleParallelFor(UpdateEnemiesJob, &job, state->enemies.count, ENEMY_JOB_GRAIN, &enemiesMoved, NULL);
+    ScheduleParallelFor(SweepProjectilesJob, &job, pool->count, BULLET_JOB_GRAIN, &bulletsSwept, &enemiesMoved);
+    WaitForJobs(&enemiesMoved);
+    WaitForJobs(&bulletsSwept);
+
+    // Hitscan pellets land first, in player order, against the moved enemies
+    BeginProfileZone(PROFILE_BULLETS);
+    if (state->shotCount > 0) {
+        RaycastScene(state->shotRays, state->shotCount, COLLIDE_BULLET | COLLIDER_ENEMY, &state->enemies, state->shotHits);
+        for (int i = 0; i < state->shotCount; i++) {
+            if (state->shotHits[i].type == HIT_ENEMY) HitEnemy(state, state->shotHits[i].index, state->shotDamage[i]);
+        }
+        state->shotCount = 0;
+    }
+
+    // Apply the impacts in slot order, so the outcome never depends on the thread
+    // count; a bullet aimed at an enemy killed earlier in the tick stops there too
+    for (int i = 0; i < pool->count; i++) {
+        const SweepHit *hit = &state->bulletHits[i];
+        if (hit->type == HIT_ENEMY) HitEnemy(state, hit->index, pool->bullets[i].damage);
+        pool->bullets[i].previous = pool->bullets[i].position;
+        pool->bullets[i].position = hit->point;
+    }
+
+    // Release spent bullets, and those out of range of every player, back to front:
+    // the last bullet, moved into a released slot, has already been checked
+    for (int i = pool->count - 1; i >= 0; i--) {
+        bool inRange = false;
+        for (int t = 0; t < targetCount && !inRange; t++) {
+            inRange = Vector3Distance(targets[t], pool->bullets[i].position) <= BULLET_RANGE;
+        }
+        if (state->bulletHits[i].type != HIT_NONE || !inRange) ReleaseProjectileAt(pool, i);
+    }
+    EndProfileZone(PROFILE_BULLETS);
+
+    state->tick++;
+}
+
+// What the renderer needs of a tick, blended between the last two ticks
+typedef struct RenderState {
+    Camera camera;
+    float recoilOffset;
+    Vector2 weaponSway;
+    float weaponBob;
+} RenderState;
+
+RenderState GetRenderState(const PlayerState *player)
+{
+    return (RenderState){ player->camera, player->recoilOffset, player->weaponSway, player->weaponBob };
+}
+
+RenderState LerpRenderState(const RenderState *from, const RenderState *to, float alpha)
+{
+    RenderState view = *to;
+    view.camera.position = Vector3Lerp(from->camera.position, to->camera.position, alpha);
+    view.camera.target = Vector3Lerp(from->camera.target, to->camera.target, alpha);
+    view.recoilOffset = Lerp(from->recoilOffset, to->recoilOffset, alpha);
+    view.weaponSway = Vector2Lerp(from->weaponSway, to->weaponSway, alpha);
+    view.weaponBob = Lerp(from->weaponBob, to->weaponBob, alpha);
+    return view;
+}
+
+int CountActiveEnemies(const GameState *state)
+{
+    return state->enemies.count;
+}
+
+// FNV-1a over the simulated state (player, enemies, bullets), for checking that
+// runs which should match bit for bit really do
+unsigned int HashGameState(const GameState *state)
+{
+    const EnemyStore *enemies = &state->enemies;
+    const ProjectilePool *pool = &state->projectiles;
+
+    unsigned int hash = 2166136261u;
+    hash = HashBytes(hash, &state->tick, sizeof(state->tick));
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        if (!state->players[p].active) continue;
+        hash = HashBytes(hash, &state->players[p].camera.position, sizeof(Vector3));
+        hash = HashBytes(hash, &state->players[p].camera.target, sizeof(Vector3));
+    }
+    hash = HashBytes(hash, &enemies->count, sizeof(int));
+    hash = HashBytes(hash, enemies->ids, enemies->count*sizeof(int));
+    hash = HashBytes(hash, enemies->position, enemies->count*sizeof(Vector3));
+    hash = HashBytes(hash, enemies->health, enemies->count*sizeof(float));
+    hash = HashBytes(hash, enemies->state, enemies->count);
+    hash = HashBytes(hash, &pool->count, sizeof(int));
+    hash = HashBytes(hash, pool->ids, pool->count*sizeof(int));
+    hash = HashBytes(hash, pool->bullets, pool->count*sizeof(Bullet));
+    return hash;
+}
+
+//------------------------------------------------------------------------------------
+// Audio Mixer
+//------------------------------------------------------------------------------------
+// Software mixer for the weapon, enemy and light sounds. A fixed pool of voices plays
+// mono sounds synthesized at startup, each with a left/right gain from its distance
+// and direction to the listener, ramped across a block so moving sources don't click.
+// Blocks are mixed on the main thread, 4 frames per SSE step, into a ring buffer that
+// raylib's audio thread drains through the stream callback. With every voice taken a
+// new sound steals the least important one (lowest priority, then quietest) if it
+// outranks it. Loops (footsteps, light hum) are kept alive by key every frame and
+// fade out once nothing asks for them.
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_BLOCK_FRAMES 256          // Frames mixed at a time, also the device stream's buffer
+#define AUDIO_RING_FRAMES 4096          // Ring capacity, power of two
+#define AUDIO_RING_TARGET 2048          // Frames mixed ahead of the device, rides out a ~40 ms hitch
+#define MAX_VOICES 32
+#define AUDIO_MASTER_VOLUME 0.5f
+#define AUDIO_REFERENCE_DISTANCE 2.0f   // Full volume this close
+#define AUDIO_MAX_DISTANCE 40.0f        // Silent from here on
+#define AUDIO_STEAL_MARGIN 1.25f        // A sound of the same priority must be this much louder to steal
+#define AUDIO_KEY_ENEMY 0x100000        // Loop keys: a light index, or this plus an enemy handle id (the server's when online)
+
+typedef struct SoundInfo {
+    float duration;     // Seconds
+    float volume;
+    int priority;       // Higher steals lower
+    bool loop;
+} SoundInfo;
+
+static const SoundInfo soundInfo[SOUND_COUNT] = {
+    { 0.35f, 0.90f, 3, false },     // Rifle shot
+    { 0.70f, 1.00f, 3, false },     // Revolver shot
+    { 0.60f, 0.70f, 3, false },     // Reload
+    { 0.15f, 0.80f, 2, false },     // Enemy hit
+    { 0.60f, 0.90f, 2, false },     // Enemy death
+    { 0.80f, 0.50f, 1, true },      // Enemy steps
+    { 1.00f, 0.25f, 0, true },      // Light hum
+    { 0.25f, 0.60f, 1, false },     // Light spark
+};
+
+typedef struct Voice {
+    int sound;              // SoundId, -1 when free
+    int key;                // Owner of a loop, -1 for one-shots
+    int cursor;             // Next frame of the sound
+    bool touched;           // Loop asked for since the last UpdateAudioScene
+    bool releasing;         // Fading out over the next block, then freed
+    Vector3 position;
+    float audibility;       // Volume after distance attenuation
+    float gain[2];          // Left/right gain reached at the end of the last block
+    float target[2];        // Gains the next block ramps to
+} Voice;
+
+typedef struct AudioStats {
+    int voicesPeak;
+    unsigned int started;
+    unsigned int stolen;
+    unsigned int rejected;          // Pool full of more important sounds (a loop asks again every frame)
+    unsigned long long blocks;
+    double mixSeconds;
+} AudioStats;
+
+typedef struct AudioMixer {
+    float *samples[SOUND_COUNT];
+    int frames[SOUND_COUNT];
+    Voice voices[MAX_VOICES];
+    Vector3 listener;
+    Vector3 listenerRight;
+    bool *lightWasOn;               // Light flicker state at the last UpdateAudioScene
+    int lightCapacity;
+    float mix[2][AUDIO_BLOCK_FRAMES];     // Left and right of the block being mixed
+    short ring[AUDIO_RING_FRAMES*2];
+    AudioStream stream;
+    bool streaming;
+    AudioStats stats;
+} AudioMixer;
+
+static AudioMixer audioMixer;
+static std::atomic<unsigned int> audioRingWrite{ 0 };  // Frames ever mixed into the ring
+static std::atomic<unsigned int> audioRingRead{ 0 };   // Frames ever handed to the device
+static std::atomic<unsigned int> audioUnderruns{ 0 };  // Device callbacks that ran dry
+
+// Shots are filtered noise over a falling thump; the rest are clicks, thuds, a growl
+// and a mains buzz. Loops come out seamless.
+static void SynthesizeSound(int sound, float *out, int frames)
+{
+    unsigned int seed = 1234u + sound;
+    float lowpass = 0.0f;
+    for (int i = 0; i < frames; i++) {
+        float t = (float)i/AUDIO_SAMPLE_RATE;
+        float noise = GenRandomFloat(&seed, -1.0f, 1.0f);
+        float v = 0.0f;
+        switch (sound) {
+            case SOUND_RIFLE_SHOT:
+                lowpass += 0.35f*(noise - lowpass);
+                v = 0.8f*lowpass*expf(-t*28.0f) + 0.7f*sinf(2*PI*(90.0f*t - 60.0f*t*t))*expf(-t*16.0f);
+                break;
+            case SOUND_REVOLVER_SHOT:
+                lowpass += 0.25f*(noise - lowpass);
+                v = 0.9f*lowpass*expf(-t*11.0f) + 0.9f*sinf(2*PI*(65.0f*t - 30.0f*t*t))*expf(-t*8.0f);
+                break;
+            case SOUND_RELOAD: {
+                // Magazine out, magazine in
+                float a = (t < 0.35f)? t : t - 0.35f;
+                v = (0.6f*noise + 0.5f*sinf(2*PI*2200.0f*a))*expf(-a*120.0f);
+            } break;
+            case SOUND_ENEMY_HIT:
+                lowpass += 0.2f*(noise - lowpass);
+                v = (0.8f*sinf(2*PI*140.0f*t) + lowpass)*expf(-t*30.0f);
+                break;
+            case SOUND_ENEMY_DEATH: {
+                // Sawtooth falling an octave
+                float phase = 110.0f*t - 45.0f*t*t;
+                v = 0.5f*(2.0f*(phase - floorf(phase)) - 1.0f)*expf(-t*4.0f);
+            } break;
+            case SOUND_ENEMY_STEPS: {
+                // Two steps per loop
+                float a = fmodf(t, 0.4f);
+                lowpass += 0.1f*(noise - lowpass);
+                v = (0.7f*sinf(2*PI*70.0f*a) + 1.5f*lowpass)*expf(-a*40.0f);
+            } break;
+            case SOUND_LIGHT_HUM:
+                // 100 Hz and harmonics, whole cycles over the loop
+                v = 0.5f*sinf(2*PI*100.0f*t) + 0.25f*sinf(2*PI*200.0f*t) + 0.15f*sinf(2*PI*300.0f*t);
+                break;
+            case SOUND_LIGHT_SPARK:
+                v = ((GenRandom(&seed) % 40 == 0)? noise : 0.1f*noise)*expf(-t*15.0f);
+                break;
+            default: break;
+        }
+        out[i] = v;
+    }
+}
+
+void LoadGameSounds(void)
+{
+    for (int s = 0; s < SOUND_COUNT; s++) {
+        audioMixer.frames[s] = (int)(soundInfo[s].duration*AUDIO_SAMPLE_RATE);
+        audioMixer.samples[s] = (float *)malloc(audioMixer.frames[s]*sizeof(float));
+        SynthesizeSound(s, audioMixer.samples[s], audioMixer.frames[s]);
+    }
+    for (int v = 0; v < MAX_VOICES; v++) audioMixer.voices[v] = (Voice){ -1, -1 };
+    audioMixer.stats = (AudioStats){ 0 };
+}
+
+void UnloadGameSounds(void)
+{
+    for (int s = 0; s < SOUND_COUNT; s++) free(audioMixer.samples[s]);
+    free(audioMixer.lightWasOn);
+    audioMixer = (AudioMixer){ 0 };
+}
+
+// The sound's volume over distance: full within the reference distance, then falling
+// off as 1/distance, faded to 0 at AUDIO_MAX_DISTANCE
+static float GetAudibility(int sound, Vector3 position)
+{
+    float distance = Vector3Distance(position, audioMixer.listener);
+    if (distance >= AUDIO_MAX_DISTANCE) return 0.0f;
+    return soundInfo[sound].volume*AUDIO_REFERENCE_DISTANCE/MaxF(distance, AUDIO_REFERENCE_DISTANCE)*(1.0f - distance/AUDIO_MAX_DISTANCE);
+}
+
+// Gains for the next block: constant-power pan across the listener's right axis
+static void SetVoiceTarget(Voice *voice)
+{
+    Vector3 offset = Vector3Subtract(voice->position, audioMixer.listener);
+    float distance = Vector3Length(offset);
+    float pan = (distance > 0.001f)? Vector3DotProduct(offset, audioMixer.listenerRight)/distance : 0.0f;
+    float angle = (pan + 1.0f)*PI/4.0f;
+    voice->audibility = GetAudibility(voice->sound, voice->position);
+    float gain = voice->releasing? 0.0f : voice->audibility;
+    voice->target[0] = gain*cosf(angle);
+    voice->target[1] = gain*sinf(angle);
+}
+
+// Voices on their way out are the first to go
+static int GetVoicePriority(const Voice *voice)
+{
+    return voice->releasing? -1 : soundInfo[voice->sound].priority;
+}
+
+// A free voice, or the least important one if sound at audibility outranks it, else NULL
+static Voice *AllocVoice(int sound, float audibility)
+{
+    Voice *victim = NULL;
+    for (int v = 0; v < MAX_VOICES; v++) {
+        Voice *voice = &audioMixer.voices[v];
+        if (voice->sound < 0) return voice;
+        if (victim == NULL || GetVoicePriority(voice) < GetVoicePriority(victim) ||
+            (GetVoicePriority(voice) == GetVoicePriority(victim) && voice->audibility < victim->audibility)) victim = voice;
+    }
+
+    int priority = soundInfo[sound].priority;
+    if (priority > GetVoicePriority(victim) || (priority == GetVoicePriority(victim) && audibility > victim->audibility*AUDIO_STEAL_MARGIN)) {
+        audioMixer.stats.stolen++;
+        return victim;
+    }
+    audioMixer.stats.rejected++;
+    return NULL;
+}
+
+static Voice *StartVoice(int sound, int key, Vector3 position)
+{
+    float audibility = GetAudibility(sound, position);
+    if (audibility <= 0.0f) return NULL;
+
+    Voice *voice = AllocVoice(sound, audibility);
+    if (voice == NULL) return NULL;
+
+    // Starts at full level, keeping the attack
+    *voice = (Voice){ sound, key, 0, true, false, position };
+    SetVoiceTarget(voice);
+    voice->gain[0] = voice->target[0];
+    voice->gain[1] = voice->target[1];
+    audioMixer.stats.started++;
+    return voice;
+}
+
+// Play a one-shot sound at a world position
+void PlaySoundAt(int sound, Vector3 position)
+{
+    StartVoice(sound, -1, position);
+}
+
+// Keep the loop owned by key playing at position; call every frame it should be heard
+void KeepSoundLoop(int key, int sound, Vector3 position)
+{
+    for (int v = 0; v < MAX_VOICES; v++) {
+        Voice *voice = &audioMixer.voices[v];
+        if (voice->key == key && voice->sound == sound) {
+            voice->position = position;
+            voice->touched = true;
+            voice->releasing = false;
+            return;
+        }
+    }
+
+    // Loops of the same sound start out of phase
+    Voice *voice = StartVoice(sound, key, position);
+    if (voice != NULL) voice->cursor = (int)((unsigned int)key*7919u % (unsigned int)audioMixer.frames[sound]);
+}
+
+// Add count frames of mono src to the left and right mix, the gains starting at
+// left/right and moving by leftStep/rightStep per frame
+void MixVoiceScalar(float *mixLeft, float *mixRight, const float *src, int count, float left, float right, float leftStep, float rightStep)
+{
+    for (int i = 0; i < count; i++) {
+        mixLeft[i] += src[i]*(left + i*leftStep);
+        mixRight[i] += src[i]*(right + i*rightStep);
+    }
+}
+
+// The left and right mix to interleaved 16-bit stereo, clipped
+void ConvertAudioScalar(const float *mixLeft, const float *mixRight, short *out, int frames)
+{
+    for (int i = 0; i < frames; i++) {
+        out[2*i] = (short)lrintf(Clamp(mixLeft[i]*AUDIO_MASTER_VOLUME, -1.0f, 1.0f)*32767.0f);
+        out[2*i + 1] = (short)lrintf(Clamp(mixRight[i]*AUDIO_MASTER_VOLUME, -1.0f, 1.0f)*32767.0f);
+    }
+}
+
+#if SIMD_WIDTH >= 4
+// 4 frames per step, the gain ramps advanced in registers
+void MixVoice(float *mixLeft, float *mixRight, const float *src, int count, float left, float right, float leftStep, float rightStep)
+{
+    __m128 gl = _mm_setr_ps(left, left + leftStep, left + 2*leftStep, left + 3*leftStep);
+    __m128 gr = _mm_setr_ps(right, right + rightStep, right + 2*rightStep, right + 3*rightStep);
+    const __m128 ls = _mm_set1_ps(4*leftStep), rs = _mm_set1_ps(4*rightStep);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 s = _mm_loadu_ps(src + i);
+        _mm_storeu_ps(mixLeft + i, _mm_add_ps(_mm_loadu_ps(mixLeft + i), _mm_mul_ps(s, gl)));
+        _mm_storeu_ps(mixRight + i, _mm_add_ps(_mm_loadu_ps(mixRight + i), _mm_mul_ps(s, gr)));
+        gl = _mm_add_ps(gl, ls);
+        gr = _mm_add_ps(gr, rs);
+    }
+
+    MixVoiceScalar(mixLeft + i, mixRight + i, src + i, count - i, left + i*leftStep, right + i*rightStep, leftStep, rightStep);
+}
+
+// 4 frames per step, interleaved into LRLR pairs; the clamp keeps the conversion in range
+void ConvertAudio(const float *mixLeft, const float *mixRight, short *out, int frames)
+{
+    const __m128 scale = _mm_set1_ps(AUDIO_MASTER_VOLUME*32767.0f);
+    const __m128 high = _mm_set1_ps(32767.0f), low = _mm_set1_ps(-32767.0f);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 l = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(mixLeft + i), scale), low), high);
+        __m128 r = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(mixRight + i), scale), low), high);
+        __m128i pairs = _mm_packs_epi32(_mm_cvtps_epi32(_mm_unpacklo_ps(l, r)), _mm_cvtps_epi32(_mm_unpackhi_ps(l, r)));
+        _mm_storeu_si128((__m128i *)(out + 2*i), pairs);
+    }
+
+    ConvertAudioScalar(mixLeft + i, mixRight + i, out + 2*i, frames - i);
+}
+#else
+void MixVoice(float *mixLeft, float *mixRight, const float *src, int count, float left, float right, float leftStep, float rightStep)
+{
+    MixVoiceScalar(mixLeft, mixRight, src, count, left, right, leftStep, rightStep);
+}
+
+void ConvertAudio(const float *mixLeft, const float *mixRight, short *out, int frames)
+{
+    ConvertAudioScalar(mixLeft, mixRight, out, frames);
+}
+#endif
+
+// Mix the next AUDIO_BLOCK_FRAMES of every voice into out (interleaved stereo).
+// One-shots that reach their end and released voices are freed.
+void MixAudioBlock(short *out)
+{
+    double start = GetWallTime();
+    float *mixLeft = audioMixer.mix[0], *mixRight = audioMixer.mix[1];
+    memset(audioMixer.mix, 0, sizeof(audioMixer.mix));
+
+    int active = 0;
+    for (int v = 0; v < MAX_VOICES; v++) {
+        Voice *voice = &audioMixer.voices[v];
+        if (voice->sound < 0) continue;
+        active++;
+
+        const float *samples = audioMixer.samples[voice->sound];
+        int frames = audioMixer.frames[voice->sound];
+        bool loop = soundInfo[voice->sound].loop;
+        float leftStep = (voice->target[0] - voice->gain[0])/AUDIO_BLOCK_FRAMES;
+        float rightStep = (voice->target[1] - voice->gain[1])/AUDIO_BLOCK_FRAMES;
+
+        // Spans up to the end of the sound, loops wrapping around
+        for (int done = 0; done < AUDIO_BLOCK_FRAMES;) {
+            int count = (AUDIO_BLOCK_FRAMES - done < frames - voice->cursor)? AUDIO_BLOCK_FRAMES - done : frames - voice->cursor;
+            MixVoice(mixLeft + done, mixRight + done, samples + voice->cursor, count, voice->gain[0] + done*leftStep, voice->gain[1] + done*rightStep, leftStep, rightStep);
+            voice->cursor += count;
+            done += count;
+            if (voice->cursor == frames) {
+                if (!loop) break;
+                voice->cursor = 0;
+            }
+        }
+
+        voice->gain[0] = voice->target[0];
+        voice->gain[1] = voice->target[1];
+        if (voice->releasing || voice->cursor == frames) *voice = (Voice){ -1, -1 };
+    }
+
+    ConvertAudio(mixLeft, mixRight, out, AUDIO_BLOCK_FRAMES);
+
+    AudioStats *stats = &audioMixer.stats;
+    if (active > stats->voicesPeak) stats->voicesPeak = active;
+    stats->blocks++;
+    stats->mixSeconds += GetWallTime() - start;
+}
+
+// Mix blocks into the ring until it holds AUDIO_RING_TARGET frames the device has not taken
+void FillAudioRing(void)
+{
+    unsigned int write = audioRingWrite.load(std::memory_order_relaxed);
+    while (write - audioRingRead.load(std::memory_order_acquire) + AUDIO_BLOCK_FRAMES <= AUDIO_RING_TARGET) {
+        MixAudioBlock(&audioMixer.ring[2*(write & (AUDIO_RING_FRAMES - 1))]);
+        write += AUDIO_BLOCK_FRAMES;
+        audioRingWrite.store(write, std::memory_order_release);
+    }
+}
+
+// Runs on raylib's audio thread: copy out of the ring, silence when it ran dry
+static void AudioStreamCallback(void *bufferData, unsigned int frames)
+{
+    short *out = (short *)bufferData;
+    unsigned int read = audioRingRead.load(std::memory_order_relaxed);
+    unsigned int available = audioRingWrite.load(std::memory_order_acquire) - read;
+    unsigned int count = (frames < available)? frames : available;
+
+    for (unsigned int i = 0; i < count;) {
+        unsigned int offset = (read + i) & (AUDIO_RING_FRAMES - 1);
+        unsigned int span = (count - i < AUDIO_RING_FRAMES - offset)? count - i : AUDIO_RING_FRAMES - offset;
+        memcpy(out + 2*i, &audioMixer.ring[2*offset], span*2*sizeof(short));
+        i += span;
+    }
+    if (count < frames) {
+        memset(out + 2*count, 0, (frames - count)*2*sizeof(short));
+        audioUnderruns++;
+    }
+    audioRingRead.store(read + count, std::memory_order_release);
+}
+
+// Stream the ring to the audio device; without one the game runs silent
+void InitAudioOutput(void)
+{
+    InitAudioDevice();
+    if (!IsAudioDeviceReady()) return;
+
+    SetAudioStreamBufferSizeDefault(AUDIO_BLOCK_FRAMES);
+    audioMixer.stream = LoadAudioStream(AUDIO_SAMPLE_RATE, 16, 2);
+    FillAudioRing();
+    SetAudioStreamCallback(audioMixer.stream, AudioStreamCallback);
+    PlayAudioStream(audioMixer.stream);
+    audioMixer.streaming = true;
+}
+
+void CloseAudioOutput(void)
+{
+    if (audioMixer.streaming) {
+        StopAudioStream(audioMixer.stream);
+        UnloadAudioStream(audioMixer.stream);
+        audioMixer.streaming = false;
+    }
+    if (IsAudioDeviceReady()) CloseAudioDevice();
+}
+
+// Start the sounds of the tick just simulated
+void PlayTickSounds(const GameState *state)
+{
+    for (int i = 0; i < state->soundCount; i++) PlaySoundAt(state->sounds[i].sound, state->sounds[i].position);
+}
+
+// Move the listener and refresh the loops: lights hum while on and spark when they go
+// out, chasing enemies are heard walking. Sources out of earshot never reach the
+// voice pool. Loops nothing kept since the last call fade out.
+void UpdateAudioScene(const GameState *state, Camera listener)
+{
+    audioMixer.listener = listener.position;
+    audioMixer.listenerRight = Vector3Normalize(Vector3CrossProduct(Vector3Subtract(listener.target, listener.position), listener.up));
+    const float rangeSq = AUDIO_MAX_DISTANCE*AUDIO_MAX_DISTANCE;
+
+    // Lights added by a level reload start out as they are
+    if (audioMixer.lightCapacity < lightCount) {
+        audioMixer.lightWasOn = (bool *)realloc(audioMixer.lightWasOn, lightCount*sizeof(bool));
+        for (int i = audioMixer.lightCapacity; i < lightCount; i++) audioMixer.lightWasOn[i] = lights[i].isOn;
+        audioMixer.lightCapacity = lightCount;
+    }
+    for (int i = 0; i < lightCount; i++) {
+        if (Vector3DistanceSqr(lights[i].position, audioMixer.listener) < rangeSq) {
+            if (lights[i].isOn) KeepSoundLoop(i, SOUND_LIGHT_HUM, lights[i].position);
+            else if (audioMixer.lightWasOn[i]) PlaySoundAt(SOUND_LIGHT_SPARK, lights[i].position);
+        }
+        audioMixer.lightWasOn[i] = lights[i].isOn;
+    }
+
+    const EnemyStore *enemies = &state->enemies;
+    for (int e = 0; e < enemies->count; e++) {
+        if (enemies->state[e] != ENEMY_CHASE || Vector3DistanceSqr(enemies->position[e], audioMixer.listener) >= rangeSq) continue;
+        int id = (state->enemyNetIds != NULL)? state->enemyNetIds[e] : enemies->ids[e];
+        KeepSoundLoop(AUDIO_KEY_ENEMY + id, SOUND_ENEMY_STEPS, enemies->position[e]);
+    }
+
+    for (int v = 0; v < MAX_VOICES; v++) {
+        Voice *voice = &audioMixer.voices[v];
+        if (voice->sound < 0) continue;
+        if (voice->key >= 0 && !voice->touched) voice->releasing = true;
+        voice->touched = false;
+        SetVoiceTarget(voice);
+    }
+}
+
+//------------------------------------------------------------------------------------
+// Sprite Atlas
+//------------------------------------------------------------------------------------
+// The weapon sprites and the muzzle flash share one texture. The cook step
+// (--cook-assets) decodes the source images, keys out the green screen behind the
+// weapons, premultiplies alpha and packs the sprites side by side into a raw RGBA8
+// file that loads with a single read and uploads as is. Without an up to date cooked
+// atlas the same build runs at startup from the source images.
+#define ATLAS_FILE_MAGIC 0x414B4E42u    // "BNKA"
+#define ATLAS_FILE_VERSION 1
+#define ATLAS_FILE_PATH "resources/weapons.atlas"
+
+typedef enum { SPRITE_RIFLE = 0, SPRITE_REVOLVER, SPRITE_MUZZLE_FLASH, SPRITE_COUNT } SpriteId;
+
+typedef struct SpriteSource {
+    const char *fileName;
+    bool chromaKey;         // Green screen background to key out
+} SpriteSource;
+
+static const SpriteSource spriteSources[SPRITE_COUNT] = {
+    { "resources/gun.png", true },
+    { "resources/revolver.png", true },
+    { "resources/muzzle_flash.png", false },    // Black background, drawn additively
+};
+
+typedef struct AtlasFileHeader {
+    unsigned int magic;
+    unsigned int version;
+    int width, height;                  // RGBA8 premultiplied pixels follow the header
+    Rectangle sprites[SPRITE_COUNT];    // Source rectangles in pixels
+} AtlasFileHeader;
+
+typedef struct SpriteAtlas {
+    Image image;                        // CPU pixels, released once uploaded
+    Texture2D texture;
+    Rectangle sprites[SPRITE_COUNT];
+    bool cooked;                        // Loaded from the cooked file
+    double loadTime;                    // Seconds spent loading or building
+} SpriteAtlas;
+
+// Green screen test: g > 150, r < 100, b < 100
+static bool IsChromaKey(Color c)
+{
+    return c.g > 150 && c.r < 100 && c.b < 100;
+}
+
+void ChromaKeyPixelsScalar(Color *pixels, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (IsChromaKey(pixels[i])) pixels[i] = BLANK;
+    }
+}
+
+#if SIMD_WIDTH >= 4
+// 4 pixels per step. SSE2 only has signed byte compares, so both sides are biased by 0x80.
+void ChromaKeyPixels(Color *pixels, int count)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i above150 = _mm_set1_epi8((char)(150 ^ 0x80));
+    const __m128i below100 = _mm_set1_epi8((char)(100 ^ 0x80));
+    const __m128i greenBytes = _mm_set1_epi32(0x0000FF00);
+    const __m128i redBlueBytes = _mm_set1_epi32(0x00FF00FF);
+    const __m128i alphaBytes = _mm_set1_epi32((int)0xFF000000);
+    const __m128i allSet = _mm_set1_epi32(-1);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i rgba = _mm_loadu_si128((const __m128i *)(pixels + i));
+        __m128i biased = _mm_xor_si128(rgba, bias);
+        __m128i high = _mm_cmpgt_epi8(biased, above150);
+        __m128i low = _mm_cmplt_epi8(biased, below100);
+
+        // Per pixel: green byte from the high test, red and blue from the low test, alpha ignored
+        __m128i tests = _mm_or_si128(_mm_or_si128(_mm_and_si128(high, greenBytes), _mm_and_si128(low, redBlueBytes)), alphaBytes);
+        __m128i keyed = _mm_cmpeq_epi32(tests, allSet);
+        _mm_storeu_si128((__m128i *)(pixels + i), _mm_andnot_si128(keyed, rgba));
+    }
+
+    ChromaKeyPixelsScalar(pixels + i, count - i);
+}
+#else
+void ChromaKeyPixels(Color *pixels, int count)
+{
+    ChromaKeyPixelsScalar(pixels, count);
+}
+#endif
+
+void UnloadSpriteAtlas(SpriteAtlas *atlas)
+{
+    if (atlas->image.data != NULL) UnloadImage(atlas->image);
+    if (atlas->texture.id != 0) UnloadTexture(atlas->texture);
+    *atlas = (SpriteAtlas){ 0 };
+}
+
+// Decode, key, premultiply and pack the source images (CPU only, safe off the main thread).
+// A source that fails to load gets an empty rectangle.
+bool BuildSpriteAtlas(SpriteAtlas *atlas)
+{
+    double start = GetWallTime();
+    *atlas = (SpriteAtlas){ 0 };
+
+    Image images[SPRITE_COUNT];
+    int width = 0, height = 0;
+    for (int s = 0; s < SPRITE_COUNT; s++) {
+        images[s] = LoadImage(spriteSources[s].fileName);
+        if (images[s].data == NULL) continue;
+
+        ImageFormat(&images[s], PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        if (spriteSources[s].chromaKey) ChromaKeyPixels((Color *)images[s].data, images[s].width*images[s].height);
+        ImageAlphaPremultiply(&images[s]);
+
+        atlas->sprites[s] = (Rectangle){ (float)width, 0.0f, (float)images[s].width, (float)images[s].height };
+        width += images[s].width;
+        if (images[s].height > height) height = images[s].height;
+    }
+
+    if (width > 0) {
+        atlas->image = GenImageColor(width, height, BLANK);
+        for (int s = 0; s < SPRITE_COUNT; s++) {
+            if (images[s].data == NULL) continue;
+            for (int y = 0; y < images[s].height; y++) {
+                memcpy((Color *)atlas->image.data + y*width + (int)atlas->sprites[s].x,
+                       (Color *)images[s].data + y*images[s].width, images[s].width*sizeof(Color));
+            }
+            UnloadImage(images[s]);
+        }
+    }
+
+    atlas->loadTime = GetWallTime() - start;
+    return width > 0;
+}
+
+bool ExportSpriteAtlas(const SpriteAtlas *atlas, const char *fileName)
+{
+    if (atlas->image.data == NULL) return false;
+
+    AtlasFileHeader header = { 0 };
+    header.magic = ATLAS_FILE_MAGIC;
+    header.version = ATLAS_FILE_VERSION;
+    header.width = atlas->image.width;
+    header.height = atlas->image.height;
+    memcpy(header.sprites, atlas->sprites, sizeof(header.sprites));
+
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL) return false;
+
+    size_t pixelCount = (size_t)header.width*header.height;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(atlas->image.data, sizeof(Color), pixelCount, file) == pixelCount;
+    fclose(file);
+    return ok;
+}
+
+// Read a cooked atlas straight into upload-ready pixels
+bool LoadSpriteAtlasFile(SpriteAtlas *atlas, const char *fileName)
+{
+    double start = GetWallTime();
+    *atlas = (SpriteAtlas){ 0 };
+
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL) return false;
+
+    AtlasFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && header.magic == ATLAS_FILE_MAGIC &&
+              header.version == ATLAS_FILE_VERSION && header.width > 0 && header.height > 0 &&
+              header.width <= 16384 && header.height <= 16384;
+
+    // Every sprite must lie inside the atlas image (NaN fails the comparisons too)
+    for (int s = 0; s < SPRITE_COUNT && ok; s++) {
+        Rectangle r = header.sprites[s];
+        ok = r.x >= 0.0f && r.y >= 0.0f && r.width >= 0.0f && r.height >= 0.0f &&
+             r.x + r.width <= (float)header.width && r.y + r.height <= (float)header.height;
+    }
+    if (ok) {
+        size_t pixelCount = (size_t)header.width*header.height;
+        void *pixels = malloc(pixelCount*sizeof(Color));
+        ok = fread(pixels, sizeof(Color), pixelCount, file) == pixelCount;
+        if (ok) atlas->image = (Image){ pixels, header.width, header.height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        else free(pixels);
+    }
+    fclose(file);
+
+    if (!ok) {
+        TraceLog(LOG_WARNING, "ATLAS: [%s] Not a valid sprite atlas (version %d expected)", fileName, ATLAS_FILE_VERSION);
+        return false;
+    }
+
+    memcpy(atlas->sprites, header.sprites, sizeof(atlas->sprites));
+    atlas->cooked = true;
+    atlas->loadTime = GetWallTime() - start;
+    return true;
+}
+
+// Cooked atlas when it is newer than every source image, otherwise built from the sources
+bool LoadSpriteAtlas(SpriteAtlas *atlas)
+{
+    long cookedTime = FileExists(ATLAS_FILE_PATH)? GetFileModTime(ATLAS_FILE_PATH) : 0;
+    bool fresh = cookedTime > 0;
+    for (int s = 0; s < SPRITE_COUNT && fresh; s++) {
+        if (FileExists(spriteSources[s].fileName) && GetFileModTime(spriteSources[s].fileName) > cookedTime) fresh = false;
+    }
+
+    if (fresh && LoadSpriteAtlasFile(atlas, ATLAS_FILE_PATH)) return true;
+    return BuildSpriteAtlas(atlas);
+}
+
+static void LoadSpriteAtlasJob(void *data, int begin, int end)
+{
+    (void)begin; (void)end;
+    LoadSpriteAtlas((SpriteAtlas *)data);
+}
+
+// Send the pixels to the GPU and drop the CPU copy (requires a window)
+void UploadSpriteAtlas(SpriteAtlas *atlas)
+{
+    if (atlas->image.data == NULL) return;
+
+    atlas->texture = LoadTextureFromImage(atlas->image);
+    SetTextureFilter(atlas->texture, TEXTURE_FILTER_BILINEAR);
+    UnloadImage(atlas->image);
+    atlas->image = (Image){ 0 };
+}
+
+//------------------------------------------------------------------------------------
+// Input Recording
+//------------------------------------------------------------------------------------
+// Per-tick inputs and step lengths captured to a small binary file, together with
+// the rand() seed of the light flicker and the level that was played. Replaying the
+// ticks through UpdateSimulation() must reproduce the recorded final state hash.
+#define RECORDING_FILE_MAGIC 0x524B4E42u    // "BNKR"
+#define RECORDING_FILE_VERSION 1
+
+typedef struct InputRecordingHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int headerSize;
+    int tickCount;
+    unsigned int randSeed;          // srand() seed before the first tick
+    unsigned int finalHash;         // HashGameState() after the last tick
+    int generateBoxes;              // Level: generated when > 0, with levelSeed
+    unsigned int levelSeed;
+    int maxBullets, maxEnemies;
+    char levelFile[128];            // Level file, empty for the built-in bunker
+} InputRecordingHeader;
+
+typedef struct InputTick {
+    unsigned short down;            // InputButton masks
+    unsigned short pressed;
+    float mouseDeltaX, mouseDeltaY;
+    float wheel;
+    float deltaTime;
+} InputTick;
+
+typedef struct InputRecording {
+    InputRecordingHeader header;
+    InputTick *ticks;
+    int capacity;
+} InputRecording;
+
+void BeginInputRecording(InputRecording *recording, unsigned int randSeed)
+{
+    *recording = (InputRecording){ 0 };
+    recording->header.magic = RECORDING_FILE_MAGIC;
+    recording->header.version = RECORDING_FILE_VERSION;
+    recording->header.headerSize = sizeof(InputRecordingHeader);
+    recording->header.randSeed = randSeed;
+}
+
+void UnloadInputRecording(InputRecording *recording)
+{
+    free(recording->ticks);
+    *recording = (InputRecording){ 0 };
+}
+
+void RecordInputTick(InputRecording *recording, const SimInput *input, float deltaTime)
+{
+    if (recording->header.tickCount == recording->capacity) {
+        recording->capacity = (recording->capacity > 0)? recording->capacity*2 : 4096;
+        recording->ticks = (InputTick *)realloc(recording->ticks, recording->capacity*sizeof(InputTick));
+    }
+
+    InputTick *tick = &recording->ticks[recording->header.tickCount++];
+    tick->down = (unsigned short)input->down;
+    tick->pressed = (unsigned short)input->pressed;
+    tick->mouseDeltaX = input->mouseDelta.x;
+    tick->mouseDeltaY = input->mouseDelta.y;
+    tick->wheel = input->wheel;
+    tick->deltaTime = deltaTime;
+}
+
+SimInput GetRecordedInput(const InputRecording *recording, int tick, float *deltaTime)
+{
+    const InputTick *t = &recording->ticks[tick];
+    SimInput input = { t->down, t->pressed, { t->mouseDeltaX, t->mouseDeltaY }, t->wheel };
+    *deltaTime = t->deltaTime;
+    return input;
+}
+
+bool SaveInputRecording(const InputRecording *recording, const char *fileName)
+{
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL) return false;
+
+    int count = recording->header.tickCount;
+    bool ok = fwrite(&recording->header, sizeof(InputRecordingHeader), 1, file) == 1 &&
+              (count == 0 || fwrite(recording->ticks, sizeof(InputTick), count, file) == (size_t)count);
+    fclose(file);
+    return ok;
+}
+
+bool LoadInputRecording(InputRecording *recording, const char *fileName)
+{
+    *recording = (InputRecording){ 0 };
+
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL) {
+        TraceLog(LOG_WARNING, "REPLAY: [%s] Failed to open recording", fileName);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    // The tick count must match the file, so a corrupt header cannot size the allocation
+    InputRecordingHeader *header = &recording->header;
+    bool ok = fread(header, sizeof(InputRecordingHeader), 1, file) == 1 && header->magic == RECORDING_FILE_MAGIC &&
+              header->version == RECORDING_FILE_VERSION && header->headerSize == sizeof(InputRecordingHeader) &&
+              header->tickCount >= 0 && (long long)sizeof(InputRecordingHeader) + (long long)header->tickCount*(long long)sizeof(InputTick) == (long long)length;
+    if (ok) {
+        header->levelFile[sizeof(header->levelFile) - 1] = '\0';
+        recording->capacity = header->tickCount;
+        recording->ticks = (InputTick *)malloc((header->tickCount > 0)? header->tickCount*sizeof(InputTick) : 1);
+        ok = fread(recording->ticks, sizeof(InputTick), header->tickCount, file) == (size_t)header->tickCount;
+    }
+    fclose(file);
+
+    if (!ok) {
+        TraceLog(LOG_WARNING, "REPLAY: [%s] Not a valid input recording (version %d expected)", fileName, RECORDING_FILE_VERSION);
+        UnloadInputRecording(recording);
+    }
+    return ok;
+}
+
+// Mean and percentiles of per-frame milliseconds; returns the 95th percentile
+float PrintFrameTimeStats(const char *label, float *frameTimes, int count)
+{
+    if (count <= 0) return 0.0f;
+
+    double sum = 0.0;
+    for (int i = 0; i < count; i++) sum += frameTimes[i];
+    qsort(frameTimes, count, sizeof(float), CompareFloats);
+
+    float p50 = frameTimes[(int)(0.50f*(count - 1))];
+    float p95 = frameTimes[(int)(0.95f*(count - 1))];
+    float p99 = frameTimes[(int)(0.99f*(count - 1))];
+    printf("  %s ms: mean %.3f, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n", label, sum/count, p50, p95, p99, frameTimes[count - 1]);
+    return p95;
+}
+
+//------------------------------------------------------------------------------------
+// Networking
+//------------------------------------------------------------------------------------
+// Authoritative dedicated server over UDP. The server runs the only real simulation;
+// clients send their inputs, each packet repeating the last few so a lost one costs
+// nothing, and get one snapshot back per tick. A snapshot carries the client's own
+// player exactly, then the players, enemies and bullets nearest to them, quantized
+// and delta-coded against the last snapshot the client acknowledged: entities that
+// did not change cost nothing and moved ones a few bytes.
+//
+// The client runs UpdatePlayer() on its own player as soon as it samples input and
+// keeps those inputs. When a snapshot says input n was the last one simulated, the
+// client restarts from the server's copy of its player and replays the inputs after n.
+#define NET_DEFAULT_PORT 27960
+#define NET_PROTOCOL_ID 0x4E4B4E42          // "BNKN"
+#define NET_MAX_PACKET 1200                 // Stays under the usual path MTU
+#define NET_INPUT_REDUNDANCY 4              // Newest inputs repeated in every input packet
+#define NET_INPUT_BUFFER 64                 // Inputs kept for replay and reordering (power of two)
+#define NET_SNAPSHOT_HISTORY 32             // Snapshots kept as delta baselines (power of two)
+#define NET_CONNECT_RETRY 0.5               // Seconds between connection requests
+#define NET_TIMEOUT 5.0                     // Seconds of silence before the other side is dropped
+#define NET_POSITION_SCALE 64.0f            // Positions travel in 1/64 units
+#define NET_ANGLE_SCALE (32767.0f/PI)       // Angles in 16 bits
+#define NET_MOUSE_SCALE 16.0f               // Mouse deltas in 1/16 pixels
+#define NET_NO_TICK 0xFFFFFFFFu
+#define SNAPSHOT_RELEVANCE_RANGE 60.0f      // Entities further than this from a player are not sent to them
+
+typedef enum {
+    NET_CONNECT = 1,    // Client: protocol id, level hash
+    NET_ACCEPT,         // Server: player slot
+    NET_REJECT,         // Server: NetRejectReason
+    NET_INPUT,          // Client: acknowledged snapshot tick, newest input sequence, inputs newest first
+    NET_SNAPSHOT,       // Server: see SendNetSnapshot()
+    NET_DISCONNECT
+} NetPacketType;
+
+typedef enum { NET_REJECT_FULL = 1, NET_REJECT_PROTOCOL, NET_REJECT_LEVEL } NetRejectReason;
+
+// Snapshot entity sections and how many of each one snapshot carries at most
+typedef enum { NET_SECTION_PLAYERS = 0, NET_SECTION_ENEMIES, NET_SECTION_BULLETS, NET_SECTION_COUNT } NetSection;
+static const int snapshotSectionCaps[NET_SECTION_COUNT] = { 16, 48, 32 };
+#define SNAPSHOT_MAX_SECTION 48
+
+// Quantized entity, the unit of delta coding. Players: x, y, z, yaw, pitch, weapon
+// flags; enemies: x, y, z, health, state; bullets: x, y, z and direction x, y, z.
+#define NET_ENTITY_FIELDS 6
+#define NET_RECORD_NEW 0x80                 // Record flags: entity not in the baseline, low bits = fields sent
+#define NET_RECORD_MAX_BYTES (1 + 5 + NET_ENTITY_FIELDS*5)
+#define NET_SOUND_MAX_BYTES (1 + 3*5)       // Snapshot sound: SoundId, quantized position
+
+typedef struct NetEntity {
+    int id;                         // Player slot or enemy/bullet handle id
+    int fields[NET_ENTITY_FIELDS];
+} NetEntity;
+
+// Entities of one tick as one client sees them, each section sorted by id
+typedef struct NetSnapshot {
+    unsigned int tick;              // NET_NO_TICK for an unused history slot
+    int counts[NET_SECTION_COUNT];
+    NetEntity entities[NET_SECTION_COUNT][SNAPSHOT_MAX_SECTION];
+} NetSnapshot;
+
+#if defined(_WIN32)
+    typedef SOCKET NetSocket;
+    #define NET_INVALID_SOCKET INVALID_SOCKET
+#else
+    typedef int NetSocket;
+    #define NET_INVALID_SOCKET -1
+#endif
+
+typedef struct NetAddress {
+    unsigned int host;      // IPv4, host byte order
+    unsigned short port;
+} NetAddress;
+
+typedef struct NetStats {
+    long long packetsSent;
+    long long bytesSent;
+    long long packetsDropped;       // Thrown away by the simulated loss
+    long long packetsReceived;
+    long long bytesReceived;
+} NetStats;
+
+NetStats netStats = { 0 };
+float netLossRate = 0.0f;           // Fraction of outgoing packets dropped on purpose, for testing
+static unsigned int netLossSeed = 1u;
+
+typedef struct NetWriter {
+    unsigned char *data;
+    int size;
+    int capacity;
+    bool overflow;
+} NetWriter;
+
+typedef struct NetReader {
+    const unsigned char *data;
+    int size;
+    int position;
+    bool overflow;
+} NetReader;
+
+// Fixed-size values are written in host order, like the level and recording files (little-endian)
+static void WriteBytes(NetWriter *writer, const void *data, int size)
+{
+    if (writer->size + size > writer->capacity) { writer->overflow = true; return; }
+    memcpy(writer->data + writer->size, data, size);
+    writer->size += size;
+}
+
+static void WriteU8(NetWriter *writer, unsigned char value) { WriteBytes(writer, &value, 1); }
+static void WriteU32(NetWriter *writer, unsigned int value) { WriteBytes(writer, &value, 4); }
+static void WriteF32(NetWriter *writer, float value) { WriteBytes(writer, &value, 4); }
+
+// 7 bits per byte, high bit set while more follow
+static void WriteVarint(NetWriter *writer, unsigned int value)
+{
+    while (value >= 0x80) {
+        WriteU8(writer, (unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    WriteU8(writer, (unsigned char)value);
+}
+
+// Zigzag, so small negative deltas stay small
+static void WriteSigned(NetWriter *writer, int value)
+{
+    WriteVarint(writer, ((unsigned int)value << 1) ^ (unsigned int)(value >> 31));
+}
+
+static void ReadBytes(NetReader *reader, void *data, int size)
+{
+    if (reader->position + size > reader->size) { reader->overflow = true; memset(data, 0, size); return; }
+    memcpy(data, reader->data + reader->position, size);
+    reader->position += size;
+}
+
+static unsigned char ReadU8(NetReader *reader) { unsigned char value; ReadBytes(reader, &value, 1); return value; }
+static unsigned int ReadU32(NetReader *reader) { unsigned int value; ReadBytes(reader, &value, 4); return value; }
+static float ReadF32(NetReader *reader) { float value; ReadBytes(reader, &value, 4); return value; }
+
+static unsigned int ReadVarint(NetReader *reader)
+{
+    unsigned int value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        unsigned char byte = ReadU8(reader);
+        value |= (unsigned int)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    reader->overflow = true;
+    return 0;
+}
+
+static int ReadSigned(NetReader *reader)
+{
+    unsigned int value = ReadVarint(reader);
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+// Open a non-blocking UDP socket bound to port on every interface (0 = any free port)
+bool OpenNetSocket(NetSocket *result, unsigned short port)
+{
+#if defined(_WIN32)
+    static bool started = false;
+    if (!started) {
+        WSADATA data;
+        if (WSAStartup(MAKEWORD(2, 2), &data) != 0) return false;
+        started = true;
+    }
+#endif
+
+    NetSocket sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == NET_INVALID_SOCKET) return false;
+
+    struct sockaddr_in address = { 0 };
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+#if defined(_WIN32)
+    u_long nonBlocking = 1;
+    bool ready = (bind(sock, (struct sockaddr *)&address, sizeof(address)) == 0) && (ioctlsocket(sock, FIONBIO, &nonBlocking) == 0);
+    if (!ready) { closesocket(sock); return false; }
+#else
+    bool ready = (bind(sock, (struct sockaddr *)&address, sizeof(address)) == 0) && (fcntl(sock, F_SETFL, O_NONBLOCK) == 0);
+    if (!ready) { close(sock); return false; }
+#endif
+
+    *result = sock;
+    return true;
+}
+
+void CloseNetSocket(NetSocket sock)
+{
+    if (sock == NET_INVALID_SOCKET) return;
+#if defined(_WIN32)
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+// Port a socket is bound to (after opening it on port 0)
+unsigned short GetNetSocketPort(NetSocket sock)
+{
+    struct sockaddr_in address = { 0 };
+    socklen_t length = sizeof(address);
+    if (getsockname(sock, (struct sockaddr *)&address, &length) != 0) return 0;
+    return ntohs(address.sin_port);
+}
+
+// "host" or "host:port", IPv4 only
+bool ResolveNetAddress(const char *text, NetAddress *result)
+{
+    char host[256];
+    snprintf(host, sizeof(host), "%s", text);
+    unsigned short port = NET_DEFAULT_PORT;
+    char *colon = strrchr(host, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        port = (unsigned short)atoi(colon + 1);
+    }
+
+    struct addrinfo hints = { 0 };
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo *info = NULL;
+    if (getaddrinfo(host, NULL, &hints, &info) != 0 || info == NULL) return false;
+
+    result->host = ntohl(((struct sockaddr_in *)info->ai_addr)->sin_addr.s_addr);
+    result->port = port;
+    freeaddrinfo(info);
+    return true;
+}
+
+static bool SameNetAddress(NetAddress a, NetAddress b)
+{
+    return (a.host == b.host) && (a.port == b.port);
+}
+
+void SendPacket(NetSocket sock, NetAddress to, const void *data, int size)
+{
+    if (netLossRate > 0.0f && GenRandomFloat(&netLossSeed, 0.0f, 1.0f) < netLossRate) {
+        netStats.packetsDropped++;
+        return;
+    }
+
+    struct sockaddr_in address = { 0 };
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(to.host);
+    address.sin_port = htons(to.port);
+    sendto(sock, (const char *)data, size, 0, (struct sockaddr *)&address, sizeof(address));
+
+    netStats.packetsSent++;
+    netStats.bytesSent += size;
+}
+
+// Next waiting datagram, or -1 when there is none
+int ReceivePacket(NetSocket sock, NetAddress *from, unsigned char *buffer, int capacity)
+{
+    struct sockaddr_in address = { 0 };
+    socklen_t length = sizeof(address);
+    int size = (int)recvfrom(sock, (char *)buffer, capacity, 0, (struct sockaddr *)&address, &length);
+    if (size < 0) return -1;
+
+    from->host = ntohl(address.sin_addr.s_addr);
+    from->port = ntohs(address.sin_port);
+    netStats.packetsReceived++;
+    netStats.bytesReceived += size;
+    return size;
+}
+
+// Inputs travel quantized, and the client predicts with the quantized values too,
+// so replaying them gives exactly what the server computed
+SimInput QuantizeSimInput(const SimInput *input)
+{
+    SimInput result = *input;
+    result.mouseDelta.x = roundf(input->mouseDelta.x*NET_MOUSE_SCALE)/NET_MOUSE_SCALE;
+    result.mouseDelta.y = roundf(input->mouseDelta.y*NET_MOUSE_SCALE)/NET_MOUSE_SCALE;
+    result.wheel = roundf(input->wheel);
+    return result;
+}
+
+static void WriteSimInput(NetWriter *writer, const SimInput *input)
+{
+    WriteVarint(writer, input->down);
+    WriteVarint(writer, input->pressed);
+    WriteSigned(writer, (int)roundf(input->mouseDelta.x*NET_MOUSE_SCALE));
+    WriteSigned(writer, (int)roundf(input->mouseDelta.y*NET_MOUSE_SCALE));
+    WriteSigned(writer, (int)input->wheel);
+}
+
+static SimInput ReadSimInput(NetReader *reader)
+{
+    SimInput input = { 0 };
+    input.down = ReadVarint(reader);
+    input.pressed = ReadVarint(reader);
+    input.mouseDelta.x = ReadSigned(reader)/NET_MOUSE_SCALE;
+    input.mouseDelta.y = ReadSigned(reader)/NET_MOUSE_SCALE;
+    input.wheel = (float)ReadSigned(reader);
+    return input;
+}
+
+// The receiving client's own player, at full precision so prediction restarts
+// from exactly the server's state
+static void WritePlayerControl(NetWriter *writer, const PlayerState *player)
+{
+    WriteBytes(writer, &player->camera.position, sizeof(Vector3));
+    WriteBytes(writer, &player->camera.target, sizeof(Vector3));
+    WriteF32(writer, player->verticalVelocity);
+    WriteF32(writer, player->switchTimer);
+    WriteU8(writer, (unsigned char)(player->currentWeapon | (player->targetWeapon << 1) |
+                                    (player->isSwitching << 2) | (player->isGrounded << 3)));
+    for (int i = 0; i < 2; i++) {
+        const Weapon *w = &player->weapons[i];
+        WriteVarint(writer, (unsigned int)w->currentAmmo);
+        WriteU8(writer, w->isReloading);
+        WriteF32(writer, w->reloadTimer);
+        WriteF32(writer, w->timeSinceLastShot);
+    }
+}
+
+static void ReadPlayerControl(NetReader *reader, PlayerState *player)
+{
+    ReadBytes(reader, &player->camera.position, sizeof(Vector3));
+    ReadBytes(reader, &player->camera.target, sizeof(Vector3));
+    player->verticalVelocity = ReadF32(reader);
+    player->switchTimer = ReadF32(reader);
+    unsigned char flags = ReadU8(reader);
+    player->currentWeapon = flags & 1;
+    player->targetWeapon = (flags >> 1) & 1;
+    player->isSwitching = (flags & 4) != 0;
+    player->isGrounded = (flags & 8) != 0;
+    for (int i = 0; i < 2; i++) {
+        Weapon *w = &player->weapons[i];
+        w->currentAmmo = (int)ReadVarint(reader);
+        w->isReloading = ReadU8(reader) != 0;
+        w->reloadTimer = ReadF32(reader);
+        w->timeSinceLastShot = ReadF32(reader);
+    }
+}
+
+static int QuantizePosition(float value)
+{
+    return (int)roundf(value*NET_POSITION_SCALE);
+}
+
+typedef struct NetCandidate {
+    float distanceSq;
+    NetEntity entity;
+} NetCandidate;
+
+static int CompareNetCandidates(const void *a, const void *b)
+{
+    float da = ((const NetCandidate *)a)->distanceSq, db = ((const NetCandidate *)b)->distanceSq;
+    return (da > db) - (da < db);
+}
+
+static int CompareNetEntities(const void *a, const void *b)
+{
+    int ia = ((const NetEntity *)a)->id, ib = ((const NetEntity *)b)->id;
+    return (ia > ib) - (ia < ib);
+}
+
+// Keep the nearest cap candidates, sorted by id, as snapshot section s
+static void SetSnapshotSection(NetSnapshot *snapshot, int s, NetCandidate *candidates, int count)
+{
+    int cap = snapshotSectionCaps[s];
+    if (count > cap) qsort(candidates, count, sizeof(NetCandidate), CompareNetCandidates);
+    snapshot->counts[s] = (count < cap)? count : cap;
+    for (int i = 0; i < snapshot->counts[s]; i++) snapshot->entities[s][i] = candidates[i].entity;
+    qsort(snapshot->entities[s], snapshot->counts[s], sizeof(NetEntity), CompareNetEntities);
+}
+
+// Quantize what the player in slot can see: the other players, enemies and bullets in
+// range, nearest first when a section is over its cap. candidates has room for every enemy and bullet.
+void BuildSnapshot(const GameState *state, int slot, NetCandidate *candidates, NetSnapshot *snapshot)
+{
+    Vector3 eye = state->players[slot].camera.position;
+    const float rangeSq = SNAPSHOT_RELEVANCE_RANGE*SNAPSHOT_RELEVANCE_RANGE;
+    snapshot->tick = state->tick;
+
+    int count = 0;
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        const PlayerState *other = &state->players[p];
+        if (!other->active || p == slot) continue;
+        float distanceSq = Vector3DistanceSqr(eye, other->camera.position);
+        if (distanceSq > rangeSq) continue;
+
+        Vector3 look = Vector3Normalize(Vector3Subtract(other->camera.target, other->camera.position));
+        NetEntity *e = &candidates[count].entity;
+        candidates[count++].distanceSq = distanceSq;
+        e->id = p;
+        e->fields[0] = QuantizePosition(other->camera.position.x);
+        e->fields[1] = QuantizePosition(other->camera.position.y);
+        e->fields[2] = QuantizePosition(other->camera.position.z);
+        e->fields[3] = (int)roundf(atan2f(look.z, look.x)*NET_ANGLE_SCALE);
+        e->fields[4] = (int)roundf(asinf(Clamp(look.y, -1.0f, 1.0f))*NET_ANGLE_SCALE);
+        e->fields[5] = other->currentWeapon | (other->isSwitching << 1) | (other->weapons[other->currentWeapon].isReloading << 2);
+    }
+    SetSnapshotSection(snapshot, NET_SECTION_PLAYERS, candidates, count);
+
+    const EnemyStore *enemies = &state->enemies;
+    count = 0;
+    for (int i = 0; i < enemies->count; i++) {
+        float distanceSq = Vector3DistanceSqr(eye, enemies->position[i]);
+        if (distanceSq > rangeSq) continue;
+
+        NetEntity *e = &candidates[count].entity;
+        candidates[count++].distanceSq = distanceSq;
+        e->id = enemies->ids[i];
+        e->fields[0] = QuantizePosition(enemies->position[i].x);
+        e->fields[1] = QuantizePosition(enemies->position[i].y);
+        e->fields[2] = QuantizePosition(enemies->position[i].z);
+        e->fields[3] = (int)ceilf(enemies->health[i]);
+        e->fields[4] = enemies->state[i];
+        e->fields[5] = 0;
+    }
+    SetSnapshotSection(snapshot, NET_SECTION_ENEMIES, candidates, count);
+
+    const ProjectilePool *pool = &state->projectiles;
+    count = 0;
+    for (int i = 0; i < pool->count; i++) {
+        const Bullet *b = &pool->bullets[i];
+        float distanceSq = Vector3DistanceSqr(eye, b->position);
+        if (distanceSq > rangeSq) continue;
+
+        NetEntity *e = &candidates[count].entity;
+        candidates[count++].distanceSq = distanceSq;
+        e->id = pool->ids[i];
+        e->fields[0] = QuantizePosition(b->position.x);
+        e->fields[1] = QuantizePosition(b->position.y);
+        e->fields[2] = QuantizePosition(b->position.z);
+        e->fields[3] = (int)roundf(b->direction.x*127.0f);
+        e->fields[4] = (int)roundf(b->direction.y*127.0f);
+        e->fields[5] = (int)roundf(b->direction.z*127.0f);
+    }
+    SetSnapshotSection(snapshot, NET_SECTION_BULLETS, candidates, count);
+}
+
+// Delta-code current against baseline (NULL = against nothing): first the ids the
+// baseline has and current lacks for every section, then per section the records of
+// new and changed entities, ended by a 0 byte. Records that no longer fit are left
+// out, and current is updated to what the client will hold afterwards (a left-out
+// entity keeps its baseline values, or is missing if it was new).
+void WriteSnapshotDelta(NetWriter *writer, const NetSnapshot *baseline, NetSnapshot *current)
+{
+    static const NetSnapshot empty = { 0 };
+    if (baseline == NULL) baseline = &empty;
+
+    for (int s = 0; s < NET_SECTION_COUNT; s++) {
+        const NetEntity *base = baseline->entities[s], *cur = current->entities[s];
+        int removed = 0;
+        for (int b = 0, c = 0; b < baseline->counts[s]; b++) {
+            while (c < current->counts[s] && cur[c].id < base[b].id) c++;
+            if (c == current->counts[s] || cur[c].id != base[b].id) removed++;
+        }
+
+        WriteVarint(writer, removed);
+        int lastId = -1;
+        for (int b = 0, c = 0; b < baseline->counts[s]; b++) {
+            while (c < current->counts[s] && cur[c].id < base[b].id) c++;
+            if (c == current->counts[s] || cur[c].id != base[b].id) {
+                WriteVarint(writer, base[b].id - lastId - 1);
+                lastId = base[b].id;
+            }
+        }
+    }
+
+    for (int s = 0; s < NET_SECTION_COUNT; s++) {
+        const NetEntity *base = baseline->entities[s];
+        NetEntity kept[SNAPSHOT_MAX_SECTION];
+        int keptCount = 0;
+        int lastId = -1;
+
+        for (int c = 0, b = 0; c < current->counts[s]; c++) {
+            const NetEntity *e = &current->entities[s][c];
+            while (b < baseline->counts[s] && base[b].id < e->id) b++;
+            const NetEntity *old = (b < baseline->counts[s] && base[b].id == e->id)? &base[b] : NULL;
+
+            unsigned char flags = (old == NULL)? NET_RECORD_NEW : 0;
+            for (int f = 0; f < NET_ENTITY_FIELDS; f++) {
+                if (e->fields[f] != ((old != NULL)? old->fields[f] : 0)) flags |= 1 << f;
+            }
+
+            // Unchanged entities are not written at all
+            if (flags == 0) {
+                kept[keptCount++] = *e;
+                continue;
+            }
+
+            // Out of room (keeping a byte for each section end)
+            if (writer->capacity - writer->size < NET_RECORD_MAX_BYTES + NET_SECTION_COUNT) {
+                if (old != NULL) kept[keptCount++] = *old;
+                continue;
+            }
+
+            WriteU8(writer, flags);
+            WriteVarint(writer, e->id - lastId - 1);
+            lastId = e->id;
+            for (int f = 0; f < NET_ENTITY_FIELDS; f++) {
+                if (flags & (1 << f)) WriteSigned(writer, e->fields[f] - ((old != NULL)? old->fields[f] : 0));
+            }
+            kept[keptCount++] = *e;
+        }
+        WriteU8(writer, 0);
+
+        memcpy(current->entities[s], kept, keptCount*sizeof(NetEntity));
+        current->counts[s] = keptCount;
+    }
+}
+
+// Rebuild a snapshot from its baseline and the delta; false if the delta is malformed
+bool ReadSnapshotDelta(NetReader *reader, const NetSnapshot *baseline, NetSnapshot *result)
+{
+    static const NetSnapshot empty = { 0 };
+    if (baseline == NULL) baseline = &empty;
+
+    int removed[NET_SECTION_COUNT][SNAPSHOT_MAX_SECTION];
+    int removedCounts[NET_SECTION_COUNT];
+    for (int s = 0; s < NET_SECTION_COUNT; s++) {
+        removedCounts[s] = (int)ReadVarint(reader);
+        if (removedCounts[s] > baseline->counts[s]) return false;
+        int lastId = -1;
+        for (int i = 0; i < removedCounts[s]; i++) {
+            lastId += (int)ReadVarint(reader) + 1;
+            removed[s][i] = lastId;
+        }
+    }
+
+    for (int s = 0; s < NET_SECTION_COUNT; s++) {
+        // Baseline entities still present
+        NetEntity survivors[SNAPSHOT_MAX_SECTION];
+        int survivorCount = 0;
+        for (int b = 0, r = 0; b < baseline->counts[s]; b++) {
+            const NetEntity *old = &baseline->entities[s][b];
+            while (r < removedCounts[s] && removed[s][r] < old->id) r++;
+            if (r < removedCounts[s] && removed[s][r] == old->id) continue;
+            survivors[survivorCount++] = *old;
+        }
+
+        // Merge the records in by id
+        NetEntity *out = result->entities[s];
+        int count = 0, next = 0;
+        int lastId = -1;
+        unsigned char flags;
+        while ((flags = ReadU8(reader)) != 0 && !reader->overflow) {
+            int id = lastId + (int)ReadVarint(reader) + 1;
+            lastId = id;
+
+            while (next < survivorCount && survivors[next].id < id) {
+                if (count == SNAPSHOT_MAX_SECTION) return false;
+                out[count++] = survivors[next++];
+            }
+
+            NetEntity e = { id, { 0 } };
+            if (!(flags & NET_RECORD_NEW)) {
+                if (next == survivorCount || survivors[next].id != id) return false;
+                e = survivors[next++];
+            }
+            for (int f = 0; f < NET_ENTITY_FIELDS; f++) {
+                if (flags & (1 << f)) e.fields[f] += ReadSigned(reader);
+            }
+
+            if (count == SNAPSHOT_MAX_SECTION) return false;
+            out[count++] = e;
+        }
+        while (next < survivorCount) {
+            if (count == SNAPSHOT_MAX_SECTION) return false;
+            out[count++] = survivors[next++];
+        }
+        result->counts[s] = count;
+    }
+
+    return !reader->overflow;
+}
+
+//------------------------------------------------------------------------------------
+// Server side
+//------------------------------------------------------------------------------------
+typedef struct NetClientSlot {
+    bool connected;
+    NetAddress address;
+    double lastHeard;
+    unsigned int newestInput;           // Newest input sequence received
+    unsigned int appliedInput;          // Last input simulated, acknowledged in every snapshot
+    SimInput inputs[NET_INPUT_BUFFER];  // Received inputs by sequence
+    SimInput lastInput;                 // Repeated (held buttons only) when an input is late
+    unsigned int ackedTick;             // Newest snapshot the client has confirmed
+    NetSnapshot *history;               // Sent snapshots by tick, the delta baselines
+    long long bytesSent;
+    int snapshotsSent;
+    int deltaSnapshots;                 // Sent against a baseline
+    long long fullBytes;                // What the snapshots would have cost without delta coding (when measured)
+} NetClientSlot;
+
+typedef struct NetServer {
+    NetSocket socket;
+    GameState *state;
+    unsigned int levelHash;
+    NetClientSlot clients[MAX_PLAYERS];     // Client i plays player slot i
+    int clientCount;
+    NetCandidate *candidates;               // Snapshot building scratch
+    int candidateCapacity;
+    bool measureFullSize;                   // Also size every snapshot as if sent without a baseline
+    double simulationTime;                  // Seconds spent in UpdateSimulation and in snapshots
+    double snapshotTime;
+} NetServer;
+
+// Serve state on port; the state's local player is removed, players join as clients connect
+bool InitNetServer(NetServer *server, GameState *state, unsigned short port)
+{
+    *server = (NetServer){ 0 };
+    if (!OpenNetSocket(&server->socket, port)) return false;
+
+    server->state = state;
+    server->levelHash = HashLevel();
+    server->candidateCapacity = state->enemies.capacity + state->projectiles.capacity + MAX_PLAYERS;
+    server->candidates = (NetCandidate *)malloc(server->candidateCapacity*sizeof(NetCandidate));
+    state->players[0].active = false;
+    return true;
+}
+
+static void DropNetClient(NetServer *server, int slot)
+{
+    NetClientSlot *client = &server->clients[slot];
+    free(client->history);
+    *client = (NetClientSlot){ 0 };
+    server->state->players[slot].active = false;
+    server->clientCount--;
+}
+
+void UnloadNetServer(NetServer *server)
+{
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        if (!server->clients[i].connected) continue;
+        unsigned char packet = NET_DISCONNECT;
+        SendPacket(server->socket, server->clients[i].address, &packet, 1);
+        DropNetClient(server, i);
+    }
+    free(server->candidates);
+    CloseNetSocket(server->socket);
+}
+
+static void ReplyNetReject(NetServer *server, NetAddress to, int reason)
+{
+    unsigned char packet[2] = { NET_REJECT, (unsigned char)reason };
+    SendPacket(server->socket, to, packet, 2);
+}
+
+static void HandleNetConnect(NetServer *server, NetAddress from, NetReader *reader, double now)
+{
+    unsigned int protocol = ReadU32(reader);
+    unsigned int levelHash = ReadU32(reader);
+    if (protocol != NET_PROTOCOL_ID) { ReplyNetReject(server, from, NET_REJECT_PROTOCOL); return; }
+    if (levelHash != server->levelHash) { ReplyNetReject(server, from, NET_REJECT_LEVEL); return; }
+
+    // A repeated request (the accept was lost) gets the same slot
+    int slot = -1;
+    for (int i = 0; i < MAX_PLAYERS && slot < 0; i++) {
+        if (server->clients[i].connected && SameNetAddress(server->clients[i].address, from)) slot = i;
+    }
+    for (int i = 0; i < MAX_PLAYERS && slot < 0; i++) {
+        if (server->clients[i].connected) continue;
+
+        slot = i;
+        NetClientSlot *client = &server->clients[i];
+        *client = (NetClientSlot){ 0 };
+        client->connected = true;
+        client->address = from;
+        client->ackedTick = NET_NO_TICK;
+        client->history = (NetSnapshot *)malloc(NET_SNAPSHOT_HISTORY*sizeof(NetSnapshot));
+        for (int h = 0; h < NET_SNAPSHOT_HISTORY; h++) client->history[h].tick = NET_NO_TICK;
+        InitPlayer(&server->state->players[i]);
+        server->clientCount++;
+    }
+    if (slot < 0) { ReplyNetReject(server, from, NET_REJECT_FULL); return; }
+
+    server->clients[slot].lastHeard = now;
+    unsigned char packet[2] = { NET_ACCEPT, (unsigned char)slot };
+    SendPacket(server->socket, from, packet, 2);
+}
+
+static void HandleNetInput(NetClientSlot *client, NetReader *reader)
+{
+    unsigned int ackedTick = ReadU32(reader);
+    unsigned int newest = ReadU32(reader);
+    int count = ReadU8(reader);
+    if (reader->overflow) return;
+
+    if (ackedTick != NET_NO_TICK && (client->ackedTick == NET_NO_TICK || ackedTick > client->ackedTick)) client->ackedTick = ackedTick;
+
+    // Inputs come newest first; keep those not simulated yet
+    for (int i = 0; i < count && (unsigned int)i < newest; i++) {
+        SimInput input = ReadSimInput(reader);
+        unsigned int sequence = newest - i;
+        if (reader->overflow) return;
+        if (sequence > client->appliedInput && sequence + NET_INPUT_BUFFER > newest) client->inputs[sequence & (NET_INPUT_BUFFER - 1)] = input;
+    }
+    if (newest > client->newestInput) client->newestInput = newest;
+}
+
+// Drain the socket
+void ReceiveNetServer(NetServer *server, double now)
+{
+    unsigned char buffer[NET_MAX_PACKET];
+    NetAddress from;
+    int size;
+    while ((size = ReceivePacket(server->socket, &from, buffer, sizeof(buffer))) >= 0) {
+        if (size == 0) continue;
+        NetReader reader = { buffer, size, 1, false };
+
+        if (buffer[0] == NET_CONNECT) {
+            HandleNetConnect(server, from, &reader, now);
+            continue;
+        }
+
+        int slot = -1;
+        for (int i = 0; i < MAX_PLAYERS && slot < 0; i++) {
+            if (server->clients[i].connected && SameNetAddress(server->clients[i].address, from)) slot = i;
+        }
+        if (slot < 0) continue;
+
+        server->clients[slot].lastHeard = now;
+        if (buffer[0] == NET_INPUT) HandleNetInput(&server->clients[slot], &reader);
+        else if (buffer[0] == NET_DISCONNECT) DropNetClient(server, slot);
+    }
+}
+
+// The tick's sounds the player in slot can hear and did not predict (its own shots
+// and reloads), as many as still fit after the entities
+static void WriteSnapshotSounds(NetWriter *writer, const GameState *state, int slot)
+{
+    Vector3 eye = state->players[slot].camera.position;
+    const float rangeSq = SNAPSHOT_RELEVANCE_RANGE*SNAPSHOT_RELEVANCE_RANGE;
+    int room = (writer->capacity - writer->size - 1)/NET_SOUND_MAX_BYTES;
+
+    const SoundEvent *heard[MAX_SOUND_EVENTS];
+    int count = 0;
+    for (int i = 0; i < state->soundCount && count < room; i++) {
+        const SoundEvent *sound = &state->sounds[i];
+        if (sound->source != slot && Vector3DistanceSqr(eye, sound->position) <= rangeSq) heard[count++] = sound;
+    }
+
+    WriteVarint(writer, count);
+    for (int i = 0; i < count; i++) {
+        WriteU8(writer, (unsigned char)heard[i]->sound);
+        WriteSigned(writer, QuantizePosition(heard[i]->position.x));
+        WriteSigned(writer, QuantizePosition(heard[i]->position.y));
+        WriteSigned(writer, QuantizePosition(heard[i]->position.z));
+    }
+}
+
+// Snapshot for one client against the newest baseline it confirmed: header, the
+// server's copy of the player, the entity delta, then the tick's sounds
+static void SendNetSnapshot(NetServer *server, int slot)
+{
+    NetClientSlot *client = &server->clients[slot];
+    const GameState *state = server->state;
+
+    NetSnapshot *snapshot = &client->history[state->tick & (NET_SNAPSHOT_HISTORY - 1)];
+    BuildSnapshot(state, slot, server->candidates, snapshot);
+
+    const NetSnapshot *baseline = NULL;
+    unsigned int acked = client->ackedTick;
+    if (acked != NET_NO_TICK && state->tick - acked < NET_SNAPSHOT_HISTORY &&
+        client->history[acked & (NET_SNAPSHOT_HISTORY - 1)].tick == acked) {
+        baseline = &client->history[acked & (NET_SNAPSHOT_HISTORY - 1)];
+    }
+
+    // Measured off the clock
+    if (server->measureFullSize) {
+        double measureStart = GetWallTime();
+        static NetSnapshot full;
+        unsigned char scratch[NET_MAX_PACKET];
+        NetWriter fullWriter = { scratch, 0, sizeof(scratch), false };
+        full = *snapshot;
+        WriteSnapshotDelta(&fullWriter, NULL, &full);
+        client->fullBytes += fullWriter.size;
+        server->snapshotTime -= GetWallTime() - measureStart;
+    }
+
+    unsigned char buffer[NET_MAX_PACKET];
+    NetWriter writer = { buffer, 0, sizeof(buffer), false };
+    WriteU8(&writer, NET_SNAPSHOT);
+    WriteU32(&writer, state->tick);
+    WriteU32(&writer, (baseline != NULL)? baseline->tick : NET_NO_TICK);
+    WriteU32(&writer, client->appliedInput);
+    WriteVarint(&writer, state->enemies.count);
+    WritePlayerControl(&writer, &state->players[slot]);
+    WriteSnapshotDelta(&writer, baseline, snapshot);
+    WriteSnapshotSounds(&writer, state, slot);
+
+    SendPacket(server->socket, client->address, buffer, writer.size);
+    client->bytesSent += writer.size;
+    client->snapshotsSent++;
+    if (baseline != NULL) client->deltaSnapshots++;
+}
+
+// One server tick: take every client's next input, simulate, send the snapshots
+void UpdateNetServer(NetServer *server, double now)
+{
+    ReceiveNetServer(server, now);
+
+    SimInput inputs[MAX_PLAYERS] = { 0 };
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        NetClientSlot *client = &server->clients[i];
+        if (!client->connected) continue;
+
+        if (now - client->lastHeard > NET_TIMEOUT) {
+            DropNetClient(server, i);
+            continue;
+        }
+
+        // A client that got far ahead skips its stale inputs; a late input is
+        // stood in for by the held buttons, and the client corrects afterwards
+        if (client->newestInput - client->appliedInput > NET_INPUT_BUFFER/2) client->appliedInput = client->newestInput - 1;
+        if (client->newestInput > client->appliedInput) {
+            client->appliedInput++;
+            client->lastInput = client->inputs[client->appliedInput & (NET_INPUT_BUFFER - 1)];
+            inputs[i] = client->lastInput;
+        } else {
+            inputs[i].down = client->lastInput.down;
+        }
+    }
+
+    double start = GetWallTime();
+    UpdateSimulation(server->state, inputs, SIM_DT);
+    double simulated = GetWallTime();
+
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        if (server->clients[i].connected) SendNetSnapshot(server, i);
+    }
+
+    server->simulationTime += simulated - start;
+    server->snapshotTime += GetWallTime() - simulated;
+}
+
+//------------------------------------------------------------------------------------
+// Client side
+//------------------------------------------------------------------------------------
+typedef struct NetClient {
+    NetSocket socket;
+    NetAddress server;
+    GameState *state;                   // World as last received, with the local player predicted
+    int slot;                           // Player slot, -1 until accepted
+    bool disconnected;                  // Rejected, timed out or told to leave
+    int rejectReason;
+    double lastHeard;
+    double lastConnectAttempt;
+    int connectAttempts;
+    unsigned int inputSequence;         // Newest input sent
+    SimInput inputs[NET_INPUT_BUFFER];  // Sent inputs by sequence, replayed on every correction
+    NetSnapshot *history;               // Received snapshots by tick, the delta baselines
+    unsigned int newestTick;            // Newest snapshot applied
+    int enemiesLeft;                    // Server-wide, the snapshot holds only the nearby ones
+    int snapshotsReceived;
+    int corrections;                    // Snapshots that moved the predicted player
+    double correctionDistance;
+} NetClient;
+
+// Client playing state (already holding the level) against the server at address
+bool InitNetClient(NetClient *client, GameState *state, NetAddress address)
+{
+    *client = (NetClient){ 0 };
+    if (!OpenNetSocket(&client->socket, 0)) return false;
+
+    client->server = address;
+    client->state = state;
+    client->slot = -1;
+    client->newestTick = NET_NO_TICK;
+    client->history = (NetSnapshot *)malloc(NET_SNAPSHOT_HISTORY*sizeof(NetSnapshot));
+    for (int h = 0; h < NET_SNAPSHOT_HISTORY; h++) client->history[h].tick = NET_NO_TICK;
+    return true;
+}
+
+void UnloadNetClient(NetClient *client)
+{
+    if (client->slot >= 0 && !client->disconnected) {
+        unsigned char packet = NET_DISCONNECT;
+        SendPacket(client->socket, client->server, &packet, 1);
+    }
+    free(client->history);
+    CloseNetSocket(client->socket);
+}
+
+// Show the received entities: other players, enemies and bullets are replaced
+// wholesale, the local player is left to prediction
+static void ApplyNetSnapshot(NetClient *client, const NetSnapshot *snapshot)
+{
+    GameState *state = client->state;
+
+    bool seen[MAX_PLAYERS] = { 0 };
+    for (int i = 0; i < snapshot->counts[NET_SECTION_PLAYERS]; i++) {
+        const NetEntity *e = &snapshot->entities[NET_SECTION_PLAYERS][i];
+        if (e->id < 0 || e->id >= MAX_PLAYERS || e->id == client->slot) continue;
+
+        PlayerState *other = &state->players[e->id];
+        if (!other->active) InitPlayer(other);
+        seen[e->id] = true;
+
+        float yaw = e->fields[3]/NET_ANGLE_SCALE, pitch = e->fields[4]/NET_ANGLE_SCALE;
+        other->camera.position = (Vector3){ e->fields[0]/NET_POSITION_SCALE, e->fields[1]/NET_POSITION_SCALE, e->fields[2]/NET_POSITION_SCALE };
+        other->camera.target = Vector3Add(other->camera.position, (Vector3){ cosf(pitch)*cosf(yaw), sinf(pitch), cosf(pitch)*sinf(yaw) });
+        other->currentWeapon = e->fields[5] & 1;
+        other->isSwitching = (e->fields[5] & 2) != 0;
+    }
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        if (p != client->slot && !seen[p]) state->players[p].active = false;
+    }
+
+    // Local handle ids change with every snapshot; the server's stay with the enemy
+    EnemyStore *enemies = &state->enemies;
+    while (enemies->count > 0) DespawnEnemyAt(enemies, enemies->count - 1);
+    if (state->enemyNetIds == NULL) state->enemyNetIds = (int *)malloc(enemies->capacity*sizeof(int));
+    for (int i = 0; i < snapshot->counts[NET_SECTION_ENEMIES]; i++) {
+        const NetEntity *e = &snapshot->entities[NET_SECTION_ENEMIES][i];
+        Vector3 position = { e->fields[0]/NET_POSITION_SCALE, e->fields[1]/NET_POSITION_SCALE, e->fields[2]/NET_POSITION_SCALE };
+        int id = SpawnEnemy(enemies, position);
+        if (id < 0) break;
+        enemies->health[enemies->slotOf[id]] = (float)e->fields[3];
+        enemies->state[enemies->slotOf[id]] = (unsigned char)e->fields[4];
+        state->enemyNetIds[enemies->slotOf[id]] = e->id;
+    }
+
+    ProjectilePool *pool = &state->projectiles;
+    while (pool->count > 0) ReleaseProjectileAt(pool, pool->count - 1);
+    for (int i = 0; i < snapshot->counts[NET_SECTION_BULLETS]; i++) {
+        const NetEntity *e = &snapshot->entities[NET_SECTION_BULLETS][i];
+        Bullet *b = AllocProjectile(pool);
+        if (b == NULL) break;
+        b->position = (Vector3){ e->fields[0]/NET_POSITION_SCALE, e->fields[1]/NET_POSITION_SCALE, e->fields[2]/NET_POSITION_SCALE };
+        b->direction = Vector3Normalize((Vector3){ (float)e->fields[3], (float)e->fields[4], (float)e->fields[5] });
+        b->previous = Vector3Subtract(b->position, Vector3Scale(b->direction, BULLET_SPEED*SIM_DT));
+        b->damage = 0.0f;
+    }
+
+    state->tick = snapshot->tick;
+}
+
+// Restart the local player from the server's copy and replay the inputs it has not
+// simulated yet. Weapon sway, bob and recoil are cosmetic and stay as predicted.
+static void ReconcileNetPlayer(NetClient *client, const PlayerState *authoritative, unsigned int appliedInput)
+{
+    PlayerState *player = &client->state->players[client->slot];
+    PlayerState predicted = *player;
+
+    *player = *authoritative;
+    if (client->inputSequence - appliedInput < NET_INPUT_BUFFER) {
+        for (unsigned int sequence = appliedInput + 1; sequence <= client->inputSequence; sequence++) {
+            UpdatePlayer(player, &client->inputs[sequence & (NET_INPUT_BUFFER - 1)], SIM_DT, true);
+        }
+    }
+    player->recoilOffset = predicted.recoilOffset;
+    player->weaponSway = predicted.weaponSway;
+    player->weaponBob = predicted.weaponBob;
+
+    float error = Vector3Distance(predicted.camera.position, player->camera.position);
+    if (error > 0.0001f) {
+        client->corrections++;
+        client->correctionDistance += error;
+    }
+}
+
+// Queue the server's sounds of a snapshot tick for the client's next PlayTickSounds()
+static void ReadSnapshotSounds(NetReader *reader, GameState *state)
+{
+    int count = (int)ReadVarint(reader);
+    for (int i = 0; i < count && !reader->overflow; i++) {
+        int sound = ReadU8(reader);
+        Vector3 position;
+        position.x = ReadSigned(reader)/NET_POSITION_SCALE;
+        position.y = ReadSigned(reader)/NET_POSITION_SCALE;
+        position.z = ReadSigned(reader)/NET_POSITION_SCALE;
+        if (!reader->overflow && sound < SOUND_COUNT) AddSoundEvent(state, sound, -1, position);
+    }
+}
+
+static void HandleNetSnapshot(NetClient *client, NetReader *reader)
+{
+    unsigned int tick = ReadU32(reader);
+    unsigned int baselineTick = ReadU32(reader);
+    unsigned int appliedInput = ReadU32(reader);
+    int enemiesLeft = (int)ReadVarint(reader);
+    if (reader->overflow) return;
+
+    // Late and duplicate snapshots are old news
+    if (client->newestTick != NET_NO_TICK && tick <= client->newestTick) return;
+
+    const NetSnapshot *baseline = NULL;
+    if (baselineTick != NET_NO_TICK) {
+        baseline = &client->history[baselineTick & (NET_SNAPSHOT_HISTORY - 1)];
+        if (baseline->tick != baselineTick) return;
+    }
+
+    // The server's copy of the local player, over the predicted one
+    PlayerState authoritative = client->state->players[client->slot];
+    ReadPlayerControl(reader, &authoritative);
+
+    NetSnapshot *snapshot = &client->history[tick & (NET_SNAPSHOT_HISTORY - 1)];
+    NetSnapshot decoded;
+    if (!ReadSnapshotDelta(reader, baseline, &decoded)) return;
+    decoded.tick = tick;
+    *snapshot = decoded;
+
+    client->newestTick = tick;
+    client->enemiesLeft = enemiesLeft;
+    client->snapshotsReceived++;
+    ApplyNetSnapshot(client, snapshot);
+    ReconcileNetPlayer(client, &authoritative, appliedInput);
+    ReadSnapshotSounds(reader, client->state);
+}
+
+void ReceiveNetClient(NetClient *client, double now)
+{
+    unsigned char buffer[NET_MAX_PACKET];
+    NetAddress from;
+    int size;
+    while ((size = ReceivePacket(client->socket, &from, buffer, sizeof(buffer))) >= 0) {
+        if (size == 0 || !SameNetAddress(from, client->server)) continue;
+        NetReader reader = { buffer, size, 1, false };
+        client->lastHeard = now;
+
+        if (buffer[0] == NET_ACCEPT && client->slot < 0 && size >= 2) {
+            // Move the local player into the slot the server gave us; a slot past the
+            // player array means the server does not speak our protocol
+            int slot = buffer[1];
+            if (slot >= MAX_PLAYERS) {
+                client->disconnected = true;
+                client->rejectReason = NET_REJECT_PROTOCOL;
+                continue;
+            }
+            GameState *state = client->state;
+            if (slot != 0) {
+                state->players[slot] = state->players[0];
+                state->players[0].active = false;
+            }
+            client->slot = slot;
+        } else if (buffer[0] == NET_REJECT) {
+            client->disconnected = true;
+            client->rejectReason = (size >= 2)? buffer[1] : 0;
+        } else if (buffer[0] == NET_DISCONNECT) {
+            client->disconnected = true;
+        } else if (buffer[0] == NET_SNAPSHOT && client->slot >= 0) {
+            HandleNetSnapshot(client, &reader);
+        }
+    }
+}
+
+// One client tick: read the server, then send input and predict the local player with it.
+// The tick's sounds, the server's and the predicted ones, are left in the client state.
+void UpdateNetClient(NetClient *client, const SimInput *input, double now)
+{
+    client->state->soundCount = 0;
+    ReceiveNetClient(client, now);
+    if (client->disconnected) return;
+
+    if (client->slot < 0) {
+        if (client->connectAttempts == 0 || now - client->lastConnectAttempt >= NET_CONNECT_RETRY) {
+            unsigned char buffer[16];
+            NetWriter writer = { buffer, 0, sizeof(buffer), false };
+            WriteU8(&writer, NET_CONNECT);
+            WriteU32(&writer, NET_PROTOCOL_ID);
+            WriteU32(&writer, HashLevel());
+            SendPacket(client->socket, client->server, buffer, writer.size);
+            if (client->connectAttempts++ == 0) client->lastHeard = now;
+            client->lastConnectAttempt = now;
+        }
+        if (now - client->lastHeard > NET_TIMEOUT) client->disconnected = true;
+        return;
+    }
+
+    if (now - client->lastHeard > NET_TIMEOUT) {
+        client->disconnected = true;
+        return;
+    }
+
+    SimInput quantized = QuantizeSimInput(input);
+    unsigned int sequence = ++client->inputSequence;
+    client->inputs[sequence & (NET_INPUT_BUFFER - 1)] = quantized;
+
+    unsigned char buffer[NET_MAX_PACKET];
+    NetWriter writer = { buffer, 0, sizeof(buffer), false };
+    int count = (sequence < NET_INPUT_REDUNDANCY)? (int)sequence : NET_INPUT_REDUNDANCY;
+    WriteU8(&writer, NET_INPUT);
+    WriteU32(&writer, client->newestTick);
+    WriteU32(&writer, sequence);
+    WriteU8(&writer, (unsigned char)count);
+    for (int i = 0; i < count; i++) WriteSimInput(&writer, &client->inputs[(sequence - i) & (NET_INPUT_BUFFER - 1)]);
+    SendPacket(client->socket, client->server, buffer, writer.size);
+
+    bool fired = UpdatePlayer(&client->state->players[client->slot], &quantized, SIM_DT, true);
+    AddPlayerSounds(client->state, client->slot, fired);
+}
+
+//------------------------------------------------------------------------------------
+// Headless Mode
+//------------------------------------------------------------------------------------
+typedef struct LaunchOptions {
+    int headlessTicks;          // > 0 runs without a window
+    int maxBullets;             // Projectile pool capacity
+    int maxEnemies;             // Enemy store capacity
+    const char *levelFile;      // Binary level file, NULL for the built-in bunker
+    int generateBoxes;          // > 0 plays a generated level of about this many boxes
+    unsigned int seed;          // Level generator seed
+    int threads;                // Job system threads including the main thread, 0 = one per core
+    const char *profileFile;    // Record the frame profiler and dump it here on exit, NULL = off
+    const char *recordFile;     // Record the inputs of the run to this file, NULL = off
+    const char *replayFile;     // Drive the run from this input recording, NULL = off
+    float frameBudget;          // Replays fail when the 95th percentile frame exceeds this (ms), 0 = off
+    int targetFps;              // Render rate cap, 0 = uncapped (the simulation always ticks at SIM_TICK_RATE)
+    int serverPort;             // > 0 runs a dedicated server on this UDP port
+    const char *connectAddress; // Play on the server at "host[:port]", NULL = local game
+    float packetLoss;           // Fraction of outgoing packets dropped on purpose
+    const char *audioRenderFile;    // Mix a scripted fight to this WAV file and exit, NULL = off
+    float audioRenderSeconds;
+} LaunchOptions;
+
+// Load the requested level file or generated level, falling back to the built-in bunker
+void LoadLevel(const LaunchOptions *options)
+{
+    if (options->generateBoxes > 0) GenerateLevel(options->seed, options->generateBoxes);
+    else if ((options->levelFile == NULL) || !LoadLevelFile(options->levelFile)) InitializeLevel();
+}
+
+// Baked lighting file of the launched level: next to a level file, per generator
+// seed and size, or the bunker's
+const char *GetLightingFilePath(const LaunchOptions *options)
+{
+    if (options->generateBoxes > 0) return TextFormat("resources/generated_%u_%d.light", options->seed, options->generateBoxes);
+    if (options->levelFile != NULL) return TextFormat("%s.light", options->levelFile);
+    return "resources/bunker.light";
+}
+
+// Bake the launched level's lighting and save it where the game looks for it
+int RunLightingBake(const LaunchOptions *options)
+{
+    LoadLevel(options);
+    const char *path = GetLightingFilePath(options);
+
+    long long rays = 0;
+    double start = GetWallTime();
+    BakeLevelLighting(&rays);
+    double seconds = GetWallTime() - start;
+
+    bool exported = ExportLevelLighting(path);
+    printf("Baked %d samples of %d lights with %d job threads: %lld rays in %.2f s (%.2f Mrays/s)\n", levelLighting.sampleCount, lightCount,
+           jobSystem.threadCount, rays, seconds, rays/fmax(seconds, 1e-9)*1e-6);
+    printf("%s %s\n", exported? "Wrote" : "Failed to write", path);
+
+    UnloadStaticBatches();
+    UnloadLevel();
+    return exported? 0 : 1;
+}
+
+// Remember the launched level in a recording
+void SetRecordingLevel(InputRecordingHeader *header, const LaunchOptions *options)
+{
+    header->generateBoxes = options->generateBoxes;
+    header->levelSeed = options->seed;
+    header->maxBullets = options->maxBullets;
+    header->maxEnemies = options->maxEnemies;
+    snprintf(header->levelFile, sizeof(header->levelFile), "%s", (options->levelFile != NULL)? options->levelFile : "");
+}
+
+// Play the level a recording was made on (options keep pointing into the header)
+void UseRecordingLevel(LaunchOptions *options, const InputRecordingHeader *header)
+{
+    options->generateBoxes = header->generateBoxes;
+    options->seed = header->levelSeed;
+    options->maxBullets = header->maxBullets;
+    options->maxEnemies = header->maxEnemies;
+    options->levelFile = (header->levelFile[0] != '\0')? header->levelFile : NULL;
+}
+
+// Compare the replayed state with the recording and print the frame times.
+// Returns the exit code: 1 on a hash mismatch, 2 when over the frame budget.
+int ReportReplay(const InputRecording *recording, const GameState *state, float *frameTimes, int ticks, float frameBudget)
+{
+    unsigned int hash = HashGameState(state);
+    bool complete = ticks == recording->header.tickCount;
+    bool match = complete && hash == recording->header.finalHash;
+
+    printf("Replay: %d of %d ticks, state hash %08x (recorded %08x) %s\n", ticks, recording->header.tickCount, hash,
+           recording->header.finalHash, !complete? "stopped early" : match? "match" : "MISMATCH");
+    float p95 = PrintFrameTimeStats("frame", frameTimes, ticks);
+
+    if (complete && !match) return 1;
+    if (frameBudget > 0.0f && p95 > frameBudget) {
+        printf("  p95 frame time %.3f ms is over the %.3f ms budget\n", p95, frameBudget);
+        return 2;
+    }
+    return 0;
+}
+
+// Replay a recording without a window, timing every tick
+int RunReplay(const LaunchOptions *options, const InputRecording *recording)
+{
+    srand(recording->header.randSeed);
+    LoadLevel(options);
+
+    GameState state;
+    InitGameState(&state, options->maxBullets, options->maxEnemies);
+    SetProfilerRecording(options->profileFile != NULL);
+
+    int ticks = recording->header.tickCount;
+    float *tickTimes = (float *)malloc((ticks > 0)? ticks*sizeof(float) : 1);
+    for (int i = 0; i < ticks; i++) {
+        PROFILE_SCOPE(PROFILE_FRAME);
+        float deltaTime;
+        SimInput input = GetRecordedInput(recording, i, &deltaTime);
+
+        double start = GetWallTime();
+        UpdateSimulation(&state, &input, deltaTime);
+        tickTimes[i] = (float)((GetWallTime() - start)*1000.0);
+    }
+
+    int result = ReportReplay(recording, &state, tickTimes, ticks, options->frameBudget);
+    if (options->profileFile != NULL) ExportProfileTrace(options->profileFile);
+
+    free(tickTimes);
+    UnloadGameState(&state);
+    UnloadStaticBatches();
+    UnloadLevelVisibility();
+    UnloadLevel();
+    return result;
+}
+
+// Run the simulation at fixed steps without a window and report throughput
+int RunHeadless(const LaunchOptions *options)
+{
+    int ticks = options->headlessTicks;
+
+    srand(1);
+    LoadLevel(options);
+
+    GameState state;
+    InitGameState(&state, options->maxBullets, options->maxEnemies);
+
+    // The bot's inputs can be recorded like a player's
+    InputRecording recording = { 0 };
+    if (options->recordFile != NULL) {
+        BeginInputRecording(&recording, 1);
+        SetRecordingLevel(&recording.header, options);
+    }
+
+    // Visibility is sampled once per game second, as the renderer would see it
+    long long culledObjects = 0, totalObjects = 0, visibleRooms = 0;
+    int visibilitySamples = 0;
+
+    SetProfilerRecording(options->profileFile != NULL);
+
+    double start = GetWallTime();
+    for (int i = 0; i < ticks; i++) {
+        PROFILE_SCOPE(PROFILE_FRAME);
+        SimInput input = GenerateBotInput(state.tick);
+        if (options->recordFile != NULL) RecordInputTick(&recording, &input, SIM_DT);
+        UpdateSimulation(&state, &input, SIM_DT);
+
+        if (i % SIM_TICK_RATE == 0) {
+            UpdateLevelVisibility(state.players[0].camera, (float)screenWidth/screenHeight);
+            culledObjects += levelVisibility.culledObjects;
+            totalObjects += levelVisibility.totalObjects;
+            visibleRooms += levelVisibility.visibleRooms;
+            visibilitySamples++;
+        }
+    }
+    double elapsed = GetWallTime() - start;
+
+    printf("Headless run: %d ticks (%.1f s game time) in %.3f s\n", ticks, ticks*SIM_DT, elapsed);
+    printf("  %.0f ticks/sec (%.2f us/tick)\n", (elapsed > 0.0)? ticks/elapsed : 0.0, (ticks > 0)? elapsed*1e6/ticks : 0.0);
+    printf("  level: %d room batches, %d hidden faces removed\n", staticBatchCount, staticHiddenFaces);
+    if (visibilitySamples > 0) {
+        printf("  visibility: %.1f of %d rooms visible, %.1f%% of objects culled\n", (double)visibleRooms/visibilitySamples,
+               roomCount, (totalObjects > 0)? 100.0*culledObjects/totalObjects : 0.0);
+    }
+    printf("  collision grid: %d colliders in %dx%d cells of %.1f units\n", levelColliderCount,
+           collisionGrid.cellsX, collisionGrid.cellsZ, collisionGrid.cellSize);
+    printf("  shots fired: %d, enemies left: %d, player at (%.2f, %.2f, %.2f)\n", state.shotsFired,
+           CountActiveEnemies(&state), state.players[0].camera.position.x, state.players[0].camera.position.y, state.players[0].camera.position.z);
+    const PerceptionStats *los = &state.perception.stats;
+    printf("  perception: %llu line of sight queries traced, %llu cache hits, %.2f ticks mean latency (max %u)\n",
+           los->processed, los->cacheHits, (los->processed > 0)? (double)los->latencyTicks/los->processed : 0.0, los->maxLatency);
+    printf("  job threads: %d, state hash: %08x\n", (jobSystem.threadCount > 1)? jobSystem.threadCount : 1, HashGameState(&state));
+
+    if (options->profileFile != NULL) {
+        static const float percentiles[3] = { 0.5f, 0.95f, 0.99f };
+        printf("  profile of the last %d ticks (us):  %8s %8s %8s %9s\n", profiler.historyCount, "p50", "p95", "p99", "busy p50");
+        for (int z = 0; z < PROFILE_ZONE_COUNT; z++) {
+            float values[3], busy;
+            GetProfilePercentiles(z, false, percentiles, values, 3);
+            GetProfilePercentiles(z, true, percentiles, &busy, 1);
+            if (values[2] > 0.0f) printf("    %-30s %8.2f %8.2f %8.2f %9.2f\n", profileZoneNames[z], values[0]*1000.0f, values[1]*1000.0f, values[2]*1000.0f, busy*1000.0f);
+        }
+        bool exported = ExportProfileTrace(options->profileFile);
+        printf("  %s profile trace to %s\n", exported? "Wrote" : "Failed to write", options->profileFile);
+    }
+
+    if (options->recordFile != NULL) {
+        recording.header.finalHash = HashGameState(&state);
+        bool saved = SaveInputRecording(&recording, options->recordFile);
+        printf("  %s %d input ticks to %s\n", saved? "Recorded" : "Failed to record", recording.header.tickCount, options->recordFile);
+        UnloadInputRecording(&recording);
+    }
+
+    UnloadGameState(&state);
+    UnloadStaticBatches();
+    UnloadLevelVisibility();
+    UnloadLevel();
+    return 0;
+}
+
+typedef struct WavHeader {
+    char riff[4];
+    unsigned int riffSize;
+    char wave[4];
+    char fmt[4];
+    unsigned int fmtSize;
+    unsigned short format;          // 1 = PCM
+    unsigned short channels;
+    unsigned int sampleRate;
+    unsigned int byteRate;
+    unsigned short blockAlign;
+    unsigned short bitsPerSample;
+    char data[4];
+    unsigned int dataSize;
+} WavHeader;
+
+// 16-bit stereo PCM at AUDIO_SAMPLE_RATE
+bool ExportAudioWav(const char *fileName, const short *samples, int frames)
+{
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL) return false;
+
+    unsigned int dataSize = frames*2*sizeof(short);
+    WavHeader header = { { 'R', 'I', 'F', 'F' }, 36 + dataSize, { 'W', 'A', 'V', 'E' }, { 'f', 'm', 't', ' ' }, 16, 1, 2,
+                         AUDIO_SAMPLE_RATE, AUDIO_SAMPLE_RATE*2*sizeof(short), 2*sizeof(short), 16, { 'd', 'a', 't', 'a' }, dataSize };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(samples, sizeof(short), frames*2, file) == (size_t)frames*2;
+    fclose(file);
+    return ok;
+}
+
+// Mix a scripted fight to a WAV file without an audio device, timing the mixer against
+// real time: the rifle on full auto with its reloads, a crowd of enemies closing in,
+// their hits and deaths, and the level's lights, through the game's voice pool. Then
+// the SIMD mix kernel against the scalar one.
+int RunAudioRender(const LaunchOptions *options)
+{
+    const int crowd = 48;
+    int ticks = (int)(options->audioRenderSeconds*SIM_TICK_RATE);
+    int blocks = (int)((long long)ticks*AUDIO_SAMPLE_RATE/SIM_TICK_RATE/AUDIO_BLOCK_FRAMES);
+
+    srand(1);
+    LoadLevel(options);
+    LoadGameSounds();
+    GameState state;
+    InitGameState(&state, options->maxBullets, options->maxEnemies);
+
+    // A ring of enemies around the player, all giving chase
+    unsigned int seed = 5;
+    Vector3 center = state.players[0].camera.position;
+    int spawned = 0;
+    for (int attempt = 0; spawned < crowd && attempt < 100*crowd; attempt++) {
+        float angle = GenRandomFloat(&seed, 0.0f, 2*PI), radius = GenRandomFloat(&seed, 6.0f, 30.0f);
+        Vector3 p = { center.x + radius*cosf(angle), 0.0f, center.z + radius*sinf(angle) };
+        p.y = GetGroundHeight(p.x, p.z, 1.0f) + ENEMY_HALF_EXTENTS.y;
+        if (QueryLevelSphere(p, ENEMY_RADIUS, COLLIDE_PLAYER) >= 0) continue;
+        int id = SpawnEnemy(&state.enemies, p);
+        if (id < 0) break;
+        state.enemies.state[state.enemies.slotOf[id]] = ENEMY_CHASE;
+        spawned++;
+    }
+
+    // The player stands and sweeps the crowd; the mixer catches up after every tick
+    short *pcm = (short *)malloc(((blocks > 0)? blocks : 1)*AUDIO_BLOCK_FRAMES*2*sizeof(short));
+    int mixed = 0;
+    unsigned int sounds = 0;
+    for (int t = 0; t < ticks; t++) {
+        SimInput input = { 0 };
+        input.down = INPUT_FIRE;
+        input.mouseDelta.x = 6.0f*sinf(t*0.02f);
+        UpdateSimulation(&state, &input, SIM_DT);
+        sounds += state.soundCount;
+
+        PlayTickSounds(&state);
+        UpdateAudioScene(&state, state.players[0].camera);
+        int due = (int)((long long)(t + 1)*AUDIO_SAMPLE_RATE/SIM_TICK_RATE/AUDIO_BLOCK_FRAMES);
+        for (; mixed < due && mixed < blocks; mixed++) MixAudioBlock(&pcm[mixed*AUDIO_BLOCK_FRAMES*2]);
+    }
+
+    const AudioStats *stats = &audioMixer.stats;
+    double audioSeconds = (double)mixed*AUDIO_BLOCK_FRAMES/AUDIO_SAMPLE_RATE;
+    printf("Audio render: %.1f s at %d Hz stereo, %d enemies, %d voices\n", audioSeconds, AUDIO_SAMPLE_RATE, spawned, MAX_VOICES);
+    printf("  %u sounds from the simulation, %d enemies left\n", sounds, state.enemies.count);
+    printf("  mix: %.2f ms, %.3f%% of real time (%.2f us per %d-frame block)\n", stats->mixSeconds*1000.0,
+           (audioSeconds > 0.0)? 100.0*stats->mixSeconds/audioSeconds : 0.0, (stats->blocks > 0)? stats->mixSeconds*1e6/stats->blocks : 0.0, AUDIO_BLOCK_FRAMES);
+    printf("  voices: %u started, peak %d, %u stolen, %u rejected\n", stats->started, stats->voicesPeak, stats->stolen, stats->rejected);
+
+    // Every voice busy with a gain ramp over one block, as the mixer's inner loop sees it
+    const int reps = 20000;
+    const float *src = audioMixer.samples[SOUND_LIGHT_HUM];
+    float *simd = (float *)calloc(AUDIO_BLOCK_FRAMES*2, sizeof(float));
+    float *scalar = (float *)calloc(AUDIO_BLOCK_FRAMES*2, sizeof(float));
+    MixVoice(simd, simd + AUDIO_BLOCK_FRAMES, src, AUDIO_BLOCK_FRAMES, 0.3f, 0.7f, 1e-4f, -2e-4f);
+    MixVoiceScalar(scalar, scalar + AUDIO_BLOCK_FRAMES, src, AUDIO_BLOCK_FRAMES, 0.3f, 0.7f, 1e-4f, -2e-4f);
+    float difference = 0.0f;
+    for (int i = 0; i < AUDIO_BLOCK_FRAMES*2; i++) difference = MaxF(difference, fabsf(simd[i] - scalar[i]));
+
+    double start = GetWallTime();
+    for (int r = 0; r < reps; r++) MixVoice(simd, simd + AUDIO_BLOCK_FRAMES, src + (r % MAX_VOICES)*AUDIO_BLOCK_FRAMES, AUDIO_BLOCK_FRAMES, 0.3f, 0.7f, 1e-4f, -2e-4f);
+    double simdTime = GetWallTime() - start;
+    start = GetWallTime();
+    for (int r = 0; r < reps; r++) MixVoiceScalar(scalar, scalar + AUDIO_BLOCK_FRAMES, src + (r % MAX_VOICES)*AUDIO_BLOCK_FRAMES, AUDIO_BLOCK_FRAMES, 0.3f, 0.7f, 1e-4f, -2e-4f);
+    double scalarTime = GetWallTime() - start;
+    printf("  kernel: %.0f M voice-frames/s SIMD, %.0f M scalar, max difference %.1e\n", (double)reps*AUDIO_BLOCK_FRAMES/simdTime/1e6,
+           (double)reps*AUDIO_BLOCK_FRAMES/scalarTime/1e6, difference);
+
+    bool exported = ExportAudioWav(options->audioRenderFile, pcm, mixed*AUDIO_BLOCK_FRAMES);
+    printf("  %s %s\n", exported? "Wrote" : "Failed to write", options->audioRenderFile);
+
+    free(simd);
+    free(scalar);
+    free(pcm);
+    UnloadGameState(&state);
+    UnloadGameSounds();
+    UnloadStaticBatches();
+    UnloadLevelVisibility();
+    UnloadLevel();
+    return exported? 0 : 1;
+}
+
+// Dedicated server: simulate at the tick rate and stream snapshots to the connected
+// clients, until stopped or for headlessTicks ticks when that is set
+int RunServer(const LaunchOptions *options)
+{
+    srand(1);
+    LoadLevel(options);
+
+    GameState state;
+    InitGameState(&state, options->maxBullets, options->maxEnemies);
+
+    NetServer server;
+    if (!InitNetServer(&server, &state, (unsigned short)options->serverPort)) {
+        printf("Server: cannot open UDP port %d\n", options->serverPort);
+        UnloadGameState(&state);
+        UnloadStaticBatches();
+        UnloadLevel();
+        return 1;
+    }
+    printf("Server: listening on UDP port %d, level hash %08x, %d enemies\n", options->serverPort, server.levelHash, state.enemies.count);
+    SetProfilerRecording(options->profileFile != NULL);
+
+    // Report every 5 s of game time
+    const int reportTicks = 5*SIM_TICK_RATE;
+    long long reportBytes = 0;
+    double reportSimulation = 0.0, reportSnapshots = 0.0;
+
+    double nextTick = GetWallTime();
+    for (int t = 1; options->headlessTicks <= 0 || t <= options->headlessTicks; t++) {
+        double now = GetWallTime();
+        if (now < nextTick) std::this_thread::sleep_for(std::chrono::duration<double>(nextTick - now));
+        nextTick += SIM_DT;
+        if (GetWallTime() - nextTick > 1.0) nextTick = GetWallTime();   // Fell far behind: skip ahead instead of racing
+
+        PROFILE_SCOPE(PROFILE_FRAME);
+        UpdateNetServer(&server, GetWallTime());
+
+        if (t % reportTicks == 0) {
+            printf("Server: tick %u, %d clients, %.3f ms simulation + %.3f ms snapshots per tick, %.1f kB/s out\n", state.tick,
+                   server.clientCount, (server.simulationTime - reportSimulation)*1000.0/reportTicks,
+                   (server.snapshotTime - reportSnapshots)*1000.0/reportTicks, (netStats.bytesSent - reportBytes)/(reportTicks*SIM_DT)/1024.0);
+            reportSimulation = server.simulationTime;
+            reportSnapshots = server.snapshotTime;
+            reportBytes = netStats.bytesSent;
+        }
+    }
+
+    if (options->profileFile != NULL) ExportProfileTrace(options->profileFile);
+
+    UnloadNetServer(&server);
+    UnloadGameState(&state);
+    UnloadStaticBatches();
+    UnloadLevelVisibility();
+    UnloadLevel();
+    return 0;
+}
+
+//------------------------------------------------------------------------------------
+// Benchmarks
+//------------------------------------------------------------------------------------
+// Levels the scaling benchmarks run on, by box count
+static const int benchmarkLevelSizes[] = { 0, 1000, 10000, 100000 };     // 0 = built-in bunker
+static const int benchmarkLevelCount = sizeof(benchmarkLevelSizes)/sizeof(benchmarkLevelSizes[0]);
+
+// Load the built-in bunker (size 0) or a generated level of about size boxes, and
+// name it in label (16 chars): "bunker" or e.g. "10k"
+void LoadBenchmarkLevel(int size, char *label)
+{
+    if (size == 0) InitializeLevel();
+    else GenerateLevel(1, size);
+    if (size == 0) snprintf(label, 16, "bunker");
+    else snprintf(label, 16, "%dk", size/1000);
+}
+
+// Spawn count enemies at random points inside the rooms, clear of the level geometry
+// (fewer if the store fills up)
+void SpawnEnemyWave(EnemyStore *store, int count, unsigned int seed)
+{
+    for (int spawned = 0; spawned < count;) {
+        const BoundingBox *b = &rooms[GenRandom(&seed)%roomCount].bounds;
+        Vector3 p = { GenRandomFloat(&seed, b->min.x + 1.0f, b->max.x - 1.0f), 1.0f, GenRandomFloat(&seed, b->min.z + 1.0f, b->max.z - 1.0f) };
+        if (QueryLevelSphere(p, ENEMY_RADIUS, COLLIDE_PLAYER) >= 0) continue;
+        if (SpawnEnemy(store, p) < 0) return;
+        spawned++;
+    }
+}
+
+// Spawn, update and release throughput of the projectile pool at several capacities
+int RunBulletBenchmark(void)
+{
+    const int capacities[] = { 100, 1000, 10000, 100000 };
+    const int updatePasses = 100;
+
+    printf("Projectile pool benchmark (%d update passes per size)\n", updatePasses);
+    printf("%10s %14s %14s %14s %14s\n", "capacity", "spawn/s", "update/s", "release/s", "churn/s");
+
+    for (int c = 0; c < (int)(sizeof(capacities)/sizeof(capacities[0])); c++) {
+        int capacity = capacities[c];
+        ProjectilePool pool;
+        InitProjectilePool(&pool, capacity);
+        unsigned int seed = 12345;
+
+        // Spawn: fill the pool
+        double start = GetWallTime();
+        for (int i = 0; i < capacity; i++) {
+            Bullet *b = AllocProjectile(&pool);
+            b->position = (Vector3){ (float)(i % 64), 1.0f, (float)(i/64) };
+            b->direction = (Vector3){ 0.0f, 0.0f, 1.0f };
+        }
+        double spawnTime = GetWallTime() - start;
+
+        // Update: integrate every live bullet
+        start = GetWallTime();
+        for (int pass = 0; pass < updatePasses; pass++) {
+            for (int i = 0; i < pool.count; i++) {
+                Bullet *b = &pool.bullets[i];
+                b->position = Vector3Add(b->position, Vector3Scale(b->direction, BULLET_SPEED*SIM_DT));
+            }
+        }
+        double updateTime = GetWallTime() - start;
+
+        // Churn: steady state, release a random live bullet and spawn a new one
+        start = GetWallTime();
+        for (int i = 0; i < capacity; i++) {
+            seed = seed*1103515245u + 12345u;
+            ReleaseProjectileAt(&pool, (int)((seed >> 8) % (unsigned int)pool.count));
+            AllocProjectile(&pool)->position = (Vector3){ 0.0f, 1.0f, 0.0f };
+        }
+        double churnTime = GetWallTime() - start;
+
+        // Release: free every bullet by handle, in scrambled order
+        start = GetWallTime();
+        for (int i = 0; i < capacity; i++) ReleaseProjectile(&pool, (int)(((unsigned int)i*2654435761u) % (unsigned int)capacity));
+        for (int i = 0; i < capacity; i++) ReleaseProjectile(&pool, i);
+        double releaseTime = GetWallTime() - start;
+
+        printf("%10d %14.0f %14.0f %14.0f %14.0f\n", capacity,
+               capacity/fmax(spawnTime, 1e-9), (double)capacity*updatePasses/fmax(updateTime, 1e-9),
+               capacity/fmax(releaseTime, 1e-9), capacity/fmax(churnTime, 1e-9));
+
+        UnloadProjectilePool(&pool);
+    }
+
+    return 0;
+}
+
+// Batch box kernels (SIMD vs scalar) and grid queries vs the old linear scan
+int RunCollisionBenchmark(void)
+{
+    InitializeLevel();
+
+    // Synthetic box soup for the raw kernels
+    const int boxCount = 4096;
+    const int queries = 20000;
+    LevelBoxSoA boxes;
+    AllocLevelBoxSoA(&boxes, boxCount);
+    unsigned int seed = 777;
+    for (int k = 0; k < boxCount; k++) {
+        seed = seed*1103515245u + 12345u;
+        float x = (float)(seed % 1000)/10.0f;
+        seed = seed*1103515245u + 12345u;
+        float z = (float)(seed % 1000)/10.0f;
+        LevelCollider c = { { x, 1.0f, z }, { 1.5f, 2.0f, 1.5f }, COLLIDER_WALL, k };
+        SetLevelBox(&boxes, k, &c, k);
+    }
+
+    Vector3 *points = (Vector3 *)malloc(queries*sizeof(Vector3));
+    for (int q = 0; q < queries; q++) {
+        seed = seed*1103515245u + 12345u;
+        points[q] = (Vector3){ (float)(seed % 1000)/10.0f, 1.0f, (float)((seed >> 10) % 1000)/10.0f };
+    }
+
+    printf("Collision kernel benchmark (%d boxes x %d queries, SIMD width %d)\n", boxCount, queries, SIMD_WIDTH);
+
+    unsigned int checksum[2] = { 0 };
+    double times[2] = { 0 };
+    for (int path = 0; path < 2; path++) {
+        double start = GetWallTime();
+        for (int q = 0; q < queries; q++) {
+            for (int k = 0; k < boxCount; k += 32) {
+                unsigned int hits = (path == 0)? SphereBoxMaskScalar(&boxes, k, 32, points[q], 0.5f, COLLIDE_PLAYER)
+                                               : SphereBoxMask(&boxes, k, 32, points[q], 0.5f, COLLIDE_PLAYER);
+                checksum[path] += (unsigned int)CountSetBits(hits);
+            }
+        }
+        times[path] = GetWallTime() - start;
+    }
+    printf("  sphere  scalar %8.1f Mbox/s   simd %8.1f Mbox/s   (%.2fx, hits %u/%u)\n",
+           (double)boxCount*queries/times[0]/1e6, (double)boxCount*queries/times[1]/1e6, times[0]/times[1], checksum[0], checksum[1]);
+
+    float tEntry[32];
+    checksum[0] = checksum[1] = 0;
+    for (int path = 0; path < 2; path++) {
+        double start = GetWallTime();
+        for (int q = 0; q < queries; q++) {
+            Vector3 invDelta = SafeInverseDelta((Vector3){ 2.0f, 0.1f, 1.0f });
+            for (int k = 0; k < boxCount; k += 32) {
+                unsigned int hits = (path == 0)? SegmentBoxMaskScalar(&boxes, k, 32, points[q], invDelta, BULLET_RADIUS, COLLIDE_BULLET, tEntry)
+                                               : SegmentBoxMask(&boxes, k, 32, points[q], invDelta, BULLET_RADIUS, COLLIDE_BULLET, tEntry);
+                checksum[path] += (unsigned int)CountSetBits(hits);
+            }
+        }
+        times[path] = GetWallTime() - start;
+    }
+    printf("  segment scalar %8.1f Mbox/s   simd %8.1f Mbox/s   (%.2fx, hits %u/%u)\n",
+           (double)boxCount*queries/times[0]/1e6, (double)boxCount*queries/times[1]/1e6, times[0]/times[1], checksum[0], checksum[1]);
+
+    // Player queries in the bunker: old per-collider AoS scan vs grid + batch kernel
+    const int levelQueries = 1000000;
+    int found[2] = { 0 };
+    for (int path = 0; path < 2; path++) {
+        seed = 99;
+        double start = GetWallTime();
+        for (int q = 0; q < levelQueries; q++) {
+            seed = seed*1103515245u + 12345u;
+            Vector3 p = { -30.0f + (float)(seed % 6200)/100.0f, 2.0f, -15.0f + (float)((seed >> 12) % 3000)/100.0f };
+            if (path == 0) {
+                for (int i = 0; i < levelColliderCount; i++) {
+                    if ((levelColliders[i].kind & COLLIDE_PLAYER) && CheckBoxCollision(p, 0.5f, levelColliders[i].position, levelColliders[i].size)) {
+                        found[path]++;
+                        break;
+                    }
+                }
+            } else if (QueryLevelSphere(p, 0.5f, COLLIDE_PLAYER) >= 0) found[path]++;
+        }
+        times[path] = GetWallTime() - start;
+    }
+    printf("  bunker player query: linear %.1f ns   grid+simd %.1f ns   (%.2fx, hits %d/%d)\n",
+           times[0]*1e9/levelQueries, times[1]*1e9/levelQueries, times[0]/times[1], found[0], found[1]);
+
+    free(points);
+    FreeLevelBoxSoA(&boxes);
+    return 0;
+}
+
+// Generated levels of increasing size, timing each phase separately so
+// anything that scales worse than the scene stands out
+int RunScaleBenchmark(unsigned int seed)
+{
+    const int sizes[] = { 1000, 10000, 100000 };
+    const int sizeCount = sizeof(sizes)/sizeof(sizes[0]);
+    const int playerQueries = 200000;
+    const int ticks = 30;
+
+    printf("Scale benchmark (seed %u, SIMD width %d)\n", seed, SIMD_WIDTH);
+    printf("  %7s %7s %7s %7s | %9s %9s %9s | %9s %9s %9s | %9s\n", "target", "boxes", "enemies", "bullets",
+           "gen ms", "batch ms", "grid+nav", "query ns", "tick us", "ns/bullet", "triangles");
+
+    for (int s = 0; s < sizeCount; s++) {
+        double start = GetWallTime();
+        GenerateLevelLayout(seed, sizes[s]);
+        double generateTime = GetWallTime() - start;
+
+        start = GetWallTime();
+        BuildStaticBatches();
+        double batchTime = GetWallTime() - start;
+
+        start = GetWallTime();
+        BuildCollisionGrid();
+        BuildNavGrid();
+        BuildGroundGrid();
+        double gridTime = GetWallTime() - start;
+
+        // DrawLevelGeometry needs a window; the triangles it submits stand in for its cost
+        int triangles = 0;
+        for (int i = 0; i < staticBatchCount; i++) triangles += staticBatches[i].mesh.triangleCount + staticBatches[i].wireMesh.triangleCount;
+
+        // Player collision queries spread over the whole level
+        unsigned int querySeed = seed;
+        int found = 0;
+        start = GetWallTime();
+        for (int q = 0; q < playerQueries; q++) {
+            Vector3 p = { GenRandomFloat(&querySeed, levelBounds.min.x, levelBounds.max.x), 2.0f,
+                          GenRandomFloat(&querySeed, levelBounds.min.z, levelBounds.max.z) };
+            if (QueryLevelSphere(p, 0.5f, COLLIDE_PLAYER) >= 0) found++;
+        }
+        double queryTime = GetWallTime() - start;
+
+        // Full simulation ticks with the pool topped up to capacity around the player
+        int boxCount = wallCount + pillarCount + propCount + stairCount;
+        int bulletCount = boxCount/GEN_BOXES_PER_BULLET;
+        GameState state;
+        InitGameState(&state, bulletCount, levelEnemyCount);
+        SimInput input = { 0 };
+        double tickTime = 0.0;
+        long long bulletUpdates = 0;
+        for (int t = 0; t < ticks; t++) {
+            while (state.projectiles.count < state.projectiles.capacity) {
+                Bullet *b = AllocProjectile(&state.projectiles);
+                float angle = GenRandomFloat(&querySeed, 0.0f, 2*PI);
+                float distance = GenRandomFloat(&querySeed, 0.0f, 60.0f);
+                b->position = Vector3Add(state.players[0].camera.position, (Vector3){ cosf(angle)*distance, 0.0f, sinf(angle)*distance });
+                b->direction = (Vector3){ -sinf(angle), 0.0f, cosf(angle) };
+            }
+            bulletUpdates += state.projectiles.count;
+
+            start = GetWallTime();
+            UpdateSimulation(&state, &input, SIM_DT);
+            tickTime += GetWallTime() - start;
+        }
+
+        printf("  %7d %7d %7d %7d | %9.2f %9.2f %9.2f | %9.1f %9.1f %9.1f | %9d\n", sizes[s], boxCount, levelEnemyCount,
+               bulletCount, generateTime*1000.0, batchTime*1000.0, gridTime*1000.0, queryTime*1e9/playerQueries,
+               tickTime*1e6/ticks, (bulletUpdates > 0)? tickTime*1e9/bulletUpdates : 0.0, triangles);
+        (void)found;
+
+        UnloadGameState(&state);
+        UnloadStaticBatches();
+        UnloadLevel();
+    }
+
+    return 0;
+}
+
+// Fingerprint of everything a level reload rebuilds: batch meshes, hidden faces,
+// collision query results, the nav grid and the ground heightfield
+static unsigned int HashLevelRebuild(void)
+{
+    unsigned int hash = HashBytes(2166136261u, &staticHiddenFaces, sizeof(int));
+    for (int b = 0; b < staticBatchCount; b++) {
+        const Mesh *meshes[2] = { &staticBatches[b].mesh, &staticBatches[b].wireMesh };
+        for (int k = 0; k < 2; k++) {
+            hash = HashBytes(hash, &meshes[k]->vertexCount, sizeof(int));
+            if (meshes[k]->vertexCount == 0) continue;
+            hash = HashBytes(hash, meshes[k]->vertices, meshes[k]->vertexCount*3*sizeof(float));
+            hash = HashBytes(hash, meshes[k]->colors, meshes[k]->vertexCount*4);
+        }
+    }
+
+    unsigned int seed = 7;
+    for (int q = 0; q < 20000; q++) {
+        Vector3 p = { GenRandomFloat(&seed, levelBounds.min.x, levelBounds.max.x), GenRandomFloat(&seed, 0.2f, 3.0f),
+                      GenRandomFloat(&seed, levelBounds.min.z, levelBounds.max.z) };
+        int hit = QueryLevelSphere(p, 0.5f, COLLIDE_PLAYER);
+        hash = HashBytes(hash, &hit, sizeof(int));
+    }
+
+    hash = HashBytes(hash, &navGrid.cellsX, sizeof(int));
+    hash = HashBytes(hash, &navGrid.cellsZ, sizeof(int));
+    hash = HashBytes(hash, navGrid.blocked, (size_t)navGrid.cellsX*navGrid.cellsZ);
+
+    int groundCells = groundGrid.cellsX*groundGrid.cellsZ;
+    hash = HashBytes(hash, groundGrid.cellStart, (groundCells + 1)*sizeof(int));
+    return HashBytes(hash, groundGrid.tops, groundGrid.cellStart[groundCells]*sizeof(float));
+}
+
+// Hot reload of a generated level: edits of growing reach are written to a level
+// file and reloaded, timed against a full load, and each reloaded state is compared
+// with a fresh load of the same file
+int RunReloadBenchmark(void)
+{
+    const char *path = "hotreload_bench.lvl";
+    const int crateEdits = 100;
+
+    GenerateLevel(1, 10000);
+    bool ok = ExportLevelFile(path);
+    FILE *file = ok? fopen(path, "rb") : NULL;
+    if (file == NULL) {
+        printf("Cannot write %s\n", path);
+        UnloadStaticBatches();
+        UnloadLevel();
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *original = (unsigned char *)malloc(size);
+    unsigned char *edited = (unsigned char *)malloc(size);
+    ok = fread(original, 1, size, file) == size;
+    fclose(file);
+
+    // Large crates are the props with colliders
+    const LevelFileHeader *header = (const LevelFileHeader *)original;
+    int filePropCount = header->sections[LEVEL_SECTION_PROPS].count;
+    int *crates = (int *)malloc((filePropCount > 0? filePropCount : 1)*sizeof(int));
+    int crateCount = 0;
+    for (int i = 0; i < filePropCount; i++) {
+        const Prop *prop = (const Prop *)(original + header->sections[LEVEL_SECTION_PROPS].offset) + i;
+        if (prop->type == 0 && prop->size.x > 1.0f) crates[crateCount++] = i;
+    }
+    ok = ok && crateCount >= crateEdits;
+
+    printf("Hot reload benchmark (%d boxes, %d large crates)\n", wallCount + pillarCount + stairCount + propCount, crateCount);
+    printf("  %-26s %10s %10s %8s %s\n", "edit", "reload ms", "full ms", "speedup", "matches fresh load");
+
+    const char *names[] = { "1 crate nudged", "100 crates nudged", "1 crate moved across level", "1 light moved", "1 crate added (structural)" };
+    bool allMatch = ok;
+    for (int c = 0; c < 5 && ok; c++) {
+        LoadLevelFile(path);
+        StartLevelWatch(path);
+
+        // Edit a copy of the file bytes, or export the level with one more crate
+        memcpy(edited, original, size);
+        Prop *fileProps = (Prop *)(edited + header->sections[LEVEL_SECTION_PROPS].offset);
+        if (c == 0) fileProps[crates[0]].position.x += 0.3f;
+        if (c == 1) for (int k = 0; k < crateEdits; k++) fileProps[crates[k*crateCount/crateEdits]].position.x += 0.3f;
+        if (c == 2) {
+            Vector3 target = fileProps[crates[crateCount - 1]].position;
+            fileProps[crates[0]].position = (Vector3){ target.x + 0.5f, fileProps[crates[0]].position.y, target.z + 0.5f };
+        }
+        if (c == 3) ((LightSource *)(edited + header->sections[LEVEL_SECTION_LIGHTS].offset))->position.x += 1.0f;
+        if (c < 4) {
+            file = fopen(path, "wb");
+            ok = file != NULL && fwrite(edited, 1, size, file) == size;
+            if (file != NULL) fclose(file);
+        } else {
+            Prop *grown = (Prop *)malloc((propCount + 1)*sizeof(Prop));
+            memcpy(grown, props, propCount*sizeof(Prop));
+            grown[propCount] = props[crates[0]];
+            grown[propCount].position.x += 2.0f;
+            Prop *saved = props;
+            props = grown;
+            propCount++;
+            ok = ExportLevelFile(path);
+            props = saved;
+            propCount--;
+            free(grown);
+        }
+
+        double start = GetWallTime();
+        bool reloaded = ok && ReloadLevelWatch();
+        double reloadTime = GetWallTime() - start;
+        unsigned int patched = HashLevelRebuild();
+
+        start = GetWallTime();
+        LoadLevelFile(path);
+        double fullTime = GetWallTime() - start;
+        bool match = reloaded && HashLevelRebuild() == patched;
+        allMatch = allMatch && match;
+
+        printf("  %-26s %10.2f %10.2f %7.1fx %s\n", names[c], reloadTime*1000.0, fullTime*1000.0,
+               (reloadTime > 0.0)? fullTime/reloadTime : 0.0, match? "yes" : "NO");
+
+        file = fopen(path, "wb");
+        ok = ok && file != NULL && fwrite(original, 1, size, file) == size;
+        if (file != NULL) fclose(file);
+    }
+
+    free(original);
+    free(edited);
+    free(crates);
+    UnloadStaticBatches();
+    UnloadLevel();
+    remove(path);
+    return allMatch? 0 : 1;
+}
+
+// Enemy waves of increasing size in the bunker: spawn, simulate with the bot
+// player firing into them, then despawn the survivors
+int RunEnemyBenchmark(void)
+{
+    const int waves[] = { 100, 250, 500, 1000, 2000 };
+    const int waveCount = sizeof(waves)/sizeof(waves[0]);
+    const int ticks = 600;
+
+    srand(1);
+    InitializeLevel();
+
+    printf("Enemy wave benchmark (bunker, %d ticks per wave, budget %.1f ms/frame)\n", ticks, 1000.0/60.0);
+    printf("  %6s | %9s %9s | %9s %9s | %7s %9s\n", "wave", "spawn us", "despawn us", "avg ms", "worst ms", "killed", "in budget");
+
+    for (int w = 0; w < waveCount; w++) {
+        GameState state;
+        InitGameState(&state, MAX_BULLETS, waves[w] + levelEnemyCount);
+
+        double start = GetWallTime();
+        SpawnEnemyWave(&state.enemies, waves[w], 1234u + w);
+        double spawnTime = GetWallTime() - start;
+        int spawned = state.enemies.count;
+
+        double total = 0.0, worst = 0.0;
+        for (int t = 0; t < ticks; t++) {
+            SimInput input = GenerateBotInput(state.tick);
+            start = GetWallTime();
+            UpdateSimulation(&state, &input, SIM_DT);
+            double elapsed = GetWallTime() - start;
+            total += elapsed;
+            if (elapsed > worst) worst = elapsed;
+        }
+        int killed = spawned - state.enemies.count;
+
+        int survivors = state.enemies.count;
+        start = GetWallTime();
+        while (state.enemies.count > 0) DespawnEnemyAt(&state.enemies, 0);
+        double despawnTime = GetWallTime() - start;
+        for (int id = 0; id < state.enemies.capacity; id++) ForgetEnemyPerception(&state.perception, id);
+
+        printf("  %6d | %9.3f %9.3f | %9.3f %9.3f | %7d %9s\n", waves[w], spawnTime*1e6/waves[w],
+               (survivors > 0)? despawnTime*1e6/survivors : 0.0, total*1000.0/ticks, worst*1000.0, killed,
+               (worst*1000.0 < 1000.0/60.0)? "yes" : "NO");
+
+        UnloadGameState(&state);
+    }
+
+    UnloadStaticBatches();
+    UnloadLevel();
+    return 0;
+}
+
+// CPU cost of filling an instance group per frame against instance count, for a
+// static crowd, one where a tenth moves each frame, and one that all moves. The
+// GPU side needs a window; the slots to upload stand in for its cost.
+int RunInstancingBenchmark(void)
+{
+    const int sizes[] = { 1000, 10000, 100000 };
+    const int sizeCount = sizeof(sizes)/sizeof(sizes[0]);
+    const char *scenes[] = { "static", "10% move", "all move" };
+    const int frames = 200;
+
+    printf("Instancing benchmark (%d frames, %d bytes per instance)\n", frames, (int)sizeof(InstanceData));
+    printf("  %9s %9s | %9s %11s | %12s %9s\n", "instances", "scene", "ns/inst", "frame ms", "upload/frame", "KB/frame");
+
+    for (int s = 0; s < sizeCount; s++) {
+        Vector3 *positions = (Vector3 *)malloc(sizes[s]*sizeof(Vector3));
+        for (int scene = 0; scene < 3; scene++) {
+            unsigned int seed = 99u;
+            for (int i = 0; i < sizes[s]; i++) positions[i] = (Vector3){ GenRandomFloat(&seed, -100.0f, 100.0f), 1.0f, GenRandomFloat(&seed, -100.0f, 100.0f) };
+
+            double total = 0.0;
+            long long uploaded = 0;
+            for (int f = 0; f < frames; f++) {
+                int moving = (scene == 0)? 0 : (scene == 1)? sizes[s]/10 : sizes[s];
+                for (int i = 0; i < moving; i++) positions[(f*moving + i)%sizes[s]].x += 0.01f;
+
+                double start = GetWallTime();
+                BeginInstances(INSTANCES_BOXES);
+                for (int i = 0; i < sizes[s]; i++) PushInstance(INSTANCES_BOXES, positions[i], (Vector3){ 1.8f, 2.0f, 1.8f }, (Color){140, 50, 50, 255});
+                total += GetWallTime() - start;
+
+                // What DrawInstances would send, then mark the GPU copy current
+                InstanceGroup *group = &instanceGroups[INSTANCES_BOXES];
+                if (f > 0) uploaded += group->dirtyEnd - group->dirtyBegin;
+                group->dirtyBegin = group->dirtyEnd = 0;
+                group->drawnCount = group->count;
+            }
+
+            double perFrame = (double)uploaded/(frames - 1);
+            printf("  %9d %9s | %9.2f %11.3f | %12.0f %9.1f\n", sizes[s], scenes[scene], total*1e9/((double)frames*sizes[s]),
+                   total*1000.0/frames, perFrame, perFrame*sizeof(InstanceData)/1024.0);
+        }
+        free(positions);
+    }
+
+    UnloadInstancedRenderer();
+    return 0;
+}
+
+// Navigation grid raster and flow field rebuild cost against grid size:
+// the bunker, then generated levels of 1k/10k/100k boxes
+int RunNavigationBenchmark(void)
+{
+    const int lookups = 1000000;
+
+    printf("Flow field benchmark (cell %.2f units, %d cells per tick budget)\n", NAV_CELL_SIZE, NAV_CELLS_PER_TICK);
+    printf("  %7s %11s | %9s %10s %9s %7s | %9s %8s\n", "level", "grid", "raster ms", "rebuild ms", "ns/cell", "ticks", "lookup ns", "steered");
+
+    for (int s = 0; s < benchmarkLevelCount; s++) {
+        char label[16];
+        LoadBenchmarkLevel(benchmarkLevelSizes[s], label);
+
+        double start = GetWallTime();
+        BuildNavGrid();
+        double rasterTime = GetWallTime() - start;
+        int cellCount = navGrid.cellsX*navGrid.cellsZ;
+
+        // One full rebuild in a single step, then count the ticks the sliced rebuild takes
+        start = GetWallTime();
+        UpdateFlowField(levelPlayerStart, 1 << 30);
+        double rebuildTime = GetWallTime() - start;
+
+        Vector3 far = { levelBounds.max.x - 10.0f, 2.0f, levelBounds.max.z - 10.0f };
+        int ticks = 1;
+        UpdateFlowField(far, NAV_CELLS_PER_TICK);
+        while (flowBuilder.phase != FLOW_IDLE) {
+            StepFlowField(NAV_CELLS_PER_TICK);
+            ticks++;
+        }
+
+        unsigned int seed = 42;
+        Vector3 *points = (Vector3 *)malloc(lookups*sizeof(Vector3));
+        for (int i = 0; i < lookups; i++) {
+            points[i] = (Vector3){ GenRandomFloat(&seed, levelBounds.min.x, levelBounds.max.x), 1.0f, GenRandomFloat(&seed, levelBounds.min.z, levelBounds.max.z) };
+        }
+
+        int steered = 0;
+        start = GetWallTime();
+        for (int i = 0; i < lookups; i++) {
+            Vector3 direction;
+            if (GetFlowDirection(points[i], &direction)) steered++;
+        }
+        double lookupTime = GetWallTime() - start;
+        free(points);
+
+        char grid[32];
+        snprintf(grid, sizeof(grid), "%dx%d", navGrid.cellsX, navGrid.cellsZ);
+        printf("  %7s %11s | %9.2f %10.2f %9.2f %7d | %9.1f %7.1f%%\n", label, grid,
+               rasterTime*1000.0, rebuildTime*1000.0, rebuildTime*1e9/cellCount, ticks, lookupTime*1e9/lookups, 100.0*steered/lookups);
+
+        UnloadStaticBatches();
+        UnloadLevel();
+    }
+
+    return 0;
+}
+
+// Hitscan rays per second: volleys of 12-pellet shots from shooters spread over the
+// level, traced as packets, as single rays, and as one projectile sweep per ray (the
+// reference, which also checks both traced results)
+int RunRaycastBenchmark(void)
+{
+    const int shooters = 64;
+    const int pellets = 12;
+    const int volleys = 200;
+    const int checked = 20000;
+    const int rayCount = shooters*pellets*volleys;
+
+    printf("Scene raycast benchmark (%d pellets per shot, %d shooters per volley, %d job threads)\n", pellets, shooters, jobSystem.threadCount);
+    printf("  %7s %7s %7s | %10s %10s %10s | %6s %7s\n", "level", "boxes", "enemies", "packet M/s", "single M/s", "sweep M/s", "hits", "differ");
+
+    SceneRay *rays = (SceneRay *)malloc(rayCount*sizeof(SceneRay));
+    SceneHit *packetHits = (SceneHit *)malloc(rayCount*sizeof(SceneHit));
+    SceneHit *singleHits = (SceneHit *)malloc(rayCount*sizeof(SceneHit));
+    int failures = 0;
+
+    for (int s = 0; s < benchmarkLevelCount; s++) {
+        char label[16];
+        LoadBenchmarkLevel(benchmarkLevelSizes[s], label);
+        GameState state;
+        InitGameState(&state, 1, levelEnemyCount);
+
+        // Shots from free spots, aimed level-ish in every direction
+        unsigned int seed = 7;
+        Weapon shotgun = { 0 };
+        shotgun.pellets = pellets;
+        shotgun.spread = 0.08f;
+        for (int v = 0; v < shooters*volleys; v++) {
+            Vector3 eye;
+            do {
+                eye = (Vector3){ GenRandomFloat(&seed, levelBounds.min.x, levelBounds.max.x), 2.0f, GenRandomFloat(&seed, levelBounds.min.z, levelBounds.max.z) };
+            } while (QueryLevelSphere(eye, 0.5f, COLLIDE_PLAYER) >= 0);
+            float yaw = GenRandomFloat(&seed, 0.0f, 2*PI), pitch = GenRandomFloat(&seed, -0.15f, 0.15f);
+            Camera camera = { eye, Vector3Add(eye, (Vector3){ cosf(yaw), pitch, sinf(yaw) }), { 0.0f, 1.0f, 0.0f }, 60.0f, CAMERA_PERSPECTIVE };
+            GenerateShotPellets(&camera, &shotgun, &rays[v*pellets]);
+        }
+
+        int mask = COLLIDE_BULLET | COLLIDER_ENEMY;
+        double start = GetWallTime();
+        RaycastScene(rays, rayCount, mask, &state.enemies, packetHits);
+        double packetTime = GetWallTime() - start;
+
+        start = GetWallTime();
+        RaycastScenePackets(rays, rayCount, mask, &state.enemies, singleHits, 1);
+        double singleTime = GetWallTime() - start;
+
+        int hits = 0, differ = 0;
+        start = GetWallTime();
+        for (int i = 0; i < checked; i++) {
+            SweepHit reference;
+            Vector3 end = Vector3Add(rays[i].origin, Vector3Scale(rays[i].direction, rays[i].maxDistance));
+            SweepProjectile(&state, rays[i].origin, end, 0.0f, &reference);
+            const SceneHit *traced[2] = { &packetHits[i], &singleHits[i] };
+            for (int k = 0; k < 2; k++) {
+                bool same = traced[k]->type == reference.type && fabsf(traced[k]->distance - reference.t*rays[i].maxDistance) < 1e-3f;
+                if (!same) differ++;
+            }
+            if (reference.type != HIT_NONE) hits++;
+        }
+        double sweepTime = GetWallTime() - start;
+        failures += differ;
+
+        printf("  %7s %7d %7d | %10.2f %10.2f %10.2f | %5.1f%% %7d\n", label,
+               wallCount + pillarCount + stairCount + propCount, state.enemies.count, rayCount/packetTime/1e6, rayCount/singleTime/1e6,
+               checked/sweepTime/1e6, 100.0*hits/checked, differ);
+
+        UnloadGameState(&state);
+        UnloadStaticBatches();
+        UnloadLevel();
+    }
+
+    free(rays);
+    free(packetHits);
+    free(singleHits);
+    return (failures == 0)? 0 : 1;
+}
+
+// Enemy line of sight: crowds of idle enemies around a player circling on a 10k box
+// level, perceived through the time-sliced cache against tracing every enemy in range
+// every tick (the reference). Stale counts lookups of a fresh enough result that the
+// reference disagrees with; unknown counts enemies in range with no result to act on.
+int RunPerceptionBenchmark(void)
+{
+    const int crowds[] = { 100, 500, 2000 };
+    const int crowdCount = sizeof(crowds)/sizeof(crowds[0]);
+    const int ticks = 600;
+
+    GenerateLevel(1, 10000);
+    printf("Perception benchmark (%d boxes, budget %d queries/tick, refresh %d, max age %d ticks)\n",
+           wallCount + pillarCount + stairCount + propCount, LOS_BUDGET_PER_TICK, LOS_REFRESH_TICKS, LOS_MAX_AGE_TICKS);
+    printf("  %7s | %9s %9s %9s | %9s %9s %9s | %7s %8s\n", "enemies", "sliced us", "max us", "naive us",
+           "queries/t", "latency", "max lat", "stale", "unknown");
+
+    unsigned int seed = 11;
+    Vector3 center;
+    do {
+        center = (Vector3){ GenRandomFloat(&seed, -20.0f, 20.0f), 2.0f, GenRandomFloat(&seed, -20.0f, 20.0f) };
+    } while (QueryLevelSphere(center, 0.5f, COLLIDE_PLAYER) >= 0);
+
+    for (int c = 0; c < crowdCount; c++) {
+        GameState state;
+        InitGameState(&state, 1, crowds[c]);
+        while (state.enemies.count > 0) DespawnEnemyAt(&state.enemies, state.enemies.count - 1);
+        for (int attempt = 0; state.enemies.count < crowds[c] && attempt < 100*crowds[c]; attempt++) {
+            float angle = GenRandomFloat(&seed, 0.0f, 2*PI), radius = GenRandomFloat(&seed, 1.0f, ENEMY_ALERT_RANGE);
+            Vector3 p = { center.x + radius*cosf(angle), 0.0f, center.z + radius*sinf(angle) };
+            p.y = GetGroundHeight(p.x, p.z, 1.0f) + ENEMY_HALF_EXTENTS.y;
+            if (QueryLevelSphere(p, ENEMY_RADIUS, COLLIDE_PLAYER) < 0) SpawnEnemy(&state.enemies, p);
         }
-    }
-    
-    // Check pillars
-    for (int i = 0; i < pillarCount; i++) {
-        Vector3 pillarBox = {pillars[i].position.x, pillars[i].height/2, pillars[i].position.z};
-        Vector3 pillarSize = {pillars[i].width, pillars[i].height, pillars[i].width};
-        if (CheckBoxCollision(resolved, radius, pillarBox, pillarSize)) {
-            resolved = oldPos;
-            break;
+
+        const EnemyStore *enemies = &state.enemies;
+        SceneRay *rays = (SceneRay *)malloc(enemies->count*sizeof(SceneRay));
+        SceneHit *hits = (SceneHit *)malloc(enemies->count*sizeof(SceneHit));
+        double slicedTime = 0.0, naiveTime = 0.0, maxTick = 0.0;
+        long long lookups = 0, stale = 0, unknown = 0;
+
+        for (int t = 0; t < ticks; t++) {
+            float angle = 2*PI*t/ticks;
+            Vector3 target = { center.x + 3.0f*cosf(angle), center.y, center.z + 3.0f*sinf(angle) };
+
+            double start = GetWallTime();
+            UpdatePerception(&state, &target, 1);
+            double elapsed = GetWallTime() - start;
+            slicedTime += elapsed;
+            if (elapsed > maxTick) maxTick = elapsed;
+
+            // The reference traces every enemy in alert range
+            int rayCount = 0;
+            start = GetWallTime();
+            for (int i = 0; i < enemies->count; i++) {
+                Vector3 eye = enemies->position[i];
+                eye.y += LOS_EYE_HEIGHT;
+                float dx = target.x - eye.x, dz = target.z - eye.z;
+                if (dx*dx + dz*dz >= ENEMY_ALERT_RANGE*ENEMY_ALERT_RANGE) continue;
+                float distance = Vector3Distance(eye, target);
+                rays[rayCount++] = (SceneRay){ eye, Vector3Scale(Vector3Subtract(target, eye), 1.0f/distance), distance };
+            }
+            RaycastScene(rays, rayCount, COLLIDE_PLAYER, NULL, hits);
+            naiveTime += GetWallTime() - start;
+
+            for (int i = 0, r = 0; i < enemies->count && r < rayCount; i++) {
+                Vector3 eye = enemies->position[i];
+                eye.y += LOS_EYE_HEIGHT;
+                if (rays[r].origin.x != eye.x || rays[r].origin.z != eye.z) continue;
+                int id = enemies->ids[i];
+                if (!IsPerceptionFresh(&state.perception, id, state.tick, LOS_MAX_AGE_TICKS)) unknown++;
+                else if (state.perception.visible[id] != (hits[r].type == HIT_NONE)) stale++;
+                lookups++;
+                r++;
+            }
+            state.tick++;
         }
+
+        const PerceptionStats *stats = &state.perception.stats;
+        printf("  %7d | %9.1f %9.1f %9.1f | %9.1f %9.2f %9u | %6.1f%% %7.1f%%\n", enemies->count, slicedTime*1e6/ticks, maxTick*1e6,
+               naiveTime*1e6/ticks, (double)stats->processed/ticks, (stats->processed > 0)? (double)stats->latencyTicks/stats->processed : 0.0,
+               stats->maxLatency, (lookups > 0)? 100.0*stale/lookups : 0.0, (lookups > 0)? 100.0*unknown/lookups : 0.0);
+
+        free(rays);
+        free(hits);
+        UnloadGameState(&state);
     }
-    
-    // Check large props (crates only for collision)
-    for (int i = 0; i < propCount; i++) {
-        if (props[i].type == 0 && props[i].size.x > 1.0f) { // Only large crates
-            if (CheckBoxCollision(resolved, radius, props[i].position, props[i].size)) {
-                resolved = oldPos;
-                break;
+
+    UnloadStaticBatches();
+    UnloadLevel();
+    return 0;
+}
+
+// Ground height lookups against a scan over every level box (what the per-frame
+// stair loop did), with the reference checking every grid answer it times
+int RunGroundBenchmark(void)
+{
+    const int lookups = 1000000;
+    const int scans = 2000;
+
+    printf("Ground heightfield benchmark (cell %.2f units, step %.2f)\n", GROUND_CELL_SIZE, MAX_STEP_HEIGHT);
+    printf("  %7s %11s %9s | %9s %9s | %9s %9s %8s\n", "level", "grid", "KB", "build ms", "tops/cell", "lookup ns", "scan ns", "differ");
+
+    int failures = 0;
+    for (int s = 0; s < benchmarkLevelCount; s++) {
+        char label[16];
+        LoadBenchmarkLevel(benchmarkLevelSizes[s], label);
+
+        double start = GetWallTime();
+        BuildGroundGrid();
+        double buildTime = GetWallTime() - start;
+        int cellCount = groundGrid.cellsX*groundGrid.cellsZ;
+        int topCount = groundGrid.cellStart[cellCount];
+
+        unsigned int seed = 42;
+        Vector3 *points = (Vector3 *)malloc(lookups*sizeof(Vector3));
+        for (int i = 0; i < lookups; i++) {
+            points[i] = (Vector3){ GenRandomFloat(&seed, levelBounds.min.x, levelBounds.max.x), GenRandomFloat(&seed, 0.0f, 5.0f),
+                                   GenRandomFloat(&seed, levelBounds.min.z, levelBounds.max.z) };
+        }
+
+        volatile float checksum = 0.0f;     // Keeps the timed lookups
+        start = GetWallTime();
+        for (int i = 0; i < lookups; i++) checksum = checksum + GetGroundHeight(points[i].x, points[i].z, points[i].y);
+        double lookupTime = GetWallTime() - start;
+
+        // Reference: every walkable box whose ground cells hold the point
+        int differ = 0;
+        int elementCount = wallCount + pillarCount + stairCount + propCount;
+        start = GetWallTime();
+        for (int i = 0; i < scans; i++) {
+            int cx = (int)floorf((points[i].x - groundGrid.originX)/GROUND_CELL_SIZE);
+            int cz = (int)floorf((points[i].z - groundGrid.originZ)/GROUND_CELL_SIZE);
+            float ground = 0.0f;
+            for (int e = 0; e < elementCount; e++) {
+                BoundingBox box;
+                int x0, z0, x1, z1;
+                if (!GetWalkableBox(e, &box) || !GetGroundCellRange(box, &x0, &z0, &x1, &z1)) continue;
+                if (cx >= x0 && cx <= x1 && cz >= z0 && cz <= z1 && box.max.y <= points[i].y && box.max.y > ground) ground = box.max.y;
             }
+            if (ground != GetGroundHeight(points[i].x, points[i].z, points[i].y)) differ++;
         }
+        double scanTime = GetWallTime() - start;
+        free(points);
+        failures += differ;
+
+        char grid[32];
+        snprintf(grid, sizeof(grid), "%dx%d", groundGrid.cellsX, groundGrid.cellsZ);
+        printf("  %7s %11s %9d | %9.2f %9.2f | %9.1f %9.1f %8d\n", label, grid,
+               (int)(((size_t)(cellCount + 1)*sizeof(int) + (size_t)topCount*sizeof(float))/1024), buildTime*1000.0,
+               (float)topCount/cellCount, lookupTime*1e9/lookups, scanTime*1e9/scans, differ);
+
+        UnloadStaticBatches();
+        UnloadLevel();
     }
-    
-    return resolved;
+
+    return (failures == 0)? 0 : 1;
 }
 
-//------------------------------------------------------------------------------------
-// Drawing Functions
-//------------------------------------------------------------------------------------
-void DrawLevelGeometry()
+// Tick cost against job system thread count on the stress scenes: an enemy wave
+// chasing the player through the bunker, and generated 10k/100k box levels with
+// every enemy chasing and the projectile pool kept full. Each run replays the same
+// ticks and must end in the single-thread run's state hash.
+int RunJobBenchmark(void)
 {
-    // Draw Floor - Dark concrete
-    DrawPlane((Vector3){0.0f, 0.0f, 0.0f}, (Vector2){80.0f, 50.0f}, FLOOR_COLOR);
-    
-    // Draw all walls
-    for (int i = 0; i < wallCount; i++) {
-        DrawCubeV(walls[i].position, walls[i].size, walls[i].color);
-        // Add subtle edge lines
-        DrawCubeWiresV(walls[i].position, walls[i].size, (Color){30, 30, 35, 100});
-    }
-    
-    // Draw pillars (square concrete pillars)
-    for (int i = 0; i < pillarCount; i++) {
-        Vector3 pillarPos = {pillars[i].position.x, pillars[i].height/2, pillars[i].position.z};
-        DrawCube(pillarPos, pillars[i].width, pillars[i].height, pillars[i].width, CONCRETE_LIGHT);
-        DrawCubeWires(pillarPos, pillars[i].width, pillars[i].height, pillars[i].width, (Color){40, 40, 45, 150});
-    }
-    
-    // Draw stairs
-    for (int i = 0; i < stairCount; i++) {
-        DrawCubeV(stairs[i].position, stairs[i].size, CONCRETE_MED);
-        DrawCubeWiresV(stairs[i].position, stairs[i].size, (Color){50, 50, 55, 100});
-    }
-    
-    // Draw props
-    for (int i = 0; i < propCount; i++) {
-        DrawCubeV(props[i].position, props[i].size, props[i].color);
-        // Add wire edges for definition
-        if (props[i].type != 4) { // Not for pipes/cables
-            DrawCubeWiresV(props[i].position, props[i].size, (Color){25, 25, 30, 80});
+    const int scenes[] = { 0, 10000, 100000 };     // 0 = built-in bunker with an enemy wave
+    const int sceneCount = sizeof(scenes)/sizeof(scenes[0]);
+    const int waveSize = 2000;
+    const int ticks = 120;
+
+    // Powers of two up to the core count (at least 4, so determinism is checked anywhere)
+    int cores = (int)std::thread::hardware_concurrency();
+    int maxThreads = (cores > 4)? cores : 4;
+    if (maxThreads > MAX_JOB_THREADS) maxThreads = MAX_JOB_THREADS;
+    int threadCounts[8];
+    int runCount = 0;
+    for (int n = 1; n < maxThreads; n *= 2) threadCounts[runCount++] = n;
+    threadCounts[runCount++] = maxThreads;
+
+    // Runs below start their own pools
+    ShutdownJobSystem();
+
+    printf("Job system benchmark (%d hardware threads, %d ticks per run)\n", cores, ticks);
+    printf("  %7s %7s %7s | %7s %9s %8s | %8s %5s\n", "scene", "enemies", "bullets", "threads", "tick ms", "speedup", "hash", "match");
+
+    int mismatches = 0;
+    for (int s = 0; s < sceneCount; s++) {
+        char label[16];
+        LoadBenchmarkLevel(scenes[s], label);
+
+        int boxCount = wallCount + pillarCount + propCount + stairCount;
+        int bulletCount = (scenes[s] == 0)? waveSize : boxCount/GEN_BOXES_PER_BULLET;
+        int enemyCount = levelEnemyCount + ((scenes[s] == 0)? waveSize : 0);
+
+        double serialTime = 0.0;
+        unsigned int serialHash = 0;
+        for (int r = 0; r < runCount; r++) {
+            InitJobSystem(threadCounts[r]);
+            srand(1);
+            BuildNavGrid();     // Fresh flow field, as after loading
+
+            GameState state;
+            InitGameState(&state, bulletCount, enemyCount);
+
+            SpawnEnemyWave(&state.enemies, enemyCount - state.enemies.count, 1234u);
+            unsigned int seed = 4321u;
+            for (int i = 0; i < state.enemies.count; i++) state.enemies.state[i] = ENEMY_CHASE;
+
+            double total = 0.0;
+            for (int t = 0; t < ticks; t++) {
+                while (state.projectiles.count < state.projectiles.capacity) {
+                    Bullet *b = AllocProjectile(&state.projectiles);
+                    float angle = GenRandomFloat(&seed, 0.0f, 2*PI);
+                    float distance = GenRandomFloat(&seed, 0.0f, 60.0f);
+                    b->position = Vector3Add(state.players[0].camera.position, (Vector3){ cosf(angle)*distance, 0.0f, sinf(angle)*distance });
+                    b->direction = (Vector3){ -sinf(angle), 0.0f, cosf(angle) };
+                    b->damage = 34.0f;
+                }
+
+                SimInput input = GenerateBotInput(state.tick);
+                double start = GetWallTime();
+                UpdateSimulation(&state, &input, SIM_DT);
+                total += GetWallTime() - start;
+            }
+
+            unsigned int hash = HashGameState(&state);
+            if (r == 0) {
+                serialTime = total;
+                serialHash = hash;
+            }
+            if (hash != serialHash) mismatches++;
+
+            if (r == 0) printf("  %7s %7d %7d |", label, enemyCount, bulletCount);
+            else printf("  %7s %7s %7s |", "", "", "");
+            printf(" %7d %9.3f %7.2fx | %08x %5s\n", threadCounts[r], total*1000.0/ticks, (total > 0.0)? serialTime/total : 0.0,
+                   hash, (hash == serialHash)? "yes" : "NO");
+
+            UnloadGameState(&state);
+            ShutdownJobSystem();
         }
+
+        UnloadStaticBatches();
+        UnloadLevel();
     }
+
+    return (mismatches == 0)? 0 : 1;
 }
 
-void DrawAtmosphericLights()
+// A dedicated server and simulated clients in one process over loopback, in the bunker
+// with an enemy wave: server tick cost, snapshot size against full snapshots, and how
+// far prediction had to be corrected, with and without packet loss
+int RunNetworkBenchmark(void)
 {
-    // Draw light fixtures (simple boxes representing lamps)
-    for (int i = 0; i < lightCount; i++) {
-        Color lightColor = lights[i].isOn ? (Color){180, 160, 120, 255} : (Color){60, 55, 50, 255};
-        DrawCube(lights[i].position, 0.6f, 0.2f, 0.6f, DARK_METAL);
-        
-        if (lights[i].isOn) {
-            // Light glow cone (simple representation)
-            Vector3 glowPos = {lights[i].position.x, lights[i].position.y - 1.5f, lights[i].position.z};
-            DrawCube(glowPos, 2.0f, 0.05f, 2.0f, (Color){100, 90, 70, 40});
+    typedef struct NetBenchRun { int clients; float loss; } NetBenchRun;
+    const NetBenchRun runs[] = { { 1, 0.0f }, { 8, 0.0f }, { 16, 0.0f }, { 32, 0.0f }, { 8, 0.05f }, { 32, 0.05f } };
+    const int runCount = sizeof(runs)/sizeof(runs[0]);
+    const int waveSize = 500;
+    const int ticks = 600;
+
+    InitializeLevel();
+
+    printf("Network benchmark: bunker with %d + %d enemies, %d ticks per run over loopback\n", levelEnemyCount, waveSize, ticks);
+    printf("  %7s %5s | %8s %8s | %9s %9s %6s %8s | %11s %9s\n", "clients", "loss", "sim ms", "snap ms",
+           "snap B", "full B", "ratio", "kB/s/cl", "corrections", "final err");
+
+    int failures = 0;
+    for (int r = 0; r < runCount; r++) {
+        srand(1);
+        BuildNavGrid();
+
+        GameState serverState;
+        InitGameState(&serverState, MAX_BULLETS, levelEnemyCount + waveSize);
+
+        SpawnEnemyWave(&serverState.enemies, waveSize, 1234u);
+
+        NetServer server;
+        if (!InitNetServer(&server, &serverState, 0)) {
+            printf("  cannot open a UDP socket\n");
+            UnloadGameState(&serverState);
+            failures++;
+            break;
+        }
+        server.measureFullSize = true;
+        NetAddress address = { 0x7F000001u, GetNetSocketPort(server.socket) };
+
+        int clientCount = runs[r].clients;
+        GameState *clientStates = (GameState *)malloc(clientCount*sizeof(GameState));
+        NetClient *clients = (NetClient *)malloc(clientCount*sizeof(NetClient));
+        for (int c = 0; c < clientCount; c++) {
+            InitGameState(&clientStates[c], snapshotSectionCaps[NET_SECTION_BULLETS], snapshotSectionCaps[NET_SECTION_ENEMIES]);
+            InitNetClient(&clients[c], &clientStates[c], address);
+        }
+
+        // Connect without loss, on a clock that advances one tick per round
+        netLossRate = 0.0f;
+        double now = 0.0;
+        int connected = 0;
+        SimInput idle = { 0 };
+        for (int round = 0; round < 100 && connected < clientCount; round++, now += SIM_DT) {
+            for (int c = 0; c < clientCount; c++) {
+                if (clients[c].slot < 0) UpdateNetClient(&clients[c], &idle, now);
+            }
+            ReceiveNetServer(&server, now);
+            connected = 0;
+            for (int c = 0; c < clientCount; c++) {
+                ReceiveNetClient(&clients[c], now);
+                if (clients[c].slot >= 0) connected++;
+            }
+        }
+
+        netLossRate = runs[r].loss;
+        netStats = (NetStats){ 0 };
+        for (int t = 0; t < ticks; t++, now += SIM_DT) {
+            for (int c = 0; c < clientCount; c++) {
+                SimInput input = GenerateBotInput((unsigned int)(t + 37*c));
+                UpdateNetClient(&clients[c], &input, now);
+            }
+            UpdateNetServer(&server, now);
+        }
+
+        // Without loss every input reaches the server in its tick, so after the last
+        // snapshot each prediction must sit exactly on the server's player
+        netLossRate = 0.0f;
+        float worstError = 0.0f;
+        int corrections = 0;
+        long long snapshotBytes = 0, fullBytes = 0;
+        int snapshots = 0;
+        for (int c = 0; c < clientCount; c++) {
+            ReceiveNetClient(&clients[c], now);
+            corrections += clients[c].corrections;
+            if (clients[c].slot < 0) continue;
+
+            const NetClientSlot *slot = &server.clients[clients[c].slot];
+            snapshotBytes += slot->bytesSent;
+            fullBytes += slot->fullBytes;
+            snapshots += slot->snapshotsSent;
+            float error = Vector3Distance(clientStates[c].players[clients[c].slot].camera.position,
+                                          serverState.players[clients[c].slot].camera.position);
+            if (error > worstError) worstError = error;
+        }
+        if (connected < clientCount || (runs[r].loss == 0.0f && (worstError > 0.0f || corrections > 0))) failures++;
+
+        double seconds = ticks*SIM_DT;
+        printf("  %7d %4.0f%% | %8.3f %8.3f | %9.1f %9.1f %5.1fx %8.2f | %11d %9.4f%s\n", clientCount, runs[r].loss*100.0f,
+               server.simulationTime*1000.0/ticks, server.snapshotTime*1000.0/ticks,
+               (snapshots > 0)? (double)snapshotBytes/snapshots : 0.0, (snapshots > 0)? (double)fullBytes/snapshots : 0.0,
+               (snapshotBytes > 0)? (double)fullBytes/snapshotBytes : 0.0, snapshotBytes/seconds/1024.0/clientCount,
+               corrections, worstError, (connected < clientCount)? "  (not all connected)" : "");
+
+        for (int c = 0; c < clientCount; c++) {
+            UnloadNetClient(&clients[c]);
+            UnloadGameState(&clientStates[c]);
         }
+        free(clients);
+        free(clientStates);
+        UnloadNetServer(&server);
+        UnloadGameState(&serverState);
     }
+    netLossRate = 0.0f;
+
+    UnloadStaticBatches();
+    UnloadLevel();
+    return (failures == 0)? 0 : 1;
 }
 
-void UpdateLightFlicker(float deltaTime)
+// Startup cost of the weapon sprites: building them from the source images with the
+// scalar chroma key (the old startup path) or the SIMD one, against reading the cooked atlas
+int RunAssetBenchmark(void)
 {
-    flickerTimer += deltaTime;
-    
-    // Random flicker effect
-    if (flickerTimer > 0.1f) {
-        flickerTimer = 0.0f;
-        globalFlicker = 0.85f + ((float)(rand() % 30) / 100.0f);
-        
-        // Randomly toggle individual lights for dramatic effect
-        for (int i = 0; i < lightCount; i++) {
-            lights[i].flickerTimer += deltaTime * lights[i].flickerSpeed;
-            if (lights[i].flickerTimer > 1.0f) {
-                lights[i].flickerTimer = 0.0f;
-                // 5% chance to flicker off briefly
-                if (rand() % 100 < 5) {
-                    lights[i].isOn = !lights[i].isOn;
-                } else {
-                    lights[i].isOn = true;
-                }
+    const int repeats = 5;
+
+    if (!FileExists(ATLAS_FILE_PATH)) {
+        SpriteAtlas cooked;
+        if (!BuildSpriteAtlas(&cooked) || !ExportSpriteAtlas(&cooked, ATLAS_FILE_PATH)) {
+            printf("Asset benchmark: could not build the sprite atlas from the source images\n");
+            UnloadSpriteAtlas(&cooked);
+            return 1;
+        }
+        printf("Cooked %s for the benchmark\n", ATLAS_FILE_PATH);
+        UnloadSpriteAtlas(&cooked);
+    }
+
+    double decodeTime = 1e9, scalarTime = 1e9, simdTime = 1e9, buildTime = 1e9, cookedTime = 1e9;
+    bool keysMatch = true;
+    long long pixelCount = 0;
+    for (int r = 0; r < repeats; r++) {
+        // Decode and convert, then key identical copies both ways
+        double start = GetWallTime();
+        Image images[SPRITE_COUNT];
+        for (int s = 0; s < SPRITE_COUNT; s++) {
+            images[s] = LoadImage(spriteSources[s].fileName);
+            if (images[s].data != NULL) ImageFormat(&images[s], PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        }
+        decodeTime = fmin(decodeTime, GetWallTime() - start);
+
+        double scalar = 0.0, simd = 0.0;
+        pixelCount = 0;
+        for (int s = 0; s < SPRITE_COUNT; s++) {
+            if (images[s].data == NULL || !spriteSources[s].chromaKey) {
+                if (images[s].data != NULL) UnloadImage(images[s]);
+                continue;
             }
+            int count = images[s].width*images[s].height;
+            Image copy = ImageCopy(images[s]);
+            pixelCount += count;
+
+            start = GetWallTime();
+            ChromaKeyPixelsScalar((Color *)images[s].data, count);
+            scalar += GetWallTime() - start;
+            start = GetWallTime();
+            ChromaKeyPixels((Color *)copy.data, count);
+            simd += GetWallTime() - start;
+
+            if (memcmp(images[s].data, copy.data, count*sizeof(Color)) != 0) keysMatch = false;
+            UnloadImage(copy);
+            UnloadImage(images[s]);
         }
+        scalarTime = fmin(scalarTime, scalar);
+        simdTime = fmin(simdTime, simd);
+
+        SpriteAtlas atlas;
+        BuildSpriteAtlas(&atlas);
+        buildTime = fmin(buildTime, atlas.loadTime);
+        UnloadSpriteAtlas(&atlas);
+
+        if (LoadSpriteAtlasFile(&atlas, ATLAS_FILE_PATH)) cookedTime = fmin(cookedTime, atlas.loadTime);
+        UnloadSpriteAtlas(&atlas);
     }
+
+    printf("Sprite startup benchmark (best of %d, SIMD width %d)\n", repeats, SIMD_WIDTH);
+    printf("  decode + convert:  %8.2f ms\n", decodeTime*1000.0);
+    printf("  chroma key:        %8.2f ms scalar, %.2f ms SIMD (%.1fx, %.2f ns/pixel), results %s\n", scalarTime*1000.0,
+           simdTime*1000.0, (simdTime > 0.0)? scalarTime/simdTime : 0.0, (pixelCount > 0)? simdTime*1e9/pixelCount : 0.0,
+           keysMatch? "match" : "DIFFER");
+    printf("  source build:      %8.2f ms with the scalar key (old startup), %.2f ms with SIMD\n",
+           (buildTime - simdTime + scalarTime)*1000.0, buildTime*1000.0);
+    printf("  cooked atlas read: %8.2f ms (%.1fx faster than the old startup path)\n", cookedTime*1000.0,
+           (cookedTime > 0.0)? (buildTime - simdTime + scalarTime)/cookedTime : 0.0);
+
+    return keysMatch? 0 : 1;
 }
 
 //------------------------------------------------------------------------------------
 // Program main entry point
 //------------------------------------------------------------------------------------
-int main(void)
+int main(int argc, char *argv[])
 {
+    double launchTime = GetWallTime();
+
+    // Command line options
+    //   --headless [ticks]    run the simulation without a window
+    //   --max-bullets <n>     projectile pool capacity
+    //   --max-enemies <n>     enemy store capacity
+    //   --bench-bullets       projectile pool microbenchmark
+    //   --bench-collision     batch collision kernels, SIMD vs scalar
+    //   --bench-enemies       enemy waves of 100 to 2000 against the frame budget
+    //   --bench-nav           navigation grid and flow field rebuild cost vs grid size
+    //   --bench-ground        ground height lookups vs a scan over every level box
+    //   --bench-raycast       hitscan rays/sec as packets, single rays and projectile sweeps
+    //   --bench-perception    time-sliced enemy line of sight vs tracing every enemy every tick
+    //   --render-audio <file> [seconds]  mix a full-auto fight to a WAV file, no audio device needed
+    //   --level <file>        load a binary level file instead of the built-in bunker
+    //   --export-level <file> write the built-in bunker as a binary level file
+    //   --generate <boxes>    play a generated level of about this many boxes
+    //   --seed <n>            level generator seed
+    //   --bench-scale [seed]  per-phase cost on generated levels of 1k/10k/100k boxes
+    //   --threads <n>         job system threads including the main thread (default: one per core)
+    //   --bench-jobs          tick cost and determinism against thread count on the stress scenes
+    //   --cook-assets         build the premultiplied weapon sprite atlas from the source images
+    //   --bench-assets        sprite startup cost: source images (scalar/SIMD key) vs cooked atlas
+    //   --profile <file>      record the frame profiler, dump Chrome trace JSON (or .csv) on exit
+    //   --record <file>       record the inputs of this run (windowed or headless bot)
+    //   --replay <file>       replay a recording in the window, or without one with --headless
+    //   --frame-budget <ms>   replays fail when the 95th percentile frame time exceeds this
+    //   --fps <n>             render frame rate cap, 0 = uncapped (gameplay is unaffected)
+    //   --server [port]       run a dedicated server (with --headless n: for n ticks)
+    //   --connect <host[:port]> play on a dedicated server (record/replay are for local games)
+    //   --packet-loss <pct>   drop this percentage of outgoing packets, for testing
+    //   --bench-net           server tick cost, snapshot bandwidth and prediction with many clients
+    //   --bake-lighting       bake light and occlusion of the launched level into its .light file
+    //   --bench-instancing    per-frame instance fill cost and upload size for static and moving crowds
+    //   --bench-reload        level hot reload cost per edit vs a full load, checked against a fresh load
+    LaunchOptions options = { 0, MAX_BULLETS, MAX_ENEMY_CAPACITY, NULL, 0, 1, 0, NULL, NULL, NULL, 0.0f, 60, 0, NULL, 0.0f, NULL, 20.0f };
+
+    // The job system comes up first so every mode below, benchmarks included, can use it
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0) options.threads = atoi(argv[i + 1]);
+    }
+    InitJobSystem(options.threads);
+    atexit(ShutdownJobSystem);
+
+    bool bakeLighting = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            options.headlessTicks = (i + 1 < argc && argv[i + 1][0] != '-')? atoi(argv[++i]) : 100000;
+        } else if (strcmp(argv[i], "--max-bullets") == 0 && i + 1 < argc) {
+            options.maxBullets = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-enemies") == 0 && i + 1 < argc) {
+            options.maxEnemies = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+            options.levelFile = argv[++i];
+        } else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+            options.generateBoxes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            options.profileFile = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            options.recordFile = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            options.replayFile = argv[++i];
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            options.targetFps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--server") == 0) {
+            options.serverPort = (i + 1 < argc && argv[i + 1][0] != '-')? atoi(argv[++i]) : NET_DEFAULT_PORT;
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            options.connectAddress = argv[++i];
+        } else if (strcmp(argv[i], "--packet-loss") == 0 && i + 1 < argc) {
+            options.packetLoss = (float)atof(argv[++i])/100.0f;
+        } else if (strcmp(argv[i], "--bench-net") == 0) {
+            return RunNetworkBenchmark();
+        } else if (strcmp(argv[i], "--render-audio") == 0 && i + 1 < argc) {
+            options.audioRenderFile = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-') options.audioRenderSeconds = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--bake-lighting") == 0) {
+            bakeLighting = true;    // After the level options
+        } else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc) {
+            options.frameBudget = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--bench-scale") == 0) {
+            return RunScaleBenchmark((i + 1 < argc && argv[i + 1][0] != '-')? (unsigned int)strtoul(argv[++i], NULL, 10) : 1);
+        } else if (strcmp(argv[i], "--export-level") == 0 && i + 1 < argc) {
+            InitializeLevel();
+            bool exported = ExportLevelFile(argv[++i]);
+            printf("%s level to %s\n", exported? "Exported" : "Failed to export", argv[i]);
+            UnloadStaticBatches();
+            return exported? 0 : 1;
+        } else if (strcmp(argv[i], "--bench-bullets") == 0) {
+            return RunBulletBenchmark();
+        } else if (strcmp(argv[i], "--bench-collision") == 0) {
+            return RunCollisionBenchmark();
+        } else if (strcmp(argv[i], "--bench-enemies") == 0) {
+            return RunEnemyBenchmark();
+        } else if (strcmp(argv[i], "--bench-nav") == 0) {
+            return RunNavigationBenchmark();
+        } else if (strcmp(argv[i], "--bench-ground") == 0) {
+            return RunGroundBenchmark();
+        } else if (strcmp(argv[i], "--bench-raycast") == 0) {
+            return RunRaycastBenchmark();
+        } else if (strcmp(argv[i], "--bench-perception") == 0) {
+            return RunPerceptionBenchmark();
+        } else if (strcmp(argv[i], "--bench-instancing") == 0) {
+            return RunInstancingBenchmark();
+        } else if (strcmp(argv[i], "--bench-reload") == 0) {
+            return RunReloadBenchmark();
+        } else if (strcmp(argv[i], "--bench-jobs") == 0) {
+            return RunJobBenchmark();
+        } else if (strcmp(argv[i], "--cook-assets") == 0) {
+            SpriteAtlas atlas;
+            bool cooked = BuildSpriteAtlas(&atlas) && ExportSpriteAtlas(&atlas, ATLAS_FILE_PATH);
+            printf("%s %s (%dx%d, %d sprites)\n", cooked? "Cooked" : "Failed to cook", ATLAS_FILE_PATH,
+                   atlas.image.width, atlas.image.height, SPRITE_COUNT);
+            UnloadSpriteAtlas(&atlas);
+            return cooked? 0 : 1;
+        } else if (strcmp(argv[i], "--bench-assets") == 0) {
+            return RunAssetBenchmark();
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            i++;    // Read above
+        }
+    }
+
+    if (bakeLighting) return RunLightingBake(&options);
+    if (options.audioRenderFile != NULL) return RunAudioRender(&options);
+
+    netLossRate = options.packetLoss;
+    if (options.serverPort > 0) return RunServer(&options);
+
+    // Online the server owns the simulation, so there is nothing to record or replay
+    NetAddress serverAddress = { 0 };
+    if (options.connectAddress != NULL) {
+        if (!ResolveNetAddress(options.connectAddress, &serverAddress)) {
+            printf("Cannot resolve server address %s\n", options.connectAddress);
+            return 1;
+        }
+        options.recordFile = NULL;
+        options.replayFile = NULL;
+    }
+
+    // A replay plays the recorded level, headless or in the window
+    InputRecording recording = { 0 };
+    if (options.replayFile != NULL) {
+        if (!LoadInputRecording(&recording, options.replayFile)) return 1;
+        UseRecordingLevel(&options, &recording.header);
+
+        if (options.headlessTicks > 0) {
+            int result = RunReplay(&options, &recording);
+            UnloadInputRecording(&recording);
+            return result;
+        }
+    }
+
+    if (options.headlessTicks > 0) return RunHeadless(&options);
+
     // Initialization
     //--------------------------------------------------------------------------------------
-    InitWindow(screenWidth, screenHeight, "WWII Industrial Bunker - FPS");
+    // Sprites load on a job while the window opens and the level initializes
+    SpriteAtlas atlas = { 0 };
+    JobCounter spritesLoaded;
+    ScheduleJob(LoadSpriteAtlasJob, &atlas, 0, 1, &spritesLoaded, NULL);
 
-    // Define the camera to look into our 3d world
-    Camera camera = { 0 };
-    camera.position = (Vector3){ -24.0f, 2.0f, 0.0f };    // Start in left hall
-    camera.target = (Vector3){ -18.0f, 2.0f, 0.0f };      // Looking towards doorway
-    camera.up = (Vector3){ 0.0f, 1.0f, 0.0f };
-    camera.fovy = 60.0f;
-    camera.projection = CAMERA_PERSPECTIVE;
+    InitWindow(screenWidth, screenHeight, "WWII Industrial Bunker - FPS");
 
     DisableCursor();
-    SetTargetFPS(60);
+    SetTargetFPS(options.targetFps);
     
     // Initialize Level
-    InitializeLevel();
+    LoadLevel(&options);
+    LoadLevelLighting(GetLightingFilePath(&options));
+    UploadStaticBatches();
+    InitInstancedRenderer();
+
+    GameState state;
+    InitGameState(&state, options.maxBullets, options.maxEnemies);
+
+    LoadGameSounds();
+    InitAudioOutput();
     
     // Load Resources
-    Image gunImage = LoadImage("resources/gun.png");
-    ImageFormat(&gunImage, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
-    
-    Color *pixels = (Color *)gunImage.data;
-    for (int i = 0; i < gunImage.width * gunImage.height; i++)
-    {
-        Color c = pixels[i];
-        if (c.g > 150 && c.r < 100 && c.b < 100) {
-            pixels[i] = BLANK;
-        }
-    }
-    
-    Texture2D gunTexture = LoadTextureFromImage(gunImage);
-    UnloadImage(gunImage);
+    WaitForJobs(&spritesLoaded);
+    UploadSpriteAtlas(&atlas);
 
-    Texture2D flashTexture = LoadTexture("resources/muzzle_flash.png");
-    
-    // Load Revolver
-    Image revolverImage = LoadImage("resources/revolver.png");
-    ImageFormat(&revolverImage, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
-    Color *revPixels = (Color *)revolverImage.data;
-    for (int i = 0; i < revolverImage.width * revolverImage.height; i++)
-    {
-        if (revPixels[i].g > 150 && revPixels[i].r < 100 && revPixels[i].b < 100) revPixels[i] = BLANK;
-    }
-    Texture2D revolverTexture = LoadTextureFromImage(revolverImage);
-    UnloadImage(revolverImage);
+    // Attach weapon sprites
+    PlayerState *player = &state.players[0];
+    player->weapons[0].sprite = atlas.sprites[SPRITE_RIFLE];
+    player->weapons[1].sprite = atlas.sprites[SPRITE_REVOLVER];
+    Rectangle flashSprite = atlas.sprites[SPRITE_MUZZLE_FLASH];
 
-    // Initialize Weapons
-    Weapon weapons[2] = { 0 };
-    
-    // Rifle
-    weapons[0].texture = gunTexture;
-    weapons[0].maxAmmo = 32;
-    weapons[0].currentAmmo = 32;
-    weapons[0].scale = 0.4f;
-    weapons[0].reloadTime = 2.0f;
-    weapons[0].cooldown = 0.1f;    
-    weapons[0].automatic = true;   
-    weapons[0].flashOffsetX = 60;
-    weapons[0].flashOffsetY = 100;
-    weapons[0].flashScale = 0.2f; 
-    
-    // Revolver
-    weapons[1].texture = revolverTexture;
-    weapons[1].maxAmmo = 6;
-    weapons[1].currentAmmo = 6;
-    weapons[1].scale = 0.4f; 
-    weapons[1].reloadTime = 1.5f;
-    weapons[1].cooldown = 0.5f;    
-    weapons[1].automatic = false;  
-    weapons[1].flashOffsetX = 60;
-    weapons[1].flashOffsetY = 110;
-    weapons[1].flashScale = 0.15f; 
-
-    int currentWeapon = 0;
+    // Online, the world comes from the server and only the local player is simulated here
+    NetClient client = { 0 };
+    bool online = options.connectAddress != NULL;
+    if (online && !InitNetClient(&client, &state, serverAddress)) {
+        TraceLog(LOG_WARNING, "NET: Cannot open a UDP socket");
+        online = false;
+    }
 
-    //--------------------------------------------------------------------------------------
+    // Level file edits show up while playing; online and recorded games keep the level fixed
+    if (options.levelFile != NULL && !online && options.recordFile == NULL && options.replayFile == NULL) StartLevelWatch(options.levelFile);
 
-    // Game Loop Variables
-    Vector3 enemyPositions[5] = {
-        {0.0f, 1.0f, -10.0f},   // Central room
-        {24.0f, 1.0f, 0.0f},    // Right room
-        {24.0f, 1.0f, 7.0f},    // Right room
-        {-24.0f, 1.0f, -8.0f},  // Left hall
-        {8.0f, 1.0f, 5.0f}      // Central room
-    };
-    bool enemyActive[5] = {true, true, true, true, true};
-    
-    // Projectiles
-    typedef struct Bullet {
-        Vector3 position;
-        Vector3 direction;
-        bool active;
-    } Bullet;
-    
-    #define MAX_BULLETS 100
-    Bullet bullets[MAX_BULLETS] = { 0 };
+    bool firstFrame = true;
+    SetProfilerRecording(options.profileFile != NULL);
 
-    // Gun Dynamics variables
-    float recoilOffset = 0.0f;
-    Vector2 weaponSway = { 0.0f, 0.0f };
-    float weaponBob = 0.0f;
+    // Replays run uncapped so the frame times show the real cost; recordings get a fresh flicker seed
+    int replayTick = 0;
+    float *frameTimes = NULL;
+    if (options.replayFile != NULL) {
+        srand(recording.header.randSeed);
+        SetTargetFPS(0);
+        frameTimes = (float *)malloc((recording.header.tickCount > 0)? recording.header.tickCount*sizeof(float) : 1);
+    } else if (options.recordFile != NULL) {
+        unsigned int randSeed = (unsigned int)(GetWallTime()*1000.0);
+        srand(randSeed);
+        BeginInputRecording(&recording, randSeed);
+        SetRecordingLevel(&recording.header, &options);
+    }
 
-    // Physics & Movement
-    float verticalVelocity = 0.0f;
-    const float GRAVITY = 13.0f;
-    const float JUMP_FORCE = 6.0f;
-    bool isGrounded = true;
-    float playerHeight = 2.0f;
-    float playerRadius = 0.5f;
+    // Fixed-step simulation: frame time accumulates and is spent in SIM_DT ticks, and
+    // the frame shows the last two ticks blended by the time left over
+    float accumulator = 0.0f;
+    SimInput pending = { 0 };
+    RenderState previous = GetRenderState(player);
 
-    // Weapon Switch Logic
-    int targetWeapon = currentWeapon;
-    bool isSwitching = false;
-    float switchTimer = 0.0f;
-    float switchDuration = 0.6f;
+    //--------------------------------------------------------------------------------------
 
     // Main game loop
     while (!WindowShouldClose())
     {
-        float deltaTime = GetFrameTime();
-        
-        // Update atmospheric effects
-        UpdateLightFlicker(deltaTime);
-        
-        // Store old position for collision
-        Vector3 oldPosition = camera.position;
-        
-        // Weapon Switching Input
-        if (!isSwitching) {
-            if (IsKeyPressed(KEY_ONE) && currentWeapon != 0) {
-                targetWeapon = 0;
-                isSwitching = true;
-                switchTimer = 0.0f;
-            }
-            if (IsKeyPressed(KEY_TWO) && currentWeapon != 1) {
-                targetWeapon = 1;
-                isSwitching = true;
-                switchTimer = 0.0f;
-            }
-            
-            float wheel = GetMouseWheelMove();
-            if (wheel != 0) {
-                int next = currentWeapon + (int)wheel;
-                 if (next > 1) next = 0;
-                 if (next < 0) next = 1;
-                 
-                 if (next != currentWeapon) {
-                     targetWeapon = next;
-                     isSwitching = true;
-                     switchTimer = 0.0f;
-                 }
-            }
-        }
-        
-        // Weapon Switch Animation Logic
-        if (isSwitching) {
-            switchTimer += deltaTime;
-            
-            if (switchTimer >= switchDuration / 2.0f && currentWeapon != targetWeapon) {
-                currentWeapon = targetWeapon;
-            }
-            
-            if (switchTimer >= switchDuration) {
-                isSwitching = false;
-                switchTimer = 0.0f;
-            }
-        }
-
-        float oldCamY = camera.position.y;
+        PROFILE_SCOPE(PROFILE_FRAME);
 
-        UpdateCamera(&camera, CAMERA_FIRST_PERSON);
-        
-        // Apply collision detection
-        Vector3 feetPos = {camera.position.x, camera.position.y - playerHeight + 0.5f, camera.position.z};
-        camera.position = ResolveCollision(camera.position, oldPosition, playerRadius);
-        
-        // Physics: Apply Gravity
-        if (!isGrounded) {
-             verticalVelocity -= GRAVITY * deltaTime;
-        } else {
-            if (IsKeyPressed(KEY_SPACE)) {
-                verticalVelocity = JUMP_FORCE;
-                isGrounded = false;
-            }
-        }
-        
-        camera.position.y += verticalVelocity * deltaTime;
-        
-        // Floor and stair collision
-        float groundLevel = playerHeight;
-        
-        // Check if on stairs
-        for (int i = 0; i < stairCount; i++) {
-            float stepTop = stairs[i].position.y + stairs[i].size.y/2;
-            if (camera.position.x > stairs[i].position.x - stairs[i].size.x/2 - 0.5f &&
-                camera.position.x < stairs[i].position.x + stairs[i].size.x/2 + 0.5f &&
-                camera.position.z > stairs[i].position.z - stairs[i].size.z/2 - 0.3f &&
-                camera.position.z < stairs[i].position.z + stairs[i].size.z/2 + 0.3f) {
-                if (stepTop + playerHeight > groundLevel) {
-                    groundLevel = stepTop + playerHeight;
-                }
-            }
-        }
-        
-        // Check if on upper platform
-        if (camera.position.x > -2.5f && camera.position.x < 2.5f &&
-            camera.position.z > 6.0f && camera.position.z < 9.0f) {
-            groundLevel = 4.2f + playerHeight;
-        }
-        
-        if (camera.position.y <= groundLevel) {
-            camera.position.y = groundLevel;
-            verticalVelocity = 0;
-            isGrounded = true;
-        } else {
-            isGrounded = false;
+        // F3: frame profiler overlay (records while shown)
+        if (IsKeyPressed(KEY_F3)) {
+            profiler.overlay = !profiler.overlay;
+            SetProfilerRecording(profiler.overlay || (options.profileFile != NULL));
         }
 
-        camera.target.y += (camera.position.y - oldCamY);
+        double frameStart = GetWallTime();
+        float alpha = 1.0f;
 
-        // Reload Logic
-        Weapon *w = &weapons[currentWeapon];
+        if (PollLevelWatch(frameStart)) UploadStaticBatches();   // Batches rebuilt from scratch need a fresh upload
         
-        if (w->isReloading) {
-            w->reloadTimer -= deltaTime;
-            if (w->reloadTimer <= 0) {
-                w->currentAmmo = w->maxAmmo;
-                w->isReloading = false;
-            }
+        if (options.replayFile != NULL) {
+            // One recorded tick per frame, drawn as simulated
+            if (replayTick == recording.header.tickCount) break;
+            float deltaTime;
+            SimInput input = GetRecordedInput(&recording, replayTick++, &deltaTime);
+            UpdateSimulation(&state, &input, deltaTime);
+            PlayTickSounds(&state);
         } else {
-             if (w->currentAmmo <= 0 || IsKeyPressed(KEY_R)) {
-                 if (w->currentAmmo < w->maxAmmo) {
-                    w->isReloading = true;
-                    w->reloadTimer = w->reloadTime;
-                 }
-             }
-        }
-        
-        w->timeSinceLastShot += deltaTime;
-
-        // Shooting logic
-        bool shootInput = false;
-        if (w->automatic) shootInput = IsMouseButtonDown(MOUSE_BUTTON_LEFT);
-        else shootInput = IsMouseButtonPressed(MOUSE_BUTTON_LEFT);
-
-        if (shootInput && !w->isReloading && !isSwitching && w->currentAmmo > 0 && w->timeSinceLastShot >= w->cooldown) {
-            for (int i = 0; i < MAX_BULLETS; i++) {
-                if (!bullets[i].active) {
-                    bullets[i].active = true;
-                    bullets[i].position = camera.position;
-                    Vector3 forward = Vector3Subtract(camera.target, camera.position);
-                    bullets[i].direction = Vector3Normalize(forward);
-                    
-                    w->currentAmmo--;
-                    w->timeSinceLastShot = 0.0f;
-                    recoilOffset = 0.4f;
-                    break;
+            // Input of frames that run no tick carries over, so no press or mouse motion is lost
+            SimInput frameInput = PollSimInput();
+            pending.down = frameInput.down;
+            pending.pressed |= frameInput.pressed;
+            pending.mouseDelta = Vector2Add(pending.mouseDelta, frameInput.mouseDelta);
+            pending.wheel += frameInput.wheel;
+
+            accumulator += GetFrameTime();
+            int steps = 0;
+            while (accumulator >= SIM_DT && steps < MAX_SIM_STEPS_PER_FRAME) {
+                previous = GetRenderState(player);
+                if (online) {
+                    UpdateLightFlicker(SIM_DT);
+                    UpdateNetClient(&client, &pending, GetWallTime());
+                    PlayTickSounds(&state);
+                    if (client.slot >= 0) player = &state.players[client.slot];
+                } else {
+                    if (options.recordFile != NULL) RecordInputTick(&recording, &pending, SIM_DT);
+                    UpdateSimulation(&state, &pending, SIM_DT);
+                    PlayTickSounds(&state);
                 }
+
+                pending.pressed = 0;
+                pending.mouseDelta = (Vector2){ 0.0f, 0.0f };
+                pending.wheel = 0.0f;
+                accumulator -= SIM_DT;
+                steps++;
             }
+
+            // After a long hitch, drop what is still owed: the game slows down briefly
+            // instead of spending every following frame catching up
+            if (accumulator >= SIM_DT) accumulator = fmodf(accumulator, SIM_DT);
+            alpha = accumulator/SIM_DT;
         }
 
-        // Update Projectiles
-        for (int i = 0; i < MAX_BULLETS; i++) {
-            if (bullets[i].active) {
-                float speed = 2.0f; 
-                bullets[i].position = Vector3Add(bullets[i].position, Vector3Scale(bullets[i].direction, speed));
-               
-                // Collision with Enemies
-                for (int e = 0; e < 5; e++) {
-                    if (enemyActive[e]) {
-                        if (bullets[i].position.x > enemyPositions[e].x - 1.0f && bullets[i].position.x < enemyPositions[e].x + 1.0f &&
-                            bullets[i].position.z > enemyPositions[e].z - 1.0f && bullets[i].position.z < enemyPositions[e].z + 1.0f &&
-                            bullets[i].position.y > enemyPositions[e].y - 1.0f && bullets[i].position.y < enemyPositions[e].y + 1.0f) {
-                                enemyActive[e] = false;
-                                bullets[i].active = false;
-                        }
-                    }
-                }
-                
-                // Wall collision for bullets
-                for (int wi = 0; wi < wallCount; wi++) {
-                    if (CheckBoxCollision(bullets[i].position, 0.1f, walls[wi].position, walls[wi].size)) {
-                        bullets[i].active = false;
-                        break;
-                    }
-                }
-                
-                // Despawn distance
-                 if (Vector3Distance(camera.position, bullets[i].position) > 100.0f) {
-                    bullets[i].active = false;
-                }
-            }
+        if (online && client.disconnected) {
+            TraceLog(LOG_WARNING, "NET: %s", (client.rejectReason == NET_REJECT_FULL)? "Server is full" :
+                     (client.rejectReason == NET_REJECT_LEVEL)? "Server is playing a different level" :
+                     (client.rejectReason == NET_REJECT_PROTOCOL)? "Server speaks a different protocol" : "Lost connection to the server");
+            break;
         }
 
-        // Weapon dynamics
-        if (recoilOffset > 0) recoilOffset -= 0.02f;
-        if (recoilOffset < 0) recoilOffset = 0.0f;
+        RenderState current = GetRenderState(player);
+        RenderState view = LerpRenderState(&previous, &current, alpha);
+        Weapon *w = &player->weapons[player->currentWeapon];
 
-        Vector2 mouseDelta = GetMouseDelta();
-        float swayIntensity = 2.0f;
-        float swaySmooth = 0.1f;
-        
-        Vector2 targetSway = { -mouseDelta.x * swayIntensity, -mouseDelta.y * swayIntensity };
-        
-        float constantSwayClamp = 30.0f;
-        if (targetSway.x > constantSwayClamp) targetSway.x = constantSwayClamp;
-        if (targetSway.x < -constantSwayClamp) targetSway.x = -constantSwayClamp;
-        if (targetSway.y > constantSwayClamp) targetSway.y = constantSwayClamp;
-        if (targetSway.y < -constantSwayClamp) targetSway.y = -constantSwayClamp;
-
-        weaponSway.x = Lerp(weaponSway.x, targetSway.x, swaySmooth);
-        weaponSway.y = Lerp(weaponSway.y, targetSway.y, swaySmooth);
-
-        bool isMoving = IsKeyDown(KEY_W) || IsKeyDown(KEY_A) || IsKeyDown(KEY_S) || IsKeyDown(KEY_D);
-        if (isMoving) {
-            weaponBob += deltaTime * 10.0f;
-        } else {
-            weaponBob = Lerp(weaponBob, (float)((int)(weaponBob / PI) * PI), 0.1f);
-        }
+        // Sounds are heard from the drawn camera and mixed ahead of the device
+        BeginProfileZone(PROFILE_AUDIO);
+        UpdateAudioScene(&state, view.camera);
+        FillAudioRing();
+        EndProfileZone(PROFILE_AUDIO);
+
+        int activeEnemies = (online && client.snapshotsReceived > 0)? client.enemiesLeft : CountActiveEnemies(&state);
+
+        // HUD widgets re-render only when their values changed, before the frame starts
+        BeginProfileZone(PROFILE_HUD);
+        UpdateGameHud(w, activeEnemies);
+        EndProfileZone(PROFILE_HUD);
 
         // Draw
         //--------------------------------------------------------------------------------------
@@ -766,40 +9720,65 @@ int main(void)
             // Fog-like background color for atmosphere
             ClearBackground(FOG_COLOR);
 
-            BeginMode3D(camera);
+            // Rooms, lights and enemies outside the view are skipped
+            UpdateLevelVisibility(view.camera, (float)screenWidth/screenHeight);
+
+            BeginMode3D(view.camera);
 
                 // Draw level geometry
                 DrawLevelGeometry();
                 
+                // Lamps, enemies, players and bullets are instanced: one draw per primitive
+                BeginProfileZone(PROFILE_DRAW_DYNAMIC);
+                instanceStats = (InstanceStats){ 0 };
+                for (int g = 0; g < INSTANCE_GROUP_COUNT; g++) BeginInstances((InstanceGroupKind)g);
+
                 // Draw atmospheric lights
                 DrawAtmosphericLights();
 
                 // Draw enemies
-                for (int e = 0; e < 5; e++) {
-                    if (enemyActive[e]) {
-                        DrawCube(enemyPositions[e], 1.8f, 2.0f, 1.8f, (Color){140, 50, 50, 255});
-                        DrawCubeWires(enemyPositions[e], 1.8f, 2.0f, 1.8f, (Color){100, 30, 30, 255});
+                const EnemyStore *enemies = &state.enemies;
+                for (int e = 0; e < enemies->count; e++) {
+                    BoundingBox box = { { enemies->hitboxes.minX[e], enemies->hitboxes.minY[e], enemies->hitboxes.minZ[e] },
+                                        { enemies->hitboxes.maxX[e], enemies->hitboxes.maxY[e], enemies->hitboxes.maxZ[e] } };
+                    if (IsLevelBoxVisible(box)) {
+                        Color body = (enemies->state[e] == ENEMY_IDLE)? (Color){140, 50, 50, 255} : (Color){170, 60, 45, 255};
+                        PushInstance(INSTANCES_BOXES, enemies->position[e], (Vector3){ 1.8f, 2.0f, 1.8f }, body);
+                        PushInstance(INSTANCES_BOX_EDGES, enemies->position[e], (Vector3){ 1.8f, 2.0f, 1.8f }, (Color){100, 30, 30, 255});
                     }
                 }
 
+                // Draw the other players (online only)
+                for (int p = 0; p < MAX_PLAYERS; p++) {
+                    const PlayerState *other = &state.players[p];
+                    if (!other->active || other == player) continue;
+                    Vector3 body = { other->camera.position.x, other->camera.position.y - 1.0f, other->camera.position.z };
+                    PushInstance(INSTANCES_BOXES, body, (Vector3){ 0.9f, 2.0f, 0.9f }, (Color){70, 85, 60, 255});
+                    PushInstance(INSTANCES_BOX_EDGES, body, (Vector3){ 0.9f, 2.0f, 0.9f }, (Color){40, 50, 35, 255});
+                }
+
                 // Draw projectiles
-                for (int i = 0; i < MAX_BULLETS; i++) {
-                    if (bullets[i].active) {
-                        DrawSphere(bullets[i].position, 0.08f, (Color){255, 220, 100, 255});
-                    }
+                for (int i = 0; i < state.projectiles.count; i++) {
+                    const Bullet *b = &state.projectiles.bullets[i];
+                    PushInstance(INSTANCES_SPHERES, Vector3Lerp(b->previous, b->position, alpha), (Vector3){ 0.16f, 0.16f, 0.16f }, (Color){255, 220, 100, 255});
                 }
 
+                for (int g = 0; g < INSTANCE_GROUP_COUNT; g++) DrawInstances((InstanceGroupKind)g);
+                EndProfileZone(PROFILE_DRAW_DYNAMIC);
+
             EndMode3D();
 
+            BeginProfileZone(PROFILE_HUD);
+
             // Draw Gun
             float scale = w->scale;
-            int gunWidth = (int)(w->texture.width * scale);
-            int gunHeight = (int)(w->texture.height * scale);
+            int gunWidth = (int)(w->sprite.width * scale);
+            int gunHeight = (int)(w->sprite.height * scale);
             
-            float bobOffsetX = sinf(weaponBob) * 10.0f;
-            float bobOffsetY = fabsf(cosf(weaponBob)) * 10.0f;
+            float bobOffsetX = sinf(view.weaponBob) * 10.0f;
+            float bobOffsetY = fabsf(cosf(view.weaponBob)) * 10.0f;
             
-            float recoilScreenY = recoilOffset * 200.0f;
+            float recoilScreenY = view.recoilOffset * 200.0f;
             
             float reloadOffsetY = 0.0f;
             if (w->isReloading) {
@@ -809,8 +9788,8 @@ int main(void)
             }
             
             float switchOffsetY = 0.0f;
-            if (isSwitching) {
-                float t = switchTimer / switchDuration;
+            if (player->isSwitching) {
+                float t = player->switchTimer / player->switchDuration;
                 if (t < 0.5f) {
                     float halfT = t * 2.0f; 
                     switchOffsetY = Lerp(0.0f, 300.0f, halfT); 
@@ -820,30 +9799,26 @@ int main(void)
                 }
             }
 
-            int gunX = (screenWidth / 2) + 120 - (gunWidth / 2) + (int)weaponSway.x + (int)bobOffsetX;
-            int gunY = screenHeight - gunHeight + 60 + (int)weaponSway.y + (int)bobOffsetY + (int)recoilScreenY + (int)reloadOffsetY + (int)switchOffsetY; 
+            int gunX = (screenWidth / 2) + 120 - (gunWidth / 2) + (int)view.weaponSway.x + (int)bobOffsetX;
+            int gunY = screenHeight - gunHeight + 60 + (int)view.weaponSway.y + (int)bobOffsetY + (int)recoilScreenY + (int)reloadOffsetY + (int)switchOffsetY; 
 
-            DrawTextureEx(w->texture, (Vector2){ (float)gunX, (float)gunY }, 0.0f, scale, WHITE);
+            // Atlas sprites are premultiplied
+            BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+                DrawTexturePro(atlas.texture, w->sprite, (Rectangle){ (float)gunX, (float)gunY, w->sprite.width*scale, w->sprite.height*scale },
+                               (Vector2){ 0.0f, 0.0f }, 0.0f, WHITE);
+            EndBlendMode();
             
-            // UI: Ammo
-            Color ammoColor = (w->currentAmmo <= w->maxAmmo / 4) ? RED : (Color){180, 180, 160, 255};
-            if (w->isReloading) {
-                 const char *text = "RELOADING...";
-                 int textWidth = MeasureText(text, 30);
-                 DrawText(text, screenWidth - textWidth - 20, screenHeight - 40, 30, (Color){200, 150, 50, 255});
-            } else {
-                 const char *text = TextFormat("AMMO: %d / %d", w->currentAmmo, w->maxAmmo);
-                 int textWidth = MeasureText(text, 40);
-                 DrawText(text, screenWidth - textWidth - 20, screenHeight - 50, 40, ammoColor);
-            }
+            // UI: ammo, controls hint, enemy and visibility counters, victory banner
+            DrawHud();
 
             // Muzzle Flash
-            if (w->timeSinceLastShot < 0.1f && recoilOffset > 0.1f) {
-                int flashX = gunX + w->flashOffsetX - (int)(flashTexture.width * w->flashScale / 2);
-                int flashY = gunY + w->flashOffsetY - (int)(flashTexture.height * w->flashScale / 2);
+            if (w->timeSinceLastShot < 0.1f && view.recoilOffset > 0.1f) {
+                int flashX = gunX + w->flashOffsetX - (int)(flashSprite.width * w->flashScale / 2);
+                int flashY = gunY + w->flashOffsetY - (int)(flashSprite.height * w->flashScale / 2);
                 
                 BeginBlendMode(BLEND_ADDITIVE);
-                    DrawTextureEx(flashTexture, (Vector2){ (float)flashX, (float)flashY }, 0.0f, w->flashScale, WHITE);
+                    DrawTexturePro(atlas.texture, flashSprite, (Rectangle){ (float)flashX, (float)flashY, flashSprite.width*w->flashScale, flashSprite.height*w->flashScale },
+                                   (Vector2){ 0.0f, 0.0f }, 0.0f, WHITE);
                 EndBlendMode();
             }
 
@@ -851,31 +9826,57 @@ int main(void)
             DrawCircle(screenWidth/2, screenHeight/2, 2, (Color){200, 50, 50, 200});
             DrawCircleLines(screenWidth/2, screenHeight/2, 8, (Color){200, 50, 50, 150});
 
-            // Controls hint
-            DrawText("WASD: Move | Mouse: Look | LMB: Shoot | R: Reload | 1/2: Switch", 10, 10, 16, (Color){150, 150, 140, 200});
-            
-            // Enemy counter
-            int activeEnemies = 0;
-            for (int e = 0; e < 5; e++) if (enemyActive[e]) activeEnemies++;
-            DrawText(TextFormat("Enemies: %d", activeEnemies), 10, 30, 20, (Color){180, 100, 100, 255});
-            
-            if (activeEnemies == 0) {
-                const char* victoryText = "AREA CLEARED!";
-                int victoryWidth = MeasureText(victoryText, 40);
-                DrawText(victoryText, screenWidth/2 - victoryWidth/2, screenHeight/2 - 50, 40, (Color){100, 200, 100, 255});
-            }
+            if (profiler.overlay) DrawProfileOverlay(screenWidth - 290, 30);
 
+            EndProfileZone(PROFILE_HUD);
+
+        BeginProfileZone(PROFILE_PRESENT);
         EndDrawing();
+        EndProfileZone(PROFILE_PRESENT);
+
+        if (options.replayFile != NULL) frameTimes[replayTick - 1] = (float)((GetWallTime() - frameStart)*1000.0);
+
+        if (firstFrame) {
+            TraceLog(LOG_INFO, "STARTUP: First frame %.1f ms after launch (sprites %s in %.1f ms)", (GetWallTime() - launchTime)*1000.0,
+                     atlas.cooked? "read from cooked atlas" : "built from source images", atlas.loadTime*1000.0);
+            firstFrame = false;
+        }
     }
 
     // De-Initialization
     //--------------------------------------------------------------------------------------
-    UnloadTexture(gunTexture);
-    UnloadTexture(revolverTexture);
-    UnloadTexture(flashTexture);
+    if (options.profileFile != NULL && !ExportProfileTrace(options.profileFile)) {
+        TraceLog(LOG_WARNING, "PROFILE: [%s] Failed to write profile trace", options.profileFile);
+    }
+
+    int exitCode = 0;
+    if (options.replayFile != NULL) {
+        exitCode = ReportReplay(&recording, &state, frameTimes, replayTick, options.frameBudget);
+        free(frameTimes);
+    } else if (options.recordFile != NULL) {
+        recording.header.finalHash = HashGameState(&state);
+        if (SaveInputRecording(&recording, options.recordFile)) {
+            TraceLog(LOG_INFO, "REPLAY: [%s] Recorded %d ticks", options.recordFile, recording.header.tickCount);
+        } else {
+            TraceLog(LOG_WARNING, "REPLAY: [%s] Failed to save recording", options.recordFile);
+        }
+    }
+    UnloadInputRecording(&recording);
+    if (online) UnloadNetClient(&client);
+
+    UnloadSpriteAtlas(&atlas);
+    UnloadStaticBatches();
+    UnloadInstancedRenderer();
+    UnloadHud();
+    UnloadLevelVisibility();
+    UnloadMaterial(staticMaterial);
+    UnloadGameState(&state);
+    UnloadLevel();
 
+    CloseAudioOutput();
+    UnloadGameSounds();
     CloseWindow();
     //--------------------------------------------------------------------------------------
 
-    return 0;
-}
\ No newline at end of file
+    return exitCode;
+}